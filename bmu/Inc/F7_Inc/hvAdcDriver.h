@@ -0,0 +1,22 @@
+#ifndef HV_ADC_DRIVER_H
+#define HV_ADC_DRIVER_H
+
+#include "bsp.h"
+#include "hv_adc_stream.h"
+
+/// ADC output rate set up by hvadc_init (ADC_FREQ_1KHZ)
+#define HV_ADC_SAMPLE_RATE_HZ 1000
+
+HAL_StatusTypeDef hv_adc_stream_start(uint32_t samplesPerWake);
+
+bool hv_adc_stream_pop(HvAdcSample_t *sample);
+
+void hv_adc_dready_isr(void);
+
+float hv_adc_to_current(int32_t raw);
+
+float hv_adc_to_v1(int32_t raw);
+
+float hv_adc_to_v2(int32_t raw);
+
+#endif /* end of include guard: HV_ADC_DRIVER_H */
@@ -2,6 +2,7 @@
 #define IMD_H
 
 #include "bsp.h"
+#include "imd_decoder.h"
 
 typedef struct {
   uint32_t meas_freq_mHz;
@@ -28,4 +29,6 @@ HAL_StatusTypeDef init_imd_measurement(void);
 
 IMDStatus get_imd_status();
 
+void get_imd_decoder(ImdDecoder_t *decoder);
+
 #endif
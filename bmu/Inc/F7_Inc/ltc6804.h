@@ -0,0 +1,14 @@
+/* 
+ * LTC6804-1 chip architecture, implements ltc_chip_interface.h when
+ * LTC_CHIP == LTC_CHIP_6804
+ * */
+#ifndef LTC6804_H
+#define LTC6804_H
+
+#include "ltc_chip_interface.h"
+
+#define BATT_CONFIG_SIZE 6    // Size of Config per Register
+
+HAL_StatusTypeDef format_and_send_config(uint8_t config[NUM_BOARDS][NUM_LTC_CHIPS_PER_BOARD][BATT_CONFIG_SIZE]);
+
+#endif /* LTC6804_H */
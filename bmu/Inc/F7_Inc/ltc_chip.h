@@ -50,7 +50,13 @@
 
 #if LTC_CHIP == LTC_CHIP_6804
 #define NUM_LTC_CHIPS_PER_BOARD 1
+// Conversion times with margin, all cells/GPIOs or a single channel per mode
+#define CONVERSION_TIME_27kHz_US (1200)
 #define CONVERSION_TIME_7kHz_US (2480)
+#define CONVERSION_TIME_26Hz_US (202000)
+#define CONVERSION_TIME_SINGLE_27kHz_US (250)
+#define CONVERSION_TIME_SINGLE_7kHz_US (405)
+#define CONVERSION_TIME_SINGLE_26Hz_US (34000)
 #elif LTC_CHIP == LTC_CHIP_6812
 #define NUM_LTC_CHIPS_PER_BOARD 1
 #else
@@ -62,11 +68,22 @@
 
 // Average 4 readings for both pullup and pulldown in open wire test
 #define NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS 2
+
+// The open wire test is split by ADOW channel selection into groups of one cell
+// per half of the LTC (cells n and n+6), run OPEN_WIRE_GROUPS_PER_CYCLE per call
+// of checkForOpenCircuit. Every cell is checked once per
+// OPEN_WIRE_CELL_GROUPS / OPEN_WIRE_GROUPS_PER_CYCLE battery task cycles
+#define OPEN_WIRE_CELL_GROUPS 5
+#define OPEN_WIRE_GROUPS_PER_CYCLE 1
+// Conversion of a single cell pair in 7kHz mode is 405us
+#define OPEN_WIRE_GROUP_CONVERSION_TIME_US 500
 #define NUM_THERMISTOR_MEASUREMENTS_PER_CYCLE 1
 
 #define NUM_PEC_MISMATCH_CONSECUTIVE_FAILS_ERROR (3)
 #define NUM_PEC_MISMATCH_CONSECUTIVE_FAILS_WARNING (2)
 #define PRINT_ALL_PEC_ERRORS (0)
+// Number of times a register group is read again for the boards that failed PEC
+#define PEC_MISMATCH_READ_RETRIES (2)
 
 // Public defines
 #define NUM_VOLTAGE_CELLS           (NUM_BOARDS*CELLS_PER_BOARD)
@@ -108,7 +125,28 @@ typedef enum DischargeTimerLength {
     INVALID_DT_TIME, // There is longer times, but we won't need it for now
 } DischargeTimerLength;
 
+// ADC mode for cell voltage and thermistor conversions, values are the MD bits
+// of the conversion commands with ADCOPT = 0
+typedef enum ltc_adc_mode_t {
+    LTC_ADC_MODE_FAST = 1,     // 27kHz, shortest conversion, most noise
+    LTC_ADC_MODE_NORMAL = 2,   // 7kHz
+    LTC_ADC_MODE_FILTERED = 3, // 26Hz, longest conversion, least noise
+} ltc_adc_mode_t;
+
+// Register groups read back from the LTCs, PEC errors are counted per group
+typedef enum ltc_register_group_t {
+    LTC_REG_CFG = 0,
+    LTC_REG_CVA,
+    LTC_REG_CVB,
+    LTC_REG_CVC,
+    LTC_REG_CVD,
+    LTC_REG_AUXB,
+    NUM_LTC_REG_GROUPS,
+} ltc_register_group_t;
+
 /* Public Functions */
+HAL_StatusTypeDef batt_read_cell_voltages(float *cell_voltage_array);
+HAL_StatusTypeDef batt_read_cell_temps(float *cell_temp_array);
 HAL_StatusTypeDef batt_read_cell_voltages_and_temps(float *cell_voltage_array, float *cell_temp_array);
 
 
@@ -116,10 +154,17 @@ HAL_StatusTypeDef batt_balance_cell(int cell);
 HAL_StatusTypeDef batt_stop_balance_cell(int cell);
 bool batt_is_cell_balancing(int cell);
 HAL_StatusTypeDef batt_unset_balancing_all_cells();
-HAL_StatusTypeDef batt_write_balancing_config();
+HAL_StatusTypeDef batt_write_balancing_config(const bool *balance, DischargeTimerLength length);
 HAL_StatusTypeDef checkForOpenCircuit();
 HAL_StatusTypeDef batt_start_ADC_conversion(void);
 HAL_StatusTypeDef batt_set_disharge_timer(DischargeTimerLength length);
+HAL_StatusTypeDef batt_set_adc_mode(ltc_adc_mode_t mode);
+ltc_adc_mode_t batt_get_adc_mode(void);
+uint32_t batt_get_conversion_time_us(ltc_adc_mode_t mode, bool all_channels);
+uint32_t batt_get_pec_errors(int board, ltc_register_group_t group);
+const char *batt_register_group_name(ltc_register_group_t group);
+void batt_clear_pec_errors(void);
+void batt_get_config_write_counts(uint32_t *writes, uint32_t *skipped);
 
 HAL_StatusTypeDef batt_init();
 HAL_StatusTypeDef balanceTest();
@@ -29,10 +29,14 @@ typedef struct open_wire_failure_t {
 
 void batt_init_chip_configs(void);
 HAL_StatusTypeDef batt_write_config(void);
+HAL_StatusTypeDef batt_write_config_if_changed(void);
 HAL_StatusTypeDef batt_verify_config(void);
 HAL_StatusTypeDef batt_readBackCellVoltage(float *cell_voltage_array, voltage_operation_t voltage_operation);
+HAL_StatusTypeDef batt_readBackCellVoltageBlocks(float *cell_voltage_array, voltage_operation_t voltage_operation,
+                                                 uint8_t block_mask);
 void batt_set_temp_config(size_t channel);
 HAL_StatusTypeDef batt_broadcast_command(ltc_command_t curr_command); 
+HAL_StatusTypeDef batt_broadcast_open_wire_command(bool pullup, uint8_t cell_group);
 HAL_StatusTypeDef batt_read_thermistors(size_t channel, float *cell_temp_array);
 void batt_set_balancing_cell (int board, int chip, int cell);
 void batt_unset_balancing_cell (int board, int chip, int cell);
@@ -9,7 +9,6 @@
 #define TEMP_CHANNELS_PER_BOARD     16
 #define VOLTAGE_MEASURE_DELAY_MS    2   // Length of time for voltage measurements to finish
 #define VOLTAGE_MEASURE_DELAY_EXTRA_US 400 // Time to add on to ms delay for measurements to finsh
-#define TEMP_MEASURE_DELAY_US 405 // Time for measurements to finsh
 #define MUX_MEASURE_DELAY_US  1 // Time for Mux to switch
 
 
@@ -43,7 +42,7 @@
 #define T_SLEEP_US           2000000    // The LTC sleeps in 2 seconds
 #define T_WAKE_MS            1        // The LTC wakes in 300 us, but since systick is 1 KHz just round up to 1 ms
 #define T_READY_US           10 // The time to bring up ISOSPI bus if already in standby
-#define T_IDLE_US            4400 // Time for ISOSPI bus to go to idle state (min 4.4ms, typ 5.5 ms)
+#define T_IDLE_US            4300 // Time for ISOSPI bus to go to idle state (min 4.3ms, typ 5.5 ms)
 #define T_REFUP_MS           5 // Takes 4.4 ms for reference to power up
 
 // Config Byte 0 options
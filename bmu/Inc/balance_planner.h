@@ -0,0 +1,41 @@
+#ifndef BALANCE_PLANNER_H
+#define BALANCE_PLANNER_H
+
+/*
+ * Balancing planner. From relaxed cell voltages it estimates how much charge
+ * each cell holds above the lowest cell and how long its bleed resistor needs
+ * to be on to remove it, then schedules which resistors are on, longest
+ * remaining first, within a per board dissipation limit.
+ */
+
+#include "ocv_lut.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BALANCE_PLANNER_MAX_CELLS 140
+
+typedef struct BalancePlanner_Params_t {
+    uint32_t numCells;
+    uint32_t cellsPerBoard;
+    float capacity_As;              ///< Capacity of a series cell group, A-s
+    float bleedResistance_ohms;     ///< Balance resistor, Ohms
+    float maxBoardPower_W;          ///< Max total bleed dissipation per board, W
+    float maxTemp_C;                ///< No bleeding at or above this cell temp, C
+    float startSocDelta;            ///< Start bleeding a cell this far above the lowest, SOC 0-1
+    float stopSocDelta;             ///< Keep a planned cell bleeding until within this, SOC 0-1
+} BalancePlanner_Params_t;
+
+typedef struct BalancePlanner_t {
+    BalancePlanner_Params_t params;
+    float remaining_s[BALANCE_PLANNER_MAX_CELLS];   ///< Planned bleed time left per cell
+    float bleedPower_W[BALANCE_PLANNER_MAX_CELLS];  ///< Resistor dissipation per cell
+    bool bleeding[BALANCE_PLANNER_MAX_CELLS];       ///< Cells selected to bleed this period
+    float predictedTimeToBalance_s;                 ///< < 0 if balancing is thermally blocked
+} BalancePlanner_t;
+
+void balancePlannerInit(BalancePlanner_t *planner, const BalancePlanner_Params_t *params);
+void balancePlannerUpdate(BalancePlanner_t *planner, const float cellVoltage[]);
+void balancePlannerStep(BalancePlanner_t *planner, float elapsed_s, float maxCellTemp);
+bool balancePlannerIsBalanced(const BalancePlanner_t *planner);
+
+#endif /* end of include guard: BALANCE_PLANNER_H */
@@ -5,6 +5,8 @@
 #include "FreeRTOS.h"
 #include "queue.h"
 #include "bsp.h"
+#include "hv_bus_snapshot.h"
+#include "cell_history.h"
 
 /*
  * Battery task Defines and Variables
@@ -38,6 +40,9 @@
 /// Rate at which the low voltage threshold dynamically lowers vs current
 #define LIMIT_LOWVOLTAGE_WARNING_SLOPE 0.0043125F
 
+/// Capacity of a series cell group, used for coulomb counting (Amp-seconds)
+#define PACK_CAPACITY_AS (128050.0F)
+
 /* The following values are used in State of Power calculation and should
  * be determined from cell testing data */
 
@@ -52,6 +57,81 @@
 // Our current pack is 70s7p. So this assumption factors in that IBus is total current from cells and the current gets divided by 7
 #define ADJUSTED_CELL_IR_DEFAULT (0.00486F)
 
+/* The following are used by the state of power map (see state_of_power.h). Samsung
+ * INR18650-30Q datasheet: 3.0Ah, 4A max charge current, 13mOhm max AC impedance at 1kHz */
+#define SOP_CELLS_IN_PARALLEL (PACK_CAPACITY_AS / (3.0F * 3600.0F))
+/// Polarization resistance of a series group. At half capacity the datasheet's 15A discharge
+/// curve is 0.24V under its 0.2C (0.6A) curve, 16.7mOhm per cell, less the 13mOhm AC impedance
+#define SOP_CELL_POLARIZATION_R ((0.0167F - 0.013F) / SOP_CELLS_IN_PARALLEL)   ///< Ohms
+/// The datasheet has no transient data. Polarization is under a tenth of ADJUSTED_CELL_IR_DEFAULT,
+/// so it's taken as developing within the 2s horizon, which only lowers the limits
+#define SOP_CELL_POLARIZATION_TAU_S (2.0F)     ///< Seconds
+/// Cell voltage the discharge limit keeps the weakest cell above
+#define SOP_CELL_VOLTAGE_MIN (LIMIT_LOWVOLTAGE_WARNING)
+/// Pack discharge current limit (fuse/contactor rating), Amps
+#define SOP_MAX_DISCHARGE_CURRENT (250.0F)
+/// Pack charge (regen) current limit, the datasheet's max charge current per cell, Amps
+#define SOP_MAX_CHARGE_CURRENT (4.0F * SOP_CELLS_IN_PARALLEL)
+
+/* The following are used by the sum of cells vs VBatt check (see pack_voltage_check.h) */
+/// Resistance between the first/last cell taps and the VBatt sense point. It hasn't been
+/// measured on this pack, so no drop is assumed: PACK_CHECK_TOLERANCE_V alone covers
+/// 8mOhm at SOP_MAX_DISCHARGE_CURRENT, and PACK_CHECK_TOLERANCE_RELATIVE another 20mOhm at
+/// the nominal 504V
+#define PACK_CHECK_INTERCONNECT_R (0.0F)       ///< Ohms
+/// Fixed allowance, covers the LTC (+-1.2mV per cell) and ADE offset errors
+#define PACK_CHECK_TOLERANCE_V (2.0F)
+/// Allowance for the VBatt divider and ADE gain error
+#define PACK_CHECK_TOLERANCE_RELATIVE (0.01F)
+/// Time to read back all cell voltages, the cells aren't sampled at once
+#define PACK_CHECK_ACQUISITION_S (0.02F)
+/// Sum of cells has to be out of tolerance this long before sending a DTC
+#define PACK_CHECK_FAULT_TIME_S (2.0F)
+
+/* The following are used to estimate channels with a failed thermistor (see thermal_estimator.h).
+ * The pack is 140 series groups (NUM_VOLTAGE_CELLS) over 189 thermistor channels (NUM_TEMP_CELLS),
+ * so a channel covers 140/189 of a series group. Samsung 30Q cells (see cellTester): 3.0Ah,
+ * 18.33mm x 64.85mm, so PACK_CAPACITY_AS is about 12 in parallel */
+#define THERMAL_GROUPS_PER_CHANNEL (140.0F / 189.0F)
+#define THERMAL_CELLS_PER_CHANNEL (PACK_CAPACITY_AS / (3.0F * 3600.0F) * THERMAL_GROUPS_PER_CHANNEL)
+/// Cooled surface of a channel's cells, the can's side (m^2)
+#define THERMAL_CHANNEL_AREA (THERMAL_CELLS_PER_CHANNEL * 3.1416F * 0.01833F * 0.06485F)
+/// Share of a series group's resistance heating one channel
+#define THERMAL_HEATING_R (ADJUSTED_CELL_IR_DEFAULT * THERMAL_GROUPS_PER_CHANNEL)   ///< Ohms
+#define THERMAL_HEAT_CAPACITY (THERMAL_GROUPS_PER_CHANNEL * CELL_MASS * CELL_HEAT_CAPACITY) ///< J/K
+/// Free convection in air, about 5 W/m^2K
+#define THERMAL_COOLING_FAN_OFF (5.0F * THERMAL_CHANNEL_AREA)     ///< W/K
+/// Added by the fans, cross flow over a bank of 18mm cylinders at a few m/s is about 50 W/m^2K
+#define THERMAL_COOLING_FAN_FULL (45.0F * THERMAL_CHANNEL_AREA)   ///< W/K
+/// Conduction through the nickel strip into the next channel, a 0.15mm x 7mm strip
+/// (91 W/mK) over the 18.5mm cell pitch, top and bottom of each parallel cell
+#define THERMAL_NEIGHBOUR_COUPLING (2.0F * PACK_CAPACITY_AS / (3.0F * 3600.0F) * 91.0F * 0.15e-3F * 7e-3F / 18.5e-3F) ///< W/K
+/// Growth in uncertainty of a model only estimate
+#define THERMAL_PROCESS_NOISE (0.01F)          ///< K^2/s
+/// Spread of a channel around its neighbours
+#define THERMAL_NEIGHBOUR_NOISE (1.0F)         ///< K^2
+#define THERMAL_SENSOR_NOISE (0.0625F)         ///< K^2
+/// Readings outside these are a failed thermistor (the open/short thermistor readings)
+#define THERMAL_MIN_VALID_C (-30.0F)
+#define THERMAL_MAX_VALID_C (120.0F)
+/// Failed channels are checked and derate on their estimate plus/minus this many standard deviations
+#define THERMAL_BOUND_SIGMAS (3.0F)
+/// Largest bound a failed channel's estimate can stand in for its thermistor with. A channel
+/// next to a working one settles at about 3 K, two channels from one at about 6 K
+#define THERMAL_MAX_BOUND_K (10.0F)
+
+/* The following are used by the post-mortem cell history (see cell_history.h) */
+/// Cell history messages sent per battery task cycle once frozen
+#define CELL_HISTORY_CAN_MSGS_PER_CYCLE (10)
+/// Why the cell history was frozen, sent with each frame
+typedef enum CellHistoryFreezeReason_t {
+    CELL_HISTORY_REASON_NONE = 0,
+    CELL_HISTORY_REASON_OVERVOLTAGE,
+    CELL_HISTORY_REASON_UNDERVOLTAGE,
+    CELL_HISTORY_REASON_OVERTEMP,
+    CELL_HISTORY_REASON_BATTERY_ERROR,
+} CellHistoryFreezeReason_t;
+
 /** Maximum allowable cell temperature, will send critical DTC if surpassed */
 #define CELL_OVERTEMP (CELL_MAX_TEMP_C)
 /** Temp at warning DTC is sent */
@@ -76,9 +156,33 @@
  */
 #define BALANCE_MIN_SOC_DELTA (1.0F)
 
+/**
+ * Once a cell is being balanced, keep going until it's SoC is within this
+ * percent of the minimum cell SoC
+ */
+#define BALANCE_STOP_SOC_DELTA (0.2F)
+
+/// Balance resistor on the AMS boards (Ohms), the 33 Ohm discharge resistor of the LTC6804 typical application
+#define BALANCE_BLEED_RESISTANCE_OHMS (33.0F)
+
+/// Maximum total balance resistor dissipation on one AMS board (Watts)
+#define BALANCE_MAX_BOARD_POWER_W (5.0F)
+
+/// Don't balance while any cell is above this temperature
+#define BALANCE_MAX_TEMP_C (CELL_OVERTEMP_WARNING)
+
 /// Pause balancing for this length when reading cell voltages to get good readings
 #define CELL_RELAXATION_TIME_MS (250)
 
+/**
+ * LTC ADC mode used for cell voltages and temperatures in each BMU state.
+ * Filtered mode takes ~240 ms per cycle, so it only fits the charge task period
+ */
+#define CELL_ADC_MODE_DRIVE    LTC_ADC_MODE_FAST
+#define CELL_ADC_MODE_IDLE     LTC_ADC_MODE_NORMAL
+#define CELL_ADC_MODE_CHARGE   LTC_ADC_MODE_FILTERED
+#define CELL_ADC_MODE_BALANCE  LTC_ADC_MODE_NORMAL
+
 /// SoC to stop charging at (of the cell with lowest SoC)
 #define CHARGE_STOP_SOC (98.0)
 
@@ -88,13 +192,20 @@
  */
 #define CHARGE_CART_HEARTBEAT_MAX_PERIOD (1000)
 
-/// Default charging current limit (Amps)
+/// Default charging current limit (Amps), the charge profile's constant current
 #define CHARGE_DEFAULT_MAX_CURRENT 5
 
+/* The following are used by the charge profile (see charge_profile.h) */
+/// Highest cell is held here, below the over voltage limit with margin for
+/// measurement error
+#define CHARGE_CV_CELL_VOLTAGE (4.18F)
+/// Charging is done once the CV current tapers to this and cells are balanced
+#define CHARGE_TERM_CURRENT_A (0.5F)
+
 /**
- * Period at which cell SoCs are checked to determine which cells to balance.
- * This should be long enough so cells aren't constantly being toggled
- * between balance and not
+ * Period at which balancing is paused to take relaxed cell voltage readings
+ * and re-plan which cells to balance. Between these the planned cells keep
+ * balancing
  */
 #define BALANCE_RECHECK_PERIOD_MS (3000)
 #define START_NUM_TRIES (3)
@@ -111,6 +222,26 @@
  */
 
 #define CAN_TX_CELL_GROUP_LEN 3
+/// The packed cell messages fit 5 readings of 11 bits after the muxIndex
+#define CAN_TX_CELL_PACKED_GROUP_LEN 5
+/// Offsets and scales of the packed cell signals, as in the DBC
+#define CAN_TX_CELL_PACKED_VOLTAGE_OFFSET (2.5F)
+#define CAN_TX_CELL_PACKED_VOLTAGE_SCALE (0.001F)
+#define CAN_TX_CELL_PACKED_TEMP_OFFSET (-40.0F)
+#define CAN_TX_CELL_PACKED_TEMP_SCALE (0.1F)
+
+/* The following are used to prioritise the cell broadcast (see cell_broadcast.h) */
+/// Every other send slot continues the full sweep, the rest go to the most important cells
+#define CELL_BROADCAST_SWEEP_EVERY (2)
+/// Change since last sent, distance from the pack mean that count as importance 1
+#define CELL_BROADCAST_VOLTAGE_CHANGE_V (0.005F)
+#define CELL_BROADCAST_VOLTAGE_OUTLIER_V (0.05F)
+#define CELL_BROADCAST_TEMP_CHANGE_C (0.5F)
+#define CELL_BROADCAST_TEMP_OUTLIER_C (5.0F)
+/// Importance rises to CELL_BROADCAST_LIMIT_WEIGHT as a reading approaches a limit over this band
+#define CELL_BROADCAST_VOLTAGE_LIMIT_BAND_V (0.2F)
+#define CELL_BROADCAST_TEMP_LIMIT_BAND_C (10.0F)
+#define CELL_BROADCAST_LIMIT_WEIGHT (4.0F)
 
 /**
  * Return of balance charge function
@@ -136,12 +267,14 @@ typedef enum Charge_Notifications_t {
     BATTERY_STOP_NOTIFICATION,                  
 } Battery_Notifications_t;
 
+HAL_StatusTypeDef getHVBusMeasurements(HVBusMeasurements_t *measurements);
 HAL_StatusTypeDef getIBus(float *IBus);
 HAL_StatusTypeDef getVBatt(float *VBatt);
 HAL_StatusTypeDef getVBus(float *VBus);
 
-HAL_StatusTypeDef initBusVoltagesAndCurrentQueues();
+HAL_StatusTypeDef initBusVoltagesAndCurrentSnapshot();
 HAL_StatusTypeDef balance_cell(int cell, bool set);
+HAL_StatusTypeDef balance_cells(const bool *balance);
 HAL_StatusTypeDef getPackVoltage(float *packVoltage);
 HAL_StatusTypeDef getAdjustedPackVoltage(float *packVoltage);
 HAL_StatusTypeDef initPackVoltageQueues();
@@ -149,9 +282,14 @@ float map_range_float(float in, float low, float high, float low_out, float high
 HAL_StatusTypeDef setMaxChargeCurrent(float maxCurrent);
 void setSendOnlyOneCell(int cellIdx);
 void clearSendOnlyOneCell();
+void setCellBroadcastPacked(bool packed);
 HAL_StatusTypeDef cliSetVBatt(float VBatt);
 HAL_StatusTypeDef cliSetVBus(float VBus);
 HAL_StatusTypeDef cliSetIBus(float IBus);
 void cliSetStateBusHVSendPeriod(uint32_t period);
 uint32_t cliGetStateBusHVSendPeriod();
+HAL_StatusTypeDef sendCellHistory(void);
+void restartCellHistorySend(void);
+const CellHistory_t *getCellHistory(void);
+void clearCellHistory(void);
 #endif /* end of include guard: BATTERIES_H */
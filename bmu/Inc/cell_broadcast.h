@@ -0,0 +1,53 @@
+#ifndef CELL_BROADCAST_H
+#define CELL_BROADCAST_H
+
+/*
+ * Chooses which group of cell voltages or temperatures to broadcast in each
+ * CAN send slot. Every sweepEvery'th slot continues a round robin sweep of
+ * all groups, guaranteeing the whole pack is refreshed at a minimum rate. The
+ * other slots go to the group with the highest priority, its importance
+ * (changed since it was last sent, an outlier from the pack, near a limit)
+ * times how long since it was sent.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CELL_BROADCAST_MAX_VALUES 190
+#define CELL_BROADCAST_MAX_GROUPS CELL_BROADCAST_MAX_VALUES
+
+/// The packed messages carry 11 bit codes. The top code marks a reading the
+/// others can't carry, below the offset (undervoltage, open wire) or above
+/// the range, so it isn't sent as a plausible value
+#define CELL_BROADCAST_PACKED_BITS 11
+#define CELL_BROADCAST_PACKED_INVALID ((1U << CELL_BROADCAST_PACKED_BITS) - 1)
+
+typedef struct CellBroadcast_Params_t {
+    uint32_t numValues;
+    uint32_t groupLen;              ///< Values sent per message
+    uint32_t sweepEvery;            ///< 1 for a plain round robin, 2 for every other slot...
+    float changeScale;              ///< Change since last sent that counts as importance 1
+    float outlierScale;             ///< Distance from the pack mean that counts as importance 1
+    float lowLimit;                 ///< Values approaching either limit are important
+    float highLimit;
+    float limitBand;                ///< Importance rises to limitWeight over this band from a limit
+    float limitWeight;
+} CellBroadcast_Params_t;
+
+typedef struct CellBroadcast_t {
+    CellBroadcast_Params_t params;
+    uint32_t numGroups;
+    float lastSent[CELL_BROADCAST_MAX_VALUES];
+    uint32_t age[CELL_BROADCAST_MAX_GROUPS];    ///< Slots since each group was sent
+    uint32_t nextSweepGroup;
+    uint32_t slot;
+} CellBroadcast_t;
+
+void cellBroadcastInit(CellBroadcast_t *broadcast, const CellBroadcast_Params_t *params);
+uint32_t cellBroadcastNext(CellBroadcast_t *broadcast, const float values[]);
+float cellBroadcastImportance(const CellBroadcast_t *broadcast, const float values[], uint32_t group,
+                              float mean);
+uint32_t cellBroadcastPackedCode(float value, float offset, float scale);
+float cellBroadcastPack(float value, float offset, float scale);
+
+#endif /* end of include guard: CELL_BROADCAST_H */
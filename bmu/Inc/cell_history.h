@@ -0,0 +1,63 @@
+#ifndef CELL_HISTORY_H
+#define CELL_HISTORY_H
+
+/*
+ * Post-mortem history of the cell voltages, channel temperatures, IBus and
+ * BMU state. The most recent frames are kept in a ring and frozen when the
+ * BMU faults, so the seconds leading up to the trip can be read back after
+ * the event. Frames are stored as 8 bit deltas from the previous frame with a
+ * per frame scale, in a fixed RAM budget.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CELL_HISTORY_MAX_CELLS 140
+#define CELL_HISTORY_MAX_TEMPS 189
+/// RAM for the whole history, including the base and latest values
+#define CELL_HISTORY_RAM_BYTES (20 * 1024)
+
+#define CELL_HISTORY_VOLTAGE_LSB_V (0.001F)
+#define CELL_HISTORY_TEMP_LSB_C (0.1F)
+/// Deltas are scaled by up to 2^this to fit in 8 bits, larger steps take more than one frame
+#define CELL_HISTORY_MAX_SHIFT 4
+
+typedef struct CellHistoryFrame_t {
+    uint32_t tick;
+    int16_t IBus_dA;                ///< 0.1 A
+    uint8_t state;
+    uint8_t shifts;                 ///< Voltage delta scale in the low nibble, temp in the high
+    int8_t voltageDelta[CELL_HISTORY_MAX_CELLS];
+    int8_t tempDelta[CELL_HISTORY_MAX_TEMPS];
+} CellHistoryFrame_t;
+
+#define CELL_HISTORY_FIXED_BYTES (4 * (CELL_HISTORY_MAX_CELLS + CELL_HISTORY_MAX_TEMPS) + 32)
+#define CELL_HISTORY_FRAMES ((CELL_HISTORY_RAM_BYTES - CELL_HISTORY_FIXED_BYTES) / sizeof(CellHistoryFrame_t))
+
+typedef struct CellHistory_t {
+    uint32_t numCells;
+    uint32_t numTemps;
+    // Values before the oldest frame, in LSBs
+    uint16_t baseVoltage[CELL_HISTORY_MAX_CELLS];
+    int16_t baseTemp[CELL_HISTORY_MAX_TEMPS];
+    // Values after the newest frame, what the next frame is a delta from
+    uint16_t lastVoltage[CELL_HISTORY_MAX_CELLS];
+    int16_t lastTemp[CELL_HISTORY_MAX_TEMPS];
+    CellHistoryFrame_t frames[CELL_HISTORY_FRAMES];
+    uint32_t oldest;
+    uint32_t count;
+    bool frozen;
+    uint8_t freezeReason;
+    uint32_t freezeTick;
+} CellHistory_t;
+
+void cellHistoryInit(CellHistory_t *history, uint32_t numCells, uint32_t numTemps);
+void cellHistoryRecord(CellHistory_t *history, const float voltages[], const float temps[],
+                       float IBus, uint8_t state, uint32_t tick);
+void cellHistoryFreeze(CellHistory_t *history, uint8_t reason);
+void cellHistoryClear(CellHistory_t *history);
+uint32_t cellHistoryNumFrames(const CellHistory_t *history);
+bool cellHistoryGetFrame(const CellHistory_t *history, uint32_t index, float voltages[], float temps[],
+                         float *IBus, uint8_t *state, uint32_t *tick);
+
+#endif /* end of include guard: CELL_HISTORY_H */
@@ -0,0 +1,50 @@
+#ifndef CHARGE_PROFILE_H
+#define CHARGE_PROFILE_H
+
+/*
+ * Charge current profile. Constant current up to the point the highest cell
+ * reaches the CV voltage, then constant voltage on that cell: the current is
+ * tapered to hold it there, using an OCV behind R0 and R1||C1 cell model to
+ * look through the IR drop. The current is derated near the hot and cold
+ * limits.
+ */
+
+typedef enum ChargeProfile_Phase_t {
+    CHARGE_PROFILE_CC,              ///< Constant current, highest cell below the CV voltage
+    CHARGE_PROFILE_CV,              ///< Current tapered to hold the highest cell at the CV voltage
+    CHARGE_PROFILE_TEMP_BLOCKED,    ///< Too hot or cold to charge, no current
+    CHARGE_PROFILE_DONE,            ///< Tapered below the termination current
+} ChargeProfile_Phase_t;
+
+typedef struct ChargeProfile_Params_t {
+    float maxCurrent_A;             ///< Constant current, A
+    float cvCellVoltage;            ///< Highest cell is held here, below the over voltage limit, V
+    float r0_ohms;                  ///< Ohmic resistance of a series group, Ohms
+    float r1_ohms;                  ///< Polarization resistance of a series group, Ohms
+    float tau_s;                    ///< Polarization time constant, s
+    float tempMin_C;                ///< No charging at or below this temperature, C
+    float derateLow_C;              ///< Current ramps up to full from tempMin_C to here, C
+    float derateHigh_C;             ///< Current ramps down to zero from here to tempMax_C, C
+    float tempMax_C;                ///< No charging at or above this temperature, C
+    float termCurrent_A;            ///< Done once CV has tapered to this, A
+} ChargeProfile_Params_t;
+
+typedef struct ChargeProfile_Inputs_t {
+    float cellVoltageMax;           ///< Highest cell terminal voltage, V
+    float tempMax;                  ///< Hottest cell, C
+    float tempMin;                  ///< Coldest cell, C
+    float current_A;                ///< Measured charge current, positive into the pack, A
+} ChargeProfile_Inputs_t;
+
+typedef struct ChargeProfile_t {
+    ChargeProfile_Params_t params;
+    float polarization_V;           ///< Estimated R1||C1 voltage of the highest cell
+    float current_A;                ///< Commanded current, last step
+    ChargeProfile_Phase_t phase;
+} ChargeProfile_t;
+
+void chargeProfileInit(ChargeProfile_t *profile, const ChargeProfile_Params_t *params);
+float chargeProfileStep(ChargeProfile_t *profile, const ChargeProfile_Inputs_t *in, float dt_s);
+const char *chargeProfilePhaseName(ChargeProfile_Phase_t phase);
+
+#endif /* end of include guard: CHARGE_PROFILE_H */
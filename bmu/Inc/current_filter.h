@@ -0,0 +1,56 @@
+#ifndef CURRENT_FILTER_H
+#define CURRENT_FILTER_H
+
+/*
+ * Filter pipeline for the HV bus current samples from the ADE7913.
+ *
+ *   sample --+--> 2nd order Butterworth ------------------------> fast
+ *            |
+ *            +--> CIC, decimate by R --> 4th order Butterworth --> slow
+ *
+ * The fast output is updated every sample with low latency for overcurrent
+ * checks. The slow output is updated every R samples, and the CIC nulls
+ * alias onto its passband so it suits coulomb counting and reporting. Both
+ * have unity DC gain.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CURRENT_FILTER_MAX_CIC_ORDER 4
+#define CURRENT_FILTER_SLOW_SECTIONS 2
+
+typedef struct CurrentFilter_Params_t {
+    float sampleRate_Hz;        ///< Rate samples are passed in at
+    float fastCutoff_Hz;        ///< -3 dB point of the fast output
+    uint32_t cicOrder;          ///< Number of CIC integrator/comb stages, 1 - CURRENT_FILTER_MAX_CIC_ORDER
+    uint32_t cicDecimation;     ///< Slow output is updated every this many samples
+    float slowCutoff_Hz;        ///< -3 dB point of the slow output, below sampleRate/(2*decimation)
+    float cicLsb_A;             ///< Samples are quantized to this before the CIC, A
+} CurrentFilter_Params_t;
+
+/// Transposed direct form II second order section
+typedef struct CurrentFilter_Biquad_t {
+    float b0, b1, b2;
+    float a1, a2;
+    float z1, z2;
+} CurrentFilter_Biquad_t;
+
+typedef struct CurrentFilter_t {
+    CurrentFilter_Params_t params;
+    CurrentFilter_Biquad_t fastSection;
+    CurrentFilter_Biquad_t slowSections[CURRENT_FILTER_SLOW_SECTIONS];
+    uint32_t integrators[CURRENT_FILTER_MAX_CIC_ORDER]; ///< Wrap around, only differences are used
+    uint32_t combs[CURRENT_FILTER_MAX_CIC_ORDER];
+    uint32_t decimationCount;
+    int32_t maxCounts;          ///< Input clamp so the CIC output can't overflow
+    float cicScale;             ///< CIC output to amps
+    float fast;                 ///< Latest fast output, A
+    float slow;                 ///< Latest slow output, A
+} CurrentFilter_t;
+
+void currentFilterDefaultParams(CurrentFilter_Params_t *params);
+void currentFilterInit(CurrentFilter_t *filter, const CurrentFilter_Params_t *params);
+bool currentFilterStep(CurrentFilter_t *filter, float sample);
+
+#endif /* end of include guard: CURRENT_FILTER_H */
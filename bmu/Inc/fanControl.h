@@ -2,6 +2,9 @@
 
 #define FANCONTROL_H
 
+#include "bsp.h"
 
+float getFanDuty(void);
+HAL_StatusTypeDef setFanLimits(float offTemp, float peakTemp, float maxDuty);
 
 #endif /* end of include guard: FANCONTROL_H */
@@ -0,0 +1,55 @@
+#ifndef FAN_CONTROLLER_H
+#define FAN_CONTROLLER_H
+
+/*
+ * Pack fan duty from the hottest cell. Feedback is on the hottest cell's
+ * temperature projected ahead by its trend, so the fans come up while the
+ * pack is heating and back off once it is cooling. Feed-forward is the fan
+ * duty needed to carry away the I^2 R heat with the hottest cell at the
+ * peak temperature, so a hard stint brings the fans up before the
+ * thermistors see it. Fans stall below a minimum duty so are either off or
+ * above it, with hysteresis. The fans' LV power and energy are estimated
+ * from the duty.
+ */
+
+#include <stdbool.h>
+
+typedef struct FanController_Params_t {
+    float offTemp_C;                ///< Fans can be off with the projected hottest cell below this, C
+    float peakTemp_C;               ///< Feedback is full duty with the projected hottest cell here, C
+    float minDuty;                  ///< Fans stall below this duty, 0 to 1
+    float maxDuty;                  ///< Duty limit, 0 to 1
+    float horizon_s;                ///< Temperature trend is projected this far ahead, s
+    float trendTau_s;               ///< Smoothing of the temperature trend and heating, s
+    float heatingResistance_ohms;   ///< Resistance heating the hottest cell's channel, Ohms
+    float coolingFanOff_WperK;      ///< Channel conductance to the inlet air with fans off, W/K
+    float coolingFanFull_WperK;     ///< Extra conductance with fans at full duty, W/K
+    float minDeltaT_K;              ///< Floor on the peak to inlet difference for feed-forward, K
+    float fullPower_W;              ///< LV power of the fans at full duty, W
+} FanController_Params_t;
+
+typedef struct FanController_Inputs_t {
+    float tempMax;                  ///< Hottest cell, C
+    float tempInlet;                ///< Inlet air, or the coolest cell, C
+    float current_A;                ///< Pack current, either direction, A
+    bool forceFull;                 ///< Run at the duty limit, e.g. while charging
+} FanController_Inputs_t;
+
+typedef struct FanController_t {
+    FanController_Params_t params;
+    bool initialized;
+    float level_C;                  ///< Smoothed hottest cell temperature
+    float trend_Kps;                ///< Its rate of change, K/s
+    float heat_W;                   ///< Smoothed I^2 R heating of the hottest channel
+    // Results of the last step
+    float projected_C;
+    float feedForward;              ///< Duty from the heating alone
+    float duty;                     ///< 0 (off) to 1 (full)
+    float power_W;                  ///< Estimated LV power of the fans
+    float energy_J;                 ///< Estimated LV energy used since init
+} FanController_t;
+
+void fanControllerInit(FanController_t *fan, const FanController_Params_t *params);
+float fanControllerStep(FanController_t *fan, const FanController_Inputs_t *in, float dt_s);
+
+#endif /* end of include guard: FAN_CONTROLLER_H */
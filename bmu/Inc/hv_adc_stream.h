@@ -0,0 +1,60 @@
+#ifndef HV_ADC_STREAM_H
+#define HV_ADC_STREAM_H
+
+/*
+ * Streaming acquisition from the HV ADC (ADE7912/ADE7913). Each falling edge
+ * of DREADY time stamps a conversion and starts a burst read of the current
+ * and both voltage registers. The decoded samples go into a ring buffer
+ * written from the interrupts and drained by the HV measure task, which is
+ * woken once per block of samples rather than per sample. Counts samples
+ * dropped with the buffer full, conversions missed while a read was still in
+ * flight, and gaps in the sample times.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Burst read: command byte, then IWV, V1WV and V2WV, 24 bits each
+#define HV_ADC_BURST_LEN 10
+/// Ring buffer length, a power of two
+#define HV_ADC_STREAM_SIZE 32
+
+typedef struct HvAdcSample_t {
+    int32_t current;            ///< IWV, sign extended ADC counts
+    int32_t v1;                 ///< V1WV, sign extended ADC counts
+    int32_t v2;                 ///< V2WV, sign extended ADC counts
+    uint32_t timestamp_us;      ///< Falling edge of DREADY
+} HvAdcSample_t;
+
+typedef struct HvAdcStream_t {
+    HvAdcSample_t buffer[HV_ADC_STREAM_SIZE];
+    volatile uint32_t head;     ///< Samples written, only by the interrupts
+    volatile uint32_t tail;     ///< Samples read, only by the task
+    uint32_t blockSize;         ///< Samples per task wake up
+    uint32_t samplePeriod_us;   ///< Nominal ADC output period
+    // Read in flight
+    volatile bool busy;
+    uint32_t readTime_us;
+    // Previous sample
+    bool anySamples;
+    uint32_t lastTime_us;
+    // Statistics
+    uint32_t samples;
+    uint32_t overruns;          ///< Dropped with the buffer full
+    uint32_t busyDrdys;         ///< DREADY while the previous read was in flight
+    uint32_t readErrors;        ///< Reads that failed
+    uint32_t gaps;              ///< Samples more than 1.5 periods after the last
+    uint32_t minInterval_us;
+    uint32_t maxInterval_us;
+} HvAdcStream_t;
+
+void hvAdcStreamInit(HvAdcStream_t *stream, uint32_t blockSize, uint32_t samplePeriod_us);
+void hvAdcBurstCommand(uint8_t tx[HV_ADC_BURST_LEN]);
+void hvAdcDecodeBurst(const uint8_t rx[HV_ADC_BURST_LEN], HvAdcSample_t *sample);
+bool hvAdcStreamDataReady(HvAdcStream_t *stream, uint32_t now_us);
+bool hvAdcStreamReadComplete(HvAdcStream_t *stream, const uint8_t rx[HV_ADC_BURST_LEN]);
+void hvAdcStreamReadFailed(HvAdcStream_t *stream);
+bool hvAdcStreamPop(HvAdcStream_t *stream, HvAdcSample_t *sample);
+uint32_t hvAdcStreamCount(const HvAdcStream_t *stream);
+
+#endif /* end of include guard: HV_ADC_STREAM_H */
@@ -0,0 +1,32 @@
+#ifndef HV_BUS_SNAPSHOT_H
+#define HV_BUS_SNAPSHOT_H
+
+/*
+ * Most recent HV bus measurements, published by a single writer (the HV
+ * measure task) and read by any task without kernel calls. Readers always get
+ * a coherent set of measurements taken at the same time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// Number of times a reader retries if the writer overtook it mid copy
+#define HV_BUS_SNAPSHOT_READ_TRIES 3
+
+typedef struct HVBusMeasurements_t {
+    float IBus;         ///< HV bus current, A
+    float VBus;         ///< HV bus voltage, V
+    float VBatt;        ///< HV battery voltage, V
+    uint32_t timestamp; ///< Tick count when measured
+} HVBusMeasurements_t;
+
+typedef struct HVBusSnapshot_t {
+    volatile uint32_t sequence;     ///< Twice the number of writes, odd while writing
+    HVBusMeasurements_t buffer[2];
+} HVBusSnapshot_t;
+
+void hvBusSnapshotInit(HVBusSnapshot_t *snapshot);
+void hvBusSnapshotWrite(HVBusSnapshot_t *snapshot, const HVBusMeasurements_t *measurements);
+bool hvBusSnapshotRead(const HVBusSnapshot_t *snapshot, HVBusMeasurements_t *measurements);
+
+#endif /* end of include guard: HV_BUS_SNAPSHOT_H */
@@ -0,0 +1,70 @@
+#ifndef IMD_DECODER_H
+#define IMD_DECODER_H
+
+/*
+ * Decoder for the IMD (Bender IR155-32xx) PWM status output. Each input
+ * capture gives a period and high time. The frequency band gives the IMD's
+ * state and the duty cycle its measurement, so a band is only taken once a
+ * few consecutive captures agree on it, and the duty cycle is the median of
+ * the latest captures in the band, so single glitched captures are
+ * rejected. Tracks the time from power up to the first valid reading, and
+ * counts the captures rejected.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IMD_DECODER_WINDOW 5
+
+typedef enum ImdDecoder_Band_t {
+    IMD_BAND_NONE,      ///< No valid signal (no captures, or not locked to a band yet)
+    IMD_BAND_10HZ,      ///< Normal, insulation resistance in the duty cycle
+    IMD_BAND_20HZ,      ///< HV undervoltage, insulation resistance in the duty cycle
+    IMD_BAND_30HZ,      ///< Speed start measurement, good or bad in the duty cycle
+    IMD_BAND_40HZ,      ///< Device error
+    IMD_BAND_50HZ,      ///< Connection fault to earth (KL31)
+    IMD_NUM_BANDS,
+} ImdDecoder_Band_t;
+
+typedef struct ImdDecoder_Params_t {
+    uint32_t tickFrequency_Hz;      ///< Input capture timer frequency
+    float bandTolerance;            ///< Fraction either side of a band's frequency
+    uint32_t lockCount;             ///< Consecutive captures in a band before it's taken
+    float outlierDuty_percent;      ///< Captures this far from the median duty are counted as outliers
+    uint32_t timeout_ms;            ///< No captures for this long is no signal
+} ImdDecoder_Params_t;
+
+typedef struct ImdDecoder_t {
+    ImdDecoder_Params_t params;
+    uint32_t startTime_ms;
+    uint32_t lastCaptureTime_ms;
+    bool anyCaptures;
+    // Captures in the current band, and in a band it may be changing to
+    ImdDecoder_Band_t band;
+    float duty[IMD_DECODER_WINDOW];
+    uint32_t period[IMD_DECODER_WINDOW];
+    uint32_t count;
+    uint32_t index;
+    ImdDecoder_Band_t candidateBand;
+    float candidateDuty[IMD_DECODER_WINDOW];
+    uint32_t candidatePeriod[IMD_DECODER_WINDOW];
+    uint32_t candidateCount;
+    // Results of the last capture
+    bool valid;                     ///< Locked to a band
+    float frequency_Hz;             ///< Mean over the window
+    float duty_percent;             ///< Median over the window
+    float resistance_kOhms;         ///< In the 10 Hz and 20 Hz bands, INFINITY otherwise
+    // Statistics
+    uint32_t captures;
+    uint32_t outliers;              ///< Outside every band, or away from the median duty
+    uint32_t bandChanges;
+    uint32_t timeToValid_ms;        ///< From init to the first valid reading, 0 until then
+} ImdDecoder_t;
+
+void imdDecoderInit(ImdDecoder_t *dec, const ImdDecoder_Params_t *params, uint32_t now_ms);
+bool imdDecoderCapture(ImdDecoder_t *dec, uint32_t periodTicks, uint32_t highTicks, uint32_t now_ms);
+bool imdDecoderSignalLost(const ImdDecoder_t *dec, uint32_t now_ms);
+float imdDecoderBandFrequency(ImdDecoder_Band_t band);
+const char *imdDecoderBandName(ImdDecoder_Band_t band);
+
+#endif /* end of include guard: IMD_DECODER_H */
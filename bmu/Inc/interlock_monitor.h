@@ -0,0 +1,43 @@
+#ifndef INTERLOCK_MONITOR_H
+#define INTERLOCK_MONITOR_H
+
+/*
+ * Debounced, edge time stamped state of the safety loop sense inputs. Edges
+ * are recorded from the GPIO interrupt with @ref interlockMonitorEdge, and
+ * the fault monitor task confirms a loop is open with
+ * @ref interlockMonitorUpdate once it has stayed open for the debounce time.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum InterlockLoop_t {
+    INTERLOCK_HVIL,
+    INTERLOCK_BRB,
+    INTERLOCK_BSPD,
+    INTERLOCK_HVD,
+    INTERLOCK_IL,
+    INTERLOCK_CBRB,
+    NUM_INTERLOCK_LOOPS
+} InterlockLoop_t;
+
+typedef struct InterlockLoopState_t {
+    bool open;                  ///< Debounced state
+    bool pending;               ///< Seen open, waiting for the debounce time
+    uint32_t openedAt_us;       ///< Time of the edge that opened the loop
+    uint32_t confirmedAt_us;    ///< Time the open was confirmed
+    uint32_t glitches;          ///< Opens shorter than the debounce time
+} InterlockLoopState_t;
+
+typedef struct InterlockMonitor_t {
+    uint32_t debounce_us;
+    InterlockLoopState_t loops[NUM_INTERLOCK_LOOPS];
+} InterlockMonitor_t;
+
+void interlockMonitorInit(InterlockMonitor_t *monitor, uint32_t debounce_us);
+void interlockMonitorEdge(InterlockMonitor_t *monitor, InterlockLoop_t loop, bool closed, uint32_t now_us);
+uint32_t interlockMonitorUpdate(InterlockMonitor_t *monitor, const bool closed[NUM_INTERLOCK_LOOPS], uint32_t now_us);
+bool interlockMonitorPending(const InterlockMonitor_t *monitor, uint32_t now_us, uint32_t *wait_us);
+const char *interlockLoopName(InterlockLoop_t loop);
+
+#endif /* end of include guard: INTERLOCK_MONITOR_H */
@@ -0,0 +1,17 @@
+#ifndef OCV_LUT_H
+#define OCV_LUT_H
+
+/*
+ * Cell open circuit voltage vs state of charge, as a table of breakpoints
+ * shared by the SOC EKF and the balance planner.
+ */
+
+#define OCV_LUT_LEN 26U
+
+extern const float ocvLutSoc[OCV_LUT_LEN];
+extern const float ocvLutVoltage[OCV_LUT_LEN];
+
+float ocvLutSocToOcv(float soc, float *dOcvdSoc);
+float ocvLutOcvToSoc(float ocv);
+
+#endif /* end of include guard: OCV_LUT_H */
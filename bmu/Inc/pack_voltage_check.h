@@ -0,0 +1,36 @@
+#ifndef PACK_VOLTAGE_CHECK_H
+#define PACK_VOLTAGE_CHECK_H
+
+/*
+ * Plausibility check between the sum of the cell voltages from the AMS
+ * boards and the pack voltage from the HV bus ADC. The allowed difference
+ * covers the drop over the pack interconnects and the change in cell voltage
+ * between the two measurements being taken.
+ */
+
+#include <stdbool.h>
+
+typedef struct PackVoltageCheck_Params_t {
+    float interconnectResistance_ohms;  ///< Busbars, fuse and connectors between cell taps and VBatt sense, Ohms
+    float packResistance_ohms;          ///< Total series resistance seen by a current change, Ohms
+    float tolerance_V;                  ///< Fixed allowance for sensor offsets, V
+    float toleranceRelative;            ///< Allowance proportional to VBatt for gain errors, 0-1
+    float acquisitionTime_s;            ///< Time to read all the cells, added to the skew
+    float faultTime_s;                  ///< Out of tolerance this long before faulting, s
+} PackVoltageCheck_Params_t;
+
+typedef struct PackVoltageCheck_t {
+    PackVoltageCheck_Params_t params;
+    float lastIBus;
+    bool haveLastIBus;
+    float residual_V;       ///< Sum of cells minus expected, last step
+    float allowed_V;        ///< Tolerance on residual_V, last step
+    float outOfTolerance_s; ///< Time residual_V has been out of tolerance
+    bool faulted;
+} PackVoltageCheck_t;
+
+void packVoltageCheckInit(PackVoltageCheck_t *check, const PackVoltageCheck_Params_t *params);
+bool packVoltageCheckStep(PackVoltageCheck_t *check, float sumOfCells, float VBatt, float IBus,
+                          float skew_s, float dt_s);
+
+#endif /* end of include guard: PACK_VOLTAGE_CHECK_H */
@@ -68,4 +68,15 @@ typedef enum PCDC_Notifications_t {
 #define PRECHARGE_STEP_5_COMPLETE_PERCENT_VPACK (0.98F)
 #define PRECHARGE_STEP_5_PERCENT_IDEAL_CURRENT_REQUIRED (0.8F)
 
+// Step 4 RC fit (see precharge_fit.h)
+#define PRECHARGE_MC_CAPACITANCE_MIN_F (100e-6F)
+#define PRECHARGE_MC_CAPACITANCE_MAX_F (1000e-6F)
+#define PRECHARGE_CHARGER_CAPACITANCE_MIN_F (0.0F)
+#define PRECHARGE_CHARGER_CAPACITANCE_MAX_F (1000e-6F)
+#define PRECHARGE_LEAKAGE_MIN_PERCENT_VBATT (0.95F)
+#define PRECHARGE_RELAY_CLOSE_TIME_S (0.03F)
+#define PRECHARGE_FIT_START_RISE_PERCENT_VBATT (0.02F)
+#define PRECHARGE_FIT_MIN_TIME_S (0.3F)
+#define PRECHARGE_FIT_SETTLE_TAUS (1.0F)
+
 #endif /* end of include guard: PRECHARGEDISCHARGE_H */
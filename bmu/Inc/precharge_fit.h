@@ -0,0 +1,59 @@
+#ifndef PRECHARGE_FIT_H
+#define PRECHARGE_FIT_H
+
+/*
+ * Online fit of the HV bus charging through the precharge resistor, used to
+ * catch a bus that isn't charging like the expected RC before the precharge
+ * times out. The bus is modelled as a capacitance with a leakage resistance,
+ * charged from VBatt through the precharge resistor:
+ *     C dVBus/dt = (VBatt - VBus) / R - VBus / R_leak
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum PrechargeFit_Result_t {
+    PRECHARGE_FIT_CHARGING,         ///< Not done yet, keep going
+    PRECHARGE_FIT_NORMAL,           ///< Bus charging like the expected RC, nothing left to judge
+    PRECHARGE_FIT_CAPACITANCE_LOW,  ///< Charging faster than the smallest expected bus
+    PRECHARGE_FIT_CAPACITANCE_HIGH, ///< Charging slower than the largest expected bus, or not at all
+    PRECHARGE_FIT_LEAKAGE,          ///< Bus will settle below the complete voltage
+} PrechargeFit_Result_t;
+
+typedef struct PrechargeFit_Params_t {
+    float resistance_ohms;          ///< Precharge resistor
+    float capacitanceMin_F;         ///< Expected range of the bus capacitance
+    float capacitanceMax_F;
+    float completeFraction;         ///< VBus / VBatt at which precharge is complete
+    float leakageMinFraction;       ///< Settling below this VBus / VBatt is a leakage fault
+    float relayCloseTime_s;         ///< From commanding the precharge relay to its contacts closing
+    float startRiseFraction;        ///< VBus rise, of VBatt, that marks the precharge relay closed
+    float fitMinTime_s;             ///< Fit this long after the rise before judging it
+    float settleTaus;               ///< And this many R C before judging leakage
+} PrechargeFit_Params_t;
+
+typedef struct PrechargeFit_t {
+    PrechargeFit_Params_t params;
+    uint32_t samples;
+    bool rising;
+    float firstTime_s;
+    float startTime_s;
+    float startVBus;
+    float lastTime_s;
+    float lastVBus;
+    float lastVBatt;
+    double intVBatt;                ///< Integrals since the rise, V s
+    double intVBus;
+    double sums[3][4];              ///< Normal equations for VBus = c + alpha * intVBatt - beta * intVBus
+    // Results of the last step
+    float capacitance_F;
+    float leakage_ohms;             ///< INFINITY without leakage
+    float finalFraction;            ///< VBus / VBatt the bus is settling to
+    PrechargeFit_Result_t result;
+} PrechargeFit_t;
+
+void prechargeFitInit(PrechargeFit_t *fit, const PrechargeFit_Params_t *params);
+PrechargeFit_Result_t prechargeFitStep(PrechargeFit_t *fit, float VBus, float VBatt, float time_s);
+const char *prechargeFitResultName(PrechargeFit_Result_t result);
+
+#endif /* end of include guard: PRECHARGE_FIT_H */
@@ -0,0 +1,48 @@
+#ifndef SOC_EKF_H
+#define SOC_EKF_H
+
+/*
+ * Equivalent circuit extended Kalman filter for state of charge.
+ *
+ * Cell model is a first order Thevenin circuit:
+ *
+ *   V_cell = OCV(SOC) - V_rc - R0 * I
+ *
+ * where V_rc is the voltage across a single R1 || C1 polarization branch and
+ * I is positive when discharging. State is x = [SOC, V_rc, R0]. Every step
+ * runs a fixed amount of work (3x3 matrices and one walk of the OCV LUT) so
+ * the worst case runtime is bounded.
+ */
+
+#include "ocv_lut.h"
+
+#define SOC_EKF_NUM_STATES 3
+
+typedef struct SocEkf_Params_t {
+    float capacity_As;          ///< Capacity of one series cell group, A-s
+    float r0_ohms;              ///< Initial series (ohmic) resistance, Ohms
+    float r1_ohms;              ///< Polarization resistance, Ohms
+    float c1_farads;            ///< Polarization capacitance, F
+    float processNoiseSoc;      ///< SOC process noise variance, per second
+    float processNoiseVrc;      ///< V_rc process noise variance (V^2), per second
+    float processNoiseR0;       ///< R0 process noise variance (Ohm^2), per second
+    float measurementNoise;     ///< Cell voltage measurement variance, V^2
+    float initialSocVariance;   ///< Initial SOC covariance
+    float initialVrcVariance;   ///< Initial V_rc covariance, V^2
+    float initialR0Variance;    ///< Initial R0 covariance, Ohm^2
+} SocEkf_Params_t;
+
+typedef struct SocEkf_State_t {
+    SocEkf_Params_t params;
+    float soc;                  ///< Estimated SOC, 0-1
+    float vrc;                  ///< Estimated polarization voltage, V
+    float r0;                   ///< Estimated series resistance, Ohms
+    float P[SOC_EKF_NUM_STATES][SOC_EKF_NUM_STATES]; ///< Estimate covariance
+    float innovation;           ///< Last measurement residual, V
+} SocEkf_State_t;
+
+void socEkfDefaultParams(SocEkf_Params_t *params);
+void socEkfInit(SocEkf_State_t *ekf, const SocEkf_Params_t *params, float initialSoc);
+float socEkfStep(SocEkf_State_t *ekf, float current_A, float cellVoltage, float dt_s);
+
+#endif /* end of include guard: SOC_EKF_H */
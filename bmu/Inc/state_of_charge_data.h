@@ -2,6 +2,10 @@
 
 #define STATE_OF_CHARGE_DATA_H
 
+// The SOC LUTs are indexed by segment voltage, characterized for this many
+// series cells per segment. Must match CELLS_PER_BOARD * NUM_BOARDS_PER_SEGMENT
+#define SOC_LUT_CELLS_PER_SEGMENT 20U
+
 #define HV_SOC_LUT_MIN (80.0f)
 #define HV_SOC_LUT_LEN 14U
 #define HV_SOC_LUT_STEP 0.1f
@@ -14,7 +18,19 @@
 #define LV_SOC_LUT_LEN 9U
 #define LV_SOC_LUT_STEP 1.f
 
+#define CELL_HIGH_VOLTAGE_LOOKUP_CUTOFF 4.0f
+#define CELL_LOW_VOLTAGE_LOOKUP_CUTOFF 3.28f
+
+#define SEGMENT_HIGH_VOLTAGE_LOOKUP_CUTOFF (CELL_HIGH_VOLTAGE_LOOKUP_CUTOFF * SOC_LUT_CELLS_PER_SEGMENT) //When the segment reaches this threshold, the soc algorithm will be using the integration method exclusively
+#define SEGMENT_LOW_VOLTAGE_LOOKUP_CUTOFF (CELL_LOW_VOLTAGE_LOOKUP_CUTOFF * SOC_LUT_CELLS_PER_SEGMENT) //When the segment reaches this threshold, the soc algorithm will start weighing the lookup table method
+
+#define SOC_HIGH_VOLTAGE_SOC_CUTOFF (0.942f) // Ramp up to around all cells 4V
+#define SOC_LOW_VOLTAGE_SOC_CUTOFF (0.06144f) // Ramp down when all cells around 3V
+
 extern const float highVoltageSocLut[HV_SOC_LUT_LEN];
 extern const float midVoltageSocLut[MID_SOC_LUT_LEN];
 extern const float lowVoltageSocLut[LV_SOC_LUT_LEN];
+
+float socLutSegmentVoltageToSoc(float segmentVoltage);
+float socLutVoltageWeight(float voltageSoc);
 #endif
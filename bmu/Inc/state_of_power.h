@@ -0,0 +1,49 @@
+#ifndef STATE_OF_POWER_H
+#define STATE_OF_POWER_H
+
+/*
+ * State of power map. Given the present cell extremes, SOC and resistance,
+ * computes the current and power the pack can sustain for a given horizon
+ * without any cell leaving its voltage or temperature window.
+ */
+
+#define SOP_SHORT_HORIZON_S (2.0f)
+#define SOP_LONG_HORIZON_S (10.0f)
+
+typedef struct SOP_Params_t {
+    float cellVoltageMin;           ///< Discharge floor for the weakest cell, V
+    float cellVoltageMax;           ///< Charge ceiling for the strongest cell, V
+    float cellTempMax;              ///< Temperature no cell may reach, C
+    float dischargeDerateTemp;      ///< Discharge limit ramps to 0 from here to cellTempMax, C
+    float chargeTempMin;            ///< No charging at or below this temperature, C
+    float chargeDerateTemp;         ///< Charge limit ramps up to full from chargeTempMin to here, C
+    float capacity_As;              ///< Series cell group capacity, A-s
+    float r0_ohms;                  ///< Ohmic resistance of a series group, Ohms
+    float r1_ohms;                  ///< Polarization resistance of a series group, Ohms
+    float tau_s;                    ///< Polarization time constant, s
+    float thermalMass_JperK;        ///< Heat capacity seen by the hottest cell, J/K
+    float thermalResistance_ohms;   ///< Resistance heating the hottest cell, Ohms
+    float maxDischargeCurrent;      ///< Hardware (fuse, contactor) discharge limit, A
+    float maxChargeCurrent;         ///< Hardware charge limit, A
+    unsigned numSeriesCells;
+} SOP_Params_t;
+
+typedef struct SOP_Inputs_t {
+    float ocvMin;                   ///< Open circuit voltage of the lowest cell, V
+    float ocvMax;                   ///< Open circuit voltage of the highest cell, V
+    float tempMax;                  ///< Hottest cell temperature, C
+    float tempMin;                  ///< Coldest cell temperature, C
+    float soc;                      ///< Pack SOC, 0-1
+    float packOcv;                  ///< Pack open circuit voltage, V
+} SOP_Inputs_t;
+
+typedef struct SOP_Limits_t {
+    float dischargeCurrent;         ///< A, positive
+    float chargeCurrent;            ///< A, positive
+    float dischargePower;           ///< W, positive
+    float chargePower;              ///< W, positive
+} SOP_Limits_t;
+
+void sopCompute(const SOP_Params_t *params, const SOP_Inputs_t *in, float horizon_s, SOP_Limits_t *out);
+
+#endif /* end of include guard: STATE_OF_POWER_H */
@@ -0,0 +1,49 @@
+#ifndef THERMAL_ESTIMATOR_H
+#define THERMAL_ESTIMATOR_H
+
+/*
+ * Pack thermal estimator. Each thermistor channel is a thermal node heated by
+ * the pack current, cooled towards the air inlet temperature by the fans and
+ * coupled to its neighbours in the segment. Channels with a plausible reading
+ * follow the reading, channels whose thermistor has failed are predicted by
+ * the model and corrected towards their neighbours, with a variance that
+ * grows while the estimate is unsupported.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define THERMAL_ESTIMATOR_MAX_CHANNELS 189
+
+typedef struct ThermalEstimator_Params_t {
+    uint32_t numChannels;
+    uint32_t channelsPerSegment;    ///< Channels aren't neighbours across segments
+    float heatingResistance_ohms;   ///< Resistance heating one channel's cells, Ohms
+    float heatCapacity_JperK;       ///< Heat capacity of one channel's cells, J/K
+    float coolingFanOff_WperK;      ///< Conductance to the inlet air with fans off, W/K
+    float coolingFanFull_WperK;     ///< Extra conductance with fans at full duty, W/K
+    float neighbourCoupling_WperK;  ///< Conductance to each neighbouring channel, W/K
+    float processNoise_K2ps;        ///< Model uncertainty growth, K^2/s
+    float neighbourNoise_K2;        ///< Spread of a channel around its neighbours' mean, K^2
+    float sensorNoise_K2;           ///< Variance of a working thermistor, K^2
+    float minValid_C;               ///< Readings below are an open thermistor, C
+    float maxValid_C;               ///< Readings above are a shorted thermistor, C
+} ThermalEstimator_Params_t;
+
+typedef struct ThermalEstimator_t {
+    ThermalEstimator_Params_t params;
+    float temperature_C[THERMAL_ESTIMATOR_MAX_CHANNELS];
+    float variance_K2[THERMAL_ESTIMATOR_MAX_CHANNELS];
+    bool failed[THERMAL_ESTIMATOR_MAX_CHANNELS];
+    bool initialized;
+    float inlet_C;                  ///< Coolest working channel, taken as the air inlet
+    uint32_t numFailed;
+} ThermalEstimator_t;
+
+void thermalEstimatorInit(ThermalEstimator_t *est, const ThermalEstimator_Params_t *params);
+void thermalEstimatorStep(ThermalEstimator_t *est, const float measured_C[], float current_A,
+                          float fanDuty, float dt_s);
+float thermalEstimatorUpperBound(const ThermalEstimator_t *est, uint32_t channel, float sigmas);
+float thermalEstimatorLowerBound(const ThermalEstimator_t *est, uint32_t channel, float sigmas);
+
+#endif /* end of include guard: THERMAL_ESTIMATOR_H */
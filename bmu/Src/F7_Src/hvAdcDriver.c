@@ -0,0 +1,203 @@
+/**
+  *****************************************************************************
+  * @file    hvAdcDriver.c
+  * @brief   Streams HV ADC samples on the ADC's data ready signal
+  * @details Once hvadc_init has configured the ADC (see ade7913_common.c),
+  * the falling edge of DREADY starts a DMA burst read of the current and both
+  * voltages, time stamped at the edge. The read completes in the SPI
+  * callback, which queues the sample (see hv_adc_stream.h) and wakes the HV
+  * measure task once a block of samples is waiting.
+  * The ADC's own clock paces the samples, rather than the FreeRTOS tick.
+  *
+  * The blocking register reads in ade7913_common.c share the SPI and must
+  * not be used once streaming has started.
+  ******************************************************************************
+  */
+
+#include "hvAdcDriver.h"
+#include "ade7913.h"
+#include "bsp.h"
+#include "debug.h"
+#include "cycleClock.h"
+#include "hv_adc_stream.h"
+#include "cmsis_os.h"
+
+#define HV_ADC_SAMPLE_PERIOD_US (1000000 / HV_ADC_SAMPLE_RATE_HZ)
+
+extern osThreadId HVMeasureHandle;
+
+DMA_HandleTypeDef hdma_hv_adc_rx;
+DMA_HandleTypeDef hdma_hv_adc_tx;
+
+static HvAdcStream_t hvAdcStream;
+static uint8_t hvAdcTx[HV_ADC_BURST_LEN];
+static uint8_t hvAdcRx[HV_ADC_BURST_LEN];
+static volatile bool hvAdcStreaming = false;
+
+/**
+ * @brief SPI1 RX and TX on DMA2 streams 0 and 3, channel 3, which Cube
+ * leaves free
+ */
+static HAL_StatusTypeDef hvAdcDmaInit()
+{
+   __HAL_RCC_DMA2_CLK_ENABLE();
+
+   hdma_hv_adc_rx.Instance = DMA2_Stream0;
+   hdma_hv_adc_rx.Init.Channel = DMA_CHANNEL_3;
+   hdma_hv_adc_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+   hdma_hv_adc_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+   hdma_hv_adc_rx.Init.MemInc = DMA_MINC_ENABLE;
+   hdma_hv_adc_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+   hdma_hv_adc_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+   hdma_hv_adc_rx.Init.Mode = DMA_NORMAL;
+   hdma_hv_adc_rx.Init.Priority = DMA_PRIORITY_HIGH;
+   hdma_hv_adc_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+   if (HAL_DMA_Init(&hdma_hv_adc_rx) != HAL_OK)
+   {
+      return HAL_ERROR;
+   }
+   __HAL_LINKDMA(&HV_ADC_SPI_HANDLE, hdmarx, hdma_hv_adc_rx);
+
+   hdma_hv_adc_tx.Instance = DMA2_Stream3;
+   hdma_hv_adc_tx.Init = hdma_hv_adc_rx.Init;
+   hdma_hv_adc_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+   hdma_hv_adc_tx.Init.Priority = DMA_PRIORITY_MEDIUM;
+   if (HAL_DMA_Init(&hdma_hv_adc_tx) != HAL_OK)
+   {
+      return HAL_ERROR;
+   }
+   __HAL_LINKDMA(&HV_ADC_SPI_HANDLE, hdmatx, hdma_hv_adc_tx);
+
+   // Must be at or below configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY to notify the task
+   HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+   HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+   // For SPI errors during DMA transfers
+   HAL_NVIC_SetPriority(SPI1_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(SPI1_IRQn);
+
+   return HAL_OK;
+}
+
+/**
+ * @brief Starts streaming. Call after hvadc_init, from the HV measure task
+ *
+ * @param samplesPerWake The task is woken once this many samples are waiting
+ */
+HAL_StatusTypeDef hv_adc_stream_start(uint32_t samplesPerWake)
+{
+   cycleClockInit();
+   hvAdcStreamInit(&hvAdcStream, samplesPerWake, HV_ADC_SAMPLE_PERIOD_US);
+   hvAdcBurstCommand(hvAdcTx);
+
+   if (hvAdcDmaInit() != HAL_OK)
+   {
+      ERROR_PRINT("Failed to init HV ADC DMA\n");
+      return HAL_ERROR;
+   }
+
+   // Data ready pulses low once per conversion
+   GPIO_InitTypeDef GPIO_InitStruct = {0};
+   GPIO_InitStruct.Pin = HV_ADC_DREADY_L_Pin;
+   GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+   GPIO_InitStruct.Pull = GPIO_NOPULL;
+   HAL_GPIO_Init(HV_ADC_DREADY_L_GPIO_Port, &GPIO_InitStruct);
+
+   hvAdcStreaming = true;
+   HAL_NVIC_SetPriority(EXTI4_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+
+   return HAL_OK;
+}
+
+/**
+ * @brief Take the oldest streamed sample. Only for the HV measure task
+ *
+ * @return false if there are no samples waiting
+ */
+bool hv_adc_stream_pop(HvAdcSample_t *sample)
+{
+   return hvAdcStreamPop(&hvAdcStream, sample);
+}
+
+float hv_adc_to_current(int32_t raw)
+{
+   return CURRENT_SCALE * ((float)raw) + CURRENT_OFFSET;
+}
+
+float hv_adc_to_v1(int32_t raw)
+{
+   return VOLTAGE_1_SCALE * ((float)raw) + VOLTAGE_1_OFFSET;
+}
+
+float hv_adc_to_v2(int32_t raw)
+{
+   return VOLTAGE_2_SCALE * ((float)raw) + VOLTAGE_2_OFFSET;
+}
+
+/**
+ * @brief Called from the EXTI callback on the falling edge of DREADY
+ */
+void hv_adc_dready_isr(void)
+{
+   if (!hvAdcStreaming) {
+      return;
+   }
+   if (!hvAdcStreamDataReady(&hvAdcStream, cycleClockMicros())) {
+      return;
+   }
+
+   HAL_GPIO_WritePin(HV_ADC_SPI_NSS_GPIO_Port, HV_ADC_SPI_NSS_Pin, GPIO_PIN_RESET);
+   if (HAL_SPI_TransmitReceive_DMA(&HV_ADC_SPI_HANDLE, hvAdcTx, hvAdcRx, HV_ADC_BURST_LEN) != HAL_OK) {
+      HAL_GPIO_WritePin(HV_ADC_SPI_NSS_GPIO_Port, HV_ADC_SPI_NSS_Pin, GPIO_PIN_SET);
+      hvAdcStreamReadFailed(&hvAdcStream);
+   }
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+
+   if (hspi != &HV_ADC_SPI_HANDLE) {
+      return;
+   }
+
+   // Raising chip select ends the burst
+   HAL_GPIO_WritePin(HV_ADC_SPI_NSS_GPIO_Port, HV_ADC_SPI_NSS_Pin, GPIO_PIN_SET);
+   if (hvAdcStreamReadComplete(&hvAdcStream, hvAdcRx)) {
+      vTaskNotifyGiveFromISR(HVMeasureHandle, &xHigherPriorityTaskWoken);
+      portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+   }
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+   if (hspi != &HV_ADC_SPI_HANDLE) {
+      return;
+   }
+
+   HAL_GPIO_WritePin(HV_ADC_SPI_NSS_GPIO_Port, HV_ADC_SPI_NSS_Pin, GPIO_PIN_SET);
+   hvAdcStreamReadFailed(&hvAdcStream);
+}
+
+void EXTI4_IRQHandler(void)
+{
+   HAL_GPIO_EXTI_IRQHandler(HV_ADC_DREADY_L_Pin);
+}
+
+void DMA2_Stream0_IRQHandler(void)
+{
+   HAL_DMA_IRQHandler(&hdma_hv_adc_rx);
+}
+
+void DMA2_Stream3_IRQHandler(void)
+{
+   HAL_DMA_IRQHandler(&hdma_hv_adc_tx);
+}
+
+// HV_ADC_SPI_HANDLE is SPI1
+void SPI1_IRQHandler(void)
+{
+   HAL_SPI_IRQHandler(&HV_ADC_SPI_HANDLE);
+}
@@ -8,6 +8,8 @@
   * ground. It reports a fault if the insulation drop below a certain value.
   * The IMD communicates with the BMU through a gpio pin indicating a boolean
   * fault status (OK or FAIL) and a PWM signal indicating the fault type.
+  * The PWM input captures are decoded in the capture interrupt (see
+  * imd_decoder.h), which wakes the IMD task when the decoded band changes.
   *
   ******************************************************************************
   */
@@ -18,12 +20,22 @@
 #include "bmu_dtc.h"
 #include "state_machine.h"
 #include "controlStateMachine.h"
+#include "imd_decoder.h"
+#include "cmsis_os.h"
 
 #define IMD_SENSE_PIN_FAULT    GPIO_PIN_RESET
 #define IMD_SENSE_PIN_NO_FAULT GPIO_PIN_SET
 
 // Lowest freqency expected is 10 Hz, so set timeout to twice that period
 #define IMD_FREQ_MEAS_TIMEOUT_MS 200
+/// Each band is +/- 5 % in the IR155 datasheet
+#define IMD_BAND_TOLERANCE (0.05F)
+/// Consecutive captures in a band before it's taken
+#define IMD_LOCK_COUNT 3
+/// Captures this far from the median duty are counted as outliers
+#define IMD_OUTLIER_DUTY_PERCENT (5.0F)
+
+extern osThreadId IMDHandle;
 
 /* Captured Value */
 volatile uint32_t            meas_IC2_val = 0;
@@ -34,8 +46,8 @@ volatile uint32_t            meas_duty_cycle = 0;
 /* Frequency Value */
 volatile uint32_t            meas_freq_mHz = 0;
 
-/* Last time we captured a pwm pulse */
-volatile uint32_t lastCaptureTimeTicks = 0;
+/* Decoded PWM, stepped in the capture interrupt */
+static ImdDecoder_t imdDecoder;
 
 static void print_error(char err[]) {
   ERROR_PRINT("imd error: %s\n", err);
@@ -81,7 +93,14 @@ HAL_StatusTypeDef init_imd_measurement(void) {
   meas_duty_cycle = 0;
   meas_freq_mHz = 0;
 
-  lastCaptureTimeTicks = 0;
+  ImdDecoder_Params_t params = {
+    .tickFrequency_Hz = IMD_TIMER_TICK_FREQUENCY_HZ,
+    .bandTolerance = IMD_BAND_TOLERANCE,
+    .lockCount = IMD_LOCK_COUNT,
+    .outlierDuty_percent = IMD_OUTLIER_DUTY_PERCENT,
+    .timeout_ms = IMD_FREQ_MEAS_TIMEOUT_MS,
+  };
+  imdDecoderInit(&imdDecoder, &params, xTaskGetTickCount() * portTICK_PERIOD_MS);
 
   return HAL_OK;
 }
@@ -127,9 +146,19 @@ IMDMeasurements get_imd_measurements(void) {
   };
 }
 
-IMDStatus _imd_status(uint32_t freq_mHz, uint32_t duty){
+/**
+ * @brief Copies the decoder state, for its statistics
+ */
+void get_imd_decoder(ImdDecoder_t *decoder)
+{
+  taskENTER_CRITICAL();
+  *decoder = imdDecoder;
+  taskEXIT_CRITICAL();
+}
+
+IMDStatus _imd_status(ImdDecoder_Band_t band, float duty){
   IMDStatus status = IMDSTATUS_Invalid;
-  if ((freq_mHz > 9500) && (freq_mHz < 10500)){
+  if (band == IMD_BAND_10HZ){
     if ((duty > 5) && (duty < 84)){
       status = IMDSTATUS_Normal;
     }
@@ -137,27 +166,27 @@ IMDStatus _imd_status(uint32_t freq_mHz, uint32_t duty){
     {
       status = IMDSTATUS_Fault_Earth;
     }
-  } else if ((freq_mHz > 19000) && (freq_mHz < 21000)){
+  } else if (band == IMD_BAND_20HZ){
     if ((duty > 5) && (duty < 95)){
       status = IMDSTATUS_Undervoltage;
     }
-  } else if ((freq_mHz > 28500) && (freq_mHz < 31500)){
+  } else if (band == IMD_BAND_30HZ){
     if ((duty > 5) && (duty < 10)){
       status = IMDSTATUS_SST_Good;
     } else if ((duty > 90) && (duty < 95)){
       status = IMDSTATUS_SST_Bad;
     }
-  } else if ((freq_mHz > 38000) && (freq_mHz < 42000)){
+  } else if (band == IMD_BAND_40HZ){
     if ((duty > 47) && (duty < 53)){
       status = IMDSTATUS_Device_Error;
     }
-  } else if ((freq_mHz > 47500) && (freq_mHz < 52500)){
+  } else if (band == IMD_BAND_50HZ){
     if ((duty > 47) && (duty < 53)){
       status = IMDSTATUS_Fault_Earth;
     }
   } else{
 	  DEBUG_PRINT("--- Unhandled IMD Freq ---\n");
-	  DEBUG_PRINT("freq_mHz %lu, duty %lu\n", freq_mHz, duty);
+	  DEBUG_PRINT("band %s, duty %f\n", imdDecoderBandName(band), duty);
   }
 
   return status;
@@ -167,8 +196,11 @@ IMDStatus _imd_status(uint32_t freq_mHz, uint32_t duty){
 IMDStatus get_imd_status() {
   IMDMeasurements meas = get_imd_measurements();
   IMDStatus status;
+  ImdDecoder_t decoder;
+
+  get_imd_decoder(&decoder);
 
-  if (xTaskGetTickCount() - lastCaptureTimeTicks >= pdMS_TO_TICKS(IMD_FREQ_MEAS_TIMEOUT_MS)) {
+  if (imdDecoderSignalLost(&decoder, xTaskGetTickCount() * portTICK_PERIOD_MS)) {
     // We're not getting pwm pulses anymore, so the frequency is 0 Hz
     // This means a short has occured
     status = IMDSTATUS_HV_Short;
@@ -177,7 +209,8 @@ IMDStatus get_imd_status() {
   }
 
   if (meas.status == IMD_SENSE_PIN_FAULT) {
-    status = _imd_status(meas.meas_freq_mHz, meas.meas_duty);
+    // Not locked to a band yet is invalid, not a fault
+    status = decoder.valid ? _imd_status(decoder.band, decoder.duty_percent) : IMDSTATUS_Invalid;
   } else {
     status = IMDSTATUS_Normal;
   }
@@ -203,7 +236,13 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
         /* meas_freq_mHz computation */
         meas_freq_mHz = (IMD_TIMER_TICK_FREQUENCY_HZ*1000)  / meas_IC2_val;
 
-        lastCaptureTimeTicks = xTaskGetTickCountFromISR();
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        if (imdDecoderCapture(&imdDecoder, meas_IC2_val, meas_IC1_val,
+                              xTaskGetTickCountFromISR() * portTICK_PERIOD_MS)) {
+          // Classify a change straight away rather than on the next task period
+          vTaskNotifyGiveFromISR(IMDHandle, &xHigherPriorityTaskWoken);
+        }
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
       }
       else
       {
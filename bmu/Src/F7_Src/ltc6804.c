@@ -3,7 +3,7 @@
  * This is the LTC6804-1 chip architecture, the current plan is that it uses 
  *
  * */
-#include "ltc_chip_interface.h"
+#include "ltc6804.h"
 #include "string.h"
 #if LTC_CHIP == LTC_CHIP_6804
 
@@ -49,15 +49,17 @@
 #define ADCVAX_BYTE0 0x05
 #define ADCVAX_BYTE1 0x6f
 
-// Use normal MD (7kHz), Discharge not permission, all channels
-#define ADCV_BROADCAST_BYTE0 (0x03)
-#define ADCV_BYTE0 0x03
-#define ADCV_BYTE1 0x60
+// MD bits of the conversion commands are split across both command bytes
+#define MD_BYTE0(MD) (((MD) >> 1) & 0x1)
+#define MD_BYTE1(MD) (((MD) & 0x1) << 7)
+
+// Use selected MD, Discharge not permission, all channels
+#define ADCV_BYTE0(MD) (0x02 | MD_BYTE0(MD))
+#define ADCV_BYTE1(MD) (0x60 | MD_BYTE1(MD))
 
-// Use fast MD (27kHz), Discharge not permission, all channels and GPIO 5
-#define ADAX_BROADCAST_BYTE0 (0x05)
-#define ADAX_BYTE0 0x05
-#define ADAX_BYTE1 0x65
+// Use selected MD, GPIO 5
+#define ADAX_BYTE0(MD) (0x04 | MD_BYTE0(MD))
+#define ADAX_BYTE1(MD) (0x65 | MD_BYTE1(MD))
 
 #define RDSTATA_BYTE0 0x00
 #define RDSTATA_BYTE1 0x10
@@ -69,6 +71,8 @@
 #define ADOW_BROADCAST_BYTE0 (0x03)
 #define ADOW_BYTE0 0x03
 #define ADOW_BYTE1(PUP) (0x28 | ((PUP)<<6))
+// Channel selection, 0 for all cells or n for cells n and n+6
+#define ADOW_CH(group) ((group) & 0x7)
 
 // debugging
 #define ADSTAT_BYTE0 0x05
@@ -78,7 +82,6 @@
 #define SWTRD(en) ((en) << 1) // We're not using the software time
 #define REFON(en) ((en) << 2)
 
-#define BATT_CONFIG_SIZE 6    // Size of Config per Register
 #define COMMAND_SIZE 2
 #define PEC_SIZE 2
 #define VOLTAGE_BLOCK_SIZE 6
@@ -114,64 +117,137 @@ HAL_StatusTypeDef format_and_send_config(uint8_t config[NUM_BOARDS][NUM_LTC_CHIP
 		return HAL_ERROR;
 	}
 
-	// Send command + data
-	for (uint8_t board = 0; board < NUM_BOARDS; ++board)
+	// Send command + data, one write shifts every board's config into place
+	if (batt_spi_tx(txBuffer, BUFF_SIZE) != HAL_OK)
 	{
-		if (batt_spi_tx(txBuffer, BUFF_SIZE) != HAL_OK)
-		{
-			ERROR_PRINT("Failed to transmit config to AMS board %u\n", board);
-			return HAL_ERROR;
-		}
+		ERROR_PRINT("Failed to transmit config to AMS boards\n");
+		return HAL_ERROR;
 	}
 
 	return HAL_OK;
 }
 
+// Config last sent to the boards, so unchanged configs don't have to be resent
+static uint8_t m_written_config[NUM_BOARDS][NUM_LTC_CHIPS_PER_BOARD][BATT_CONFIG_SIZE] = {0};
+static bool m_written_config_valid = false;
+static uint32_t config_writes = 0;
+static uint32_t config_writes_skipped = 0;
+
 HAL_StatusTypeDef batt_write_config()
 {
-	format_and_send_config(m_batt_config);
-    return HAL_OK;
+	if (format_and_send_config(m_batt_config) != HAL_OK) {
+		m_written_config_valid = false;
+		return HAL_ERROR;
+	}
+	memcpy(m_written_config, m_batt_config, sizeof(m_written_config));
+	m_written_config_valid = true;
+	config_writes++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef batt_write_config_if_changed()
+{
+	if (m_written_config_valid && memcmp(m_written_config, m_batt_config, sizeof(m_written_config)) == 0) {
+		config_writes_skipped++;
+		return HAL_OK;
+	}
+	return batt_write_config();
+}
+
+void batt_get_config_write_counts(uint32_t *writes, uint32_t *skipped)
+{
+	*writes = config_writes;
+	*skipped = config_writes_skipped;
 }
 
 #define INVALID_DATA 0xFF
 static uint32_t PEC_count = 0;
 static uint32_t last_PEC_tick = 0;
+// PEC errors since boot (or last clear) per board and register group
+static uint32_t pec_errors[NUM_BOARDS][NUM_LTC_REG_GROUPS] = {0};
+
+#define ALL_BOARDS_MASK ((1UL << NUM_BOARDS) - 1)
 
+uint32_t batt_get_pec_errors(int board, ltc_register_group_t group)
+{
+	if (board < 0 || board >= NUM_BOARDS || group >= NUM_LTC_REG_GROUPS) {
+		return 0;
+	}
+	return pec_errors[board][group];
+}
+
+const char *batt_register_group_name(ltc_register_group_t group)
+{
+	static const char *names[NUM_LTC_REG_GROUPS] = {"CFG", "CVA", "CVB", "CVC", "CVD", "AUXB"};
+	return (group < NUM_LTC_REG_GROUPS) ? names[group] : "?";
+}
+
+void batt_clear_pec_errors(void)
+{
+	memset(pec_errors, 0, sizeof(pec_errors));
+}
 
 /*
 TODO: Should probably clean this up. Call it smth different or change param names
 	first_byte, second_byte: 	11 bit command
 	data_buffer: 				full size of the output buffer (num_boards*response_size)
 	response_size: 				size of one board's response
+	group:						register group being read, for PEC error counts
+	failed_boards:				optional, set to a mask of the boards with no valid data
+
+The register group is read again for up to PEC_MISMATCH_READ_RETRIES times if
+any board fails PEC, only the data of boards that failed before is taken from
+the retries. Data of boards that never pass PEC is left untouched.
 */
-static HAL_StatusTypeDef batt_read_data(uint8_t first_byte, uint8_t second_byte, uint8_t* data_buffer, unsigned int response_size){
+static HAL_StatusTypeDef batt_read_data(uint8_t first_byte, uint8_t second_byte, uint8_t* data_buffer, unsigned int response_size,
+                                        ltc_register_group_t group, uint32_t *failed_boards){
 	const size_t BUFF_SIZE = COMMAND_SIZE + PEC_SIZE + ((response_size + PEC_SIZE) * NUM_BOARDS);
 	const size_t DATA_START_IDX = COMMAND_SIZE + PEC_SIZE;
 	uint8_t rxBuffer[BUFF_SIZE];
 	uint8_t txBuffer[BUFF_SIZE];
-	memset(rxBuffer, 0xFF, BUFF_SIZE);
+	uint32_t pending_boards = ALL_BOARDS_MASK;
+
+	if (failed_boards != NULL) {
+		*failed_boards = pending_boards;
+	}
+
 	memset(txBuffer, 0xFF, BUFF_SIZE);
 	if (batt_format_command(first_byte, second_byte, txBuffer) != HAL_OK) {
 		ERROR_PRINT("Failed to send write config command\n");
 		return HAL_ERROR;
 	}
 
-	if (spi_tx_rx(txBuffer, rxBuffer, BUFF_SIZE) != HAL_OK) {
-		ERROR_PRINT("Failed to send read data command\n");
-		return HAL_ERROR;
-	}
-	
-	for (int board = 0; board < NUM_BOARDS; ++board)
+	for (int attempt = 0; attempt <= PEC_MISMATCH_READ_RETRIES && pending_boards != 0; attempt++)
 	{
-		const uint16_t startOfData = DATA_START_IDX + (board * (response_size + PEC_SIZE));
-		if (checkPEC(&(rxBuffer[startOfData]), response_size) != HAL_OK)
-		{
-			DEBUG_PRINT("PEC ERROR on board %d config\r\n", board);
-			PEC_count++;
+		if (attempt > 0 && batt_spi_wakeup(false /* not sleeping*/)) {
 			return HAL_ERROR;
 		}
-	}
 
+		memset(rxBuffer, 0xFF, BUFF_SIZE);
+		if (spi_tx_rx(txBuffer, rxBuffer, BUFF_SIZE) != HAL_OK) {
+			ERROR_PRINT("Failed to send read data command\n");
+			return HAL_ERROR;
+		}
+
+		for (int board = 0; board < NUM_BOARDS; ++board)
+		{
+			if (!(pending_boards & (1UL << board))) {
+				continue;
+			}
+
+			const uint16_t startOfData = DATA_START_IDX + (board * (response_size + PEC_SIZE));
+			if (checkPEC(&(rxBuffer[startOfData]), response_size) != HAL_OK)
+			{
+				DEBUG_PRINT("PEC ERROR on board %d %s\r\n", board, batt_register_group_name(group));
+				PEC_count++;
+				pec_errors[board][group]++;
+				continue;
+			}
+
+			memcpy(&(data_buffer[board*response_size]), &(rxBuffer[startOfData]), response_size);
+			pending_boards &= ~(1UL << board);
+		}
+	}
 
 	if(xTaskGetTickCount() - last_PEC_tick > 10000)
 	{
@@ -179,24 +255,26 @@ static HAL_StatusTypeDef batt_read_data(uint8_t first_byte, uint8_t second_byte,
 		last_PEC_tick = xTaskGetTickCount();
 	}
 
-	for(int board = 0; board < NUM_BOARDS; board++) {
-		memcpy(&(data_buffer[board*response_size]), &(rxBuffer[DATA_START_IDX + (board * (response_size + PEC_SIZE))]), response_size);
+	if (failed_boards != NULL) {
+		*failed_boards = pending_boards;
 	}
-	
-	return HAL_OK;
+
+	return (pending_boards == 0) ? HAL_OK : HAL_ERROR;
 }
 
 HAL_StatusTypeDef batt_read_config(uint8_t config[NUM_BOARDS][NUM_LTC_CHIPS_PER_BOARD][BATT_CONFIG_SIZE])
 {
 	const uint8_t response_buffer_size = NUM_BOARDS * BATT_CONFIG_SIZE;
 	uint8_t response_buffer[response_buffer_size];
-	batt_read_data(RDCFG_BYTE0, RDCFG_BYTE1, response_buffer, BATT_CONFIG_SIZE);
+	memset(response_buffer, 0, response_buffer_size);
+	HAL_StatusTypeDef status = batt_read_data(RDCFG_BYTE0, RDCFG_BYTE1, response_buffer, BATT_CONFIG_SIZE,
+	                                          LTC_REG_CFG, NULL);
 
 	for(int board = 0; board < NUM_BOARDS; board++){
 		memcpy(&(config[board][0][0]), &(response_buffer[board * BATT_CONFIG_SIZE]), BATT_CONFIG_SIZE);
 	}
 
-	return HAL_OK;
+	return status;
 }
 
 HAL_StatusTypeDef batt_verify_config(){
@@ -233,15 +311,14 @@ HAL_StatusTypeDef batt_send_command(ltc_command_t curr_command, bool broadcast,
 	switch(curr_command) {
 		case(ADCV): 
 		{
-			command_byte_low = ADCV_BYTE0;
-			command_byte_high = ADCV_BYTE1;
+			command_byte_low = ADCV_BYTE0(batt_get_adc_mode());
+			command_byte_high = ADCV_BYTE1(batt_get_adc_mode());
 			break;
 		}
 		case(ADAX):
 		{
-			command_byte_low = ADAX_BROADCAST_BYTE0;
-			command_byte_low = ADAX_BROADCAST_BYTE0;
-			command_byte_high = ADAX_BYTE1;
+			command_byte_low = ADAX_BYTE0(batt_get_adc_mode());
+			command_byte_high = ADAX_BYTE1(batt_get_adc_mode());
 			break;
 		}
 		case(ADOW_UP):
@@ -303,6 +380,29 @@ HAL_StatusTypeDef batt_broadcast_command(ltc_command_t curr_command) {
 	return HAL_OK;
 }
 
+/*
+ * Start an open wire conversion of one group of cells on all boards. Group 0
+ * converts all cells, group n (1 - 6) converts LTC cells n and n+6, which
+ * takes a fraction of the time
+ */
+HAL_StatusTypeDef batt_broadcast_open_wire_command(bool pullup, uint8_t cell_group) {
+	const size_t TX_BUFF_SIZE = COMMAND_SIZE + PEC_SIZE;
+	uint8_t txBuffer[TX_BUFF_SIZE];
+
+	if (batt_format_command(ADOW_BROADCAST_BYTE0, ADOW_BYTE1(pullup) | ADOW_CH(cell_group), txBuffer) != HAL_OK)
+	{
+		ERROR_PRINT("Failed to format open wire command\n");
+		return HAL_ERROR;
+	}
+
+	if (batt_spi_tx(txBuffer, TX_BUFF_SIZE) != HAL_OK)
+	{
+		ERROR_PRINT("Failed to transmit open wire command\n");
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
 /*
  * Read back cell voltages, this assumes that the command to initiate ADC
  * readings has been sent already and the appropriate amount of time has
@@ -311,10 +411,26 @@ HAL_StatusTypeDef batt_broadcast_command(ltc_command_t curr_command) {
  */
 HAL_StatusTypeDef batt_readBackCellVoltage(float *cell_voltage_array, voltage_operation_t voltage_operation)
 {
-	uint8_t cell_indexes_allocated = 0;
+	return batt_readBackCellVoltageBlocks(cell_voltage_array, voltage_operation,
+	                                      (1U << VOLTAGE_BLOCKS_PER_CHIP) - 1);
+}
+
+/*
+ * Read back only the voltage register groups (blocks) set in block_mask,
+ * leaving the other cells in cell_voltage_array untouched
+ */
+HAL_StatusTypeDef batt_readBackCellVoltageBlocks(float *cell_voltage_array, voltage_operation_t voltage_operation,
+                                                 uint8_t block_mask)
+{
+	HAL_StatusTypeDef status = HAL_OK;
 
 	for (int block = 0; block < VOLTAGE_BLOCKS_PER_CHIP; block++) {
 		uint8_t cmdByteLow, cmdByteHigh;
+
+		if (!(block_mask & (1U << block)))
+		{
+			continue;
+		}
 		// Select appropriate voltage register group
 		switch(block){
 			case 0:
@@ -355,7 +471,9 @@ HAL_StatusTypeDef batt_readBackCellVoltage(float *cell_voltage_array, voltage_op
 			return HAL_ERROR;
 		}
 		
-		if(batt_read_data(cmdByteLow, cmdByteHigh, adc_vals, VOLTAGE_BLOCK_SIZE) != HAL_OK) {
+		uint32_t failed_boards = 0;
+		if(batt_read_data(cmdByteLow, cmdByteHigh, adc_vals, VOLTAGE_BLOCK_SIZE,
+		                  LTC_REG_CVA + block, &failed_boards) != HAL_OK) {
 			DEBUG_PRINT("Failed AMS voltage block read (block %u)\r\n", block);
 		}
 
@@ -370,25 +488,40 @@ HAL_StatusTypeDef batt_readBackCellVoltage(float *cell_voltage_array, voltage_op
 			{
 				continue;
 			}
+			const uint8_t board_cell_idx = (ltc_cell_num < 6) ? (ltc_cell_num - 1) : (ltc_cell_num - 2);
 
 			for (int board = 0; board < NUM_BOARDS; ++board)
 			{
 				const size_t cell_voltage_data_index = (board * VOLTAGE_BLOCK_SIZE) + (block_index * CELL_VOLTAGE_SIZE_BYTES);
 				const uint16_t adc_reading = ((uint16_t) (adc_vals[(cell_voltage_data_index + 1)] << 8 | adc_vals[cell_voltage_data_index]));
 				
-				const size_t bmu_cell_idx = (board * CELLS_PER_BOARD) + cell_indexes_allocated;
-				cell_voltage_array[bmu_cell_idx] = ((float)adc_reading) / VOLTAGE_REGISTER_COUNTS_PER_VOLT;
+				const size_t bmu_cell_idx = (board * CELLS_PER_BOARD) + board_cell_idx;
 
-				if(voltage_operation == OPEN_WIRE)
+				if (failed_boards & (1UL << board))
 				{
-					open_wire_failure[bmu_cell_idx].num_times_consec = 0;
+					// Keep the last reading of the cell, it is marked so the
+					// open wire test skips it
+					open_wire_failure[bmu_cell_idx].occurred = true;
+					if (open_wire_failure[bmu_cell_idx].num_times_consec < NUM_PEC_MISMATCH_CONSECUTIVE_FAILS_ERROR)
+					{
+						open_wire_failure[bmu_cell_idx].num_times_consec++;
+					}
+					if (open_wire_failure[bmu_cell_idx].num_times_consec >= NUM_PEC_MISMATCH_CONSECUTIVE_FAILS_ERROR)
+					{
+						ERROR_PRINT("Cell %u failed PEC %d times in a row\n", bmu_cell_idx,
+						            NUM_PEC_MISMATCH_CONSECUTIVE_FAILS_ERROR);
+						status = HAL_ERROR;
+					}
+					continue;
 				}
+
+				cell_voltage_array[bmu_cell_idx] = ((float)adc_reading) / VOLTAGE_REGISTER_COUNTS_PER_VOLT;
+				open_wire_failure[bmu_cell_idx].num_times_consec = 0;
 			}
-			++cell_indexes_allocated;
 		}
 	}
 
-    return HAL_OK;
+    return status;
 }
 
 
@@ -406,12 +539,18 @@ HAL_StatusTypeDef batt_read_thermistors(size_t channel, float *cell_temp_array)
 	// adc values for one block from all boards
 	uint8_t adc_vals[AUX_BLOCK_SIZE * NUM_BOARDS] = {0};
 			
-	if(batt_read_data(RDAUXB_BYTE0, RDAUXB_BYTE1, adc_vals, AUX_BLOCK_SIZE) != HAL_OK) {
-		DEBUG_PRINT("Failed to read LTC AUX B register\r\n");
-		return HAL_ERROR;
+	uint32_t failed_boards = 0;
+	HAL_StatusTypeDef status = batt_read_data(RDAUXB_BYTE0, RDAUXB_BYTE1, adc_vals, AUX_BLOCK_SIZE,
+	                                          LTC_REG_AUXB, &failed_boards);
+	if (status != HAL_OK) {
+		DEBUG_PRINT("Failed to read LTC AUX B register (boards 0x%lx)\r\n", failed_boards);
 	}
 
 	for(int board = 0; board < NUM_BOARDS; board++) {
+		// Keep the last reading of boards that failed PEC
+		if (failed_boards & (1UL << board)) {
+			continue;
+		}
 		// shifting index due to skipping certain thermistors on the AMS boards. An explaination exists above the batt_read_cell_temps function
 		if (channel == 6 && board%2 == 1) {
 			continue;
@@ -431,7 +570,7 @@ HAL_StatusTypeDef batt_read_thermistors(size_t channel, float *cell_temp_array)
 		float voltageThermistor = ((float)adcCounts) / VOLTAGE_REGISTER_COUNTS_PER_VOLT;
 		cell_temp_array[cellIdx] = batt_convert_voltage_to_temp(voltageThermistor);
 	}
-	return HAL_OK;
+	return status;
 }
 
 
@@ -487,7 +626,7 @@ HAL_StatusTypeDef batt_config_discharge_timer(DischargeTimerLength length) {
 
     for (int board = 0; board < NUM_BOARDS; board++) {
 		for(int chip = 0; chip < NUM_LTC_CHIPS_PER_BOARD; chip++) {	
-			m_batt_config[board][chip][5] |= (length << 4);
+			m_batt_config[board][chip][5] = (m_batt_config[board][chip][5] & 0x0F) | (length << 4);
 		}
     }
 
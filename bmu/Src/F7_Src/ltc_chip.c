@@ -13,6 +13,41 @@
 
 #define OPEN_WIRE_IBUS_TOLERANCE_A (10.0f)
 
+// Mode used by ADCV and ADAX, the open wire test always runs at 7kHz
+static ltc_adc_mode_t adc_mode = LTC_ADC_MODE_NORMAL;
+
+HAL_StatusTypeDef batt_set_adc_mode(ltc_adc_mode_t mode)
+{
+    if (mode < LTC_ADC_MODE_FAST || mode > LTC_ADC_MODE_FILTERED) {
+        ERROR_PRINT("Invalid LTC ADC mode %d\n", mode);
+        return HAL_ERROR;
+    }
+    adc_mode = mode;
+    return HAL_OK;
+}
+
+ltc_adc_mode_t batt_get_adc_mode(void)
+{
+    return adc_mode;
+}
+
+/*
+ * @param all_channels true for conversion of all cells, false for a single
+ * cell pair or GPIO
+ */
+uint32_t batt_get_conversion_time_us(ltc_adc_mode_t mode, bool all_channels)
+{
+    switch (mode) {
+        case LTC_ADC_MODE_FAST:
+            return all_channels ? CONVERSION_TIME_27kHz_US : CONVERSION_TIME_SINGLE_27kHz_US;
+        case LTC_ADC_MODE_FILTERED:
+            return all_channels ? CONVERSION_TIME_26Hz_US : CONVERSION_TIME_SINGLE_26Hz_US;
+        case LTC_ADC_MODE_NORMAL:
+        default:
+            return all_channels ? CONVERSION_TIME_7kHz_US : CONVERSION_TIME_SINGLE_7kHz_US;
+    }
+}
+
 HAL_StatusTypeDef batt_init()
 {
 
@@ -73,7 +108,7 @@ HAL_StatusTypeDef batt_read_cell_voltages(float *cell_voltage_array)
         return HAL_ERROR;
     }
 
-    long_delay_us(CONVERSION_TIME_7kHz_US);
+    long_delay_us(batt_get_conversion_time_us(adc_mode, true /* all channels */));
 
     if (batt_readBackCellVoltage(cell_voltage_array, POLL_VOLTAGE) != HAL_OK)
     {
@@ -112,7 +147,7 @@ HAL_StatusTypeDef batt_read_cell_temps_single_channel(uint8_t channel, float *ce
     }
 
 	batt_broadcast_command(ADAX);
-    delay_us(TEMP_MEASURE_DELAY_US);
+    long_delay_us(batt_get_conversion_time_us(adc_mode, false /* single channel */));
 
     if (batt_spi_wakeup(false /* not sleeping*/))
     {
@@ -160,31 +195,107 @@ Differ any questions to Justin Vuong, Owen Brake or Andrew Stekar.
 
 Future todo: could add a reading of VREF2 to get a better estimate of thermistor resistance
 */
+static uint8_t batt_next_temp_channel(void)
+{
+    static const uint8_t channel_read_order[14] = {0, 1, 2, 3, 4, 5, 6, 9, 10, 11, 12, 13, 14, 15};
+    static uint8_t curr_channel_read_index = 0;
+
+    uint8_t channel = channel_read_order[curr_channel_read_index];
+    curr_channel_read_index = (curr_channel_read_index + 1) % 14;
+    return channel;
+}
+
 HAL_StatusTypeDef batt_read_cell_temps(float *cell_temp_array)
 {
-    uint8_t channel_read_order[14] = {0, 1, 2, 3, 4, 5, 6, 9, 10, 11, 12, 13, 14, 15};
-	static uint8_t curr_channel_read_index = 0;
 	for (int i = 0; i < NUM_THERMISTOR_MEASUREMENTS_PER_CYCLE; i++)
 	{
-		if (batt_read_cell_temps_single_channel(channel_read_order[curr_channel_read_index], cell_temp_array) != HAL_OK)
+		if (batt_read_cell_temps_single_channel(batt_next_temp_channel(), cell_temp_array) != HAL_OK)
 		{
 			return HAL_ERROR;
 		}
-        curr_channel_read_index = (curr_channel_read_index + 1) % 14;
     }
 
     return HAL_OK;
 }
 
+/*
+ * Cell voltages and the first thermistor channel of the cycle are read in one
+ * sequence. The thermistor mux is on GPIO5, which ADCVAX can't convert, so
+ * instead the mux is set before the cell conversion to settle during it, and
+ * the thermistor conversion runs while the cell voltages are read back. This
+ * saves a full isoSPI wakeup and the thermistor conversion wait each cycle
+ */
 HAL_StatusTypeDef batt_read_cell_voltages_and_temps(float *cell_voltage_array, float *cell_temp_array){
-    if (batt_read_cell_voltages(cell_voltage_array) != HAL_OK) {
+    const uint8_t channel = batt_next_temp_channel();
+
+    if (batt_spi_wakeup(true))
+    {
+        return HAL_ERROR;
+    }
+
+    batt_set_temp_config(channel);
+    if (batt_write_config() != HAL_OK)
+    {
+        ERROR_PRINT("Failed to setup mux for temp reading\n");
+        return HAL_ERROR;
+    }
+
+    if (batt_broadcast_command(ADCV) != HAL_OK)
+    {
         ERROR_PRINT("Failed to read cell voltages\n");
         return HAL_ERROR;
     }
-    if (batt_read_cell_temps(cell_temp_array) != HAL_OK) {
+
+    long_delay_us(batt_get_conversion_time_us(adc_mode, true /* all channels */));
+
+    if (batt_spi_wakeup(false /* not sleeping*/))
+    {
+        return HAL_ERROR;
+    }
+
+    if (batt_broadcast_command(ADAX) != HAL_OK)
+    {
         ERROR_PRINT("Failed to read cell temperatures\n");
         return HAL_ERROR;
     }
+    const uint32_t aux_start_ticks = xTaskGetTickCount();
+
+    if (batt_readBackCellVoltage(cell_voltage_array, POLL_VOLTAGE) != HAL_OK)
+    {
+        ERROR_PRINT("Failed to read cell voltages\n");
+        return HAL_ERROR;
+    }
+
+    // Each block read back wakes the isoSPI bus, which normally covers the
+    // thermistor conversion. Wait for what is left of it otherwise, the tick
+    // count may have been up to 1 ms short
+    const uint32_t aux_conversion_us = batt_get_conversion_time_us(adc_mode, false /* single channel */);
+    const uint32_t aux_elapsed_ms = xTaskGetTickCount() - aux_start_ticks;
+    if ((aux_elapsed_ms * 1000) < aux_conversion_us + 1000)
+    {
+        long_delay_us(aux_conversion_us + 1000 - (aux_elapsed_ms * 1000));
+    }
+
+    if (batt_spi_wakeup(false /* not sleeping*/))
+    {
+        return HAL_ERROR;
+    }
+
+    if (batt_read_thermistors(channel, cell_temp_array) != HAL_OK)
+    {
+        ERROR_PRINT("Failed to read cell temperatures\n");
+        return HAL_ERROR;
+    }
+
+    // Any further thermistor channels for this cycle are read on their own
+    for (int i = 1; i < NUM_THERMISTOR_MEASUREMENTS_PER_CYCLE; i++)
+    {
+        if (batt_read_cell_temps_single_channel(batt_next_temp_channel(), cell_temp_array) != HAL_OK)
+        {
+            ERROR_PRINT("Failed to read cell temperatures\n");
+            return HAL_ERROR;
+        }
+    }
 
     return HAL_OK;
 }
@@ -217,10 +328,14 @@ float cell_voltages_single_reading[CELLS_PER_BOARD * NUM_BOARDS];
 
 // Perform open wire test cell voltage reading, either pullup or pulldown
 // Average num_readings voltages to account for noise
+/*
+ * Cell group 0 runs the open wire conversion on every cell, group n (1 - 5)
+ * only on LTC cells n and n+6 and reads back only the blocks holding them
+ */
 HAL_StatusTypeDef performOpenCircuitTestReading(float *cell_voltages, bool pullup,
-                                                unsigned int num_readings)
+                                                uint8_t cell_group, unsigned int num_readings)
 {
-    if (num_readings <= 0) {
+    if (num_readings <= 0 || cell_group > OPEN_WIRE_CELL_GROUPS) {
         return HAL_ERROR;
     }
 
@@ -229,12 +344,16 @@ HAL_StatusTypeDef performOpenCircuitTestReading(float *cell_voltages, bool pullu
             return HAL_ERROR;
         }
 
-        if (batt_broadcast_command(pullup ? ADOW_UP : ADOW_DOWN) != HAL_OK) {
+        if (batt_broadcast_open_wire_command(pullup, cell_group) != HAL_OK) {
             return HAL_ERROR;
         }
 
-        vTaskDelay(VOLTAGE_MEASURE_DELAY_MS);
-        delay_us(VOLTAGE_MEASURE_DELAY_EXTRA_US);
+        if (cell_group == 0) {
+            vTaskDelay(VOLTAGE_MEASURE_DELAY_MS);
+            delay_us(VOLTAGE_MEASURE_DELAY_EXTRA_US);
+        } else {
+            delay_us(OPEN_WIRE_GROUP_CONVERSION_TIME_US);
+        }
     }
 
 	if (batt_spi_wakeup(false /* not sleeping*/))
@@ -242,7 +361,15 @@ HAL_StatusTypeDef performOpenCircuitTestReading(float *cell_voltages, bool pullu
 		return HAL_ERROR;
 	}
 
-	if (batt_readBackCellVoltage(cell_voltages_single_reading, OPEN_WIRE) != HAL_OK)
+	uint8_t block_mask = 0xF;
+	if (cell_group != 0)
+	{
+		// Block of LTC cell n is (n - 1) / 3
+		block_mask = (1U << ((cell_group - 1) / VOLTAGES_PER_BLOCK))
+		             | (1U << ((cell_group + 5) / VOLTAGES_PER_BLOCK));
+	}
+
+	if (batt_readBackCellVoltageBlocks(cell_voltages_single_reading, OPEN_WIRE, block_mask) != HAL_OK)
 	{
 		return HAL_ERROR;
 	}
@@ -252,90 +379,118 @@ HAL_StatusTypeDef performOpenCircuitTestReading(float *cell_voltages, bool pullu
     return HAL_OK;
 }
 
-HAL_StatusTypeDef checkForOpenCircuit()
+/*
+ * Check one cell's open wire readings
+ * @return HAL_ERROR if the cell is open
+ */
+static HAL_StatusTypeDef checkOpenCircuitCell(int board, int cell, float *cell_voltages_pullup,
+                                              float *cell_voltages_pulldown)
 {
-    // Perform averaging of multiple voltage readings to account for potential
-    // bad connections to AMS boards that causes noise
-    float cell_voltages_pullup[CELLS_PER_BOARD * NUM_BOARDS] = {0};
-    float cell_voltages_pulldown[CELLS_PER_BOARD * NUM_BOARDS] = {0};
-	
-	float last_IBus = 0.0f;
-	// If we can't get it from the IBus queue, skip the check
-	bool skip_IBus_check = (getIBus(&last_IBus) != HAL_OK);
+	uint8_t cellIdx = board * CELLS_PER_BOARD + cell;
 
-    if (performOpenCircuitTestReading(cell_voltages_pullup, true /* pullup */,
-                                      NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS)
-        != HAL_OK)
-    {
-        return HAL_ERROR;
-    }
+	if (open_wire_failure[cellIdx].occurred) // PEC mismatch on this cell
+	{
+		open_wire_failure[cellIdx].occurred = false;
+		return HAL_OK;
+	}
 
-    if (performOpenCircuitTestReading(cell_voltages_pulldown, false /* pulldown */,
-                                      NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS)
-        != HAL_OK)
-    {
-        return HAL_ERROR;
-    }
+	float pullup = cell_voltages_pullup[cellIdx];
+	float pulldown = cell_voltages_pulldown[cellIdx];
 
-    float curr_IBus = 0.0f;
-	skip_IBus_check |= (getIBus(&curr_IBus) != HAL_OK);
-	if (!skip_IBus_check)
+	if (cell == 0)
 	{
-		float IBus_error = float_abs(last_IBus - curr_IBus);
-		if (IBus_error > OPEN_WIRE_IBUS_TOLERANCE_A)
+		// First cell in board
+		if (float_abs(pullup - 0) < 0.0002)
 		{
-			// Open Wire check only really works if IBus is constant
-			DEBUG_PRINT("Sharp IBus spike over > %f A, at %f A\n", OPEN_WIRE_IBUS_TOLERANCE_A, IBus_error);
-			return HAL_OK;
+			ERROR_PRINT("Cell %d open (val: %f, diff: %f < 0.0002)\n",
+			            cellIdx, pullup, float_abs(pullup - 0));
+			return HAL_ERROR;
 		}
+		return HAL_OK;
 	}
 
-    for (int board = 0; board < NUM_BOARDS; board++)
-    {
-        for (int cell = 1; cell < CELLS_PER_BOARD; cell++)
-        {
-        	uint8_t cellIdx = board * CELLS_PER_BOARD + cell;
-        	if(!open_wire_failure[cellIdx].occurred)
-			{
-				float pullup = cell_voltages_pullup[cellIdx];
-				float pulldown = cell_voltages_pulldown[cellIdx];
-				
-				if (float_abs(pullup - pulldown) > (0.4))
-				{
-					ERROR_PRINT("Cell %d open (PU: %f, PD: %f, diff: %f > 0.4)\n",
-								cellIdx, pullup, pulldown,
-								float_abs(pullup - pulldown));
-					return HAL_ERROR;
-				}
-				if(cell == CELLS_PER_BOARD - 1 && (float_abs(cell_voltages_pulldown[cellIdx] - 0) < 0.0002))
-				{	
-					ERROR_PRINT("Cell %d open (val: %f, diff: %f < 0.0002)\n",
-								cellIdx, cell_voltages_pulldown[cellIdx],
-								float_abs(cell_voltages_pulldown[cellIdx] - 0));
-					return HAL_ERROR;
-				}
-			}
-			else // PEC mismatch on this cell
+	if (float_abs(pullup - pulldown) > (0.4))
+	{
+		ERROR_PRINT("Cell %d open (PU: %f, PD: %f, diff: %f > 0.4)\n",
+		            cellIdx, pullup, pulldown,
+		            float_abs(pullup - pulldown));
+		return HAL_ERROR;
+	}
+	if (cell == CELLS_PER_BOARD - 1 && (float_abs(pulldown - 0) < 0.0002))
+	{
+		ERROR_PRINT("Cell %d open (val: %f, diff: %f < 0.0002)\n",
+		            cellIdx, pulldown, float_abs(pulldown - 0));
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+/*
+ * Run the open wire test on the next OPEN_WIRE_GROUPS_PER_CYCLE cell groups,
+ * so a full pack is covered over several calls instead of stalling one cycle
+ * for the whole test
+ */
+HAL_StatusTypeDef checkForOpenCircuit()
+{
+	static uint8_t next_cell_group = 1;
+
+	for (int slice = 0; slice < OPEN_WIRE_GROUPS_PER_CYCLE; slice++)
+	{
+		const uint8_t cell_group = next_cell_group;
+
+		// Perform averaging of multiple voltage readings to account for potential
+		// bad connections to AMS boards that causes noise
+		float cell_voltages_pullup[CELLS_PER_BOARD * NUM_BOARDS] = {0};
+		float cell_voltages_pulldown[CELLS_PER_BOARD * NUM_BOARDS] = {0};
+
+		float last_IBus = 0.0f;
+		// If we can't get it from the IBus queue, skip the check
+		bool skip_IBus_check = (getIBus(&last_IBus) != HAL_OK);
+
+		if (performOpenCircuitTestReading(cell_voltages_pullup, true /* pullup */, cell_group,
+		                                  NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS)
+		    != HAL_OK)
+		{
+			return HAL_ERROR;
+		}
+
+		if (performOpenCircuitTestReading(cell_voltages_pulldown, false /* pulldown */, cell_group,
+		                                  NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS)
+		    != HAL_OK)
+		{
+			return HAL_ERROR;
+		}
+
+		float curr_IBus = 0.0f;
+		skip_IBus_check |= (getIBus(&curr_IBus) != HAL_OK);
+		if (!skip_IBus_check)
+		{
+			float IBus_error = float_abs(last_IBus - curr_IBus);
+			if (IBus_error > OPEN_WIRE_IBUS_TOLERANCE_A)
 			{
-				open_wire_failure[cellIdx].occurred = false;
+				// Open Wire check only really works if IBus is constant,
+				// retry the same group next time
+				DEBUG_PRINT("Sharp IBus spike over > %f A, at %f A\n", OPEN_WIRE_IBUS_TOLERANCE_A, IBus_error);
+				return HAL_OK;
 			}
-        }
+		}
 
+		next_cell_group = (cell_group % OPEN_WIRE_CELL_GROUPS) + 1;
 
-		// First cell in board
-		uint8_t first_cell_idx = board*CELLS_PER_BOARD;
-        if (!open_wire_failure[first_cell_idx].occurred && (float_abs(cell_voltages_pullup[first_cell_idx] - 0) < 0.0002)) {
-                ERROR_PRINT("Cell %d open (val: %f, diff: %f < 0.0002)\n",
-                            first_cell_idx, cell_voltages_pullup[first_cell_idx],
-                            float_abs(cell_voltages_pullup[first_cell_idx] - 0));
-                return HAL_ERROR;
-        }
-		else if(open_wire_failure[first_cell_idx].occurred) // PEC mismatch on this cell
+		// LTC cell n is board cell n - 1, LTC cell n + 6 is board cell n + 4
+		const int group_cells[] = {cell_group - 1, cell_group + 4};
+		for (int board = 0; board < NUM_BOARDS; board++)
 		{
-			open_wire_failure[first_cell_idx].occurred = false;
+			for (int i = 0; i < sizeof(group_cells) / sizeof(group_cells[0]); i++)
+			{
+				if (checkOpenCircuitCell(board, group_cells[i], cell_voltages_pullup,
+				                         cell_voltages_pulldown) != HAL_OK)
+				{
+					return HAL_ERROR;
+				}
+			}
 		}
-	
-    }
+	}
 
     return HAL_OK;
 }
@@ -399,6 +554,33 @@ HAL_StatusTypeDef batt_unset_balancing_all_cells()
     return HAL_OK;
 }
 
+/*
+ * Sets the balance state of every cell and the discharge timer, then sends the
+ * config to all boards in one write. The write is skipped if the config is
+ * unchanged since it was last sent (the thermistor mux writes also send it)
+ *
+ * balance: NUM_VOLTAGE_CELLS entries, true to balance the cell
+ */
+HAL_StatusTypeDef batt_write_balancing_config(const bool *balance, DischargeTimerLength length)
+{
+    for (int cell = 0; cell < NUM_VOLTAGE_CELLS; cell++) {
+        int boardIdx = cell / CELLS_PER_BOARD;
+        int bmuCellIdx = cell % CELLS_PER_BOARD;
+
+        if (balance[cell]) {
+            batt_set_balancing_cell(boardIdx, 0, bmuCellIdx);
+        } else {
+            batt_unset_balancing_cell(boardIdx, 0, bmuCellIdx);
+        }
+    }
+
+    if (batt_set_disharge_timer(length) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    return batt_write_config_if_changed();
+}
+
 HAL_StatusTypeDef batt_set_disharge_timer(DischargeTimerLength length)
 {
     if (length >= INVALID_DT_TIME) {
@@ -149,7 +149,10 @@ int batt_spi_wakeup(bool sleeping)
 {
     if (!sleeping) {
         // The boards have been initialized, so we're in the REFUP state
-        if (xTaskGetTickCount() - lastWakeup_ticks <= pdMS_TO_TICKS(US_TO_MS(T_IDLE_US))) {
+        // The tick count can go up just after the last wakeup, so the bus may
+        // have been quiet for up to a tick more than counted. Only skip the
+        // wakeup while that is still shorter than tIDLE
+        if (xTaskGetTickCount() - lastWakeup_ticks < pdMS_TO_TICKS(US_TO_MS(T_IDLE_US))) {
             // SPI bus already up
             return 0;
         }
@@ -180,6 +183,8 @@ int batt_spi_wakeup(bool sleeping)
 			ERROR_PRINT("Failed to wakeup isospi while not asleep\n");
 			return 1;
 		}
+		// Each isoSPI port in the chain is ready tREADY after the one before it
+		delay_us(NUM_BOARDS * LTC_T_READY_US);
 	}
 
     lastWakeup_ticks = xTaskGetTickCount();
@@ -0,0 +1,161 @@
+/**
+  *****************************************************************************
+  * @file    balance_planner.c
+  * @brief   Plans balance resistor on times to reach balance quickly
+  * @details The plan is refreshed from relaxed voltage readings with
+  * @ref balancePlannerUpdate, which converts each cell's voltage to SOC
+  * through the OCV curve and sets its remaining bleed time to the charge it
+  * holds above the lowest cell divided by its bleed current. Between updates
+  * @ref balancePlannerStep counts down the time each selected cell has bled
+  * and re-selects cells, so cells stop as soon as their charge has been
+  * removed rather than at the next threshold check. A cell that is part of
+  * the plan keeps bleeding until it is within stopSocDelta, which is smaller
+  * than startSocDelta, so cells don't toggle around a single threshold.
+  *****************************************************************************
+  */
+
+#include "balance_planner.h"
+#include <stddef.h>
+
+void balancePlannerInit(BalancePlanner_t *planner, const BalancePlanner_Params_t *params)
+{
+    planner->params = *params;
+    if (planner->params.numCells > BALANCE_PLANNER_MAX_CELLS)
+    {
+        planner->params.numCells = BALANCE_PLANNER_MAX_CELLS;
+    }
+
+    for (uint32_t cell = 0; cell < BALANCE_PLANNER_MAX_CELLS; cell++)
+    {
+        planner->remaining_s[cell] = 0.0f;
+        planner->bleedPower_W[cell] = 0.0f;
+        planner->bleeding[cell] = false;
+    }
+    planner->predictedTimeToBalance_s = 0.0f;
+}
+
+/**
+ * @brief Re-plan from a set of relaxed (not bleeding) cell voltages
+ *
+ * @param cellVoltage Voltage of each cell, params.numCells long
+ */
+void balancePlannerUpdate(BalancePlanner_t *planner, const float cellVoltage[])
+{
+    const BalancePlanner_Params_t *p = &planner->params;
+    float minSoc = 1.0f;
+
+    for (uint32_t cell = 0; cell < p->numCells; cell++)
+    {
+        float soc = ocvLutOcvToSoc(cellVoltage[cell]);
+        minSoc = soc < minSoc ? soc : minSoc;
+    }
+
+    for (uint32_t cell = 0; cell < p->numCells; cell++)
+    {
+        float excess = ocvLutOcvToSoc(cellVoltage[cell]) - minSoc;
+        float bleedCurrent = cellVoltage[cell] / p->bleedResistance_ohms;
+        bool planned = planner->remaining_s[cell] > 0.0f;
+
+        planner->bleedPower_W[cell] = cellVoltage[cell] * bleedCurrent;
+
+        if (excess > p->startSocDelta || (planned && excess > p->stopSocDelta))
+        {
+            planner->remaining_s[cell] = excess * p->capacity_As / bleedCurrent;
+        }
+        else
+        {
+            planner->remaining_s[cell] = 0.0f;
+        }
+    }
+}
+
+/**
+ * @brief Account for elapsed bleed time and choose the cells to bleed for the
+ * next period
+ *
+ * @param elapsed_s Time since the last step, during which the previously
+ * selected cells were bleeding
+ * @param maxCellTemp Hottest cell temperature, C
+ */
+void balancePlannerStep(BalancePlanner_t *planner, float elapsed_s, float maxCellTemp)
+{
+    const BalancePlanner_Params_t *p = &planner->params;
+    bool blocked = maxCellTemp >= p->maxTemp_C;
+    float predicted = 0.0f;
+
+    for (uint32_t cell = 0; cell < p->numCells; cell++)
+    {
+        if (planner->bleeding[cell])
+        {
+            planner->remaining_s[cell] -= elapsed_s;
+            planner->remaining_s[cell] = planner->remaining_s[cell] < 0.0f ? 0.0f : planner->remaining_s[cell];
+        }
+        planner->bleeding[cell] = false;
+    }
+
+    for (uint32_t boardStart = 0; boardStart < p->numCells; boardStart += p->cellsPerBoard)
+    {
+        uint32_t boardEnd = boardStart + p->cellsPerBoard;
+        boardEnd = boardEnd > p->numCells ? p->numCells : boardEnd;
+
+        float boardPower = 0.0f;
+        float boardTotal_s = 0.0f;
+        float boardLongest_s = 0.0f;
+        uint32_t slots = 0;
+
+        // Longest remaining first, until the board's dissipation budget is used
+        while (!blocked)
+        {
+            int32_t longest = -1;
+            for (uint32_t cell = boardStart; cell < boardEnd; cell++)
+            {
+                if (!planner->bleeding[cell] && planner->remaining_s[cell] > 0.0f &&
+                    (longest < 0 || planner->remaining_s[cell] > planner->remaining_s[longest]))
+                {
+                    longest = cell;
+                }
+            }
+            if (longest < 0 || boardPower + planner->bleedPower_W[longest] > p->maxBoardPower_W)
+            {
+                break;
+            }
+            planner->bleeding[longest] = true;
+            boardPower += planner->bleedPower_W[longest];
+            slots++;
+        }
+
+        for (uint32_t cell = boardStart; cell < boardEnd; cell++)
+        {
+            boardTotal_s += planner->remaining_s[cell];
+            boardLongest_s = planner->remaining_s[cell] > boardLongest_s ? planner->remaining_s[cell] : boardLongest_s;
+        }
+
+        if (boardTotal_s > 0.0f)
+        {
+            if (slots == 0)
+            {
+                predicted = -1.0f;
+                break;
+            }
+            // Can't finish before the longest cell, or before the total work
+            // shared across the resistors that can be on at once
+            float boardTime_s = boardTotal_s / slots;
+            boardTime_s = boardLongest_s > boardTime_s ? boardLongest_s : boardTime_s;
+            predicted = boardTime_s > predicted ? boardTime_s : predicted;
+        }
+    }
+
+    planner->predictedTimeToBalance_s = predicted;
+}
+
+bool balancePlannerIsBalanced(const BalancePlanner_t *planner)
+{
+    for (uint32_t cell = 0; cell < planner->params.numCells; cell++)
+    {
+        if (planner->remaining_s[cell] > 0.0f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -32,6 +32,16 @@
 #include "canReceive.h"
 #include "chargerControl.h"
 #include "state_of_charge.h"
+#include "state_of_power.h"
+#include "balance_planner.h"
+#include "charge_profile.h"
+#include "current_filter.h"
+#include "hv_adc_stream.h"
+#include "pack_voltage_check.h"
+#include "thermal_estimator.h"
+#include "cell_history.h"
+#include "cell_broadcast.h"
+#include "fanControl.h"
 #include "sense.h"
 
 /*
@@ -44,6 +54,8 @@
 #include "ltc_chip_interface.h"
 #include "ade7913.h"
 #include "imdDriver.h"
+#include "hvAdcDriver.h"
+#include "cycleClock.h"
 #endif
 
 
@@ -57,6 +69,10 @@
 #define ENABLE_CHARGER
 #define ENABLE_BALANCE
 
+#define W_TO_KW (1.0f/1000.0f)
+/// Max value of the StateBatteryPowerHV CAN signal
+#define STATE_BATTERY_POWER_HV_MAX (409.5f)
+
 
 extern osThreadId BatteryTaskHandle;
 
@@ -81,6 +97,8 @@ volatile float limit_undervoltage = DEFAULT_LIMIT_UNDERVOLTAGE;
  * voltage increases above high temperature warning limit
  */
 bool warningSentForChannelTemp[NUM_TEMP_CELLS];
+/// Set when a channel's thermistor failed warning is sent, reset when it works again
+bool warningSentForThermistorFailed[NUM_TEMP_CELLS];
 
 #define NUM_SOC_LOOKUP_VALS 101
 
@@ -102,17 +120,16 @@ float voltageToSOCLookup[NUM_SOC_LOOKUP_VALS] = {
 /*
  * HV Measure task Defines and Variables
  */
-#define HV_MEASURE_TASK_PERIOD_MS 1
+/// HV ADC output period, samples are handled in blocks once per task period
+#define HV_MEASURE_SAMPLE_PERIOD_MS 1
+#define HV_MEASURE_SAMPLES_PER_WAKE 5
+#define HV_MEASURE_TASK_PERIOD_MS (HV_MEASURE_SAMPLE_PERIOD_MS * HV_MEASURE_SAMPLES_PER_WAKE)
 #define HV_MEASURE_TASK_ID 4
 #define STATE_BUS_HV_CAN_SEND_PERIOD_MS 100
 static uint32_t StateBusHVSendPeriod = STATE_BUS_HV_CAN_SEND_PERIOD_MS;
 
-/// Queue holding most recent bus current measurement
-QueueHandle_t IBusQueue;
-/// Queue holding most recent bus volage measurement
-QueueHandle_t VBusQueue;
-/// Queue holding most recent battery voltage measurement
-QueueHandle_t VBattQueue;
+/// Most recent bus current, bus voltage and battery voltage measurements
+static HVBusSnapshot_t HVBusSnapshot;
 /// Queue holding most recent battery  voltage (calculated from sum of cell voltages) measurement
 QueueHandle_t PackVoltageQueue;
 /// Queue holding most recent adjusted pack voltage (calculated from sum of filtered and adjusted cell voltages) measurement
@@ -140,108 +157,115 @@ extern osThreadId stateOfChargeHandle;
 #define CELL_FILTER_ALPHA 0.05 
 
 /**
- * @brief Low pass filters the HV Bus current measurement
- * @param[in] IBus the measured HV Bus current
- * @return The filtered HV Bus current
+ * HV Bus current filter. The fast output is published as IBus for the
+ * overcurrent and precharge checks, the slow output is used for coulomb
+ * counting and sent over CAN (see current_filter.c)
  */
-
-#define IBUS_HISTORY_SIZE 100
-static float IBusHistory[IBUS_HISTORY_SIZE];
-
-float filterIBus(float IBus)
-{
-    static uint8_t filterIndex = 0U;
-    static float runningIBusHistorySum = 0.0f;
-
-    runningIBusHistorySum -= IBusHistory[filterIndex];
-    IBusHistory[filterIndex] = IBus;
-    runningIBusHistorySum += IBus;
-    filterIndex = (filterIndex + 1) % IBUS_HISTORY_SIZE;
-
-    return runningIBusHistorySum / IBUS_HISTORY_SIZE;
-}
+static CurrentFilter_t IBusFilter;
 
 /**
- * @brief Creates queues for HV Bus measurements
- * Queue overwrite, Queue peek, and queue size of 1 is used to ensure only the most recent
- * data is in the queue and read from the queue. Queues use Amps and Volts for
- * units
+ * @brief Initializes the snapshot holding the most recent HV Bus
+ * measurements. Measurements use Amps and Volts for units
  */
-HAL_StatusTypeDef initBusVoltagesAndCurrentQueues()
+HAL_StatusTypeDef initBusVoltagesAndCurrentSnapshot()
 {
-   IBusQueue = xQueueCreate(1, sizeof(float));
-   VBusQueue = xQueueCreate(1, sizeof(float));
-   VBattQueue = xQueueCreate(1, sizeof(float));
-
-   if (IBusQueue == NULL || VBusQueue == NULL || VBattQueue == NULL) {
-      ERROR_PRINT("Failed to create bus voltages and current queues!\n");
-      return HAL_ERROR;
-   }
+   hvBusSnapshotInit(&HVBusSnapshot);
 
    return HAL_OK;
 }
 
 /**
- * @brief Publishes the most recent HV Bus measurements to queues for other
- * tasks to read from Queue overwrite, Queue peek, and queue size of 1 is used
- * to ensure only the most recent data is in the queue and read from the queue
+ * @brief Publishes the most recent HV Bus measurements for other tasks to
+ * read. The snapshot doesn't support concurrent writers (see
+ * hv_bus_snapshot.c), so the CLI setters publish from a critical section
  *
  * @param[in] pIBus pointer to the HV bus current measurement (in Amps)
  * @param[in] pVBus pointer to the HV bus voltage measurement (in Volts)
  * @param[in] pVBatt pointer to the HV battery voltage measurement (in Volts)
+ * @param[in] timestamp tick count when the measurements were taken
  *
  * @return HAL_StatusTypeDef
  */
-HAL_StatusTypeDef publishBusVoltagesAndCurrent(float *pIBus, float *pVBus, float *pVBatt)
+HAL_StatusTypeDef publishBusVoltagesAndCurrent(float *pIBus, float *pVBus, float *pVBatt, uint32_t timestamp)
 {
-   xQueueOverwrite(IBusQueue, pIBus);
-   xQueueOverwrite(VBusQueue, pVBus);
-   xQueueOverwrite(VBattQueue, pVBatt);
+   HVBusMeasurements_t measurements = {
+      .IBus = *pIBus,
+      .VBus = *pVBus,
+      .VBatt = *pVBatt,
+      .timestamp = timestamp,
+   };
+
+   hvBusSnapshotWrite(&HVBusSnapshot, &measurements);
 
    return HAL_OK;
 }
 
 /**
- * @brief Measures HV voltages and currents using the HV ADC
+ * @brief Takes the HV voltage and current samples waiting since the last
+ * call. On the F7 these were streamed from the HV ADC (see hvAdcDriver.c),
+ * each with its own time stamp
  *
- * @param[out] IBus pointer to the HV bus current measurement (in Amps)
- * @param[out] VBus pointer to the HV bus voltage measurement (in Volts)
- * @param[out] VBatt pointer to the HV battery voltage measurement (in Volts)
+ * @param[out] IBus unfiltered HV bus current samples (in Amps)
+ * @param[out] VBus HV bus voltage samples (in Volts)
+ * @param[out] VBatt HV battery voltage samples (in Volts)
+ * @param[out] timestamp tick count when the last sample was taken
  *
- * @return HAL_StatusTypeDef
+ * @return Number of samples, at most HV_ADC_STREAM_SIZE
  */
-HAL_StatusTypeDef readBusVoltagesAndCurrents(float *IBus, float *VBus, float *VBatt)
+static uint32_t readBusVoltagesAndCurrents(float IBus[], float VBus[], float VBatt[], uint32_t *timestamp)
 {
 #if IS_BOARD_F7 && defined(ENABLE_HV_MEASURE)
-   float IBusTmp = 0.0f; //(0.29*brakeAndHallAdcVals[BRAKE_HALL_ADC_CHANNEL_HALL]) - 41.926;
-   
-// TODO: Revert back to use shunt over hall once the lid is fixed
-   if (adc_read_current(&IBusTmp) != HAL_OK) {
-      ERROR_PRINT("Error reading IBUS\n");
-      return HAL_ERROR;
-   }
-   
-    (*IBus) = filterIBus(IBusTmp);
-    
-   if (adc_read_v1(VBatt) != HAL_OK) {
-      ERROR_PRINT("Error reading VBUS\n");
-      return HAL_ERROR;
+   HvAdcSample_t sample = {0};
+   uint32_t count = 0;
+   while (count < HV_ADC_STREAM_SIZE && hv_adc_stream_pop(&sample)) {
+      // TODO: Revert back to use shunt over hall once the lid is fixed
+      IBus[count] = hv_adc_to_current(sample.current);
+      VBatt[count] = hv_adc_to_v1(sample.v1);
+      VBus[count] = hv_adc_to_v2(sample.v2);
+      count++;
    }
-   if (adc_read_v2(VBus) != HAL_OK) {
-      ERROR_PRINT("Error reading VBatt\n");
-      return HAL_ERROR;
+   if (count > 0) {
+      const uint32_t age_us = cycleClockMicros() - sample.timestamp_us;
+      *timestamp = xTaskGetTickCount() - pdMS_TO_TICKS(age_us / 1000);
    }
-   return HAL_OK;
+   return count;
 
 #elif IS_BOARD_NUCLEO_F7 || !defined(ENABLE_HV_MEASURE)
    // For nucleo, voltages and current can be manually changed via CLI for
-   // testing, so we don't do anything here
-   return HAL_OK;
+   // testing, so just repeat the values last set as a block of samples
+   HVBusMeasurements_t measurements = {0};
+   getHVBusMeasurements(&measurements);
+   for (uint32_t i = 0; i < HV_MEASURE_SAMPLES_PER_WAKE; i++) {
+      IBus[i] = measurements.IBus;
+      VBus[i] = measurements.VBus;
+      VBatt[i] = measurements.VBatt;
+   }
+   *timestamp = xTaskGetTickCount();
+   return HV_MEASURE_SAMPLES_PER_WAKE;
 #else
 #error Unsupported board type
 #endif
 }
 
+/**
+ * @brief Get the most recent HV Bus measurements. The current and voltages
+ * are from the same HV measure task cycle
+ *
+ * @param[out] measurements pointer to store the measurements and the tick
+ * count they were taken at
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef getHVBusMeasurements(HVBusMeasurements_t *measurements)
+{
+    if (!hvBusSnapshotRead(&HVBusSnapshot, measurements)) {
+        ERROR_PRINT("Failed to read HV bus measurements\n");
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+}
+
 /**
  * @brief Get the most recent bus current reading
  *
@@ -251,10 +275,12 @@ HAL_StatusTypeDef readBusVoltagesAndCurrents(float *IBus, float *VBus, float *VB
  */
 HAL_StatusTypeDef getIBus(float *IBus)
 {
-    if (xQueuePeek(IBusQueue, IBus, 0) != pdTRUE) {
-        ERROR_PRINT("Failed to receive IBus current from queue\n");
+    HVBusMeasurements_t measurements;
+
+    if (getHVBusMeasurements(&measurements) != HAL_OK) {
         return HAL_ERROR;
     }
+    (*IBus) = measurements.IBus;
 
     return HAL_OK;
 }
@@ -270,10 +296,12 @@ HAL_StatusTypeDef getIBus(float *IBus)
  */
 HAL_StatusTypeDef getVBatt(float *VBatt)
 {
-    if (xQueuePeek(VBattQueue, VBatt, 0) != pdTRUE) {
-        ERROR_PRINT("Failed to receive VBatt voltage from queue\n");
+    HVBusMeasurements_t measurements;
+
+    if (getHVBusMeasurements(&measurements) != HAL_OK) {
         return HAL_ERROR;
     }
+    (*VBatt) = measurements.VBatt;
 
     return HAL_OK;
 }
@@ -287,10 +315,12 @@ HAL_StatusTypeDef getVBatt(float *VBatt)
  */
 HAL_StatusTypeDef getVBus(float * VBus)
 {
-    if (xQueuePeek(VBusQueue, VBus, 0) != pdTRUE) {
-        ERROR_PRINT("Failed to receive VBus voltage from queue\n");
+    HVBusMeasurements_t measurements;
+
+    if (getHVBusMeasurements(&measurements) != HAL_OK) {
         return HAL_ERROR;
     }
+    (*VBus) = measurements.VBus;
 
     return HAL_OK;
 }
@@ -305,7 +335,15 @@ HAL_StatusTypeDef getVBus(float * VBus)
  */
 HAL_StatusTypeDef cliSetVBatt(float VBatt)
 {
-   xQueueOverwrite(VBattQueue, &VBatt);
+   HVBusMeasurements_t measurements = {0};
+
+   // Critical section as the HV measure task also publishes
+   taskENTER_CRITICAL();
+   hvBusSnapshotRead(&HVBusSnapshot, &measurements);
+   measurements.VBatt = VBatt;
+   measurements.timestamp = xTaskGetTickCount();
+   hvBusSnapshotWrite(&HVBusSnapshot, &measurements);
+   taskEXIT_CRITICAL();
 
    return HAL_OK;
 }
@@ -320,7 +358,15 @@ HAL_StatusTypeDef cliSetVBatt(float VBatt)
  */
 HAL_StatusTypeDef cliSetVBus(float VBus)
 {
-   xQueueOverwrite(VBusQueue, &VBus);
+   HVBusMeasurements_t measurements = {0};
+
+   // Critical section as the HV measure task also publishes
+   taskENTER_CRITICAL();
+   hvBusSnapshotRead(&HVBusSnapshot, &measurements);
+   measurements.VBus = VBus;
+   measurements.timestamp = xTaskGetTickCount();
+   hvBusSnapshotWrite(&HVBusSnapshot, &measurements);
+   taskEXIT_CRITICAL();
 
    return HAL_OK;
 }
@@ -335,7 +381,15 @@ HAL_StatusTypeDef cliSetVBus(float VBus)
  */
 HAL_StatusTypeDef cliSetIBus(float IBus)
 {
-   xQueueOverwrite(IBusQueue, &IBus);
+   HVBusMeasurements_t measurements = {0};
+
+   // Critical section as the HV measure task also publishes
+   taskENTER_CRITICAL();
+   hvBusSnapshotRead(&HVBusSnapshot, &measurements);
+   measurements.IBus = IBus;
+   measurements.timestamp = xTaskGetTickCount();
+   hvBusSnapshotWrite(&HVBusSnapshot, &measurements);
+   taskEXIT_CRITICAL();
 
    return HAL_OK;
 }
@@ -375,6 +429,12 @@ void HVMeasureTask(void *pvParamaters)
     {
        ERROR_PRINT("Failed to init HV ADC\n");
     }
+#if defined(ENABLE_HV_MEASURE)
+    else if (hv_adc_stream_start(HV_MEASURE_SAMPLES_PER_WAKE) != HAL_OK)
+    {
+       ERROR_PRINT("Failed to start HV ADC streaming\n");
+    }
+#endif
 #endif
 
     if (registerTaskToWatch(HV_MEASURE_TASK_ID, 5*pdMS_TO_TICKS(HV_MEASURE_TASK_PERIOD_MS), false, NULL) != HAL_OK)
@@ -385,35 +445,62 @@ void HVMeasureTask(void *pvParamaters)
 
     uint32_t lastStateBusHVSend = 0;
 
-    float VBus;
-    float VBatt;
-    float IBus;
+    CurrentFilter_Params_t IBusFilterParams;
+    currentFilterDefaultParams(&IBusFilterParams);
+    IBusFilterParams.sampleRate_Hz = 1000.0f / HV_MEASURE_SAMPLE_PERIOD_MS;
+    currentFilterInit(&IBusFilter, &IBusFilterParams);
+
+    // Static to keep them off the task stack, a late wake up can find the
+    // whole stream buffer waiting
+    static float VBus[HV_ADC_STREAM_SIZE];
+    static float VBatt[HV_ADC_STREAM_SIZE];
+    static float IBus[HV_ADC_STREAM_SIZE];
+    uint32_t timestamp = 0;
+#if !(IS_BOARD_F7 && defined(ENABLE_HV_MEASURE))
     TickType_t xLastWakeTime = xTaskGetTickCount();
+#endif
     while (1) {
-        if (readBusVoltagesAndCurrents(&IBus, &VBus, &VBatt) != HAL_OK) {
-            ERROR_PRINT("Failed to read bus voltages and current!\n");
+#if IS_BOARD_F7 && defined(ENABLE_HV_MEASURE)
+        // Woken by the ADC once a block of samples is waiting, the timeout
+        // only passes if it stops
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(2 * HV_MEASURE_TASK_PERIOD_MS)) == 0) {
+            ERROR_PRINT("HV ADC samples late\n");
         }
+#else
+        vTaskDelayUntil(&xLastWakeTime, HV_MEASURE_TASK_PERIOD_MS);
+#endif
 
-        if (publishBusVoltagesAndCurrent(&IBus, &VBus, &VBatt) != HAL_OK) {
-            ERROR_PRINT("Failed to publish bus voltages and current!\n");
+        // The filter runs at the ADC rate, every sample is stepped and only
+        // the last is published
+        const uint32_t count = readBusVoltagesAndCurrents(IBus, VBus, VBatt, &timestamp);
+        for (uint32_t i = 0; i < count; i++) {
+            if (currentFilterStep(&IBusFilter, IBus[i])) {
+                integrate_bus_current(IBusFilter.slow,
+                                      (float)(HV_MEASURE_SAMPLE_PERIOD_MS * IBusFilter.params.cicDecimation));
+            }
+        }
+        if (count > 0) {
+            float IBusFast = IBusFilter.fast;
+            if (publishBusVoltagesAndCurrent(&IBusFast, &VBus[count - 1], &VBatt[count - 1], timestamp) != HAL_OK) {
+                ERROR_PRINT("Failed to publish bus voltages and current!\n");
+            }
         }
-
 
         if (xTaskGetTickCount() - lastStateBusHVSend
             > pdMS_TO_TICKS(StateBusHVSendPeriod))
         {
-            CurrentBusHV = IBus;
-            VoltageBusHV = VBus;
+            HVBusMeasurements_t measurements = {0};
+            getHVBusMeasurements(&measurements);
+            CurrentBusHV = IBusFilter.slow;
+            VoltageBusHV = measurements.VBus;
             sendCAN_BMU_stateBusHV();
             vTaskDelay(2); // Added to prevent CAN mailbox full
             getAdjustedPackVoltage((float*)&AMS_PackVoltage);
             sendCAN_BMU_AmsVBatt();
             lastStateBusHVSend = xTaskGetTickCount();
         }
-        integrate_bus_current(IBus, (float)HV_MEASURE_TASK_PERIOD_MS);
-    
+
         watchdogTaskCheckIn(HV_MEASURE_TASK_ID);
-        vTaskDelayUntil(&xLastWakeTime, HV_MEASURE_TASK_PERIOD_MS);
     }
 }
 
@@ -421,9 +508,33 @@ void HVMeasureTask(void *pvParamaters)
  * IMD
  */
 
+#if IS_BOARD_F7 && defined(ENABLE_IMD)
+/**
+ * @brief Sends the decoded IMD PWM and its statistics
+ */
+static void sendImdStatus(IMDStatus imdStatus)
+{
+   ImdDecoder_t decoder;
+   get_imd_decoder(&decoder);
+
+   ImdFrequency = decoder.valid ? decoder.frequency_Hz : 0.0f;
+   ImdDutyCycle = decoder.valid ? decoder.duty_percent : 0.0f;
+   // Saturates, infinite (no measurement) is sent as the max
+   ImdInsulationResistance = (decoder.resistance_kOhms < 16383.0f) ? (uint32_t)decoder.resistance_kOhms : 16383;
+   ImdDecodedStatus = imdStatus;
+   ImdOutlierCount = decoder.outliers > 255 ? 255 : decoder.outliers;
+   ImdTimeToValid = decoder.timeToValid_ms / 1000.0f;
+
+   if (sendCAN_BMU_ImdStatus() != HAL_OK) {
+      ERROR_PRINT("Failed to send IMD status\n");
+   }
+}
+#endif
+
 /**
  * @brief Monitors the Insulation Monitoring Device (IMD). Raises error if IMD
- * reports fault
+ * reports fault. Woken early by the capture interrupt when the decoded IMD
+ * PWM band changes
  */
 void imdTask(void *pvParamaters)
 {
@@ -494,8 +605,15 @@ void imdTask(void *pvParamaters)
          fsmSendEventUrgentISR(&fsmHandle, EV_HV_Fault);
       }
 
+      sendImdStatus(imdStatus);
+
       watchdogTaskCheckIn(IMD_TASK_ID);
-      vTaskDelayUntil(&xLastWakeTime, IMD_TASK_PERIOD_MS);
+      // Wait out the rest of the period, or until the decoded band changes
+      TickType_t elapsed = xTaskGetTickCount() - xLastWakeTime;
+      if (elapsed < pdMS_TO_TICKS(IMD_TASK_PERIOD_MS)) {
+         ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IMD_TASK_PERIOD_MS) - elapsed);
+      }
+      xLastWakeTime = xTaskGetTickCount();
    }
 #else
    // Notify control fsm that IMD is ready
@@ -512,6 +630,128 @@ void imdTask(void *pvParamaters)
  */
 
 
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+/**
+ * @brief Selects the LTC ADC mode for the state, trading conversion time for
+ * noise. The conversion waits are derived from the selected mode.
+ */
+static void selectCellAdcMode(BMU_States_t state)
+{
+   ltc_adc_mode_t mode;
+
+   switch (state) {
+      case STATE_HV_Enable:
+      case STATE_Precharge:
+         mode = CELL_ADC_MODE_DRIVE;
+         break;
+      case STATE_Charging:
+         mode = CELL_ADC_MODE_CHARGE;
+         break;
+      case STATE_Balancing:
+         mode = CELL_ADC_MODE_BALANCE;
+         break;
+      default:
+         mode = CELL_ADC_MODE_IDLE;
+         break;
+   }
+
+   if (mode != batt_get_adc_mode()) {
+      DEBUG_PRINT("LTC ADC mode %d\n", mode);
+      batt_set_adc_mode(mode);
+   }
+   LtcAdcMode = batt_get_adc_mode();
+}
+#endif
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+static ThermalEstimator_t thermalEstimator;
+
+void initThermalEstimator(void)
+{
+   ThermalEstimator_Params_t params = {
+      .numChannels = NUM_TEMP_CELLS,
+      .channelsPerSegment = THERMISTORS_PER_SEGMENT,
+      .heatingResistance_ohms = THERMAL_HEATING_R,
+      .heatCapacity_JperK = THERMAL_HEAT_CAPACITY,
+      .coolingFanOff_WperK = THERMAL_COOLING_FAN_OFF,
+      .coolingFanFull_WperK = THERMAL_COOLING_FAN_FULL,
+      .neighbourCoupling_WperK = THERMAL_NEIGHBOUR_COUPLING,
+      .processNoise_K2ps = THERMAL_PROCESS_NOISE,
+      .neighbourNoise_K2 = THERMAL_NEIGHBOUR_NOISE,
+      .sensorNoise_K2 = THERMAL_SENSOR_NOISE,
+      .minValid_C = THERMAL_MIN_VALID_C,
+      .maxValid_C = THERMAL_MAX_VALID_C,
+   };
+   thermalEstimatorInit(&thermalEstimator, &params);
+}
+
+/*
+ * Step the thermal estimator with the latest thermistor readings, filling in
+ * the channels whose thermistor has failed
+ */
+static void updateThermalEstimate(void)
+{
+   static uint32_t lastUpdate_ticks = 0;
+   float IBus = 0.0f;
+
+   if (getIBus(&IBus) != HAL_OK) {
+      IBus = 0.0f;
+   }
+
+   const uint32_t now = xTaskGetTickCount();
+   const float dt_s = (lastUpdate_ticks == 0) ? 0.0f
+                      : (float)(now - lastUpdate_ticks) / configTICK_RATE_HZ;
+   lastUpdate_ticks = now;
+
+   uint32_t numFailedBefore = thermalEstimator.numFailed;
+   thermalEstimatorStep(&thermalEstimator, (float *)TempChannel, IBus, getFanDuty(), dt_s);
+   if (thermalEstimator.numFailed > numFailedBefore) {
+      ERROR_PRINT("%lu thermistors failed, using estimated temperatures\n",
+                  thermalEstimator.numFailed);
+   }
+}
+#endif
+
+static CellHistory_t cellHistory;
+/// Cell limit exceeded on the last check, the history is frozen with it on a battery error
+static CellHistoryFreezeReason_t cellLimitExceeded = CELL_HISTORY_REASON_BATTERY_ERROR;
+// Set from the CLI, carried out by the battery task so they don't race recording
+static volatile bool cellHistoryClearRequested = false;
+static volatile bool cellHistorySendRequested = false;
+/// Next frame and block of the cell history to send, frame is -1 once all sent
+static int32_t cellHistorySendFrame = 0;
+static uint32_t cellHistorySendBlock = 0;
+
+static void serviceCellHistoryRequests(void)
+{
+   if (cellHistoryClearRequested) {
+      cellHistoryClear(&cellHistory);
+      cellHistoryClearRequested = false;
+      cellHistorySendRequested = true;
+   }
+   if (cellHistorySendRequested) {
+      cellHistorySendFrame = 0;
+      cellHistorySendBlock = 0;
+      cellHistorySendRequested = false;
+   }
+}
+
+/**
+ * @brief Record the latest cell voltages and temperatures in the post-mortem
+ * history, unless it's frozen
+ */
+static void recordCellHistory(void)
+{
+   serviceCellHistoryRequests();
+
+   float IBus = 0.0f;
+   if (getIBus(&IBus) != HAL_OK) {
+      IBus = 0.0f;
+   }
+   cellHistoryRecord(&cellHistory, (float *)VoltageCell, (float *)TempChannel, IBus,
+                     fsmGetState(&fsmHandle), xTaskGetTickCount());
+}
+
 /**
  * @brief Reads the cell voltages and temperatures from the AMS boards. The
  * battery temperature and cell voltages are stored in the global arrays which
@@ -522,10 +762,17 @@ void imdTask(void *pvParamaters)
 HAL_StatusTypeDef readCellVoltagesAndTemps()
 {
 #if IS_BOARD_F7 && defined(ENABLE_AMS)
-   return batt_read_cell_voltages_and_temps((float *)VoltageCell, (float *)TempChannel);
+   selectCellAdcMode(fsmGetState(&fsmHandle));
+   HAL_StatusTypeDef rc = batt_read_cell_voltages_and_temps((float *)VoltageCell, (float *)TempChannel);
+   if (rc == HAL_OK) {
+      updateThermalEstimate();
+      recordCellHistory();
+   }
+   return rc;
 #elif IS_BOARD_NUCLEO_F7 || !defined(ENABLE_AMS)
    // For nucleo, cell voltages and temps can be manually changed via CLI for
    // testing, so we don't do anything here
+   recordCellHistory();
    return HAL_OK;
 #else
 #error Unsupported board type
@@ -580,12 +827,8 @@ HAL_StatusTypeDef initVoltageAndTempArrays()
    {
       TempChannel[i] = initTemp;
       warningSentForChannelTemp[i] = false;
+      warningSentForThermistorFailed[i] = false;
    }
-   for (int i=0; i < IBUS_HISTORY_SIZE; ++i)
-   {
-        IBusHistory[i] = 0.0f;
-   }
-
    return HAL_OK;
 }
 
@@ -603,15 +846,107 @@ void BatteryTaskError()
     AMS_CONT_OPEN;
 #endif
     fsmSendEventUrgent(&fsmHandle, EV_HV_Fault, pdMS_TO_TICKS(500));
+    // Keep the cell data leading up to the error
+    cellHistoryFreeze(&cellHistory, cellLimitExceeded);
     TickType_t xLastWakeTime = xTaskGetTickCount();
     while (1) {
         // Suspend this task while still updating watchdog
         watchdogTaskCheckIn(BATTERY_TASK_ID);
+        sendCellHistory();
         vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(BATTERY_TASK_PERIOD_MS));
     }
 }
 
 
+/**
+ * @brief Start sending the frozen cell history over CAN from the oldest frame
+ */
+void restartCellHistorySend(void)
+{
+   cellHistorySendRequested = true;
+}
+
+/**
+ * @brief Send the next few messages of the frozen cell history. Each frame
+ * is a header block (IBus, state and freeze reason, time before the freeze)
+ * then blocks of three values, the cell voltages in mV followed by the
+ * channel temperatures in 0.01 C. Nothing is sent until the history is
+ * frozen, and each freeze is sent once (see @ref restartCellHistorySend)
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef sendCellHistory(void)
+{
+   static float voltages[CELL_HISTORY_MAX_CELLS];
+   static float temps[CELL_HISTORY_MAX_TEMPS];
+   static float IBus;
+   static uint8_t state;
+   static uint32_t tick;
+   const uint32_t numValues = cellHistory.numCells + cellHistory.numTemps;
+   const uint32_t numBlocks = 1 + (numValues + 2) / 3;
+
+   serviceCellHistoryRequests();
+   if (!cellHistory.frozen) {
+      return HAL_OK;
+   }
+
+   for (int msg = 0; msg < CELL_HISTORY_CAN_MSGS_PER_CYCLE; msg++) {
+      if (cellHistorySendFrame < 0 || cellHistorySendFrame >= (int32_t)cellHistoryNumFrames(&cellHistory)) {
+         cellHistorySendFrame = -1;
+         return HAL_OK;
+      }
+
+      CellHistoryFrame = cellHistorySendFrame;
+      CellHistoryBlock = cellHistorySendBlock;
+      if (cellHistorySendBlock == 0) {
+         cellHistoryGetFrame(&cellHistory, cellHistorySendFrame, voltages, temps, &IBus, &state, &tick);
+         CellHistoryValue1 = lroundf(IBus * 10.0f);
+         CellHistoryValue2 = state | (cellHistory.freezeReason << 8);
+         CellHistoryValue3 = -(int32_t)((cellHistory.freezeTick - tick) * portTICK_PERIOD_MS);
+      } else {
+         volatile int64_t *values[3] = {&CellHistoryValue1, &CellHistoryValue2, &CellHistoryValue3};
+         for (uint32_t i = 0; i < 3; i++) {
+            uint32_t idx = (cellHistorySendBlock - 1) * 3 + i;
+            if (idx < cellHistory.numCells) {
+               *values[i] = lroundf(voltages[idx] * 1000.0f);
+            } else if (idx < numValues) {
+               *values[i] = lroundf(temps[idx - cellHistory.numCells] * 100.0f);
+            } else {
+               *values[i] = 0;
+            }
+         }
+      }
+
+      if (sendCAN_BMU_CellHistory() != HAL_OK) {
+         return HAL_ERROR;
+      }
+
+      cellHistorySendBlock++;
+      if (cellHistorySendBlock >= numBlocks) {
+         cellHistorySendBlock = 0;
+         cellHistorySendFrame++;
+      }
+   }
+   return HAL_OK;
+}
+
+/**
+ * @brief Get the post-mortem cell history, for printing over the CLI
+ */
+const CellHistory_t *getCellHistory(void)
+{
+   return &cellHistory;
+}
+
+/**
+ * @brief Drop the frozen cell history and start recording again, on the
+ * battery task's next cycle
+ */
+void clearCellHistory(void)
+{
+   cellHistoryClearRequested = true;
+}
+
 /// Maximum number of errors battery task can encounter before reporting error
 #define MAX_ERROR_COUNT 5
 
@@ -711,7 +1046,6 @@ void filterCellVoltages(float *cellVoltages, float *cellVoltagesFiltered)
 HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage, float *maxTemp, float *minTemp, float *packVoltage, float* adjustedPackVoltage)
 {
    HAL_StatusTypeDef rc = HAL_OK;
-   float measure;
    float measure_high;
    float measure_low;
    
@@ -727,6 +1061,7 @@ HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage
    enterAdjustedCellVoltages();
 
    static bool warning_dtc_sent = false;
+   cellLimitExceeded = CELL_HISTORY_REASON_BATTERY_ERROR;
    for (int i=0; i < NUM_VOLTAGE_CELLS; i++)
    {
       // We have 2 basically confidence measurements
@@ -739,10 +1074,12 @@ HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage
       if (measure_high < limit_undervoltage) {
          ERROR_PRINT("Cell %d is undervoltage at %f Volts\n", i, measure_high);
          sendDTC_CRITICAL_CELL_VOLTAGE_LOW(i);
+         cellLimitExceeded = CELL_HISTORY_REASON_UNDERVOLTAGE;
          rc = HAL_ERROR;
       } else if (measure_low > limit_overvoltage) {
          ERROR_PRINT("Cell %d is overvoltage at %f Volts\n", i, measure_low);
          sendDTC_CRITICAL_CELL_VOLTAGE_HIGH(i);
+         cellLimitExceeded = CELL_HISTORY_REASON_OVERVOLTAGE;
          rc = HAL_ERROR;
       } else if (!warning_dtc_sent && measure_high < LIMIT_LOWVOLTAGE_WARNING) {
          ERROR_PRINT("WARN: Cell %d is low voltage at %f Volts\n", i, measure_high);
@@ -763,25 +1100,49 @@ HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage
    {
        for (int i=0; i < NUM_TEMP_CELLS; i++)
        {
-            measure = TempChannel[i];
-                
+            measure_high = TempChannel[i];
+            measure_low = TempChannel[i];
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+            // A failed thermistor's estimate stands in for its reading, the
+            // limits are checked against the estimate's bounds. The channel is
+            // only a fault once those bounds are too wide to be of use
+            if (thermalEstimator.failed[i]) {
+                measure_high = thermalEstimatorUpperBound(&thermalEstimator, i, THERMAL_BOUND_SIGMAS);
+                measure_low = thermalEstimatorLowerBound(&thermalEstimator, i, THERMAL_BOUND_SIGMAS);
+                const float bound = (measure_high - measure_low) / 2.0f;
+                if (bound > THERMAL_MAX_BOUND_K) {
+                    ERROR_PRINT("Temp Channel %d thermistor failed, estimate +/- %f deg C\n", i, bound);
+                    sendDTC_CRITICAL_THERMISTOR_FAILED(i);
+                    rc = HAL_ERROR;
+                } else if (!warningSentForThermistorFailed[i]) {
+                    ERROR_PRINT("WARN: Temp Channel %d thermistor failed, reading %f deg C\n", i, TempChannel[i]);
+                    sendDTC_WARNING_THERMISTOR_FAILED(i);
+                    warningSentForThermistorFailed[i] = true;
+                }
+            } else {
+                warningSentForThermistorFailed[i] = false;
+            }
+#endif
+
             // Check it is within bounds
-            if (measure > CELL_OVERTEMP) {
-                ERROR_PRINT("Temp Channel %d is overtemp at %f deg C\n", i, measure);
+            if (measure_high > CELL_OVERTEMP) {
+                ERROR_PRINT("Temp Channel %d is overtemp at %f deg C\n", i, measure_high);
                 sendDTC_CRITICAL_CELL_TEMP_HIGH(i);
+                cellLimitExceeded = CELL_HISTORY_REASON_OVERTEMP;
                 rc = HAL_ERROR;
-            } else if (measure > CELL_OVERTEMP_WARNING) {
+            } else if (measure_high > CELL_OVERTEMP_WARNING) {
                 if (!warningSentForChannelTemp[i]) {
-                    ERROR_PRINT("WARN: Temp Channel %d is high temp at %f deg C\n", i, measure);
+                    ERROR_PRINT("WARN: Temp Channel %d is high temp at %f deg C\n", i, measure_high);
                     sendDTC_WARNING_CELL_TEMP_HIGH(i);
                     warningSentForChannelTemp[i] = true;
                 }
-            } else if(measure > 0 && measure < CELL_UNDERTEMP){
-                ERROR_PRINT("Cell %d is undertemp at %f deg C\n", i, measure);
+            } else if(measure_low > 0 && measure_low < CELL_UNDERTEMP){
+                ERROR_PRINT("Cell %d is undertemp at %f deg C\n", i, measure_low);
                 sendDTC_WARNING_CELL_TEMP_LOW(i);
-            } else if(measure > 0 && measure < CELL_UNDERTEMP_WARNING){
+            } else if(measure_low > 0 && measure_low < CELL_UNDERTEMP_WARNING){
                 if(!warningSentForChannelTemp[i]) {
-                    ERROR_PRINT("WARN: Cell %d is low temp at %f deg C\n", i, measure);
+                    ERROR_PRINT("WARN: Cell %d is low temp at %f deg C\n", i, measure_low);
                     sendDTC_WARNING_CELL_TEMP_LOW(i);
                     warningSentForChannelTemp[i] = true;
                 }
@@ -790,8 +1151,8 @@ HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage
             }
 
             // Update max voltage
-            if (measure > (*maxTemp)) {(*maxTemp) = measure;}
-            if (measure < (*minTemp)) {(*minTemp) = measure;}
+            if (measure_high > (*maxTemp)) {(*maxTemp) = measure_high;}
+            if (measure_low < (*minTemp)) {(*minTemp) = measure_low;}
         }
    }
    else
@@ -804,18 +1165,159 @@ HAL_StatusTypeDef checkCellVoltagesAndTemps(float *maxVoltage, float *minVoltage
 
 
 /**
- * @brief Calculates the state of power of the battery pack. TODO: this
- * calculation is from 2017, so should be updated for the 2021 pack
+ * @brief Calculates the state of power of the battery pack: the charge and
+ * discharge current and power limits over the short (2s) and long (10s)
+ * horizons. Fills in the BMU_stateOfPower CAN signals
+ *
+ * @param adjustedPackVoltage Pack voltage with the IR drop added back in, used
+ * as the pack open circuit voltage
  *
- * @return The state of power of the battery pack (in Watts?)
+ * @return The long horizon discharge current limit (in Amps)
  */
-float calculateStateOfPower()
+float calculateStateOfPower(float adjustedPackVoltage)
 {
-   float maxCurrent =  sqrt((((CELL_MAX_TEMP_C - TempCellMax)/CELL_TIME_TO_FAILURE_ALLOWABLE) * (CELL_HEAT_CAPACITY*CELL_MASS))/CELL_DCR);
+   SOP_Params_t params = {
+      .cellVoltageMin = SOP_CELL_VOLTAGE_MIN,
+      .cellVoltageMax = limit_overvoltage,
+      .cellTempMax = CELL_MAX_TEMP_C,
+      .dischargeDerateTemp = CELL_OVERTEMP_WARNING,
+      .chargeTempMin = CELL_UNDERTEMP,
+      .chargeDerateTemp = CELL_UNDERTEMP_WARNING,
+      .capacity_As = PACK_CAPACITY_AS,
+      .r0_ohms = adjustedCellIR,
+      .r1_ohms = SOP_CELL_POLARIZATION_R,
+      .tau_s = SOP_CELL_POLARIZATION_TAU_S,
+      .thermalMass_JperK = CELL_HEAT_CAPACITY*CELL_MASS,
+      .thermalResistance_ohms = CELL_DCR,
+      .maxDischargeCurrent = SOP_MAX_DISCHARGE_CURRENT,
+      .maxChargeCurrent = SOP_MAX_CHARGE_CURRENT,
+      .numSeriesCells = NUM_VOLTAGE_CELLS,
+   };
+
+   float IBus = 0.0f;
+   if (getIBus(&IBus) != HAL_OK)
+   {
+      IBus = 0.0f;
+   }
 
-   return maxCurrent;
+   // VoltageCellMin is already the adjusted (IR compensated) voltage,
+   // VoltageCellMax is the raw reading
+   SOP_Inputs_t inputs = {
+      .ocvMin = VoltageCellMin,
+      .ocvMax = VoltageCellMax + IBus * adjustedCellIR,
+      .tempMax = TempCellMax,
+      .tempMin = TempCellMin,
+      .soc = StateBatteryChargeHV / 100.0f,
+      .packOcv = adjustedPackVoltage,
+   };
+
+   SOP_Limits_t shortLimits;
+   SOP_Limits_t longLimits;
+   sopCompute(&params, &inputs, SOP_SHORT_HORIZON_S, &shortLimits);
+   sopCompute(&params, &inputs, SOP_LONG_HORIZON_S, &longLimits);
+
+   DischargeCurrentLimit2s = shortLimits.dischargeCurrent;
+   DischargeCurrentLimit10s = longLimits.dischargeCurrent;
+   ChargeCurrentLimit2s = shortLimits.chargeCurrent;
+   ChargeCurrentLimit10s = longLimits.chargeCurrent;
+   DischargePowerLimit2s = shortLimits.dischargePower * W_TO_KW;
+   DischargePowerLimit10s = longLimits.dischargePower * W_TO_KW;
+   ChargePowerLimit2s = shortLimits.chargePower * W_TO_KW;
+   ChargePowerLimit10s = longLimits.chargePower * W_TO_KW;
+
+   // StateBatteryPowerHV only has 12 bits at 0.1A
+   return fminf(longLimits.dischargeCurrent, STATE_BATTERY_POWER_HV_MAX);
 }
 
+/**
+ * @brief Send the state of power limits calculated by @ref calculateStateOfPower
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef sendStateOfPower()
+{
+   if (sendCAN_BMU_stateOfPowerCurrent() != HAL_OK) {
+      return HAL_ERROR;
+   }
+   return sendCAN_BMU_stateOfPowerPower();
+}
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_HV_MEASURE)
+static PackVoltageCheck_t packVoltageCheck;
+
+static void initPackVoltageCheck(void)
+{
+   PackVoltageCheck_Params_t params = {
+      .interconnectResistance_ohms = PACK_CHECK_INTERCONNECT_R,
+      .packResistance_ohms = NUM_VOLTAGE_CELLS * adjustedCellIR + PACK_CHECK_INTERCONNECT_R,
+      .tolerance_V = PACK_CHECK_TOLERANCE_V,
+      .toleranceRelative = PACK_CHECK_TOLERANCE_RELATIVE,
+      .acquisitionTime_s = PACK_CHECK_ACQUISITION_S,
+      .faultTime_s = PACK_CHECK_FAULT_TIME_S,
+   };
+   packVoltageCheckInit(&packVoltageCheck, &params);
+}
+
+/**
+ * @brief Cross-check the sum of the cell voltages against VBatt measured by
+ * the HV ADC, sending a warning DTC if they disagree. Only diagnostic, the
+ * cell voltage limits are still checked on the individual cells
+ *
+ * @param packVoltage Sum of the cell voltages
+ */
+static void checkPackVoltage(float packVoltage)
+{
+   static uint32_t lastCheck_ticks = 0;
+   HVBusMeasurements_t hv;
+
+   if (getHVBusMeasurements(&hv) != HAL_OK) {
+      return;
+   }
+
+   const uint32_t now = xTaskGetTickCount();
+   const float dt_s = (lastCheck_ticks == 0) ? 0.0f
+                      : (float)(now - lastCheck_ticks) / configTICK_RATE_HZ;
+   const float skew_s = (float)(now - hv.timestamp) / configTICK_RATE_HZ;
+   lastCheck_ticks = now;
+
+   if (packVoltageCheckStep(&packVoltageCheck, packVoltage, hv.VBatt, hv.IBus, skew_s, dt_s)) {
+      ERROR_PRINT("Sum of cells %f V differs from VBatt %f V (allowed %f V)\n",
+                  packVoltage, hv.VBatt, packVoltageCheck.allowed_V);
+      sendDTC_WARNING_PACK_VOLTAGE_MISMATCH((int)lroundf(packVoltageCheck.residual_V));
+   }
+}
+#endif
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+static uint8_t saturatePecErrors(int board, ltc_register_group_t group)
+{
+   uint32_t errors = batt_get_pec_errors(board, group);
+   return (errors > UINT8_MAX) ? UINT8_MAX : errors;
+}
+
+/**
+ * @brief Send the PEC error counts of one AMS board, cycling through the
+ * boards on each call
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef sendPecErrors()
+{
+   static int board = 0;
+
+   PecErrorsBoard = board;
+   PecErrorsCFG = saturatePecErrors(board, LTC_REG_CFG);
+   PecErrorsCVA = saturatePecErrors(board, LTC_REG_CVA);
+   PecErrorsCVB = saturatePecErrors(board, LTC_REG_CVB);
+   PecErrorsCVC = saturatePecErrors(board, LTC_REG_CVC);
+   PecErrorsCVD = saturatePecErrors(board, LTC_REG_CVD);
+   PecErrorsAUXB = saturatePecErrors(board, LTC_REG_AUXB);
+
+   board = (board + 1) % NUM_BOARDS;
+   return sendCAN_BMU_PecErrors();
+}
+#endif
+
 
 /**
  * @brief Calculates the state of charge of the battery pack. This is a measure
@@ -965,14 +1467,16 @@ HAL_StatusTypeDef startCharging()
  * @brief Sends messages to the charger. The charger expects a message every
  * second so this needs to be repeatedly called during charging
  *
+ * @param chargeCurrent Current to request, from the charge profile
+ *
  * @return HAL_StatusTypeDef
  */
-HAL_StatusTypeDef continueCharging()
+HAL_StatusTypeDef continueCharging(float chargeCurrent)
 {
 #if IS_BOARD_F7 && defined(ENABLE_CHARGER)
    ChargerStatus status;
 
-   sendChargerCommand(maxChargeVoltage, maxChargeCurrent + 0.2, true /* start charing */);
+   sendChargerCommand(maxChargeVoltage, chargeCurrent, true /* start charing */);
 
    if (checkChargerStatus(&status) != HAL_OK) {
       ERROR_PRINT("Failed to get charger status\n");
@@ -1019,6 +1523,11 @@ HAL_StatusTypeDef stopBalance()
 #endif
     
 #if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_BALANCE)
+    // Called after the bus has been quiet for a task period, a write to an
+    // idle isoSPI port would be lost
+    if (batt_spi_wakeup(false /* not sleeping*/)) {
+        return HAL_ERROR;
+    }
     if (batt_write_config() != HAL_OK) {
         return HAL_ERROR;
     }
@@ -1063,19 +1572,9 @@ HAL_StatusTypeDef pauseBalance()
  */
 HAL_StatusTypeDef resumeBalance()
 {
-#if IS_BOARD_F7 && defined(ENABLE_BALANCE)
-    for (int cell = 0; cell < NUM_VOLTAGE_CELLS; cell++) {
-        if (isCellBalancing[cell]) {
-            batt_balance_cell(cell);
-        }
-    }
-#endif
-
-#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_BALANCE)
-    if (batt_write_config() != HAL_OK) {
+    if (balance_cells(isCellBalancing) != HAL_OK) {
         ERROR_PRINT("Failed to resume balance\n");
     }
-#endif
 
     return HAL_OK;
 }
@@ -1083,9 +1582,8 @@ HAL_StatusTypeDef resumeBalance()
 /**
  * @brief Control the balance state of an individual cell. NB: this is
  * inneficient if balancing multiple cells, as he entire balance config is sent
- * to the AMS boards every time this is called. Instead, use the lower level
- * batt_balance_cell/batt_stop_balance_cell to change state for all cells, then
- * call batt_write_config to send the new balance config
+ * to the AMS boards every time this is called. Instead, use @ref balance_cells
+ * to send the balance state of all cells in one write
  *
  * @param cell The cell to change the balance state of
  * @param set True if should balance cell
@@ -1106,6 +1604,26 @@ HAL_StatusTypeDef balance_cell(int cell, bool set)
     return HAL_OK;
 }
 
+/**
+ * @brief Set the balance state of every cell and send the balance config to
+ * the AMS boards in one write, skipped if nothing changed since it was last
+ * sent. The discharge timer is set so the resistors turn off if we stop
+ * talking to the AMS boards
+ *
+ * @param balance NUM_VOLTAGE_CELLS entries, true if should balance the cell
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef balance_cells(const bool *balance)
+{
+#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_BALANCE)
+    if (batt_write_balancing_config(balance, DT_30_SEC) != HAL_OK) {
+        return HAL_ERROR;
+    }
+#endif
+    return HAL_OK;
+}
+
 
 /**
  * @brief Maps a value from one range to another in a linear manner
@@ -1160,13 +1678,75 @@ float getSOCFromVoltage(float cellVoltage)
     return soc;
 }
 
+/// Balance plan, kept global so it can be inspected from the CLI
+BalancePlanner_t balancePlanner;
+
+/// Charge profile, kept global so it can be inspected from the CLI
+ChargeProfile_t chargeProfile;
+
 /**
- * @brief Performs balance charging.
+ * @brief Steps the charge profile on the latest cell readings
+ *
+ * @param dt_s Time since the last step
+ *
+ * @return Current to request from the charger
+ */
+static float stepChargeProfile(float dt_s)
+{
+    float IBus = 0.0f;
+    if (getIBus(&IBus) != HAL_OK)
+    {
+        IBus = 0.0f;
+    }
+
+    // IBus is positive out of the pack, VoltageCellMax is the raw reading
+    ChargeProfile_Inputs_t inputs = {
+        .cellVoltageMax = VoltageCellMax,
+        .tempMax = TempCellMax,
+        .tempMin = TempCellMin,
+        .current_A = -IBus,
+    };
+
+    float chargeCurrent = chargeProfileStep(&chargeProfile, &inputs, dt_s);
+    DEBUG_PRINT("Charge profile %s, %.2f A\n", chargeProfilePhaseName(chargeProfile.phase), chargeCurrent);
+    return chargeCurrent;
+}
+
+/**
+ * @brief Performs balance charging. Which cells to bleed, and for how long,
+ * is decided by the balance planner (see balance_planner.c) from relaxed
+ * voltage readings taken every @ref BALANCE_RECHECK_PERIOD_MS.
  *
  * @return @ref ChargeReturn
  */
 ChargeReturn balanceCharge(Balance_Type_t using_charger)
 {
+    BalancePlanner_Params_t plannerParams = {
+        .numCells = NUM_VOLTAGE_CELLS,
+        .cellsPerBoard = CELLS_PER_BOARD,
+        .capacity_As = PACK_CAPACITY_AS,
+        .bleedResistance_ohms = BALANCE_BLEED_RESISTANCE_OHMS,
+        .maxBoardPower_W = BALANCE_MAX_BOARD_POWER_W,
+        .maxTemp_C = BALANCE_MAX_TEMP_C,
+        .startSocDelta = BALANCE_MIN_SOC_DELTA / 100.0f,
+        .stopSocDelta = BALANCE_STOP_SOC_DELTA / 100.0f,
+    };
+    balancePlannerInit(&balancePlanner, &plannerParams);
+
+    ChargeProfile_Params_t profileParams = {
+        .maxCurrent_A = maxChargeCurrent,
+        .cvCellVoltage = CHARGE_CV_CELL_VOLTAGE,
+        .r0_ohms = adjustedCellIR,
+        .r1_ohms = SOP_CELL_POLARIZATION_R,
+        .tau_s = SOP_CELL_POLARIZATION_TAU_S,
+        .tempMin_C = CELL_UNDERTEMP,
+        .derateLow_C = CELL_UNDERTEMP_WARNING,
+        .derateHigh_C = CELL_OVERTEMP_WARNING,
+        .tempMax_C = CELL_MAX_TEMP_C,
+        .termCurrent_A = CHARGE_TERM_CURRENT_A,
+    };
+    chargeProfileInit(&chargeProfile, &profileParams);
+
     // Start charge
     if (using_charger && startCharging() != HAL_OK) {
         return CHARGE_ERROR;
@@ -1174,7 +1754,12 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
 
     bool balancingCells = false; // Are we balancing any cell currently?
     uint32_t lastBalanceCheck = 0;
+    uint32_t lastBalanceStep = xTaskGetTickCount();
+    bool planValid = false;
     bool waitingForBalanceDone = false; // Set to true when receive stop but still balancing
+    // Nothing is requested until the profile has seen the first cell readings
+    float chargeCurrent = 0.0f;
+    uint32_t lastProfileStep = xTaskGetTickCount();
     uint32_t dbwTaskNotifications;
     float packVoltage;
     float adjustedPackVoltage;
@@ -1185,30 +1770,38 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
         */
        if (using_charger && !waitingForBalanceDone) {
               DEBUG_PRINT("Still Charging\n");
-          if (continueCharging() != HAL_OK) {
+          if (continueCharging(chargeCurrent) != HAL_OK) {
              ERROR_PRINT("Failed to send charge continue message\n");
              if (boundedContinue()) { continue; }
           }
        }
 
         /*
-         * Perform cell reading, need to pause any ongoing balance in order to
-         * get good voltage readings
-         * After we have read, we can re-enable balancing on cells
+         * Perform cell reading. The LTCs pause the balance resistors while
+         * they convert the cells (ADCV is sent with DCP clear), otherwise a
+         * bleeding cell would read low by the bleed current times its tap
+         * resistance and hide from the overvoltage check. The resistors are
+         * only turned off beforehand for the readings the balance plan is
+         * made from, so the cells can relax. Other cycles keep bleeding, and
+         * the thermistor mux write sends the balance config along, so the
+         * balance write below only goes out when the plan changes
          */
-        if (pauseBalance() != HAL_OK) {
-            ERROR_PRINT("Failed to pause balance!\n");
-            if (boundedContinue()) { continue; }
-        }
-
-        // Check in before delay
-        watchdogTaskCheckIn(BATTERY_TASK_ID);
-        if (CELL_RELAXATION_TIME_MS >= BATTERY_CHARGE_TASK_PERIOD_MS) {
-            ERROR_PRINT("Cell relaxation time %d > task period %d",
-                        CELL_RELAXATION_TIME_MS, BATTERY_CHARGE_TASK_PERIOD_MS);
-            BatteryTaskError();
-        } else {
-            vTaskDelay(pdMS_TO_TICKS(CELL_RELAXATION_TIME_MS));
+        bool relaxedReading = !planValid || (xTaskGetTickCount() - lastBalanceCheck
+                                             > pdMS_TO_TICKS(BALANCE_RECHECK_PERIOD_MS));
+        if (relaxedReading) {
+            if (pauseBalance() != HAL_OK) {
+                ERROR_PRINT("Failed to pause balance!\n");
+                if (boundedContinue()) { continue; }
+            }
+            // Check in before delay
+            watchdogTaskCheckIn(BATTERY_TASK_ID);
+            if (CELL_RELAXATION_TIME_MS >= BATTERY_CHARGE_TASK_PERIOD_MS) {
+                ERROR_PRINT("Cell relaxation time %d > task period %d",
+                            CELL_RELAXATION_TIME_MS, BATTERY_CHARGE_TASK_PERIOD_MS);
+                BatteryTaskError();
+            } else {
+                vTaskDelay(pdMS_TO_TICKS(CELL_RELAXATION_TIME_MS));
+            }
         }
 
         if (readCellVoltagesAndTemps() != HAL_OK) {
@@ -1225,12 +1818,6 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
         }
 #endif
 
-        if (resumeBalance() != HAL_OK) {
-            ERROR_PRINT("Failed to resume balance!\n");
-            if (boundedContinue()) { continue; }
-        }
-
-
         /*
          * Safety checks for cells
          */
@@ -1248,53 +1835,43 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
          */
         if (VoltageCellMin >= BALANCE_START_VOLTAGE || !using_charger)
         {
-            if (xTaskGetTickCount() - lastBalanceCheck
-                > pdMS_TO_TICKS(BALANCE_RECHECK_PERIOD_MS))
+            uint32_t now = xTaskGetTickCount();
+
+            if (relaxedReading)
             {
-                balancingCells = false;
-
-                /*DEBUG_PRINT("Starting balance\n");*/
-                /*DEBUG_PRINT("Voltages:\n");*/
-                /*for (int cell = 0; cell < NUM_VOLTAGE_CELLS; cell++) {*/
-                    /*DEBUG_PRINT("%d: %f,", cell, VoltageCell[cell]);*/
-                /*}*/
-                /*DEBUG_PRINT("\n");*/
-                float minCellSOC = getSOCFromVoltage(VoltageCellMin);
-                float maxCellSOC = getSOCFromVoltage(VoltageCellMax);
-                DEBUG_PRINT("Voltage min %f (SOC %f), max %f (SOC %f)\n\n", VoltageCellMin, minCellSOC, VoltageCellMax, maxCellSOC);
-                for (int cell=0; cell < NUM_VOLTAGE_CELLS; cell++) {
-                    float cellSOC = getSOCFromVoltage(AdjustedVoltageCell[cell]);
-                    watchdogTaskCheckIn(BATTERY_TASK_ID);
-                    /*DEBUG_PRINT("Cell %d SOC: %f\n", cell, cellSOC);*/
-
-                    if (cellSOC - minCellSOC > BALANCE_MIN_SOC_DELTA) {
-                        DEBUG_PRINT("Balancing cell %d\n", cell);
-#if IS_BOARD_F7
-                        batt_balance_cell(cell);
-#endif
-                        balancingCells = true;
-                    } else {
-                      DEBUG_PRINT("Not balancing cell %d\n", cell);
-#if IS_BOARD_F7
-                      batt_stop_balance_cell(cell);
-#endif
-                    }
-                }
+                balancePlannerUpdate(&balancePlanner, (const float *)AdjustedVoltageCell);
+                planValid = true;
+                lastBalanceCheck = now;
+            }
 
-                DEBUG_PRINT("\n\n\n");
+            // Time since the last step is how long the selected cells have
+            // been bleeding (less the relaxation pause if we just measured)
+            float bledTime_ms = (float)(now - lastBalanceStep) * portTICK_PERIOD_MS;
+            if (relaxedReading) {
+                bledTime_ms -= CELL_RELAXATION_TIME_MS;
+                bledTime_ms = bledTime_ms < 0.0f ? 0.0f : bledTime_ms;
+            }
+            balancePlannerStep(&balancePlanner, bledTime_ms / 1000.0f, TempCellMax);
+            lastBalanceStep = now;
 
-#if IS_BOARD_F7 && defined(ENABLE_AMS)
-                batt_set_disharge_timer(DT_30_SEC);
-                if (batt_write_config() != HAL_OK)
-                {
-                    return CHARGE_ERROR;
-                }
-#endif
+            balancingCells = !balancePlannerIsBalanced(&balancePlanner);
 
-                lastBalanceCheck = xTaskGetTickCount();
+            if (relaxedReading) {
+                DEBUG_PRINT("Voltage min %f, max %f, predicted time to balance %.0f s\n",
+                            VoltageCellMin, VoltageCellMax, balancePlanner.predictedTimeToBalance_s);
             }
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+            // Whole pack's balance config in one write, discharge timer turns
+            // the resistors off if we stop talking to the AMS boards
+            if (batt_write_balancing_config(balancePlanner.bleeding, DT_30_SEC) != HAL_OK)
+            {
+                return CHARGE_ERROR;
+            }
+#endif
         } else {
             balancingCells = false;
+            planValid = false;
             DEBUG_PRINT("Can't balance cells as VoltageCellMin (%f) < BALANCE_START_VOLTAGE (%f)\n", VoltageCellMin, BALANCE_START_VOLTAGE);
             if (stopBalance() != HAL_OK) {
                 ERROR_PRINT("Failed to stop balance\n");
@@ -1302,10 +1879,22 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
             }
         }
 
+        /*
+         * Charge current for the next cycle, tapered to hold the highest cell
+         * at the CV voltage and derated near the temperature limits
+         */
+        if (using_charger) {
+            uint32_t now = xTaskGetTickCount();
+            chargeCurrent = stepChargeProfile((float)(now - lastProfileStep) * portTICK_PERIOD_MS / 1000.0f);
+            lastProfileStep = now;
+        }
+
         /*
          * Check if we are done charging/balancing
          */
-        if (using_charger && getSOCFromVoltage(VoltageCellMin) >= CHARGE_STOP_SOC && !balancingCells) {
+        if (using_charger && !balancingCells
+            && (chargeProfile.phase == CHARGE_PROFILE_DONE
+                || getSOCFromVoltage(VoltageCellMin) >= CHARGE_STOP_SOC)) {
             DEBUG_PRINT("Done charging\n");
             if (using_charger && stopCharging() != HAL_OK) {
                 return CHARGE_ERROR;
@@ -1356,7 +1945,7 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
             return CHARGE_STOPPED;
         }
 
-        StateBatteryPowerHV = calculateStateOfPower();
+        StateBatteryPowerHV = calculateStateOfPower(adjustedPackVoltage);
         StateBMS = fsmGetState(&fsmHandle);
 
 
@@ -1374,8 +1963,16 @@ ChargeReturn balanceCharge(Balance_Type_t using_charger)
             if (boundedContinue()) { continue; }
         }
 
+        if (sendStateOfPower() != HAL_OK) {
+            ERROR_PRINT("Failed to send state of power\n");
+            if (boundedContinue()) { continue; }
+        }
+
         publishPackVoltage(packVoltage);
         publishAdjustedPackVoltage(adjustedPackVoltage);
+#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_HV_MEASURE)
+        checkPackVoltage(packVoltage);
+#endif
 
         // Succesfully reach end of loop, update error counter to reflect that
         ERROR_COUNTER_SUCCESS();
@@ -1418,6 +2015,14 @@ void batteryTask(void *pvParameter)
     }
 #endif
 
+#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_HV_MEASURE)
+    initPackVoltageCheck();
+#endif
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+    initThermalEstimator();
+#endif
+    cellHistoryInit(&cellHistory, NUM_VOLTAGE_CELLS, NUM_TEMP_CELLS);
+
     if (registerTaskToWatch(BATTERY_TASK_ID, 5*pdMS_TO_TICKS(BATTERY_TASK_PERIOD_MS), false, NULL) != HAL_OK)
     {
         ERROR_PRINT("Failed to register battery task with watchdog!\n");
@@ -1537,8 +2142,11 @@ void batteryTask(void *pvParameter)
         }
         // Adjusted Pack Voltage not critical
         publishAdjustedPackVoltage(adjustedPackVoltage);
+#if IS_BOARD_F7 && defined(ENABLE_AMS) && defined(ENABLE_HV_MEASURE)
+        checkPackVoltage(packVoltage);
+#endif
 
-        StateBatteryPowerHV = calculateStateOfPower();
+        StateBatteryPowerHV = calculateStateOfPower(adjustedPackVoltage);
         StateBMS = fsmGetState(&fsmHandle);
 
 
@@ -1556,6 +2164,16 @@ void batteryTask(void *pvParameter)
             if (boundedContinue()) { continue; }
         }
 
+        if (sendStateOfPower() != HAL_OK) {
+            ERROR_PRINT("Failed to send state of power\n");
+            if (boundedContinue()) { continue; }
+        }
+
+#if IS_BOARD_F7 && defined(ENABLE_AMS)
+        // Diagnostic only
+        sendPecErrors();
+#endif
+
         static bool released_soc = false;
         if(!released_soc)
         {
@@ -1615,40 +2233,109 @@ static inline uint8_t roundUpNearestMultiple(uint8_t input, uint8_t multiple)
     return (multiple <= 1 || input % multiple == 0) ? input : input + (multiple - (input % multiple));
 }
 
+/// Send the cells with the denser packed messages instead of the 3 per message ones
+static volatile bool cellBroadcastPacked = false;
+
+/**
+ * @brief Switch between the 3 cells per message broadcast (BMU_CellVoltage,
+ * BMU_CellVoltage_Adjusted and BMU_ChannelTemp) and the packed 5 cells per
+ * message broadcast (BMU_CellVoltagePacked and BMU_ChannelTempPacked, 1 mV
+ * and 0.1 C resolution, no adjusted voltages). Packed readings out of the
+ * signals' range are sent as @ref CELL_BROADCAST_PACKED_INVALID
+ */
+void setCellBroadcastPacked(bool packed)
+{
+    cellBroadcastPacked = packed;
+}
+
+static void initCellBroadcast(CellBroadcast_t *voltageBroadcast, CellBroadcast_t *tempBroadcast, bool packed)
+{
+    const uint32_t groupLen = packed ? CAN_TX_CELL_PACKED_GROUP_LEN : CAN_TX_CELL_GROUP_LEN;
+    CellBroadcast_Params_t params = {
+        .numValues = NUM_VOLTAGE_CELLS,
+        .groupLen = groupLen,
+        .sweepEvery = CELL_BROADCAST_SWEEP_EVERY,
+        .changeScale = CELL_BROADCAST_VOLTAGE_CHANGE_V,
+        .outlierScale = CELL_BROADCAST_VOLTAGE_OUTLIER_V,
+        .lowLimit = LIMIT_LOWVOLTAGE,
+        .highLimit = LIMIT_HIGHVOLTAGE,
+        .limitBand = CELL_BROADCAST_VOLTAGE_LIMIT_BAND_V,
+        .limitWeight = CELL_BROADCAST_LIMIT_WEIGHT,
+    };
+    cellBroadcastInit(voltageBroadcast, &params);
+
+    params.numValues = NUM_TEMP_CELLS;
+    params.changeScale = CELL_BROADCAST_TEMP_CHANGE_C;
+    params.outlierScale = CELL_BROADCAST_TEMP_OUTLIER_C;
+    params.lowLimit = CELL_UNDERTEMP;
+    params.highLimit = CELL_OVERTEMP;
+    params.limitBand = CELL_BROADCAST_TEMP_LIMIT_BAND_C;
+    cellBroadcastInit(tempBroadcast, &params);
+}
+
 /**
- * @brief Sends the cell voltages and temperatures over CAN
+ * @brief Sends the cell voltages and temperatures over CAN. Each period sends
+ * the same number of messages as a plain round robin, but the cells are
+ * chosen by @ref cellBroadcastNext so cells that are changing, outliers or
+ * near a limit are sent more often
  *
  */
 void canSendCellTask(void *pvParameters)
 {
-
+    static CellBroadcast_t voltageBroadcast;
+    static CellBroadcast_t tempBroadcast;
+    bool packed = cellBroadcastPacked;
     uint32_t cellIdxToSend = 0;
     TickType_t xLastWakeTime = xTaskGetTickCount();
 
+    initCellBroadcast(&voltageBroadcast, &tempBroadcast, packed);
+
     if (registerTaskToWatch(CAN_CELL_SEND_TASK_ID, 5*pdMS_TO_TICKS(CAN_CELL_SEND_PERIOD_MS), false, NULL) != HAL_OK)
     {
         ERROR_PRINT("ERROR: Failed to register canSendCellTask with watchdog\n");
     }
     while (1) {
+        if (packed != cellBroadcastPacked) {
+            packed = cellBroadcastPacked;
+            initCellBroadcast(&voltageBroadcast, &tempBroadcast, packed);
+        }
+
         if (sendOneCellVoltAndTemp) {
             // The cell index for sending should be a multiple of 3, as the cells are
             // sent in groups of 3
             cellIdxToSend = cellToSend - (cellToSend % CAN_TX_CELL_GROUP_LEN);
-        }
 
-        sendCAN_BMU_CellVoltage(cellIdxToSend);
-        vTaskDelay(2); // Added to prevent CAN mailbox full
-        sendCAN_BMU_CellVoltage_Adjusted(cellIdxToSend);
-        vTaskDelay(2); // Added to prevent CAN mailbox full
-        sendCAN_BMU_ChannelTemp(cellIdxToSend);
-
-        // Move on to next cells
-        // 3 Cells per CAN message
-        cellIdxToSend += CAN_TX_CELL_GROUP_LEN;
-        if(cellIdxToSend >= NUM_VOLTAGE_CELLS)
-        {
-            cellIdxToSend = 0;
+            sendCAN_BMU_CellVoltage(cellIdxToSend);
+            vTaskDelay(2); // Added to prevent CAN mailbox full
+            sendCAN_BMU_CellVoltage_Adjusted(cellIdxToSend);
+            vTaskDelay(2); // Added to prevent CAN mailbox full
+            sendCAN_BMU_ChannelTemp(cellIdxToSend);
+        } else if (!packed) {
+            cellIdxToSend = cellBroadcastNext(&voltageBroadcast, (float *)VoltageCell);
+            sendCAN_BMU_CellVoltage(cellIdxToSend);
+            vTaskDelay(2); // Added to prevent CAN mailbox full
+            sendCAN_BMU_CellVoltage_Adjusted(cellIdxToSend);
+            vTaskDelay(2); // Added to prevent CAN mailbox full
+            sendCAN_BMU_ChannelTemp(cellBroadcastNext(&tempBroadcast, (float *)TempChannel));
+        } else {
+            // Adjusted voltages aren't sent packed, so two voltage groups per period
+            for (int msg = 0; msg < 2; msg++) {
+                cellIdxToSend = cellBroadcastNext(&voltageBroadcast, (float *)VoltageCell);
+                for (uint32_t i = cellIdxToSend; i < cellIdxToSend + CAN_TX_CELL_PACKED_GROUP_LEN && i < NUM_VOLTAGE_CELLS; i++) {
+                    VoltageCellPacked[i] = cellBroadcastPack(VoltageCell[i], CAN_TX_CELL_PACKED_VOLTAGE_OFFSET,
+                                                             CAN_TX_CELL_PACKED_VOLTAGE_SCALE);
+                }
+                sendCAN_BMU_CellVoltagePacked(cellIdxToSend);
+                vTaskDelay(2); // Added to prevent CAN mailbox full
+            }
+            uint32_t channelIdxToSend = cellBroadcastNext(&tempBroadcast, (float *)TempChannel);
+            for (uint32_t i = channelIdxToSend; i < channelIdxToSend + CAN_TX_CELL_PACKED_GROUP_LEN && i < NUM_TEMP_CELLS; i++) {
+                TempChannelPacked[i] = cellBroadcastPack(TempChannel[i], CAN_TX_CELL_PACKED_TEMP_OFFSET,
+                                                         CAN_TX_CELL_PACKED_TEMP_SCALE);
+            }
+            sendCAN_BMU_ChannelTempPacked(channelIdxToSend);
         }
+
         watchdogTaskCheckIn(CAN_CELL_SEND_TASK_ID);
         vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(CAN_CELL_SEND_PERIOD_MS));
     }
@@ -0,0 +1,141 @@
+/**
+  *****************************************************************************
+  * @file    cell_broadcast.c
+  * @brief   Prioritised scheduling of the cell voltage/temperature broadcast
+  * @details The number of messages per slot is unchanged, so the bus load is
+  * the same as a plain round robin. Sweep slots walk the groups in order so
+  * every group is sent at least once every sweepEvery * numGroups slots. In
+  * the other slots the group with the highest (1 + importance) * age is sent,
+  * so with a quiet pack they also fall back to a round robin, and a group
+  * with importance I is picked once its age is 1/(1 + I) of the oldest quiet
+  * group's.
+  *****************************************************************************
+  */
+
+#include "cell_broadcast.h"
+#include <math.h>
+
+void cellBroadcastInit(CellBroadcast_t *broadcast, const CellBroadcast_Params_t *params)
+{
+    broadcast->params = *params;
+    if (broadcast->params.numValues > CELL_BROADCAST_MAX_VALUES) {
+        broadcast->params.numValues = CELL_BROADCAST_MAX_VALUES;
+    }
+    if (broadcast->params.groupLen == 0) {
+        broadcast->params.groupLen = 1;
+    }
+    if (broadcast->params.sweepEvery == 0) {
+        broadcast->params.sweepEvery = 1;
+    }
+    broadcast->numGroups = (broadcast->params.numValues + broadcast->params.groupLen - 1)
+                           / broadcast->params.groupLen;
+
+    for (uint32_t i = 0; i < CELL_BROADCAST_MAX_VALUES; i++) {
+        broadcast->lastSent[i] = 0.0f;
+    }
+    // Nothing has been sent yet, start every group at the same age so the
+    // first pass is in order
+    for (uint32_t g = 0; g < CELL_BROADCAST_MAX_GROUPS; g++) {
+        broadcast->age[g] = broadcast->numGroups;
+    }
+    broadcast->nextSweepGroup = 0;
+    broadcast->slot = 0;
+}
+
+/**
+ * @brief How much a group needs sending, 0 for a quiet group
+ *
+ * @param mean Mean of all the values, for outliers
+ */
+float cellBroadcastImportance(const CellBroadcast_t *broadcast, const float values[], uint32_t group,
+                              float mean)
+{
+    const CellBroadcast_Params_t *params = &broadcast->params;
+    const uint32_t start = group * params->groupLen;
+    float importance = 0.0f;
+
+    for (uint32_t i = start; i < start + params->groupLen && i < params->numValues; i++) {
+        const float change = fabsf(values[i] - broadcast->lastSent[i]) / params->changeScale;
+        const float outlier = fabsf(values[i] - mean) / params->outlierScale;
+        const float margin = fminf(values[i] - params->lowLimit, params->highLimit - values[i]);
+        const float nearLimit = params->limitWeight * fminf(fmaxf(1.0f - margin / params->limitBand, 0.0f), 1.0f);
+
+        importance = fmaxf(importance, change + outlier + nearLimit);
+    }
+    return importance;
+}
+
+/**
+ * @brief Pick the group to send in this slot, and mark it as sent
+ *
+ * @param values All the values, as they are now
+ *
+ * @return Index of the first value of the group to send
+ */
+uint32_t cellBroadcastNext(CellBroadcast_t *broadcast, const float values[])
+{
+    const CellBroadcast_Params_t *params = &broadcast->params;
+    uint32_t group;
+
+    if (broadcast->slot % params->sweepEvery == 0) {
+        group = broadcast->nextSweepGroup;
+        broadcast->nextSweepGroup = (broadcast->nextSweepGroup + 1) % broadcast->numGroups;
+    } else {
+        float mean = 0.0f;
+        for (uint32_t i = 0; i < params->numValues; i++) {
+            mean += values[i];
+        }
+        mean /= params->numValues;
+
+        float bestPriority = -1.0f;
+        group = 0;
+        for (uint32_t g = 0; g < broadcast->numGroups; g++) {
+            const float priority = (1.0f + cellBroadcastImportance(broadcast, values, g, mean))
+                                   * broadcast->age[g];
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                group = g;
+            }
+        }
+    }
+    broadcast->slot++;
+
+    for (uint32_t g = 0; g < broadcast->numGroups; g++) {
+        broadcast->age[g]++;
+    }
+    broadcast->age[group] = 0;
+
+    const uint32_t start = group * params->groupLen;
+    for (uint32_t i = start; i < start + params->groupLen && i < params->numValues; i++) {
+        broadcast->lastSent[i] = values[i];
+    }
+    return start;
+}
+
+/**
+ * @brief Code to send a value as in a packed message, rounded to the nearest
+ * step. Values outside the range of the other codes, or NaN, are sent as
+ * @ref CELL_BROADCAST_PACKED_INVALID
+ *
+ * @param offset, scale Of the signal, as in the DBC
+ */
+uint32_t cellBroadcastPackedCode(float value, float offset, float scale)
+{
+    const float steps = (value - offset) / scale;
+
+    // Checked as a float, a negative or oversized one doesn't convert
+    if (!(steps > -0.5f && steps < CELL_BROADCAST_PACKED_INVALID - 0.5f)) {
+        return CELL_BROADCAST_PACKED_INVALID;
+    }
+    return (uint32_t)lroundf(steps);
+}
+
+/**
+ * @brief Value to put in a packed signal to send value as
+ * @ref cellBroadcastPackedCode. It's the middle of the code's step, so the
+ * generated signal encoding, which truncates, sends that code
+ */
+float cellBroadcastPack(float value, float offset, float scale)
+{
+    return offset + scale * (cellBroadcastPackedCode(value, offset, scale) + 0.5f);
+}
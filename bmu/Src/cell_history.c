@@ -0,0 +1,215 @@
+/**
+  *****************************************************************************
+  * @file    cell_history.c
+  * @brief   Ring buffer of recent cell data, frozen on a fault
+  * @details Each frame stores every value as an 8 bit delta from the value
+  * reconstructed from the previous frame, in LSBs shifted by the smallest
+  * scale that fits the frame's largest step. Deltas are taken from the
+  * reconstructed value rather than the last reading, so rounding doesn't
+  * accumulate and a step too large for one frame is caught up over the
+  * following frames. The oldest frame is folded into the base values when
+  * it is overwritten, so any frame is rebuilt by adding up the deltas from
+  * the base.
+  *****************************************************************************
+  */
+
+#include "cell_history.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void cellHistoryInit(CellHistory_t *history, uint32_t numCells, uint32_t numTemps)
+{
+    memset(history, 0, sizeof(*history));
+    history->numCells = (numCells > CELL_HISTORY_MAX_CELLS) ? CELL_HISTORY_MAX_CELLS : numCells;
+    history->numTemps = (numTemps > CELL_HISTORY_MAX_TEMPS) ? CELL_HISTORY_MAX_TEMPS : numTemps;
+}
+
+static int32_t quantize(float value, float lsb, int32_t min, int32_t max)
+{
+    if (!(value == value)) {
+        // NaN, hold at 0
+        return 0;
+    }
+    float counts = roundf(value / lsb);
+    if (counts < min) {
+        return min;
+    }
+    if (counts > max) {
+        return max;
+    }
+    return (int32_t)counts;
+}
+
+/*
+ * Smallest shift that fits the largest delta in 8 bits
+ */
+static uint8_t shiftFor(int32_t maxDelta)
+{
+    uint8_t shift = 0;
+    while (shift < CELL_HISTORY_MAX_SHIFT && (maxDelta >> shift) > INT8_MAX) {
+        shift++;
+    }
+    return shift;
+}
+
+/*
+ * Encode delta in 2^shift LSBs, saturated to 8 bits
+ */
+static int8_t encodeDelta(int32_t delta, uint8_t shift)
+{
+    const int32_t half = (shift > 0) ? (1 << (shift - 1)) : 0;
+    int32_t scaled = (delta >= 0) ? (delta + half) >> shift : -((-delta + half) >> shift);
+    if (scaled > INT8_MAX) {
+        scaled = INT8_MAX;
+    } else if (scaled < INT8_MIN) {
+        scaled = INT8_MIN;
+    }
+    return (int8_t)scaled;
+}
+
+static void applyFrame(const CellHistory_t *history, const CellHistoryFrame_t *frame,
+                       uint16_t voltages[], int16_t temps[])
+{
+    const uint8_t voltageShift = frame->shifts & 0x0F;
+    const uint8_t tempShift = frame->shifts >> 4;
+
+    for (uint32_t i = 0; i < history->numCells; i++) {
+        voltages[i] += frame->voltageDelta[i] * (1 << voltageShift);
+    }
+    for (uint32_t i = 0; i < history->numTemps; i++) {
+        temps[i] += frame->tempDelta[i] * (1 << tempShift);
+    }
+}
+
+/**
+ * @brief Add a frame, overwriting the oldest if the history is full. Does
+ * nothing while frozen
+ *
+ * @param voltages Cell voltages, V
+ * @param temps Channel temperatures, C
+ * @param IBus Pack current, A
+ */
+void cellHistoryRecord(CellHistory_t *history, const float voltages[], const float temps[],
+                       float IBus, uint8_t state, uint32_t tick)
+{
+    if (history->frozen) {
+        return;
+    }
+
+    if (history->count == 0) {
+        for (uint32_t i = 0; i < history->numCells; i++) {
+            history->baseVoltage[i] = quantize(voltages[i], CELL_HISTORY_VOLTAGE_LSB_V, 0, UINT16_MAX);
+        }
+        for (uint32_t i = 0; i < history->numTemps; i++) {
+            history->baseTemp[i] = quantize(temps[i], CELL_HISTORY_TEMP_LSB_C, INT16_MIN, INT16_MAX);
+        }
+        memcpy(history->lastVoltage, history->baseVoltage, sizeof(history->lastVoltage));
+        memcpy(history->lastTemp, history->baseTemp, sizeof(history->lastTemp));
+    } else if (history->count == CELL_HISTORY_FRAMES) {
+        applyFrame(history, &history->frames[history->oldest], history->baseVoltage, history->baseTemp);
+        history->oldest = (history->oldest + 1) % CELL_HISTORY_FRAMES;
+        history->count--;
+    }
+
+    CellHistoryFrame_t *frame = &history->frames[(history->oldest + history->count) % CELL_HISTORY_FRAMES];
+    int32_t voltageDelta[CELL_HISTORY_MAX_CELLS];
+    int32_t tempDelta[CELL_HISTORY_MAX_TEMPS];
+    int32_t maxDelta = 0;
+
+    for (uint32_t i = 0; i < history->numCells; i++) {
+        voltageDelta[i] = quantize(voltages[i], CELL_HISTORY_VOLTAGE_LSB_V, 0, UINT16_MAX)
+                          - history->lastVoltage[i];
+        maxDelta = (abs(voltageDelta[i]) > maxDelta) ? abs(voltageDelta[i]) : maxDelta;
+    }
+    const uint8_t voltageShift = shiftFor(maxDelta);
+
+    maxDelta = 0;
+    for (uint32_t i = 0; i < history->numTemps; i++) {
+        tempDelta[i] = quantize(temps[i], CELL_HISTORY_TEMP_LSB_C, INT16_MIN, INT16_MAX)
+                       - history->lastTemp[i];
+        maxDelta = (abs(tempDelta[i]) > maxDelta) ? abs(tempDelta[i]) : maxDelta;
+    }
+    const uint8_t tempShift = shiftFor(maxDelta);
+
+    frame->tick = tick;
+    frame->IBus_dA = quantize(IBus, 0.1F, INT16_MIN, INT16_MAX);
+    frame->state = state;
+    frame->shifts = voltageShift | (tempShift << 4);
+    for (uint32_t i = 0; i < history->numCells; i++) {
+        frame->voltageDelta[i] = encodeDelta(voltageDelta[i], voltageShift);
+    }
+    for (uint32_t i = 0; i < history->numTemps; i++) {
+        frame->tempDelta[i] = encodeDelta(tempDelta[i], tempShift);
+    }
+    applyFrame(history, frame, history->lastVoltage, history->lastTemp);
+    history->count++;
+}
+
+/**
+ * @brief Stop recording so the frames leading up to a fault are kept. Only
+ * the first freeze is kept until @ref cellHistoryClear
+ */
+void cellHistoryFreeze(CellHistory_t *history, uint8_t reason)
+{
+    if (history->frozen) {
+        return;
+    }
+    history->frozen = true;
+    history->freezeReason = reason;
+    history->freezeTick = (history->count > 0)
+                          ? history->frames[(history->oldest + history->count - 1) % CELL_HISTORY_FRAMES].tick
+                          : 0;
+}
+
+/**
+ * @brief Drop all frames and start recording again
+ */
+void cellHistoryClear(CellHistory_t *history)
+{
+    cellHistoryInit(history, history->numCells, history->numTemps);
+}
+
+uint32_t cellHistoryNumFrames(const CellHistory_t *history)
+{
+    return history->count;
+}
+
+/**
+ * @brief Rebuild one frame
+ *
+ * @param index 0 for the oldest frame
+ * @param[out] voltages numCells cell voltages, V
+ * @param[out] temps numTemps channel temperatures, C
+ *
+ * @return false if there is no such frame
+ */
+bool cellHistoryGetFrame(const CellHistory_t *history, uint32_t index, float voltages[], float temps[],
+                         float *IBus, uint8_t *state, uint32_t *tick)
+{
+    if (index >= history->count) {
+        return false;
+    }
+
+    uint16_t voltageCounts[CELL_HISTORY_MAX_CELLS];
+    int16_t tempCounts[CELL_HISTORY_MAX_TEMPS];
+    memcpy(voltageCounts, history->baseVoltage, sizeof(voltageCounts));
+    memcpy(tempCounts, history->baseTemp, sizeof(tempCounts));
+
+    const CellHistoryFrame_t *frame = NULL;
+    for (uint32_t i = 0; i <= index; i++) {
+        frame = &history->frames[(history->oldest + i) % CELL_HISTORY_FRAMES];
+        applyFrame(history, frame, voltageCounts, tempCounts);
+    }
+
+    for (uint32_t i = 0; i < history->numCells; i++) {
+        voltages[i] = voltageCounts[i] * CELL_HISTORY_VOLTAGE_LSB_V;
+    }
+    for (uint32_t i = 0; i < history->numTemps; i++) {
+        temps[i] = tempCounts[i] * CELL_HISTORY_TEMP_LSB_C;
+    }
+    *IBus = frame->IBus_dA * 0.1F;
+    *state = frame->state;
+    *tick = frame->tick;
+    return true;
+}
@@ -0,0 +1,102 @@
+/**
+  *****************************************************************************
+  * @file    charge_profile.c
+  * @brief   CC-CV charge current on the highest cell, with temperature derating
+  * @details Each step the highest cell's OCV is estimated from its terminal
+  * voltage less the IR drop at the measured current and the modelled
+  * polarization. The CV current is the one that puts that cell's terminal
+  * voltage at the CV voltage at the end of the next step. Using the measured
+  * current keeps the estimate right when the charger isn't delivering what
+  * was asked. The CV voltage is held on the highest cell rather than on the
+  * pack average, so it can sit just under the over voltage limit whatever
+  * the spread.
+  *****************************************************************************
+  */
+
+#include "charge_profile.h"
+#include <math.h>
+#include <string.h>
+
+static float clampf(float value, float low, float high)
+{
+    value = value > high ? high : value;
+    return value < low ? low : value;
+}
+
+/**
+ * @brief Linear derating factor, 1 at full and 0 at zero, clamped to [0, 1].
+ * Works for derating in either direction, full and zero must differ
+ */
+static float derate(float value, float full, float zero)
+{
+    return clampf((value - zero) / (full - zero), 0.0f, 1.0f);
+}
+
+void chargeProfileInit(ChargeProfile_t *profile, const ChargeProfile_Params_t *params)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->params = *params;
+    profile->phase = CHARGE_PROFILE_CC;
+}
+
+const char *chargeProfilePhaseName(ChargeProfile_Phase_t phase)
+{
+    switch (phase) {
+        case CHARGE_PROFILE_CC: return "CC";
+        case CHARGE_PROFILE_CV: return "CV";
+        case CHARGE_PROFILE_TEMP_BLOCKED: return "temp blocked";
+        case CHARGE_PROFILE_DONE: return "done";
+        default: return "unknown";
+    }
+}
+
+/**
+ * @brief Work out the charge current for the next step
+ *
+ * @param dt_s Time since the last step, and until the next one
+ *
+ * @return Current to ask the charger for, A
+ */
+float chargeProfileStep(ChargeProfile_t *profile, const ChargeProfile_Inputs_t *in, float dt_s)
+{
+    const ChargeProfile_Params_t *p = &profile->params;
+
+    // Polarization follows the current that has actually been flowing
+    const float decay = expf(-dt_s / p->tau_s);
+    profile->polarization_V = profile->polarization_V * decay + in->current_A * p->r1_ohms * (1.0f - decay);
+
+    if (profile->phase == CHARGE_PROFILE_DONE) {
+        profile->current_A = 0.0f;
+        return profile->current_A;
+    }
+
+    const float ocvMax = in->cellVoltageMax - in->current_A * p->r0_ohms - profile->polarization_V;
+
+    // Terminal voltage at the end of the next step is OCV + I R0 plus the
+    // polarization moving from where it is towards I R1
+    const float cvCurrent = (p->cvCellVoltage - ocvMax - profile->polarization_V * decay)
+                            / (p->r0_ohms + p->r1_ohms * (1.0f - decay));
+    const float tempFactor = derate(in->tempMax, p->derateHigh_C, p->tempMax_C)
+                             * derate(in->tempMin, p->derateLow_C, p->tempMin_C);
+    const float ccCurrent = p->maxCurrent_A * tempFactor;
+
+    if (tempFactor <= 0.0f) {
+        profile->phase = CHARGE_PROFILE_TEMP_BLOCKED;
+        profile->current_A = 0.0f;
+    } else if (cvCurrent < ccCurrent) {
+        profile->phase = CHARGE_PROFILE_CV;
+        profile->current_A = fmaxf(cvCurrent, 0.0f);
+        // Done on the taper alone. While cells bleed the highest one needs
+        // about the bleed current to stay at the CV voltage, so waiting for
+        // balancing here would hold the charger on with an imbalanced pack
+        // for as long as balancing takes. It finishes with the charger off
+        if (profile->current_A <= p->termCurrent_A) {
+            profile->phase = CHARGE_PROFILE_DONE;
+            profile->current_A = 0.0f;
+        }
+    } else {
+        profile->phase = CHARGE_PROFILE_CC;
+        profile->current_A = ccCurrent;
+    }
+    return profile->current_A;
+}
@@ -21,6 +21,8 @@
 #define CHARGER_COMM_START_SEND_PERIOD_MS 100
 
 ChargerStatus mStatus = {0};
+/// Current limit charging was started with, requests are capped to it
+static float currentLimit = 0.0f;
 
 HAL_StatusTypeDef chargerInit()
 {
@@ -35,6 +37,7 @@ HAL_StatusTypeDef startChargerCommunication(float maxVoltage, float maxCurrent,
 {
     ChargerStatus status;
     uint32_t startTickCount = xTaskGetTickCount();
+    currentLimit = maxCurrent;
     do {
         sendChargerCommand(maxVoltage, maxCurrent, true /* start charing */);
         watchdogTaskCheckIn(watchdogTaskId);
@@ -56,8 +59,16 @@ HAL_StatusTypeDef startChargerCommunication(float maxVoltage, float maxCurrent,
     return HAL_OK;
 }
 
+/**
+ * @brief Sends the charger its voltage and current limits. The current is
+ * capped to the limit passed to @ref startChargerCommunication, so nothing
+ * after the start (e.g. the charge profile) can ask for more
+ */
 HAL_StatusTypeDef sendChargerCommand(float maxVoltage, float maxCurrent, bool startCharging)
 {
+   maxCurrent = maxCurrent > currentLimit ? currentLimit : maxCurrent;
+   maxCurrent = maxCurrent < 0.0f ? 0.0f : maxCurrent;
+
    uint32_t maxVoltageInt = maxVoltage / 0.1;
    uint32_t maxCurrentInt = maxCurrent / 0.1;
 
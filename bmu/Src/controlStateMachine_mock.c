@@ -25,6 +25,8 @@
 #include "batteries.h"
 #include "faultMonitor.h"
 #include "ltc_chip.h"
+#include "balance_planner.h"
+#include "fanControl.h"
 
 #if IS_BOARD_F7
 #include "imdDriver.h"
@@ -34,6 +36,7 @@ extern bool HITL_Precharge_Mode;
 extern float HITL_VPACK;
 extern uint32_t brakeAndHallAdcVals[2];
 extern float adjustedCellIR;
+extern BalancePlanner_t balancePlanner;
 
 BaseType_t debugUartOverCan(char *writeBuffer, size_t writeBufferLength,
                        const char *commandString)
@@ -123,6 +126,64 @@ static const CLI_Command_Definition_t testLowPassFilterCommandDefinition =
     0 /* Number of parameters */
 };
 
+#define HV_BUS_BENCH_ITERATIONS 2000
+/*
+ * Times publishing and reading back one set of HV bus measurements, through
+ * the lock free snapshot and through length 1 queues as they were previously
+ * published. The HV measure task does this every millisecond
+ */
+BaseType_t hvBusBenchCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    HVBusSnapshot_t snapshot;
+    HVBusMeasurements_t measurements = {0};
+    float IBus = 0, VBus = 0, VBatt = 0;
+
+    QueueHandle_t IBusQueue = xQueueCreate(1, sizeof(float));
+    QueueHandle_t VBusQueue = xQueueCreate(1, sizeof(float));
+    QueueHandle_t VBattQueue = xQueueCreate(1, sizeof(float));
+    if (IBusQueue == NULL || VBusQueue == NULL || VBattQueue == NULL) {
+        COMMAND_OUTPUT("Failed to create queues\n");
+        return pdFALSE;
+    }
+
+    uint32_t startTime = getRunTimeCounterValue();
+    for (int i = 0; i < HV_BUS_BENCH_ITERATIONS; i++) {
+        xQueueOverwrite(IBusQueue, &IBus);
+        xQueueOverwrite(VBusQueue, &VBus);
+        xQueueOverwrite(VBattQueue, &VBatt);
+        xQueuePeek(IBusQueue, &IBus, 0);
+        xQueuePeek(VBusQueue, &VBus, 0);
+        xQueuePeek(VBattQueue, &VBatt, 0);
+    }
+    uint32_t queueTime = getRunTimeCounterValue() - startTime;
+
+    hvBusSnapshotInit(&snapshot);
+    startTime = getRunTimeCounterValue();
+    for (int i = 0; i < HV_BUS_BENCH_ITERATIONS; i++) {
+        hvBusSnapshotWrite(&snapshot, &measurements);
+        hvBusSnapshotRead(&snapshot, &measurements);
+    }
+    uint32_t snapshotTime = getRunTimeCounterValue() - startTime;
+
+    vQueueDelete(IBusQueue);
+    vQueueDelete(VBusQueue);
+    vQueueDelete(VBattQueue);
+
+    // Run time counter ticks are 50 us
+    COMMAND_OUTPUT("Publish + read, per cycle: queues %lu ns, snapshot %lu ns\n",
+                   queueTime * 50000 / HV_BUS_BENCH_ITERATIONS,
+                   snapshotTime * 50000 / HV_BUS_BENCH_ITERATIONS);
+    return pdFALSE;
+}
+static const CLI_Command_Definition_t hvBusBenchCommandDefinition =
+{
+    "hvBusBench",
+    "hvBusBench:\r\n Time publishing and reading HV bus measurements with queues vs the snapshot\r\n",
+    hvBusBenchCommand,
+    0 /* Number of parameters */
+};
+
 BaseType_t printBattInfo(char *writeBuffer, size_t writeBufferLength,
                        const char *commandString)
 {
@@ -415,6 +476,38 @@ static const CLI_Command_Definition_t maxChargeCurrentCommandDefinition =
     1 /* Number of parameters */
 };
 
+BaseType_t fanLimitsCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    BaseType_t paramLen;
+    float offTemp, peakTemp, maxDuty;
+
+    const char *offTempParam = FreeRTOS_CLIGetParameter(commandString, 1, &paramLen);
+    const char *peakTempParam = FreeRTOS_CLIGetParameter(commandString, 2, &paramLen);
+    const char *maxDutyParam = FreeRTOS_CLIGetParameter(commandString, 3, &paramLen);
+
+    sscanf(offTempParam, "%f", &offTemp);
+    sscanf(peakTempParam, "%f", &peakTemp);
+    sscanf(maxDutyParam, "%f", &maxDuty);
+
+    if (setFanLimits(offTemp, peakTemp, maxDuty) != HAL_OK) {
+        COMMAND_OUTPUT("Invalid fan limits, need off < peak <= %.0f C and max duty above the stall duty\n",
+                       CELL_MAX_TEMP_C);
+        return pdFALSE;
+    }
+
+    COMMAND_OUTPUT("Fans off below %f C, full at %f C, max duty %f\n", offTemp, peakTemp, maxDuty);
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t fanLimitsCommandDefinition =
+{
+    "fanLimits",
+    "fanLimits <off temp> <peak temp> <max duty>:\r\n  set the pack fan temperature limits and duty limit (0 to 1)\r\n",
+    fanLimitsCommand,
+    3 /* Number of parameters */
+};
+
 BaseType_t startChargeCommand(char *writeBuffer, size_t writeBufferLength,
                        const char *commandString)
 {
@@ -607,7 +700,13 @@ BaseType_t IMDStatusCommand(char *writeBuffer, size_t writeBufferLength,
                        const char *commandString)
 {
 #if IS_BOARD_F7
-    COMMAND_OUTPUT("IMD Status %d\n", get_imd_status());
+    ImdDecoder_t decoder;
+    get_imd_decoder(&decoder);
+    COMMAND_OUTPUT("IMD Status %d, band %s, %.2f Hz, duty %.1f %%, %.0f kOhm\n",
+                   get_imd_status(), imdDecoderBandName(decoder.valid ? decoder.band : IMD_BAND_NONE),
+                   decoder.frequency_Hz, decoder.duty_percent, decoder.resistance_kOhms);
+    COMMAND_OUTPUT("%lu captures, %lu outliers, %lu band changes, valid after %lu ms\n",
+                   decoder.captures, decoder.outliers, decoder.bandChanges, decoder.timeToValid_ms);
 #else
     COMMAND_OUTPUT("IMD Disabled (batt monitoring hardware disabled)\n");
 #endif
@@ -974,10 +1073,12 @@ BaseType_t balanceCellsCommand(char *writeBuffer, size_t writeBufferLength,
         COMMAND_OUTPUT("Unkown parameter\n");
         return pdFALSE;
     }
+    bool balance[NUM_VOLTAGE_CELLS];
     for(int i = 0;i < NUM_VOLTAGE_CELLS;i++)
 	{
-		balance_cell(i, onOff);
+		balance[i] = onOff;
 	}
+    balance_cells(balance);
     return pdFALSE;
 }
 
@@ -1048,6 +1149,234 @@ static const CLI_Command_Definition_t setCellIRCommandDefinition =
 
 
 
+BaseType_t balancePlanCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    static int cellIdx = -1;
+
+    if (cellIdx == -1) {
+        COMMAND_OUTPUT("Predicted time to balance: %.0f s\r\nCell\tBleeding\tRemaining(s)\r\n",
+                       balancePlanner.predictedTimeToBalance_s);
+        cellIdx = 0;
+        return pdTRUE;
+    }
+
+    if (balancePlanner.remaining_s[cellIdx] > 0.0f) {
+        COMMAND_OUTPUT("%d\t%d\t%.0f\r\n", cellIdx+1, balancePlanner.bleeding[cellIdx],
+                       balancePlanner.remaining_s[cellIdx]);
+    }
+
+    ++cellIdx;
+    if (cellIdx >= NUM_VOLTAGE_CELLS) {
+        cellIdx = -1;
+        return pdFALSE;
+    } else {
+        vTaskDelay(1); // Hack to avoid overflowing our serial buffer
+        return pdTRUE;
+    }
+}
+
+static const CLI_Command_Definition_t balancePlanCommandDefinition =
+{
+    "balancePlan",
+    "balancePlan:\r\n Print predicted time to balance and the remaining balance time for each cell\r\n",
+    balancePlanCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t pecStatsCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+#if IS_BOARD_F7
+    static int board = -1;
+
+    if (board == -1) {
+        COMMAND_OUTPUT("PEC errors since boot\r\nBoard\tCFG\tCVA\tCVB\tCVC\tCVD\tAUXB\r\n");
+        board = 0;
+        return pdTRUE;
+    }
+
+    COMMAND_OUTPUT("%d\t%lu\t%lu\t%lu\t%lu\t%lu\t%lu\r\n", board,
+                   batt_get_pec_errors(board, LTC_REG_CFG),
+                   batt_get_pec_errors(board, LTC_REG_CVA),
+                   batt_get_pec_errors(board, LTC_REG_CVB),
+                   batt_get_pec_errors(board, LTC_REG_CVC),
+                   batt_get_pec_errors(board, LTC_REG_CVD),
+                   batt_get_pec_errors(board, LTC_REG_AUXB));
+
+    ++board;
+    if (board >= NUM_BOARDS) {
+        board = -1;
+        return pdFALSE;
+    } else {
+        vTaskDelay(1); // Hack to avoid overflowing our serial buffer
+        return pdTRUE;
+    }
+#else
+    COMMAND_OUTPUT("PEC stats disabled (batt monitoring hardware disabled)\n");
+    return pdFALSE;
+#endif
+}
+
+static const CLI_Command_Definition_t pecStatsCommandDefinition =
+{
+    "pecStats",
+    "pecStats:\r\n Print PEC error counts per AMS board and register group\r\n",
+    pecStatsCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t pecStatsClearCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+#if IS_BOARD_F7
+    batt_clear_pec_errors();
+#endif
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t pecStatsClearCommandDefinition =
+{
+    "pecStatsClear",
+    "pecStatsClear:\r\n Clear PEC error counts\r\n",
+    pecStatsClearCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t configWritesCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+#if IS_BOARD_F7
+    uint32_t writes, skipped;
+    batt_get_config_write_counts(&writes, &skipped);
+    COMMAND_OUTPUT("AMS config writes: %lu sent, %lu skipped as unchanged\r\n", writes, skipped);
+#else
+    COMMAND_OUTPUT("Config writes disabled (batt monitoring hardware disabled)\n");
+#endif
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t configWritesCommandDefinition =
+{
+    "configWrites",
+    "configWrites:\r\n Print the number of AMS config writes sent and skipped since boot\r\n",
+    configWritesCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t cellHistoryCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    static int frame = -1;
+    static float voltages[CELL_HISTORY_MAX_CELLS];
+    static float temps[CELL_HISTORY_MAX_TEMPS];
+    const CellHistory_t *history = getCellHistory();
+
+    if (!history->frozen) {
+        COMMAND_OUTPUT("Cell history is recording, only available once frozen by a fault\n");
+        return pdFALSE;
+    }
+
+    if (frame == -1) {
+        COMMAND_OUTPUT("Cell history frozen (reason %u), %lu frames\r\n"
+                       "ms\tstate\tIBus\tVmin\tcell\tVmax\tcell\tTmax\r\n",
+                       history->freezeReason, cellHistoryNumFrames(history));
+        frame = 0;
+        return pdTRUE;
+    }
+
+    float IBus;
+    uint8_t state;
+    uint32_t tick;
+    if (!cellHistoryGetFrame(history, frame, voltages, temps, &IBus, &state, &tick)) {
+        frame = -1;
+        return pdFALSE;
+    }
+
+    int minCell = 0;
+    int maxCell = 0;
+    float maxTemp = temps[0];
+    for (int i = 1; i < NUM_VOLTAGE_CELLS; i++) {
+        if (voltages[i] < voltages[minCell]) { minCell = i; }
+        if (voltages[i] > voltages[maxCell]) { maxCell = i; }
+    }
+    for (int i = 1; i < NUM_TEMP_CELLS; i++) {
+        if (temps[i] > maxTemp) { maxTemp = temps[i]; }
+    }
+    COMMAND_OUTPUT("-%lu\t%u\t%.1f\t%.3f\t%d\t%.3f\t%d\t%.1f\r\n",
+                   (history->freezeTick - tick) * portTICK_PERIOD_MS, state, IBus,
+                   voltages[minCell], minCell, voltages[maxCell], maxCell, maxTemp);
+
+    ++frame;
+    vTaskDelay(1); // Hack to avoid overflowing our serial buffer
+    return pdTRUE;
+}
+
+static const CLI_Command_Definition_t cellHistoryCommandDefinition =
+{
+    "cellHistory",
+    "cellHistory:\r\n Print a summary of each frame of the cell history frozen at the last fault\r\n",
+    cellHistoryCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t cellHistorySendCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    restartCellHistorySend();
+    COMMAND_OUTPUT("Sending cell history over CAN once frozen\n");
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t cellHistorySendCommandDefinition =
+{
+    "cellHistorySend",
+    "cellHistorySend:\r\n Send the frozen cell history over CAN again\r\n",
+    cellHistorySendCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t cellHistoryClearCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    clearCellHistory();
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t cellHistoryClearCommandDefinition =
+{
+    "cellHistoryClear",
+    "cellHistoryClear:\r\n Drop the frozen cell history and start recording again\r\n",
+    cellHistoryClearCommand,
+    0 /* Number of parameters */
+};
+
+BaseType_t cellBroadcastPackedCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    BaseType_t paramLen;
+    const char * onOffParam = FreeRTOS_CLIGetParameter(commandString, 1, &paramLen);
+
+    if (STR_EQ(onOffParam, "on", paramLen)) {
+        setCellBroadcastPacked(true);
+        COMMAND_OUTPUT("Sending cells with the packed messages\n");
+    } else if (STR_EQ(onOffParam, "off", paramLen)) {
+        setCellBroadcastPacked(false);
+        COMMAND_OUTPUT("Sending cells 3 per message\n");
+    } else {
+        COMMAND_OUTPUT("Unkown parameter\n");
+    }
+    return pdFALSE;
+}
+
+static const CLI_Command_Definition_t cellBroadcastPackedCommandDefinition =
+{
+    "cellBroadcastPacked",
+    "cellBroadcastPacked <on|off>:\r\n Send cell voltages and temps 5 per message (BMU_CellVoltagePacked, BMU_ChannelTempPacked)\r\n",
+    cellBroadcastPackedCommand,
+    1 /* Number of parameters */
+};
+
 HAL_StatusTypeDef stateMachineMockInit()
 {
     cliSetVBatt(0);
@@ -1114,6 +1443,9 @@ HAL_StatusTypeDef stateMachineMockInit()
     if (FreeRTOS_CLIRegisterCommand(&maxChargeCurrentCommandDefinition) != pdPASS) {
         return HAL_ERROR;
     }
+    if (FreeRTOS_CLIRegisterCommand(&fanLimitsCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
     if (FreeRTOS_CLIRegisterCommand(&chargeCartHeartbeatMockCommandDefinition) != pdPASS) {
         return HAL_ERROR;
     }
@@ -1195,6 +1527,33 @@ HAL_StatusTypeDef stateMachineMockInit()
     if (FreeRTOS_CLIRegisterCommand(&setCellIRCommandDefinition) != pdPASS) {
         return HAL_ERROR;
     }
+    if (FreeRTOS_CLIRegisterCommand(&balancePlanCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&hvBusBenchCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&pecStatsCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&pecStatsClearCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&configWritesCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&cellHistoryCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&cellHistorySendCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&cellHistoryClearCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&cellBroadcastPackedCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
 
 
     return HAL_OK;
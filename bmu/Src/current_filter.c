@@ -0,0 +1,156 @@
+/**
+  *****************************************************************************
+  * @file    current_filter.c
+  * @brief   Decimating filter pipeline for the HV bus current
+  * @details The CIC runs in integer arithmetic on samples quantized to
+  * cicLsb_A, so it has no rounding error and its integrators can wrap around
+  * freely. Only the difference taken by the combs has to fit, which the input
+  * clamp guarantees. Droop of the CIC across the slow passband is well under
+  * 1% as long as slowCutoff_Hz is a small fraction of the decimated rate, so
+  * no compensation filter is used.
+  *
+  * The Butterworth sections are designed at init with the bilinear transform
+  * so the cutoffs can be changed without regenerating coefficients.
+  *****************************************************************************
+  */
+
+#include "current_filter.h"
+#include <math.h>
+
+#define PI_F 3.14159265f
+
+// Default pipeline for 1 kHz samples from the HV measure task
+#define DEFAULT_SAMPLE_RATE_HZ (1000.0f)
+#define DEFAULT_FAST_CUTOFF_HZ (50.0f)
+#define DEFAULT_CIC_ORDER (2)
+#define DEFAULT_CIC_DECIMATION (10)
+#define DEFAULT_SLOW_CUTOFF_HZ (5.0f)
+#define DEFAULT_CIC_LSB_A (0.001f)
+
+// Section Q for 2nd and 4th order Butterworth filters
+#define BUTTERWORTH_2_Q (0.70710678f)
+static const float butterworth4Q[CURRENT_FILTER_SLOW_SECTIONS] = {0.54119610f, 1.30656296f};
+
+void currentFilterDefaultParams(CurrentFilter_Params_t *params)
+{
+    params->sampleRate_Hz = DEFAULT_SAMPLE_RATE_HZ;
+    params->fastCutoff_Hz = DEFAULT_FAST_CUTOFF_HZ;
+    params->cicOrder = DEFAULT_CIC_ORDER;
+    params->cicDecimation = DEFAULT_CIC_DECIMATION;
+    params->slowCutoff_Hz = DEFAULT_SLOW_CUTOFF_HZ;
+    params->cicLsb_A = DEFAULT_CIC_LSB_A;
+}
+
+/**
+ * @brief Design a 2nd order low pass section with unity DC gain
+ */
+static void designLowPass(CurrentFilter_Biquad_t *section, float cutoff_Hz, float sampleRate_Hz, float q)
+{
+    float k = tanf(PI_F * cutoff_Hz / sampleRate_Hz);
+    float norm = 1.0f / (1.0f + k / q + k * k);
+
+    section->b0 = k * k * norm;
+    section->b1 = 2.0f * section->b0;
+    section->b2 = section->b0;
+    section->a1 = 2.0f * (k * k - 1.0f) * norm;
+    section->a2 = (1.0f - k / q + k * k) * norm;
+    section->z1 = 0.0f;
+    section->z2 = 0.0f;
+}
+
+static float biquadStep(CurrentFilter_Biquad_t *section, float x)
+{
+    float y = section->b0 * x + section->z1;
+
+    section->z1 = section->b1 * x - section->a1 * y + section->z2;
+    section->z2 = section->b2 * x - section->a2 * y;
+    return y;
+}
+
+void currentFilterInit(CurrentFilter_t *filter, const CurrentFilter_Params_t *params)
+{
+    filter->params = *params;
+    if (filter->params.cicOrder < 1)
+    {
+        filter->params.cicOrder = 1;
+    }
+    else if (filter->params.cicOrder > CURRENT_FILTER_MAX_CIC_ORDER)
+    {
+        filter->params.cicOrder = CURRENT_FILTER_MAX_CIC_ORDER;
+    }
+    if (filter->params.cicDecimation < 1)
+    {
+        filter->params.cicDecimation = 1;
+    }
+
+    float gain = 1.0f;
+    for (uint32_t i = 0; i < filter->params.cicOrder; i++)
+    {
+        gain *= (float)filter->params.cicDecimation;
+        filter->integrators[i] = 0;
+        filter->combs[i] = 0;
+    }
+    filter->maxCounts = (int32_t)((float)INT32_MAX / gain);
+    filter->cicScale = filter->params.cicLsb_A / gain;
+    filter->decimationCount = 0;
+
+    designLowPass(&filter->fastSection, filter->params.fastCutoff_Hz,
+                  filter->params.sampleRate_Hz, BUTTERWORTH_2_Q);
+    float decimatedRate_Hz = filter->params.sampleRate_Hz / filter->params.cicDecimation;
+    for (int i = 0; i < CURRENT_FILTER_SLOW_SECTIONS; i++)
+    {
+        designLowPass(&filter->slowSections[i], filter->params.slowCutoff_Hz,
+                      decimatedRate_Hz, butterworth4Q[i]);
+    }
+
+    filter->fast = 0.0f;
+    filter->slow = 0.0f;
+}
+
+/**
+ * @brief Filter a new current sample. Results are in filter->fast and
+ * filter->slow
+ *
+ * @param sample Current, A
+ *
+ * @return true if the slow output was updated
+ */
+bool currentFilterStep(CurrentFilter_t *filter, float sample)
+{
+    const uint32_t order = filter->params.cicOrder;
+
+    filter->fast = biquadStep(&filter->fastSection, sample);
+
+    float counts = sample / filter->params.cicLsb_A;
+    counts = counts > filter->maxCounts ? filter->maxCounts : counts;
+    counts = counts < -filter->maxCounts ? -filter->maxCounts : counts;
+
+    uint32_t acc = (uint32_t)(int32_t)lrintf(counts);
+    for (uint32_t i = 0; i < order; i++)
+    {
+        filter->integrators[i] += acc;
+        acc = filter->integrators[i];
+    }
+
+    if (++filter->decimationCount < filter->params.cicDecimation)
+    {
+        return false;
+    }
+    filter->decimationCount = 0;
+
+    for (uint32_t i = 0; i < order; i++)
+    {
+        uint32_t diff = acc - filter->combs[i];
+        filter->combs[i] = acc;
+        acc = diff;
+    }
+
+    float slow = (float)(int32_t)acc * filter->cicScale;
+    for (int i = 0; i < CURRENT_FILTER_SLOW_SECTIONS; i++)
+    {
+        slow = biquadStep(&filter->slowSections[i], slow);
+    }
+    filter->slow = slow;
+
+    return true;
+}
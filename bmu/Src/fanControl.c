@@ -4,44 +4,117 @@
   * @author  Richard Matthews
   * @brief   Module controlling battery pack fans.
   * @details The battery pack contains an array of fans to cool the battery.
-  * The BMU controls the fans based on the temperature of the battery cells,
-  * turning them on as the cells heat up and increasing the fan speed
-  * proportional to temeprature.
+  * The BMU controls the fans based on the temperature trend of the battery
+  * cells and the I^2 R heating from the pack current (see fan_controller.h),
+  * turning them on as the cells heat up and backing them off once the pack
+  * is cooling.
   ******************************************************************************
   */
 
 #include "bsp.h"
 #include "fanControl.h"
+#include "fan_controller.h"
 #include "bmu_can.h"
 #include "batteries.h"
 #include "debug.h"
 #include "controlStateMachine.h"
 #include "state_machine.h"
 
-#define FAN_OFF_TEMP 25
-#define FAN_PEAK_TEMP 35
+#define FAN_OFF_TEMP 26
+#define FAN_PEAK_TEMP 38
 // Fans need pwm of 25 kHz, so we set timer to have 10 MHz freq, and 400 period
 #define FAN_MAX_DUTY_PERCENT 1.0
 #define FAN_ON_DUTY_PERCENT 0.2
 #define FAN_PERIOD_COUNT 400
 #define FAN_TASK_PERIOD_MS 1000
+/// Hottest cell temperature is projected this far ahead by its trend
+#define FAN_HORIZON_S (240.0F)
+/// Smoothing of the temperature trend and the pack current heating
+#define FAN_TREND_TAU_S (60.0F)
+/// Floor on the peak to inlet temperature difference used for feed-forward
+#define FAN_MIN_DELTA_T_K (2.0F)
+/// Max input power of one pack fan, 12 V 4-pin PWM (NF-F12 industrialPPC-3000 PWM datasheet: 0.3 A, 3.6 W)
+#define FAN_RATED_POWER_W (3.6F)
+#define FAN_COUNT (4)
+/// LV power of the pack fans at full duty
+#define FAN_FULL_POWER_W (FAN_COUNT * FAN_RATED_POWER_W)
+
+static FanController_t fanController;
+
+static FanController_Params_t fanParams = {
+    .offTemp_C = FAN_OFF_TEMP,
+    .peakTemp_C = FAN_PEAK_TEMP,
+    .minDuty = FAN_ON_DUTY_PERCENT,
+    .maxDuty = FAN_MAX_DUTY_PERCENT,
+    .horizon_s = FAN_HORIZON_S,
+    .trendTau_s = FAN_TREND_TAU_S,
+    .heatingResistance_ohms = THERMAL_HEATING_R,
+    .coolingFanOff_WperK = THERMAL_COOLING_FAN_OFF,
+    .coolingFanFull_WperK = THERMAL_COOLING_FAN_FULL,
+    .minDeltaT_K = FAN_MIN_DELTA_T_K,
+    .fullPower_W = FAN_FULL_POWER_W,
+};
+
+/// Set from the CLI, applied by the fan task
+static volatile bool fanParamsChanged = false;
+
+/**
+ * @brief Sets the fan temperature limits and duty limit
+ *
+ * @param offTemp Fans can be off with the projected hottest cell below this, C
+ * @param peakTemp Full fans with the projected hottest cell at this, C
+ * @param maxDuty Fan duty limit, 0 to 1
+ *
+ * @return HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef setFanLimits(float offTemp, float peakTemp, float maxDuty)
+{
+  if (peakTemp <= offTemp || peakTemp > CELL_MAX_TEMP_C
+      || maxDuty < FAN_ON_DUTY_PERCENT || maxDuty > 1.0f)
+  {
+    return HAL_ERROR;
+  }
+
+  fanParams.offTemp_C = offTemp;
+  fanParams.peakTemp_C = peakTemp;
+  fanParams.maxDuty = maxDuty;
+  fanParamsChanged = true;
+
+  return HAL_OK;
+}
 
 uint32_t calculateFanPeriod()
 {
-  // PWM Output is inverted from what we generate from PROC
-  // Full fan while charging
-  if (fsmGetState(&fsmHandle) == STATE_Charging || fsmGetState(&fsmHandle) == STATE_Balancing) {
-    /*DEBUG_PRINT("Charging fans\n");*/
-    return FAN_PERIOD_COUNT - FAN_PERIOD_COUNT*FAN_MAX_DUTY_PERCENT;
+  static TickType_t lastStep = 0;
+
+  if (fanParamsChanged) {
+    // Keeps the estimated energy used across the change
+    float energy = fanController.energy_J;
+    fanParamsChanged = false;
+    fanControllerInit(&fanController, &fanParams);
+    fanController.energy_J = energy;
   }
 
-  if (TempCellMax < FAN_OFF_TEMP) {
-    return FAN_PERIOD_COUNT;
+  float IBus = 0.0f;
+  if (getIBus(&IBus) != HAL_OK) {
+    IBus = 0.0f;
   }
 
-  return FAN_PERIOD_COUNT - map_range_float(TempCellMax, FAN_OFF_TEMP, FAN_PEAK_TEMP,
-                      FAN_PERIOD_COUNT*FAN_ON_DUTY_PERCENT,
-                      FAN_PERIOD_COUNT*FAN_MAX_DUTY_PERCENT);
+  TickType_t now = xTaskGetTickCount();
+  float dt_s = fanController.initialized ? (float)(now - lastStep) * portTICK_PERIOD_MS / 1000.0f : 0.0f;
+  lastStep = now;
+
+  FanController_Inputs_t inputs = {
+    .tempMax = TempCellMax,
+    .tempInlet = TempCellMin,
+    .current_A = IBus,
+    // Full fan while charging
+    .forceFull = fsmGetState(&fsmHandle) == STATE_Charging || fsmGetState(&fsmHandle) == STATE_Balancing,
+  };
+  float duty = fanControllerStep(&fanController, &inputs, dt_s);
+
+  // PWM Output is inverted from what we generate from PROC
+  return FAN_PERIOD_COUNT - FAN_PERIOD_COUNT * duty;
 }
 
 HAL_StatusTypeDef fanInit()
@@ -64,10 +137,21 @@ HAL_StatusTypeDef setFan()
   __HAL_TIM_SET_COMPARE(&FAN_HANDLE, TIM_CHANNEL_1, duty);
   
   FanPeriod = duty;
+  FanPower = fanController.power_W;
+  FanEnergy = fanController.energy_J / 3600.0f;
   sendCAN_BMU_FanPeriod();
   return HAL_OK;
 }
 
+/**
+ * @return Current fan duty, 0 (off) to 1 (full)
+ */
+float getFanDuty(void)
+{
+  // PWM output is inverted, see calculateFanPeriod
+  return (float)(FAN_PERIOD_COUNT - FanPeriod) / FAN_PERIOD_COUNT;
+}
+
 /**
  * Task to control the battery box fans.
  */
@@ -78,6 +162,8 @@ void fanTask()
     Error_Handler();
   }
 
+  fanControllerInit(&fanController, &fanParams);
+
   TickType_t xLastWakeTime = xTaskGetTickCount();
   while (1) {
     setFan();
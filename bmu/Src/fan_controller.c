@@ -0,0 +1,92 @@
+/**
+  *****************************************************************************
+  * @file    fan_controller.c
+  * @brief   Pack fan duty from the hottest cell's trend and the I^2 R heating
+  * @details The hottest cell temperature is tracked with an alpha-beta
+  * filter, giving a smoothed level and trend without the lag of
+  * differencing a smoothed signal. The feedback duty maps the level
+  * projected horizon_s ahead linearly from offTemp_C (none) to peakTemp_C
+  * (full). The feed-forward duty balances the hottest channel's lumped model
+  *
+  *   heat = (Goff + Gfull duty) (T - T_inlet)
+  *
+  * at the present temperature difference, the duty that stops the heating
+  * raising it further. It is only added once the projection is above
+  * offTemp_C, there's no point cooling a cold pack. Fan power goes with the
+  * cube of speed, taken as proportional to duty.
+  *****************************************************************************
+  */
+
+#include "fan_controller.h"
+#include <math.h>
+#include <string.h>
+
+static float clampf(float value, float low, float high)
+{
+    value = value > high ? high : value;
+    return value < low ? low : value;
+}
+
+void fanControllerInit(FanController_t *fan, const FanController_Params_t *params)
+{
+    memset(fan, 0, sizeof(*fan));
+    fan->params = *params;
+}
+
+/**
+ * @brief Work out the fan duty for the next step
+ *
+ * @param dt_s Time since the last step
+ *
+ * @return Fan duty, 0 (off) to 1 (full)
+ */
+float fanControllerStep(FanController_t *fan, const FanController_Inputs_t *in, float dt_s)
+{
+    const FanController_Params_t *p = &fan->params;
+    const float heat = in->current_A * in->current_A * p->heatingResistance_ohms;
+
+    if (!fan->initialized) {
+        fan->level_C = in->tempMax;
+        fan->trend_Kps = 0.0f;
+        fan->heat_W = heat;
+        fan->initialized = true;
+    } else if (dt_s > 0.0f) {
+        // Critically damped alpha-beta filter
+        const float alpha = 1.0f - expf(-dt_s / p->trendTau_s);
+        const float beta = alpha * alpha / (2.0f - alpha);
+        const float predicted = fan->level_C + fan->trend_Kps * dt_s;
+        const float residual = in->tempMax - predicted;
+        fan->level_C = predicted + alpha * residual;
+        fan->trend_Kps += beta * residual / dt_s;
+        fan->heat_W += alpha * (heat - fan->heat_W);
+    }
+
+    fan->projected_C = fan->level_C + fan->trend_Kps * p->horizon_s;
+    const float feedback = (fan->projected_C - p->offTemp_C) / (p->peakTemp_C - p->offTemp_C);
+
+    fan->feedForward = 0.0f;
+    if (fan->projected_C > p->offTemp_C) {
+        const float deltaT = fmaxf(p->peakTemp_C - in->tempInlet, p->minDeltaT_K);
+        fan->feedForward = fmaxf((fan->heat_W / deltaT - p->coolingFanOff_WperK) / p->coolingFanFull_WperK, 0.0f);
+    }
+
+    float demand = clampf(feedback + fan->feedForward, 0.0f, p->maxDuty);
+    if (in->forceFull) {
+        demand = p->maxDuty;
+    }
+
+    // Off below the stall duty, held at it down to half of it once running
+    if (demand >= p->minDuty) {
+        fan->duty = demand;
+    } else if (fan->duty > 0.0f && demand >= p->minDuty / 2.0f) {
+        fan->duty = p->minDuty;
+    } else {
+        fan->duty = 0.0f;
+    }
+
+    fan->power_W = p->fullPower_W * fan->duty * fan->duty * fan->duty;
+    if (dt_s > 0.0f) {
+        fan->energy_J += fan->power_W * dt_s;
+    }
+    return fan->duty;
+}
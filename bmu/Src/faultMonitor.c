@@ -7,6 +7,11 @@
   * interlock loop (IL) and high voltage interlock loop (HVIL) and reports an
   * error when either breaks. Also contains functions for getting the status of
   * various points along the IL.
+  *
+  * Once running, openings of the loops are caught by GPIO edge interrupts
+  * which wake the task, and confirmed after FAULT_DEBOUNCE_US (see
+  * interlock_monitor.c). The loops are also sampled every
+  * FAULT_MEASURE_TASK_PERIOD in case an edge is missed.
   ******************************************************************************
   */
 
@@ -17,10 +22,20 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "bmu_can.h"
+#include "interlock_monitor.h"
+#include "cycleClock.h"
+#include "cmsis_os.h"
+
+#if IS_BOARD_F7
+#include "hvAdcDriver.h"
+#endif
 
 #define FAULT_MEASURE_TASK_PERIOD 100
 #define FAULT_TASK_ID 6
 
+/// Time a loop must stay open before it is reported
+#define FAULT_DEBOUNCE_US 1000
+
 #define ENABLE_IL_CHECKS
 
 #define HVIL_ENABLED (0)
@@ -36,6 +51,12 @@
 
 bool skip_il = false;
 
+extern osThreadId FaultMonitorHandle;
+
+/// Debounced state of each loop, along with when it opened
+static InterlockMonitor_t interlockMonitor;
+static volatile bool interlockEdgesEnabled = false;
+
 HAL_StatusTypeDef HVIL_Control(bool enable)
 {
    if (enable)
@@ -90,6 +111,180 @@ bool getCBRB_IL_Status()
    return (HAL_GPIO_ReadPin(COCKPIT_BRB_SENSE_GPIO_Port, COCKPIT_BRB_SENSE_Pin) == GPIO_PIN_SET || skip_il);
 }
 
+static void readInterlockLevels(bool closed[NUM_INTERLOCK_LOOPS])
+{
+   closed[INTERLOCK_HVIL] = getHVIL_Status();
+   closed[INTERLOCK_BRB] = getIL_BRB_Status();
+   closed[INTERLOCK_BSPD] = getBSPD_Status();
+   closed[INTERLOCK_HVD] = getHVD_Status();
+   closed[INTERLOCK_IL] = getIL_Status();
+   closed[INTERLOCK_CBRB] = getCBRB_IL_Status();
+}
+
+/**
+ * @brief Switches the loop sense inputs to interrupt on both edges. Pulls
+ * match the Cube configuration. Only on the F7 as on the nucleo some of the
+ * inputs share EXTI lines, so there we rely on sampling
+ */
+static void interlockEdgesInit()
+{
+#if IS_BOARD_F7
+   GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+   GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+   GPIO_InitStruct.Pull = GPIO_NOPULL;
+   GPIO_InitStruct.Pin = BSPD_SENSE_Pin;
+   HAL_GPIO_Init(BSPD_SENSE_GPIO_Port, &GPIO_InitStruct);
+
+   GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+   GPIO_InitStruct.Pin = IL_SENSE_Pin;
+   HAL_GPIO_Init(IL_SENSE_GPIO_Port, &GPIO_InitStruct);
+#if HVIL_ENABLED
+   GPIO_InitStruct.Pin = HVIL_SENSE_Pin;
+   HAL_GPIO_Init(HVIL_SENSE_GPIO_Port, &GPIO_InitStruct);
+#endif
+   GPIO_InitStruct.Pin = HVD_SENSE_Pin|COCKPIT_BRB_SENSE_Pin|TSMS_SENSE_Pin;
+   HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
+
+   // Must be at or below configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY to notify the task
+   HAL_NVIC_SetPriority(EXTI0_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+   HAL_NVIC_SetPriority(EXTI9_5_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+   HAL_NVIC_SetPriority(EXTI15_10_IRQn, 5, 0);
+   HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
+
+   interlockEdgesEnabled = true;
+#endif
+}
+
+#if IS_BOARD_F7
+void EXTI0_IRQHandler(void)
+{
+   HAL_GPIO_EXTI_IRQHandler(COCKPIT_BRB_SENSE_Pin);
+}
+
+void EXTI9_5_IRQHandler(void)
+{
+   HAL_GPIO_EXTI_IRQHandler(TSMS_SENSE_Pin);
+   HAL_GPIO_EXTI_IRQHandler(HVD_SENSE_Pin);
+}
+
+void EXTI15_10_IRQHandler(void)
+{
+   HAL_GPIO_EXTI_IRQHandler(BSPD_SENSE_Pin);
+   HAL_GPIO_EXTI_IRQHandler(HVIL_SENSE_Pin);
+   HAL_GPIO_EXTI_IRQHandler(IL_SENSE_Pin);
+}
+
+void HAL_GPIO_EXTI_Callback(uint16_t pin)
+{
+   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+   uint32_t now = cycleClockMicros();
+   InterlockLoop_t loop;
+   bool closed;
+
+   // Shares the callback, but streams the HV ADC rather than the loops
+   if (pin == HV_ADC_DREADY_L_Pin) {
+      hv_adc_dready_isr();
+      return;
+   }
+
+   if (!interlockEdgesEnabled) {
+      return;
+   }
+
+   switch (pin)
+   {
+      case HVIL_SENSE_Pin:
+         loop = INTERLOCK_HVIL;
+         closed = getHVIL_Status();
+         break;
+      case IL_SENSE_Pin:
+         loop = INTERLOCK_BRB;
+         closed = getIL_BRB_Status();
+         break;
+      case BSPD_SENSE_Pin:
+         loop = INTERLOCK_BSPD;
+         closed = getBSPD_Status();
+         break;
+      case HVD_SENSE_Pin:
+         loop = INTERLOCK_HVD;
+         closed = getHVD_Status();
+         break;
+      case TSMS_SENSE_Pin:
+         loop = INTERLOCK_IL;
+         closed = getIL_Status();
+         break;
+      case COCKPIT_BRB_SENSE_Pin:
+         loop = INTERLOCK_CBRB;
+         closed = getCBRB_IL_Status();
+         break;
+      default:
+         return;
+   }
+
+   interlockMonitorEdge(&interlockMonitor, loop, closed, now);
+   vTaskNotifyGiveFromISR(FaultMonitorHandle, &xHigherPriorityTaskWoken);
+   portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+#endif
+
+/**
+ * @brief Waits for a loop edge or the end of the pending debounce time (at
+ * most FAULT_MEASURE_TASK_PERIOD), then confirms any loops that opened
+ *
+ * @return Bit mask (1 << @ref InterlockLoop_t) of loops newly confirmed open
+ */
+static uint32_t waitForInterlockChange()
+{
+   TickType_t timeout = pdMS_TO_TICKS(FAULT_MEASURE_TASK_PERIOD);
+   bool closed[NUM_INTERLOCK_LOOPS];
+   uint32_t wait_us;
+   uint32_t opened;
+
+   taskENTER_CRITICAL();
+   bool pending = interlockMonitorPending(&interlockMonitor, cycleClockMicros(), &wait_us);
+   taskEXIT_CRITICAL();
+   if (pending) {
+      // Round up so the debounce has passed when we wake
+      timeout = pdMS_TO_TICKS(wait_us / 1000) + 1;
+   }
+   ulTaskNotifyTake(pdTRUE, timeout);
+
+   uint32_t now = cycleClockMicros();
+   readInterlockLevels(closed);
+   taskENTER_CRITICAL();
+   opened = interlockMonitorUpdate(&interlockMonitor, closed, now);
+   taskEXIT_CRITICAL();
+
+   for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++) {
+      if (opened & (1U << loop)) {
+         InterlockLoopState_t *state = &interlockMonitor.loops[loop];
+         ERROR_PRINT("Fault Monitor: %s opened at %lu us, confirmed %lu us later\n",
+                     interlockLoopName(loop), state->openedAt_us,
+                     state->confirmedAt_us - state->openedAt_us);
+      }
+   }
+
+   return opened;
+}
+
+/**
+ * @brief Reports a loop opening over CAN with the time it opened, and how
+ * long it took to confirm
+ */
+static void sendInterlockStatus(uint8_t failedBit, InterlockLoop_t loop)
+{
+   InterlockLoopState_t *state = &interlockMonitor.loops[loop];
+   uint32_t latency = state->confirmedAt_us - state->openedAt_us;
+
+   BMU_checkFailed = failedBit;
+   BMU_checkFailedTime = state->openedAt_us;
+   BMU_checkFailedLatency = latency > UINT16_MAX ? UINT16_MAX : latency;
+   sendCAN_BMU_Interlock_Loop_Status();
+}
+
 /**
  * Task to continuously monitor the HVIL and IL.
  */
@@ -227,15 +422,19 @@ void faultMonitorTask(void *pvParameters)
 		Error_Handler();
    }
 	
+   cycleClockInit();
+   interlockMonitorInit(&interlockMonitor, FAULT_DEBOUNCE_US);
+   interlockEdgesInit();
+
    bool last_cbrb_ok = false;
-   TickType_t xLastWakeTime = xTaskGetTickCount();
    while (1)
    {
-		if (getHVIL_Status() == false)
+		waitForInterlockChange();
+
+		if (interlockMonitor.loops[INTERLOCK_HVIL].open)
 		{
 			ERROR_PRINT("Fault Monitor: HVIL broken!\n");
-			BMU_checkFailed = HVIL_FAILED_BIT;
-			sendCAN_BMU_Interlock_Loop_Status();
+			sendInterlockStatus(HVIL_FAILED_BIT, INTERLOCK_HVIL);
 
 			fsmSendEventUrgent(&fsmHandle, EV_HV_Fault, portMAX_DELAY);
 			while (1) {
@@ -244,11 +443,10 @@ void faultMonitorTask(void *pvParameters)
 			}
 		}
 
-      if (getBSPD_Status() == false)
+		if (interlockMonitor.loops[INTERLOCK_BSPD].open)
 		{
 			ERROR_PRINT("Fault Monitor: BSPD broken!\n");
-			BMU_checkFailed = BSPD_FAILED_BIT;
-			sendCAN_BMU_Interlock_Loop_Status();
+			sendInterlockStatus(BSPD_FAILED_BIT, INTERLOCK_BSPD);
 
 			fsmSendEventUrgent(&fsmHandle, EV_HV_Fault, portMAX_DELAY);
 			while (1) {
@@ -257,14 +455,13 @@ void faultMonitorTask(void *pvParameters)
 			}
 		}
 
-		bool il_ok = getIL_Status();
-		bool cbrb_ok = getCBRB_IL_Status();
-		bool hvd_ok = getHVD_Status();
+		bool il_ok = !interlockMonitor.loops[INTERLOCK_IL].open;
+		bool cbrb_ok = !interlockMonitor.loops[INTERLOCK_CBRB].open;
+		bool hvd_ok = !interlockMonitor.loops[INTERLOCK_HVD].open;
 		if((!cbrb_ok && hvd_ok) && !last_cbrb_ok)
 		{	
 			ERROR_PRINT("Fault Monitor: Cockpit BRB pressed\n");
-			BMU_checkFailed = CBRB_FAILED_BIT;
-			sendCAN_BMU_Interlock_Loop_Status();
+			sendInterlockStatus(CBRB_FAILED_BIT, INTERLOCK_CBRB);
 
 			fsmSendEventUrgent(&fsmHandle, EV_Cockpit_BRB_Pressed, portMAX_DELAY);
 			last_cbrb_ok = true;
@@ -278,8 +475,7 @@ void faultMonitorTask(void *pvParameters)
 		if ((!hvd_ok) || (!il_ok && cbrb_ok))
 		{
 			ERROR_PRINT("Fault Monitor: IL broken!\n");
-			BMU_checkFailed = IL_FAILED_BIT;
-			sendCAN_BMU_Interlock_Loop_Status();
+			sendInterlockStatus(IL_FAILED_BIT, hvd_ok ? INTERLOCK_IL : INTERLOCK_HVD);
 
 			fsmSendEventUrgent(&fsmHandle, EV_HV_Fault, portMAX_DELAY);
 			while (1) {
@@ -289,7 +485,6 @@ void faultMonitorTask(void *pvParameters)
 		}
 
 		watchdogTaskCheckIn(FAULT_TASK_ID);
-		vTaskDelayUntil(&xLastWakeTime, FAULT_MEASURE_TASK_PERIOD);
    }
 
 #else
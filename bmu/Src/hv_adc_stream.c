@@ -0,0 +1,157 @@
+/**
+  *****************************************************************************
+  * @file    hv_adc_stream.c
+  * @brief   Streaming acquisition of HV ADC samples on DREADY
+  * @details Reading IWV starts a burst read, in which the ADC keeps clocking
+  * out V1WV, V2WV and the status registers until chip select is raised, so
+  * one 10 byte transfer reads all three channels from the same conversion.
+  * Registers are 24 bit two's complement, most significant byte first.
+  *
+  * The interrupts (DREADY, then the end of the read) are the only writers of
+  * head and the task the only writer of tail. Both run on the same core, so
+  * the barriers only need to stop the compiler reordering memory accesses. A
+  * sample is time stamped with the DREADY edge rather than the end of the
+  * read, so the read's latency doesn't add jitter.
+  *****************************************************************************
+  */
+
+#include "hv_adc_stream.h"
+#include <string.h>
+
+#define COMPILER_BARRIER() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+#define ADDR_IWV (0x00)
+#define READ_EN (0x4)
+
+void hvAdcStreamInit(HvAdcStream_t *stream, uint32_t blockSize, uint32_t samplePeriod_us)
+{
+    memset(stream, 0, sizeof(*stream));
+    if (blockSize == 0) {
+        blockSize = 1;
+    } else if (blockSize > HV_ADC_STREAM_SIZE / 2) {
+        blockSize = HV_ADC_STREAM_SIZE / 2;
+    }
+    stream->blockSize = blockSize;
+    stream->samplePeriod_us = samplePeriod_us;
+    stream->minInterval_us = UINT32_MAX;
+}
+
+/**
+ * @brief Fill the transmit buffer for a burst read
+ */
+void hvAdcBurstCommand(uint8_t tx[HV_ADC_BURST_LEN])
+{
+    memset(tx, 0, HV_ADC_BURST_LEN);
+    tx[0] = (ADDR_IWV << 3) | READ_EN;
+}
+
+static int32_t signExtend24(const uint8_t bytes[3])
+{
+    // Shift to the upper three bytes, then right shift one byte to sign extend
+    const uint32_t raw = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8);
+    return (int32_t)raw >> 8;
+}
+
+/**
+ * @brief Decode the registers from a burst read. The first byte was clocked
+ * out during the command and is ignored
+ */
+void hvAdcDecodeBurst(const uint8_t rx[HV_ADC_BURST_LEN], HvAdcSample_t *sample)
+{
+    sample->current = signExtend24(&rx[1]);
+    sample->v1 = signExtend24(&rx[4]);
+    sample->v2 = signExtend24(&rx[7]);
+}
+
+/**
+ * @brief Call on the falling edge of DREADY
+ *
+ * @return true if a burst read should be started, false if the previous one
+ * is still in flight, in which case this conversion is missed
+ */
+bool hvAdcStreamDataReady(HvAdcStream_t *stream, uint32_t now_us)
+{
+    if (stream->busy) {
+        stream->busyDrdys++;
+        return false;
+    }
+    stream->busy = true;
+    stream->readTime_us = now_us;
+    return true;
+}
+
+/**
+ * @brief Call when the burst read started by @ref hvAdcStreamDataReady
+ * completes
+ *
+ * @return true if a block of samples is waiting for the task
+ */
+bool hvAdcStreamReadComplete(HvAdcStream_t *stream, const uint8_t rx[HV_ADC_BURST_LEN])
+{
+    HvAdcSample_t sample;
+    hvAdcDecodeBurst(rx, &sample);
+    sample.timestamp_us = stream->readTime_us;
+    stream->busy = false;
+
+    if (stream->anySamples) {
+        const uint32_t interval = sample.timestamp_us - stream->lastTime_us;
+        if (interval < stream->minInterval_us) {
+            stream->minInterval_us = interval;
+        }
+        if (interval > stream->maxInterval_us) {
+            stream->maxInterval_us = interval;
+        }
+        if (2 * interval > 3 * stream->samplePeriod_us) {
+            stream->gaps++;
+        }
+    }
+    stream->anySamples = true;
+    stream->lastTime_us = sample.timestamp_us;
+    stream->samples++;
+
+    const uint32_t head = stream->head;
+    if (head - stream->tail >= HV_ADC_STREAM_SIZE) {
+        stream->overruns++;
+        return true;
+    }
+    stream->buffer[head % HV_ADC_STREAM_SIZE] = sample;
+    COMPILER_BARRIER();
+    stream->head = head + 1;
+
+    return head + 1 - stream->tail >= stream->blockSize;
+}
+
+/**
+ * @brief Call if the burst read failed, so the next DREADY starts another
+ */
+void hvAdcStreamReadFailed(HvAdcStream_t *stream)
+{
+    stream->readErrors++;
+    stream->busy = false;
+}
+
+/**
+ * @brief Take the oldest sample. Must only be called from one task
+ *
+ * @return false if there are no samples waiting
+ */
+bool hvAdcStreamPop(HvAdcStream_t *stream, HvAdcSample_t *sample)
+{
+    const uint32_t tail = stream->tail;
+    if (stream->head == tail) {
+        return false;
+    }
+    COMPILER_BARRIER();
+    *sample = stream->buffer[tail % HV_ADC_STREAM_SIZE];
+    COMPILER_BARRIER();
+    stream->tail = tail + 1;
+    return true;
+}
+
+/**
+ * @return Number of samples waiting
+ */
+uint32_t hvAdcStreamCount(const HvAdcStream_t *stream)
+{
+    return stream->head - stream->tail;
+}
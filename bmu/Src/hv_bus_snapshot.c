@@ -0,0 +1,75 @@
+/**
+  *****************************************************************************
+  * @file    hv_bus_snapshot.c
+  * @brief   Lock free publishing of HV bus measurements
+  * @details The sequence number is incremented when the writer starts and
+  * again when it finishes a write, so it is odd while a write is in progress
+  * and sequence / 2 is the number of completed writes. Writes alternate
+  * between the two buffers, so the last completed one is always intact. A
+  * reader copies the last completed buffer and then re-checks the sequence
+  * number. That buffer is only written again once the writer has started the
+  * write after next, in which case the reader retries. A reader that preempts
+  * the writer part way through a write copies the other buffer, so it never
+  * has to wait for the writer to run.
+  *
+  * Only one task may write. Both the writer and readers run on the same core,
+  * so the barriers only need to stop the compiler reordering memory accesses.
+  *****************************************************************************
+  */
+
+#include "hv_bus_snapshot.h"
+
+#define COMPILER_BARRIER() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+void hvBusSnapshotInit(HVBusSnapshot_t *snapshot)
+{
+    snapshot->sequence = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        snapshot->buffer[i] = (HVBusMeasurements_t){0};
+    }
+}
+
+/**
+ * @brief Publish a new set of measurements. Must only be called from one task
+ */
+void hvBusSnapshotWrite(HVBusSnapshot_t *snapshot, const HVBusMeasurements_t *measurements)
+{
+    uint32_t sequence = snapshot->sequence;
+
+    snapshot->sequence = sequence + 1;
+    COMPILER_BARRIER();
+    snapshot->buffer[((sequence >> 1) + 1) & 1U] = *measurements;
+    COMPILER_BARRIER();
+    snapshot->sequence = sequence + 2;
+}
+
+/**
+ * @brief Copy the most recently published measurements
+ *
+ * @return false if nothing has been published yet, or if the writer kept
+ * overwriting the buffer being copied, which can only happen if the reader is
+ * preempted for more than a write period
+ */
+bool hvBusSnapshotRead(const HVBusSnapshot_t *snapshot, HVBusMeasurements_t *measurements)
+{
+    for (int tries = 0; tries < HV_BUS_SNAPSHOT_READ_TRIES; tries++)
+    {
+        // Sequence number when the buffer we copy was completed
+        uint32_t completed = snapshot->sequence & ~1U;
+        if (completed == 0U)
+        {
+            return false;
+        }
+        COMPILER_BARRIER();
+        *measurements = snapshot->buffer[(completed >> 1) & 1U];
+        COMPILER_BARRIER();
+        // It is overwritten once the write after next starts
+        if (snapshot->sequence - completed < 3U)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
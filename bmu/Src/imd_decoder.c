@@ -0,0 +1,214 @@
+/**
+  *****************************************************************************
+  * @file    imd_decoder.c
+  * @brief   Decodes the IMD PWM output from input capture periods
+  * @details A capture whose frequency is in no band, or whose high time is
+  * longer than its period, is rejected. Captures in a band other than the
+  * current one are collected as a candidate, and the band changes once
+  * lockCount of them arrive in a row. The candidate's captures become the
+  * window, so the new band is valid straight away. A gap of timeout_ms
+  * without captures drops the band, so a signal coming back is locked
+  * afresh. In the 10 Hz and 20 Hz bands the insulation resistance is, from
+  * the IR155 datasheet,
+  *
+  *   R = 90 % * 1200 kOhm / (duty - 5 %) - 1200 kOhm
+  *
+  * which is infinite at 5 % duty and zero at 95 %.
+  *****************************************************************************
+  */
+
+#include "imd_decoder.h"
+#include <math.h>
+#include <string.h>
+
+#define IMD_SELF_RESISTANCE_KOHMS (1200.0f)
+
+static const float bandFrequency_Hz[IMD_NUM_BANDS] = {
+    [IMD_BAND_NONE] = 0.0f,
+    [IMD_BAND_10HZ] = 10.0f,
+    [IMD_BAND_20HZ] = 20.0f,
+    [IMD_BAND_30HZ] = 30.0f,
+    [IMD_BAND_40HZ] = 40.0f,
+    [IMD_BAND_50HZ] = 50.0f,
+};
+
+void imdDecoderInit(ImdDecoder_t *dec, const ImdDecoder_Params_t *params, uint32_t now_ms)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->params = *params;
+    if (dec->params.lockCount == 0) {
+        dec->params.lockCount = 1;
+    } else if (dec->params.lockCount > IMD_DECODER_WINDOW) {
+        dec->params.lockCount = IMD_DECODER_WINDOW;
+    }
+    dec->startTime_ms = now_ms;
+    dec->resistance_kOhms = INFINITY;
+}
+
+float imdDecoderBandFrequency(ImdDecoder_Band_t band)
+{
+    return band < IMD_NUM_BANDS ? bandFrequency_Hz[band] : 0.0f;
+}
+
+const char *imdDecoderBandName(ImdDecoder_Band_t band)
+{
+    switch (band) {
+        case IMD_BAND_NONE: return "none";
+        case IMD_BAND_10HZ: return "10 Hz";
+        case IMD_BAND_20HZ: return "20 Hz";
+        case IMD_BAND_30HZ: return "30 Hz";
+        case IMD_BAND_40HZ: return "40 Hz";
+        case IMD_BAND_50HZ: return "50 Hz";
+        default: return "unknown";
+    }
+}
+
+static ImdDecoder_Band_t classifyFrequency(const ImdDecoder_t *dec, float frequency_Hz)
+{
+    for (int band = IMD_BAND_10HZ; band < IMD_NUM_BANDS; band++) {
+        if (fabsf(frequency_Hz - bandFrequency_Hz[band]) <= dec->params.bandTolerance * bandFrequency_Hz[band]) {
+            return (ImdDecoder_Band_t)band;
+        }
+    }
+    return IMD_BAND_NONE;
+}
+
+static float median(const float values[], uint32_t count)
+{
+    float sorted[IMD_DECODER_WINDOW] = {0};
+    memcpy(sorted, values, count * sizeof(float));
+    // Insertion sort, the window is tiny
+    for (uint32_t i = 1; i < count; i++) {
+        float value = sorted[i];
+        uint32_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+    if (count % 2) {
+        return sorted[count / 2];
+    }
+    return (sorted[count / 2 - 1] + sorted[count / 2]) / 2.0f;
+}
+
+static void clearBand(ImdDecoder_t *dec)
+{
+    dec->band = IMD_BAND_NONE;
+    dec->count = 0;
+    dec->index = 0;
+    dec->candidateBand = IMD_BAND_NONE;
+    dec->candidateCount = 0;
+    dec->valid = false;
+}
+
+static void updateResults(ImdDecoder_t *dec)
+{
+    uint64_t periodSum = 0;
+    for (uint32_t i = 0; i < dec->count; i++) {
+        periodSum += dec->period[i];
+    }
+    dec->frequency_Hz = (float)dec->params.tickFrequency_Hz * dec->count / periodSum;
+    dec->duty_percent = median(dec->duty, dec->count);
+
+    dec->resistance_kOhms = INFINITY;
+    if (dec->band == IMD_BAND_10HZ || dec->band == IMD_BAND_20HZ) {
+        if (dec->duty_percent >= 95.0f) {
+            dec->resistance_kOhms = 0.0f;
+        } else if (dec->duty_percent > 5.0f) {
+            dec->resistance_kOhms = 0.9f * IMD_SELF_RESISTANCE_KOHMS / ((dec->duty_percent - 5.0f) / 100.0f)
+                                    - IMD_SELF_RESISTANCE_KOHMS;
+        }
+    }
+}
+
+/**
+ * @brief Add an input capture
+ *
+ * @param periodTicks Rising edge to rising edge, in timer ticks
+ * @param highTicks Rising edge to falling edge, in timer ticks
+ *
+ * @return true if the decoded band changed (including to or from no signal)
+ */
+bool imdDecoderCapture(ImdDecoder_t *dec, uint32_t periodTicks, uint32_t highTicks, uint32_t now_ms)
+{
+    const ImdDecoder_Band_t bandBefore = dec->valid ? dec->band : IMD_BAND_NONE;
+
+    if (dec->anyCaptures && now_ms - dec->lastCaptureTime_ms > dec->params.timeout_ms) {
+        clearBand(dec);
+    }
+    dec->anyCaptures = true;
+    dec->lastCaptureTime_ms = now_ms;
+    dec->captures++;
+
+    if (periodTicks == 0 || highTicks > periodTicks) {
+        dec->outliers++;
+        return false;
+    }
+    const float frequency_Hz = (float)dec->params.tickFrequency_Hz / periodTicks;
+    const float duty_percent = 100.0f * highTicks / periodTicks;
+    const ImdDecoder_Band_t band = classifyFrequency(dec, frequency_Hz);
+    if (band == IMD_BAND_NONE) {
+        dec->outliers++;
+        return false;
+    }
+
+    if (band != dec->band) {
+        dec->outliers++;
+        if (band != dec->candidateBand) {
+            dec->candidateBand = band;
+            dec->candidateCount = 0;
+        }
+        dec->candidateDuty[dec->candidateCount] = duty_percent;
+        dec->candidatePeriod[dec->candidateCount] = periodTicks;
+        dec->candidateCount++;
+        if (dec->candidateCount < dec->params.lockCount) {
+            return false;
+        }
+
+        // Candidate's captures were counted as outliers while it was one
+        dec->outliers -= dec->candidateCount;
+        dec->band = band;
+        dec->count = dec->candidateCount;
+        dec->index = dec->candidateCount % IMD_DECODER_WINDOW;
+        memcpy(dec->duty, dec->candidateDuty, sizeof(dec->duty));
+        memcpy(dec->period, dec->candidatePeriod, sizeof(dec->period));
+        dec->candidateBand = IMD_BAND_NONE;
+        dec->candidateCount = 0;
+        if (bandBefore != IMD_BAND_NONE) {
+            dec->bandChanges++;
+        }
+    } else {
+        dec->candidateBand = IMD_BAND_NONE;
+        dec->candidateCount = 0;
+        if (dec->count >= dec->params.lockCount
+            && fabsf(duty_percent - dec->duty_percent) > dec->params.outlierDuty_percent) {
+            dec->outliers++;
+        }
+        dec->duty[dec->index] = duty_percent;
+        dec->period[dec->index] = periodTicks;
+        dec->index = (dec->index + 1) % IMD_DECODER_WINDOW;
+        if (dec->count < IMD_DECODER_WINDOW) {
+            dec->count++;
+        }
+    }
+
+    updateResults(dec);
+    dec->valid = dec->count >= dec->params.lockCount;
+    if (dec->valid && dec->timeToValid_ms == 0) {
+        dec->timeToValid_ms = now_ms - dec->startTime_ms;
+    }
+    return (dec->valid ? dec->band : IMD_BAND_NONE) != bandBefore;
+}
+
+/**
+ * @return true if there have been no captures for the timeout, the IMD
+ * output is stuck high or low
+ */
+bool imdDecoderSignalLost(const ImdDecoder_t *dec, uint32_t now_ms)
+{
+    if (!dec->anyCaptures) {
+        return now_ms - dec->startTime_ms > dec->params.timeout_ms;
+    }
+    return now_ms - dec->lastCaptureTime_ms > dec->params.timeout_ms;
+}
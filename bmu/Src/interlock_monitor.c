@@ -0,0 +1,152 @@
+/**
+  *****************************************************************************
+  * @file    interlock_monitor.c
+  * @brief   Debounce and time stamp safety loop openings
+  * @details An edge opening a loop starts the debounce. If the loop closes
+  * again before the debounce time has passed the open is counted as a glitch
+  * and forgotten, otherwise the next update confirms it, reporting the time
+  * of the opening edge. Updates also sample the input levels, so a loop that
+  * opened without an edge being seen is still caught, debounced from the
+  * update that first saw it open.
+  *
+  * Edges are recorded from an interrupt, so updates must run with that
+  * interrupt masked. The caller takes the time before sampling the levels,
+  * so an edge that arrives between sampling and the update is newer than
+  * the levels and isn't discarded as a glitch.
+  *****************************************************************************
+  */
+
+#include "interlock_monitor.h"
+#include <stddef.h>
+
+static const char *loopNames[NUM_INTERLOCK_LOOPS] = {
+    [INTERLOCK_HVIL] = "HVIL",
+    [INTERLOCK_BRB] = "BRB",
+    [INTERLOCK_BSPD] = "BSPD",
+    [INTERLOCK_HVD] = "HVD",
+    [INTERLOCK_IL] = "IL",
+    [INTERLOCK_CBRB] = "Cockpit BRB",
+};
+
+void interlockMonitorInit(InterlockMonitor_t *monitor, uint32_t debounce_us)
+{
+    monitor->debounce_us = debounce_us;
+    for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++)
+    {
+        monitor->loops[loop] = (InterlockLoopState_t){0};
+    }
+}
+
+/**
+ * @brief Record an edge on a loop's sense input. Safe to call from an
+ * interrupt
+ *
+ * @param closed Level of the input after the edge
+ * @param now_us Time of the edge
+ */
+void interlockMonitorEdge(InterlockMonitor_t *monitor, InterlockLoop_t loop, bool closed, uint32_t now_us)
+{
+    InterlockLoopState_t *state = &monitor->loops[loop];
+
+    if (!closed && !state->pending && !state->open)
+    {
+        state->openedAt_us = now_us;
+        state->pending = true;
+    }
+    else if (closed && state->pending)
+    {
+        state->pending = false;
+        state->glitches++;
+    }
+}
+
+/**
+ * @brief Confirm pending opens from the current input levels
+ *
+ * @param closed Current level of each loop's sense input
+ * @param now_us Time taken before sampling the levels
+ *
+ * @return Bit mask (1 << @ref InterlockLoop_t) of loops newly confirmed open
+ */
+uint32_t interlockMonitorUpdate(InterlockMonitor_t *monitor, const bool closed[NUM_INTERLOCK_LOOPS], uint32_t now_us)
+{
+    uint32_t opened = 0;
+
+    for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++)
+    {
+        InterlockLoopState_t *state = &monitor->loops[loop];
+
+        if (closed[loop])
+        {
+            if (state->pending && (int32_t)(state->openedAt_us - now_us) > 0)
+            {
+                // Opened after the levels were sampled
+                continue;
+            }
+            if (state->pending)
+            {
+                state->glitches++;
+            }
+            state->pending = false;
+            state->open = false;
+            continue;
+        }
+
+        if (state->open)
+        {
+            continue;
+        }
+
+        if (!state->pending)
+        {
+            // Missed the edge
+            state->openedAt_us = now_us;
+            state->pending = true;
+        }
+
+        if ((int32_t)(now_us - state->openedAt_us) >= (int32_t)monitor->debounce_us)
+        {
+            state->pending = false;
+            state->open = true;
+            state->confirmedAt_us = now_us;
+            opened |= (1U << loop);
+        }
+    }
+
+    return opened;
+}
+
+/**
+ * @brief Check if any loop is waiting for its debounce time
+ *
+ * @param[out] wait_us Time until the first pending loop can be confirmed
+ *
+ * @return true if any loop is pending
+ */
+bool interlockMonitorPending(const InterlockMonitor_t *monitor, uint32_t now_us, uint32_t *wait_us)
+{
+    bool pending = false;
+    uint32_t wait = UINT32_MAX;
+
+    for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++)
+    {
+        const InterlockLoopState_t *state = &monitor->loops[loop];
+
+        if (state->pending)
+        {
+            int32_t elapsed = (int32_t)(now_us - state->openedAt_us);
+            elapsed = elapsed < 0 ? 0 : elapsed;
+            uint32_t remaining = (uint32_t)elapsed >= monitor->debounce_us ? 0 : monitor->debounce_us - elapsed;
+            wait = remaining < wait ? remaining : wait;
+            pending = true;
+        }
+    }
+
+    *wait_us = pending ? wait : 0;
+    return pending;
+}
+
+const char *interlockLoopName(InterlockLoop_t loop)
+{
+    return loop < NUM_INTERLOCK_LOOPS ? loopNames[loop] : "Unknown";
+}
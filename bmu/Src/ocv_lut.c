@@ -0,0 +1,136 @@
+/**
+  *****************************************************************************
+  * @file    ocv_lut.c
+  * @brief   Cell open circuit voltage curve
+  * @details One curve, built from the segment SOC LUTs, for everything that
+  * models a cell at rest: the EKF cell model and the balance planner's
+  * voltage to charge conversion. Both lookups walk the table once, at most
+  * OCV_LUT_LEN comparisons, and interpolate linearly between breakpoints.
+  *****************************************************************************
+  */
+
+#include "ocv_lut.h"
+#include "state_of_charge_data.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Cell voltage at a segment LUT index
+#define LUT_CELL_V(lutMin, lutStep, index) (((lutMin) + (index) * (lutStep)) / SOC_LUT_CELLS_PER_SEGMENT)
+
+// Cell open circuit voltage vs SOC, used by the EKF cell model. These are the
+// LUT breakpoints per cell, kept where socLutSegmentVoltageToSoc increases, so
+// the EKF agrees with it there. It doesn't between 4.0V and 4.055V: the HV LUT
+// starts back at 94.2%, which the mid LUT already reached at 3.76V, so those
+// points are left out. Plus end points at 0% and 100%.
+const float ocvLutSoc[OCV_LUT_LEN] =
+{
+    0.00000,
+    0.01114,
+    0.02005,
+    0.03124,
+    0.04488,
+    0.06144,
+    0.08186,
+    0.10583,
+    0.13283,
+    0.16790,
+    0.18942, // Mid LUT at the low voltage lookup cutoff
+    0.22169,
+    0.29539,
+    0.38091,
+    0.45930,
+    0.52878,
+    0.60245,
+    0.68764,
+    0.75858,
+    0.82780,
+    0.94200,
+    0.98895,
+    0.99110,
+    0.99325,
+    0.99405,
+    1.00000
+};
+
+const float ocvLutVoltage[OCV_LUT_LEN] =
+{
+    2.500,
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 0),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 1),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 2),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 3),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 4),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 5),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 6),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 7),
+    LUT_CELL_V(LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, 8),
+    CELL_LOW_VOLTAGE_LOOKUP_CUTOFF,
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 2),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 3),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 4),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 5),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 6),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 7),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 8),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 9),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 10),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 11),
+    LUT_CELL_V(MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, 12),
+    LUT_CELL_V(HV_SOC_LUT_MIN, HV_SOC_LUT_STEP, 11),
+    LUT_CELL_V(HV_SOC_LUT_MIN, HV_SOC_LUT_STEP, 12),
+    LUT_CELL_V(HV_SOC_LUT_MIN, HV_SOC_LUT_STEP, 13),
+    4.200
+};
+
+/**
+ * @brief Cell open circuit voltage from the OCV LUT
+ *
+ * @param soc State of charge, 0-1. Clamped to the LUT range
+ * @param[out] dOcvdSoc Slope of the OCV curve at soc, V/unit SOC. May be NULL
+ *
+ * @return Open circuit voltage, V
+ */
+float ocvLutSocToOcv(float soc, float *dOcvdSoc)
+{
+    uint32_t i = 1;
+
+    soc = soc > 1.0f ? 1.0f : soc;
+    soc = soc < 0.0f ? 0.0f : soc;
+
+    while (i < OCV_LUT_LEN - 1 && soc > ocvLutSoc[i])
+    {
+        i++;
+    }
+
+    float slope = (ocvLutVoltage[i] - ocvLutVoltage[i-1]) / (ocvLutSoc[i] - ocvLutSoc[i-1]);
+    if (dOcvdSoc != NULL)
+    {
+        *dOcvdSoc = slope;
+    }
+    return ocvLutVoltage[i-1] + (soc - ocvLutSoc[i-1]) * slope;
+}
+
+/**
+ * @brief Inverse of @ref ocvLutSocToOcv, SOC of a cell at rest from its voltage
+ *
+ * @param ocv Open circuit voltage, V. Clamped to the LUT range
+ *
+ * @return State of charge, 0-1
+ */
+float ocvLutOcvToSoc(float ocv)
+{
+    uint32_t i = 1;
+
+    if (ocv <= ocvLutVoltage[0])
+    {
+        return 0.0f;
+    }
+
+    while (i < OCV_LUT_LEN - 1 && ocv > ocvLutVoltage[i])
+    {
+        i++;
+    }
+
+    float soc = ocvLutSoc[i-1] + (ocv - ocvLutVoltage[i-1]) * (ocvLutSoc[i] - ocvLutSoc[i-1]) / (ocvLutVoltage[i] - ocvLutVoltage[i-1]);
+    return soc > 1.0f ? 1.0f : soc;
+}
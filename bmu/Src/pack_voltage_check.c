@@ -0,0 +1,70 @@
+/**
+  *****************************************************************************
+  * @file    pack_voltage_check.c
+  * @brief   Cross-check of the summed cell voltages against VBatt
+  * @details On discharge (positive IBus) the pack terminal voltage is the sum
+  * of the cell voltages less the drop over the interconnects between the cell
+  * taps and the VBatt sense point. The cells and VBatt are not sampled at
+  * the same instant, so the tolerance is widened by the change in IR drop
+  * over the skew, estimated from the change in IBus since the last step. The
+  * check only faults once the residual has been out of tolerance for
+  * faultTime_s, and clears once it is back within tolerance.
+  *****************************************************************************
+  */
+
+#include "pack_voltage_check.h"
+#include <math.h>
+
+void packVoltageCheckInit(PackVoltageCheck_t *check, const PackVoltageCheck_Params_t *params)
+{
+    check->params = *params;
+    check->lastIBus = 0.0f;
+    check->haveLastIBus = false;
+    check->residual_V = 0.0f;
+    check->allowed_V = 0.0f;
+    check->outOfTolerance_s = 0.0f;
+    check->faulted = false;
+}
+
+/**
+ * @brief Compare one set of measurements
+ *
+ * @param sumOfCells Sum of the cell voltages, V
+ * @param VBatt Pack voltage, V
+ * @param IBus Pack current, positive on discharge, A
+ * @param skew_s Age of the VBatt/IBus sample when the cell reading finished
+ * @param dt_s Time since the last step
+ *
+ * @return true on the step the check faults
+ */
+bool packVoltageCheckStep(PackVoltageCheck_t *check, float sumOfCells, float VBatt, float IBus,
+                          float skew_s, float dt_s)
+{
+    const PackVoltageCheck_Params_t *params = &check->params;
+
+    float currentSlew_Aps = 0.0f;
+    if (check->haveLastIBus && dt_s > 0.0f) {
+        currentSlew_Aps = fabsf(IBus - check->lastIBus) / dt_s;
+    }
+    check->lastIBus = IBus;
+    check->haveLastIBus = true;
+
+    const float skewDrop_V = params->packResistance_ohms * currentSlew_Aps
+                             * (fabsf(skew_s) + params->acquisitionTime_s);
+
+    check->residual_V = sumOfCells - IBus * params->interconnectResistance_ohms - VBatt;
+    check->allowed_V = params->tolerance_V + params->toleranceRelative * fabsf(VBatt) + skewDrop_V;
+
+    if (fabsf(check->residual_V) <= check->allowed_V) {
+        check->outOfTolerance_s = 0.0f;
+        check->faulted = false;
+        return false;
+    }
+
+    check->outOfTolerance_s += dt_s;
+    if (!check->faulted && check->outOfTolerance_s >= params->faultTime_s) {
+        check->faulted = true;
+        return true;
+    }
+    return false;
+}
@@ -22,6 +22,7 @@
 #include "bmu_can.h"
 #include "bmu_dtc.h"
 #include "batteries.h"
+#include "precharge_fit.h"
 
 /** Define this to enable contactor control, otherwise PCDC will always
  *  return successful.
@@ -48,6 +49,34 @@ typedef enum Precharge_Type_t {
 } Precharge_Type_t;
 
 
+/**
+ * Expected bus for each @ref Precharge_Type_t, to judge the step 4 RC fit
+ */
+static const PrechargeFit_Params_t prechargeFitParams[PC_NumTypes] = {
+    [PC_MotorControllers] = {
+        .resistance_ohms = PRECHARGE_RESISTOR_OHMS,
+        .capacitanceMin_F = PRECHARGE_MC_CAPACITANCE_MIN_F,
+        .capacitanceMax_F = PRECHARGE_MC_CAPACITANCE_MAX_F,
+        .completeFraction = PRECHARGE_STEP_4_COMPLETE_PERCENT_VPACK,
+        .leakageMinFraction = PRECHARGE_LEAKAGE_MIN_PERCENT_VBATT,
+        .relayCloseTime_s = PRECHARGE_RELAY_CLOSE_TIME_S,
+        .startRiseFraction = PRECHARGE_FIT_START_RISE_PERCENT_VBATT,
+        .fitMinTime_s = PRECHARGE_FIT_MIN_TIME_S,
+        .settleTaus = PRECHARGE_FIT_SETTLE_TAUS,
+    },
+    [PC_Charger] = {
+        .resistance_ohms = PRECHARGE_RESISTOR_OHMS,
+        .capacitanceMin_F = PRECHARGE_CHARGER_CAPACITANCE_MIN_F,
+        .capacitanceMax_F = PRECHARGE_CHARGER_CAPACITANCE_MAX_F,
+        .completeFraction = PRECHARGE_STEP_4_COMPLETE_PERCENT_VPACK,
+        .leakageMinFraction = PRECHARGE_LEAKAGE_MIN_PERCENT_VBATT,
+        .relayCloseTime_s = PRECHARGE_RELAY_CLOSE_TIME_S,
+        .startRiseFraction = PRECHARGE_FIT_START_RISE_PERCENT_VBATT,
+        .fitMinTime_s = PRECHARGE_FIT_MIN_TIME_S,
+        .settleTaus = PRECHARGE_FIT_SETTLE_TAUS,
+    },
+};
+
 Precharge_Discharge_Return_t discharge();
 
 HAL_StatusTypeDef pcdcInit()
@@ -145,15 +174,14 @@ void openAllContactors()
  */
 HAL_StatusTypeDef updateMeasurements(float *VBus, float *VBatt, float *IBus)
 {
-    if (getVBatt(VBatt) != HAL_OK) {
-        return HAL_ERROR;
-    }
-    if (getVBus(VBus) != HAL_OK) {
-        return HAL_ERROR;
-    }
-    if (getIBus(IBus) != HAL_OK) {
+    HVBusMeasurements_t measurements;
+
+    if (getHVBusMeasurements(&measurements) != HAL_OK) {
         return HAL_ERROR;
     }
+    (*VBatt) = measurements.VBatt;
+    (*VBus) = measurements.VBus;
+    (*IBus) = measurements.IBus;
 
     return HAL_OK;
 }
@@ -365,6 +393,12 @@ Precharge_Discharge_Return_t precharge(Precharge_Type_t prechargeType)
 
     float maxIBus = 0;
     DEBUG_PRINT("VPack %f\r\nTick, VBUS, VBATT, IBUS\n", packVoltage);
+
+    // Outside HITL an abnormal bus is caught by the fit rather than at the
+    // timeout. HITL benches don't look like the car's bus, so aren't fitted
+    PrechargeFit_t prechargeFit;
+    PrechargeFit_Result_t fitResult = PRECHARGE_FIT_CHARGING;
+    prechargeFitInit(&prechargeFit, &prechargeFitParams[prechargeType]);
     startTickCount = xTaskGetTickCount();
 
     setPrechargeContactor(CONTACTOR_CLOSED);
@@ -372,14 +406,37 @@ Precharge_Discharge_Return_t precharge(Precharge_Type_t prechargeType)
     setPosContactor(CONTACTOR_OPEN);
 
     do {
-        if (updateMeasurements(&VBus, &VBatt, &IBus) != HAL_OK) {
+        HVBusMeasurements_t measurements;
+        if (getHVBusMeasurements(&measurements) != HAL_OK) {
             return PCDC_ERROR;
         }
+        VBus = measurements.VBus;
+        VBatt = measurements.VBatt;
+        IBus = measurements.IBus;
 
         ERROR_PRINT("%lu, %f, %f, %f\r\n", xTaskGetTickCount(), VBus, VBatt, IBus);
         if (IBus > maxIBus) {
             maxIBus = IBus;
         }
+
+        if (!HITL_Precharge_Mode) {
+            // Measurement time rather than now, the snapshot may be a tick old
+            const float fitTime_s = (float)(int32_t)(measurements.timestamp - startTickCount)
+                                    / configTICK_RATE_HZ;
+            fitResult = prechargeFitStep(&prechargeFit, VBus, VBatt, fitTime_s);
+            if (fitResult != PRECHARGE_FIT_CHARGING && fitResult != PRECHARGE_FIT_NORMAL) {
+                ERROR_PRINT("Precharge bus abnormal: %s\n", prechargeFitResultName(fitResult));
+                ERROR_PRINT("INFO: C %f uF, leakage %f ohms, settling to %f VBatt\n",
+                            prechargeFit.capacitance_F * 1e6f, prechargeFit.leakage_ohms,
+                            prechargeFit.finalFraction);
+                ERROR_PRINT("INFO: VBUS %f\n", VBus);
+                ERROR_PRINT("INFO: VBatt %f\n", VBatt);
+                ERROR_PRINT("INFO: IBus %f\n", IBus);
+                sendDTC_FATAL_PRECHARGE_BUS_ABNORMAL(fitResult);
+                return PCDC_ERROR;
+            }
+        }
+
         WAIT_FOR_NEXT_MEASURE_OR_STOP(PRECHARGE_STEP_4_CURRENT_MEASURE_PERIOD_MS,
                                       dbwTaskNotifications);
         if (xTaskGetTickCount() - startTickCount > PRECHARGE_STEP_4_TIMEOUT) {
@@ -393,6 +450,10 @@ Precharge_Discharge_Return_t precharge(Precharge_Type_t prechargeType)
 
     uint32_t prechargeTime = xTaskGetTickCount() - startTickCount;
     DEBUG_PRINT("Precharge took %lu ticks\n", prechargeTime);
+    if (!HITL_Precharge_Mode) {
+        DEBUG_PRINT("Bus C %f uF, leakage %f ohms\n", prechargeFit.capacitance_F * 1e6f,
+                    prechargeFit.leakage_ohms);
+    }
     ERROR_PRINT("INFO: VBUS %f\n", VBus);
     ERROR_PRINT("INFO: VBatt %f\n", VBatt);
     ERROR_PRINT("INFO: IBus %f\n", IBus);
@@ -0,0 +1,212 @@
+/**
+  *****************************************************************************
+  * @file    precharge_fit.c
+  * @brief   Online RC fit of the HV bus during precharge
+  * @details Integrating the bus model from the start of the rise gives
+  *     VBus(t) = c + alpha * int(VBatt) - beta * int(VBus)
+  * with alpha = 1 / (R C) and beta = alpha + 1 / (R_leak C), which is linear
+  * in c, alpha and beta so it is fitted by least squares with running sums.
+  * Regressing on the integrals rather than on dVBus/dt keeps the ADC noise
+  * from being differentiated, and doesn't need evenly spaced samples. The
+  * bus settles to alpha / beta of VBatt with a time constant of 1 / beta.
+  *****************************************************************************
+  */
+
+#include "precharge_fit.h"
+#include <math.h>
+#include <string.h>
+
+void prechargeFitInit(PrechargeFit_t *fit, const PrechargeFit_Params_t *params)
+{
+    memset(fit, 0, sizeof(*fit));
+    fit->params = *params;
+    fit->capacitance_F = NAN;
+    fit->leakage_ohms = INFINITY;
+    fit->finalFraction = NAN;
+    fit->result = PRECHARGE_FIT_CHARGING;
+}
+
+const char *prechargeFitResultName(PrechargeFit_Result_t result)
+{
+    switch (result) {
+        case PRECHARGE_FIT_CHARGING: return "charging";
+        case PRECHARGE_FIT_NORMAL: return "normal";
+        case PRECHARGE_FIT_CAPACITANCE_LOW: return "capacitance low";
+        case PRECHARGE_FIT_CAPACITANCE_HIGH: return "capacitance high";
+        case PRECHARGE_FIT_LEAKAGE: return "leakage";
+        default: return "unknown";
+    }
+}
+
+static void addSample(PrechargeFit_t *fit, float VBus)
+{
+    const double x[3] = {1.0, fit->intVBatt, -fit->intVBus};
+
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            fit->sums[row][col] += x[row] * x[col];
+        }
+        fit->sums[row][3] += x[row] * VBus;
+    }
+}
+
+static double det3(const double m[3][4], int replaceCol)
+{
+    double a[3][3];
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            a[row][col] = (col == replaceCol) ? m[row][3] : m[row][col];
+        }
+    }
+    return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+           - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+           + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+}
+
+/*
+ * Solve the normal equations by Cramer's rule
+ *
+ * @return false if the regressors are collinear
+ */
+static bool solve(const PrechargeFit_t *fit, double coeffs[3])
+{
+    const double det = det3(fit->sums, -1);
+    const double scale = fit->sums[0][0] * fit->sums[1][1] * fit->sums[2][2];
+
+    if (!(scale > 0.0) || fabs(det) <= 1e-12 * scale) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        coeffs[i] = det3(fit->sums, i) / det;
+    }
+    return true;
+}
+
+/*
+ * Fit VBus = c + alpha * (int(VBatt) - int(VBus)), the model without leakage,
+ * from the same sums
+ *
+ * @return alpha, 0 if it can't be fitted
+ */
+static float solveNoLeakage(const PrechargeFit_t *fit)
+{
+    const double n = fit->sums[0][0];
+    const double sx = fit->sums[0][1] + fit->sums[0][2];
+    const double sxx = fit->sums[1][1] + 2.0 * fit->sums[1][2] + fit->sums[2][2];
+    const double sy = fit->sums[0][3];
+    const double sxy = fit->sums[1][3] + fit->sums[2][3];
+    const double det = n * sxx - sx * sx;
+
+    if (!(det > 1e-12 * n * sxx)) {
+        return 0.0f;
+    }
+    return (n * sxy - sx * sy) / det;
+}
+
+/**
+ * @brief Add a measurement and judge the precharge. Once the result is no
+ * longer @ref PRECHARGE_FIT_CHARGING it is latched
+ *
+ * @param time_s Time the measurement was taken, only differences are used.
+ * Repeats of the last time are ignored
+ *
+ * @return @ref PrechargeFit_Result_t
+ */
+PrechargeFit_Result_t prechargeFitStep(PrechargeFit_t *fit, float VBus, float VBatt, float time_s)
+{
+    const PrechargeFit_Params_t *params = &fit->params;
+    const float R = params->resistance_ohms;
+
+    if (fit->result != PRECHARGE_FIT_CHARGING) {
+        return fit->result;
+    }
+
+    if (fit->samples == 0) {
+        fit->firstTime_s = time_s;
+        fit->startVBus = VBus;
+    } else if (time_s <= fit->lastTime_s) {
+        return fit->result;
+    } else if (!fit->rising) {
+        if (VBus - fit->startVBus >= params->startRiseFraction * VBatt) {
+            // Start from the last sample before the rise, c takes up
+            // wherever on the curve that was
+            fit->rising = true;
+            fit->startTime_s = fit->lastTime_s;
+            fit->intVBatt = 0.0;
+            fit->intVBus = 0.0;
+            addSample(fit, fit->lastVBus);
+        } else {
+            // The largest expected bus takes R Cmax ln(1 / (1 - f)) to rise,
+            // allow twice that for the relay and noise
+            const float riseTimeout_s = params->relayCloseTime_s + params->fitMinTime_s
+                                        - 2.0f * R * params->capacitanceMax_F * log1pf(-params->startRiseFraction);
+            if (time_s - fit->firstTime_s > riseTimeout_s) {
+                fit->result = PRECHARGE_FIT_CAPACITANCE_HIGH;
+            }
+        }
+    }
+
+    if (fit->rising) {
+        const float dt_s = time_s - fit->lastTime_s;
+        fit->intVBatt += 0.5 * (VBatt + fit->lastVBatt) * dt_s;
+        fit->intVBus += 0.5 * (VBus + fit->lastVBus) * dt_s;
+        addSample(fit, VBus);
+    }
+    fit->samples++;
+    fit->lastTime_s = time_s;
+    fit->lastVBus = VBus;
+    fit->lastVBatt = VBatt;
+
+    if (!fit->rising || fit->result != PRECHARGE_FIT_CHARGING) {
+        return fit->result;
+    }
+
+    const float fitTime_s = time_s - fit->startTime_s;
+    bool settled = false;
+
+    if (fitTime_s >= params->fitMinTime_s) {
+        // Until the curve bends over leakage can't be told from capacitance,
+        // so judge the capacitance from all the charge going into the bus
+        const float alpha = solveNoLeakage(fit);
+        if (!(alpha > 0.0f)) {
+            fit->result = PRECHARGE_FIT_CAPACITANCE_HIGH;
+            return fit->result;
+        }
+        fit->capacitance_F = 1.0f / (alpha * R);
+
+        // Leakage only makes the time constant shorter than R C
+        double coeffs[3];
+        if (fitTime_s >= params->settleTaus * R * fit->capacitance_F && solve(fit, coeffs) && coeffs[1] > 0.0) {
+            settled = true;
+            // beta below alpha would be a negative leakage, that's noise
+            const float alphaFull = coeffs[1];
+            const float beta = fmaxf(coeffs[2], alphaFull);
+
+            fit->capacitance_F = 1.0f / (alphaFull * R);
+            fit->leakage_ohms = (beta > alphaFull) ? 1.0f / ((beta - alphaFull) * fit->capacitance_F) : INFINITY;
+            fit->finalFraction = alphaFull / beta;
+        }
+
+        if (fit->capacitance_F < params->capacitanceMin_F) {
+            fit->result = PRECHARGE_FIT_CAPACITANCE_LOW;
+            return fit->result;
+        }
+        if (fit->capacitance_F > params->capacitanceMax_F) {
+            fit->result = PRECHARGE_FIT_CAPACITANCE_HIGH;
+            return fit->result;
+        }
+    }
+
+    if (settled) {
+        fit->result = (fit->finalFraction < fmaxf(params->leakageMinFraction, params->completeFraction))
+                      ? PRECHARGE_FIT_LEAKAGE : PRECHARGE_FIT_NORMAL;
+    } else if (VBus >= params->completeFraction * VBatt) {
+        // A small bus can be charged before there's enough to fit. Too quick
+        // even for the smallest expected bus, from where it started, is a fault
+        const float startFraction = fit->startVBus / VBatt + params->startRiseFraction;
+        const float minTime_s = R * params->capacitanceMin_F
+                                * logf((1.0f - startFraction) / (1.0f - params->completeFraction));
+        fit->result = (fitTime_s < minTime_s) ? PRECHARGE_FIT_CAPACITANCE_LOW : PRECHARGE_FIT_NORMAL;
+    }
+    return fit->result;
+}
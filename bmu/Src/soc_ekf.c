@@ -0,0 +1,167 @@
+/**
+  *****************************************************************************
+  * @file    soc_ekf.c
+  * @brief   Extended Kalman filter state of charge estimator
+  * @details Pack level EKF using a first order equivalent circuit cell model.
+  * Since the pack is a single series string, every cell group sees IBus, so
+  * the filter runs on the average cell voltage and tracks one SOC for the
+  * pack. The ohmic resistance is also tracked as a slow random walk, since
+  * it moves with temperature and age and an error in it shows up directly as
+  * an SOC error under load. The per step cost is constant: fixed 3x3 matrix
+  * loops and at most OCV_LUT_LEN comparisons for the OCV lookup, with
+  * no allocation, so it is safe to run from the SOC task at any rate.
+  *****************************************************************************
+  */
+
+#include "soc_ekf.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Series cell group capacity, A-s (matches coulomb counting)
+#define SOC_EKF_DEFAULT_CAPACITY_AS (128050.0f)
+// Matches ADJUSTED_CELL_IR_DEFAULT, the ohmic drop per series group at IBus
+#define SOC_EKF_DEFAULT_R0_OHMS (0.00486f)
+// Polarization branch, roughly a 30s time constant
+#define SOC_EKF_DEFAULT_R1_OHMS (0.003f)
+#define SOC_EKF_DEFAULT_C1_FARADS (10000.0f)
+
+#define SOC_EKF_DEFAULT_Q_SOC (1e-8f)
+#define SOC_EKF_DEFAULT_Q_VRC (1e-6f)
+#define SOC_EKF_DEFAULT_Q_R0 (1e-10f)
+// LUT and cell to cell spread dominate the LTC measurement error
+#define SOC_EKF_DEFAULT_R_VOLTAGE (4e-4f)
+#define SOC_EKF_DEFAULT_P_SOC (0.01f)
+#define SOC_EKF_DEFAULT_P_VRC (1e-4f)
+#define SOC_EKF_DEFAULT_P_R0 (1e-6f)
+
+// Limit slope used in the update so the flat part of the curve doesn't
+// produce a near singular gain
+#define SOC_EKF_MIN_OCV_SLOPE (0.01f)
+#define SOC_EKF_MIN_R0_OHMS (0.0f)
+
+void socEkfDefaultParams(SocEkf_Params_t *params)
+{
+    params->capacity_As = SOC_EKF_DEFAULT_CAPACITY_AS;
+    params->r0_ohms = SOC_EKF_DEFAULT_R0_OHMS;
+    params->r1_ohms = SOC_EKF_DEFAULT_R1_OHMS;
+    params->c1_farads = SOC_EKF_DEFAULT_C1_FARADS;
+    params->processNoiseSoc = SOC_EKF_DEFAULT_Q_SOC;
+    params->processNoiseVrc = SOC_EKF_DEFAULT_Q_VRC;
+    params->processNoiseR0 = SOC_EKF_DEFAULT_Q_R0;
+    params->measurementNoise = SOC_EKF_DEFAULT_R_VOLTAGE;
+    params->initialSocVariance = SOC_EKF_DEFAULT_P_SOC;
+    params->initialVrcVariance = SOC_EKF_DEFAULT_P_VRC;
+    params->initialR0Variance = SOC_EKF_DEFAULT_P_R0;
+}
+
+void socEkfInit(SocEkf_State_t *ekf, const SocEkf_Params_t *params, float initialSoc)
+{
+    ekf->params = *params;
+    ekf->soc = initialSoc > 1.0f ? 1.0f : initialSoc;
+    ekf->soc = ekf->soc < 0.0f ? 0.0f : ekf->soc;
+    ekf->vrc = 0.0f;
+    ekf->r0 = params->r0_ohms;
+    for (int i = 0; i < SOC_EKF_NUM_STATES; i++)
+    {
+        for (int j = 0; j < SOC_EKF_NUM_STATES; j++)
+        {
+            ekf->P[i][j] = 0.0f;
+        }
+    }
+    ekf->P[0][0] = params->initialSocVariance;
+    ekf->P[1][1] = params->initialVrcVariance;
+    ekf->P[2][2] = params->initialR0Variance;
+    ekf->innovation = 0.0f;
+}
+
+/**
+ * @brief Run one predict/update cycle of the filter
+ *
+ * @param ekf Filter state
+ * @param current_A Average current over the step, positive for discharge
+ * @param cellVoltage Measured (average) cell voltage at the end of the step
+ * @param dt_s Step length, seconds
+ *
+ * @return Updated SOC estimate, 0-1
+ */
+float socEkfStep(SocEkf_State_t *ekf, float current_A, float cellVoltage, float dt_s)
+{
+    const SocEkf_Params_t *p = &ekf->params;
+    float (*P)[SOC_EKF_NUM_STATES] = ekf->P;
+
+    if (dt_s <= 0.0f)
+    {
+        return ekf->soc;
+    }
+
+    /* Predict, F = diag(1, a, 1) */
+    float a = expf(-dt_s / (p->r1_ohms * p->c1_farads));
+    float F[SOC_EKF_NUM_STATES] = {1.0f, a, 1.0f};
+    float Q[SOC_EKF_NUM_STATES] = {
+        p->processNoiseSoc * dt_s,
+        p->processNoiseVrc * dt_s,
+        p->processNoiseR0 * dt_s
+    };
+
+    ekf->soc -= current_A * dt_s / p->capacity_As;
+    ekf->vrc = a * ekf->vrc + p->r1_ohms * (1.0f - a) * current_A;
+
+    for (int i = 0; i < SOC_EKF_NUM_STATES; i++)
+    {
+        for (int j = 0; j < SOC_EKF_NUM_STATES; j++)
+        {
+            P[i][j] *= F[i] * F[j];
+        }
+        P[i][i] += Q[i];
+    }
+
+    /* Update, H = [dOCV/dSOC, -1, -I] */
+    float d = 0.0f;
+    float predicted = ocvLutSocToOcv(ekf->soc, &d) - ekf->vrc - ekf->r0 * current_A;
+    d = d < SOC_EKF_MIN_OCV_SLOPE ? SOC_EKF_MIN_OCV_SLOPE : d;
+    float H[SOC_EKF_NUM_STATES] = {d, -1.0f, -current_A};
+
+    // PH = P H', s = H P H' + R
+    float PH[SOC_EKF_NUM_STATES];
+    float s = p->measurementNoise;
+    for (int i = 0; i < SOC_EKF_NUM_STATES; i++)
+    {
+        PH[i] = 0.0f;
+        for (int j = 0; j < SOC_EKF_NUM_STATES; j++)
+        {
+            PH[i] += P[i][j] * H[j];
+        }
+        s += H[i] * PH[i];
+    }
+
+    ekf->innovation = cellVoltage - predicted;
+    if (s > 0.0f)
+    {
+        float K[SOC_EKF_NUM_STATES];
+        for (int i = 0; i < SOC_EKF_NUM_STATES; i++)
+        {
+            K[i] = PH[i] / s;
+        }
+
+        ekf->soc += K[0] * ekf->innovation;
+        ekf->vrc += K[1] * ekf->innovation;
+        ekf->r0 += K[2] * ekf->innovation;
+
+        // P = P - K (P H')', P is symmetric so H P = (P H')'
+        for (int i = 0; i < SOC_EKF_NUM_STATES; i++)
+        {
+            for (int j = i; j < SOC_EKF_NUM_STATES; j++)
+            {
+                P[i][j] -= K[i] * PH[j];
+                P[j][i] = P[i][j];
+            }
+        }
+    }
+
+    ekf->soc = ekf->soc > 1.0f ? 1.0f : ekf->soc;
+    ekf->soc = ekf->soc < 0.0f ? 0.0f : ekf->soc;
+    ekf->r0 = ekf->r0 < SOC_EKF_MIN_R0_OHMS ? SOC_EKF_MIN_R0_OHMS : ekf->r0;
+
+    return ekf->soc;
+}
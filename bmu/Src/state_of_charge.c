@@ -1,6 +1,7 @@
 #include "state_of_charge.h"
 #include "ltc_chip.h"
 #include "state_of_charge_data.h"
+#include "soc_ekf.h"
 #include "batteries.h"
 #include "debug.h"
 #include "watchdog.h"
@@ -8,27 +9,30 @@
 #define SOC_TASK_PERIOD 200 
 #define SOC_TASK_ID 7
 
-#define CELL_HIGH_VOLTAGE_LOOKUP_CUTOFF 4.0f
-#define CELL_LOW_VOLTAGE_LOOKUP_CUTOFF 3.28f
+// Run the EKF and publish its estimate instead of the voltage LUT/coulomb
+// counting blend. Off until it's tuned on logged data: against a simulated
+// pack (test_soc_ekf.c) it is only better when the BMU starts with the pack
+// still polarized. From a relaxed start the blend is better (1.1% vs 4.2% RMS)
+//#define ENABLE_SOC_EKF
 
-
-#define SEGMENT_HIGH_VOLTAGE_LOOKUP_CUTOFF (CELL_HIGH_VOLTAGE_LOOKUP_CUTOFF * CELLS_PER_BOARD * NUM_BOARDS_PER_SEGMENT) //When the segment reaches this threshold, the soc algorithm will be using the integration method exclusively
-#define SEGMENT_LOW_VOLTAGE_LOOKUP_CUTOFF (CELL_LOW_VOLTAGE_LOOKUP_CUTOFF * CELLS_PER_BOARD * NUM_BOARDS_PER_SEGMENT) //When the segment reaches this threshold, the soc algorithm will start weighing the lookup table method
-
-#define SOC_HIGH_VOLTAGE_SOC_CUTOFF (0.942f) // Ramp up to around all cells 4V
-#define SOC_LOW_VOLTAGE_SOC_CUTOFF (0.06144f) // Ramp down when all cells around 3V
+#if SOC_LUT_CELLS_PER_SEGMENT != (CELLS_PER_BOARD * NUM_BOARDS_PER_SEGMENT)
+#error "SOC LUTs are characterized for a different number of cells per segment"
+#endif
 
 
 // Units A-s 152.44898 per cell
-static const float TOTAL_CAPACITY = 128050.0f;
+static const float TOTAL_CAPACITY = PACK_CAPACITY_AS;
 
 static float capacity_startup = 1.0f;
 
 // Units A-s
 static volatile float IBus_integrated = 0.0f;
 
+#ifdef ENABLE_SOC_EKF
+static SocEkf_State_t socEkf;
+#endif
+
 static HAL_StatusTypeDef getSegmentVoltage(float *segmentVoltage);
-static float interpolateLut(float value, float lut_min, float lut_step, uint8_t lutLen, const float lut[]);
 
 // In amp seconds
 void integrate_bus_current(float IBus, float period_ms)
@@ -39,13 +43,8 @@ void integrate_bus_current(float IBus, float period_ms)
 
 static float compute_voltage_soc(void)
 {
-	float soc = 0.0f;
 	float segment_voltage = 0.0f;
-	const float * soc_lut;
-	float lut_min = 0.0f;
-	float lut_step = 0.0f;
-	float lut_len = 0.0f;
-	
+
 	if(getSegmentVoltage(&segment_voltage) != HAL_OK)
 	{
 		ERROR_PRINT("Failed to read segment voltage, returning 0V");
@@ -53,33 +52,20 @@ static float compute_voltage_soc(void)
 	}
 //	DEBUG_PRINT("Segment Voltage: %f\n", segment_voltage);
 
-	if(segment_voltage >= SEGMENT_HIGH_VOLTAGE_LOOKUP_CUTOFF)
-	{
-		soc_lut = highVoltageSocLut;
-		lut_min =  HV_SOC_LUT_MIN;
-		lut_step = HV_SOC_LUT_STEP;
-		lut_len = HV_SOC_LUT_LEN;
-	}
-	else if(segment_voltage >= SEGMENT_LOW_VOLTAGE_LOOKUP_CUTOFF)
-	{
-		soc_lut = midVoltageSocLut;
-		lut_min =  MID_SOC_LUT_MIN;
-		lut_step = MID_SOC_LUT_STEP;
-		lut_len = MID_SOC_LUT_LEN;
-	}
-	else
-	{
-		soc_lut = lowVoltageSocLut;
-		lut_min =  LV_SOC_LUT_MIN;
-		lut_step = LV_SOC_LUT_STEP;
-		lut_len = LV_SOC_LUT_LEN;	
-	}
-	soc = interpolateLut(segment_voltage, lut_min, lut_step, lut_len, soc_lut);
-	soc = soc > 1.0f ? 1.0f : soc;
-	soc = soc < 0.0f ? 0.0f : soc;
-	return soc;
+	return socLutSegmentVoltageToSoc(segment_voltage);
 }
 
+#ifdef ENABLE_SOC_EKF
+static HAL_StatusTypeDef getAverageCellVoltage(float *cellVoltage)
+{
+	float packVoltage = 0.0f;
+	HAL_StatusTypeDef ret = getPackVoltage(&packVoltage);
+	*cellVoltage = packVoltage / (float)NUM_VOLTAGE_CELLS;
+	return ret;
+}
+#endif
+
+#ifndef ENABLE_SOC_EKF
 static float compute_current_soc(void)
 {
 	float capacity = capacity_startup - IBus_integrated;
@@ -88,6 +74,7 @@ static float compute_current_soc(void)
 	soc = soc < 0.0f ? 0.0f : soc;
 	return soc;
 }
+#endif
 
 void socTask(void *pvParamaters)
 {
@@ -96,10 +83,18 @@ void socTask(void *pvParamaters)
 
 	// Initially set them to be about equivalent
 	float v_soc = compute_voltage_soc();
-	float i_soc = v_soc;
 	capacity_startup = v_soc * TOTAL_CAPACITY;
 	DEBUG_PRINT("Initial SOC: %f %% \n", v_soc * 100.0f);
 
+#ifdef ENABLE_SOC_EKF
+	SocEkf_Params_t ekfParams;
+	socEkfDefaultParams(&ekfParams);
+	ekfParams.capacity_As = TOTAL_CAPACITY;
+	socEkfInit(&socEkf, &ekfParams, v_soc);
+	float lastIBusIntegrated = IBus_integrated;
+	TickType_t lastEkfTick = xTaskGetTickCount();
+#endif
+
 	if (registerTaskToWatch(SOC_TASK_ID, 2*pdMS_TO_TICKS(SOC_TASK_PERIOD), false, NULL) != HAL_OK)
 	{
 		ERROR_PRINT("ERROR: Failed to init SOC task, suspending SOC task\n");
@@ -107,34 +102,30 @@ void socTask(void *pvParamaters)
 	}
 	while(1)
 	{
-		v_soc = compute_voltage_soc();
-		i_soc = compute_current_soc();
-
-		//DEBUG_PRINT("SOC: V: %f %%, I: %f %% \n", v_soc * 100.0f, i_soc*100.0f);
-		
-		float voltage_weight = 1.0f;
-		if (v_soc >= SOC_HIGH_VOLTAGE_SOC_CUTOFF)
-		{
-			float current_weight = (1.0f - v_soc)/(1.0f - SOC_HIGH_VOLTAGE_SOC_CUTOFF);
-			voltage_weight = 1.0f - current_weight;
-		}
-		else if(v_soc >= SOC_LOW_VOLTAGE_SOC_CUTOFF)
+#ifdef ENABLE_SOC_EKF
+		// Feed the EKF the average current since the last step, taken from the
+		// 1ms integration so it isn't aliased by the 200ms period
+		TickType_t now = xTaskGetTickCount();
+		float dt_s = (float)(now - lastEkfTick) / (float)configTICK_RATE_HZ;
+		float integrated = IBus_integrated;
+		float cellVoltage = 0.0f;
+		if (dt_s > 0.0f && getAverageCellVoltage(&cellVoltage) == HAL_OK)
 		{
-			voltage_weight = 0.0f;
+			float avgCurrent = (integrated - lastIBusIntegrated) / dt_s;
+			socEkfStep(&socEkf, avgCurrent, cellVoltage, dt_s);
+			lastIBusIntegrated = integrated;
+			lastEkfTick = now;
 		}
-		else
-		{
-			float current_weight = (v_soc - 0.0f)/(SOC_LOW_VOLTAGE_SOC_CUTOFF - 0.0f);
-			voltage_weight = 1.0f - current_weight;
-		}
-		
-		// Clamp voltage weight
-		voltage_weight = voltage_weight > 1.0f ? 1.0f : voltage_weight;
-		voltage_weight = voltage_weight < 0.0f ? 0.0f : voltage_weight;
-
+		//DEBUG_PRINT("SOC: ekf %f, innovation %f \n", socEkf.soc, socEkf.innovation);
+		StateBatteryChargeHV = socEkf.soc * 100.0f;
+#else
+		v_soc = compute_voltage_soc();
+		float i_soc = compute_current_soc();
+		float voltage_weight = socLutVoltageWeight(v_soc);
 		float soc = (v_soc * voltage_weight) + (i_soc * (1.0f-voltage_weight));
 		//DEBUG_PRINT("SOC: %f, v_soc: %f, i_soc: %f \n", soc, v_soc, i_soc);
 		StateBatteryChargeHV = soc * 100.0f;
+#endif
 		watchdogTaskCheckIn(SOC_TASK_ID);
 		vTaskDelay(SOC_TASK_PERIOD);
 	}
@@ -142,23 +133,6 @@ void socTask(void *pvParamaters)
 
 
 
-static float interpolateLut(float value, float lut_min, float lut_step, uint8_t lutLen, const float lut[])
-{
-	size_t lowIndex = (value - lut_min)/lut_step;
-    if (lowIndex < 0)
-    {
-        return lut[0];
-    }
-    else if (lowIndex >= lutLen-1) //Can not interpolate with last value in LUT
-    {
-        return lut[lutLen-1];
-    }
-//	DEBUG_PRINT("lowIndex : %u\n", lowIndex);
-	float lowValue = lut_min + lowIndex*lut_step;
-    
-    return lut[lowIndex] + (value - lowValue)*(lut[lowIndex+1]-lut[lowIndex])/(lut_step);
-}
-
 static HAL_StatusTypeDef getSegmentVoltage(float *segmentVoltage)
 {
 	float temp = 0.0f;
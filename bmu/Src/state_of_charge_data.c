@@ -1,4 +1,6 @@
 #include "state_of_charge_data.h"
+#include <stddef.h>
+#include <stdint.h>
 
 //The index is calculated using the number of 0.1V steps above 56V the reading is
 const float highVoltageSocLut[HV_SOC_LUT_LEN] = 
@@ -50,3 +52,80 @@ const float lowVoltageSocLut[LV_SOC_LUT_LEN] =
     0.16790  // 3.28V per cell
 };
 
+
+static float interpolateLut(float value, float lut_min, float lut_step, uint8_t lutLen, const float lut[])
+{
+    if (value < lut_min)
+    {
+        return lut[0];
+    }
+    size_t lowIndex = (value - lut_min)/lut_step;
+    if (lowIndex >= lutLen-1) //Can not interpolate with last value in LUT
+    {
+        return lut[lutLen-1];
+    }
+    float lowValue = lut_min + lowIndex*lut_step;
+
+    return lut[lowIndex] + (value - lowValue)*(lut[lowIndex+1]-lut[lowIndex])/(lut_step);
+}
+
+/**
+ * @brief SOC of a segment at rest from its voltage, from the LUT for its
+ * voltage range
+ *
+ * @param segmentVoltage Segment voltage, V
+ *
+ * @return State of charge, 0-1
+ */
+float socLutSegmentVoltageToSoc(float segmentVoltage)
+{
+    float soc;
+
+    if (segmentVoltage >= SEGMENT_HIGH_VOLTAGE_LOOKUP_CUTOFF)
+    {
+        soc = interpolateLut(segmentVoltage, HV_SOC_LUT_MIN, HV_SOC_LUT_STEP, HV_SOC_LUT_LEN, highVoltageSocLut);
+    }
+    else if (segmentVoltage >= SEGMENT_LOW_VOLTAGE_LOOKUP_CUTOFF)
+    {
+        soc = interpolateLut(segmentVoltage, MID_SOC_LUT_MIN, MID_SOC_LUT_STEP, MID_SOC_LUT_LEN, midVoltageSocLut);
+    }
+    else
+    {
+        soc = interpolateLut(segmentVoltage, LV_SOC_LUT_MIN, LV_SOC_LUT_STEP, LV_SOC_LUT_LEN, lowVoltageSocLut);
+    }
+    soc = soc > 1.0f ? 1.0f : soc;
+    soc = soc < 0.0f ? 0.0f : soc;
+    return soc;
+}
+
+/**
+ * @brief Weight of the voltage SOC in the blend with coulomb counting. The
+ * LUT is only trusted near the ends, where the curve is steep
+ *
+ * @param voltageSoc SOC from @ref socLutSegmentVoltageToSoc
+ *
+ * @return Voltage weight, 0-1
+ */
+float socLutVoltageWeight(float voltageSoc)
+{
+    float voltage_weight = 1.0f;
+    if (voltageSoc >= SOC_HIGH_VOLTAGE_SOC_CUTOFF)
+    {
+        float current_weight = (1.0f - voltageSoc)/(1.0f - SOC_HIGH_VOLTAGE_SOC_CUTOFF);
+        voltage_weight = 1.0f - current_weight;
+    }
+    else if(voltageSoc >= SOC_LOW_VOLTAGE_SOC_CUTOFF)
+    {
+        voltage_weight = 0.0f;
+    }
+    else
+    {
+        float current_weight = (voltageSoc - 0.0f)/(SOC_LOW_VOLTAGE_SOC_CUTOFF - 0.0f);
+        voltage_weight = 1.0f - current_weight;
+    }
+
+    // Clamp voltage weight
+    voltage_weight = voltage_weight > 1.0f ? 1.0f : voltage_weight;
+    voltage_weight = voltage_weight < 0.0f ? 0.0f : voltage_weight;
+    return voltage_weight;
+}
@@ -0,0 +1,80 @@
+/**
+  *****************************************************************************
+  * @file    state_of_power.c
+  * @brief   Charge and discharge limits over a prediction horizon
+  * @details Each limit is the smallest of:
+  *   - Voltage: the weakest (or strongest) cell, modelled as OCV behind R0
+  *     and an R1||C1 branch, must stay inside its window at the end of the
+  *     horizon
+  *   - Charge: the pack can't deliver more charge than it holds (or accept
+  *     more than it has room for) within the horizon
+  *   - Thermal: I^2R heating over the horizon can't take the hottest cell
+  *     past its maximum temperature
+  *   - Temperature derating near the hot and cold limits, and the hardware
+  *     current limits
+  * Power is evaluated at the pack terminal voltage at that current.
+  *****************************************************************************
+  */
+
+#include "state_of_power.h"
+#include <math.h>
+
+static float minf(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static float clampf(float value, float low, float high)
+{
+    value = value > high ? high : value;
+    return value < low ? low : value;
+}
+
+/**
+ * @brief Linear derating factor, 1 at full and 0 at zero, clamped to [0, 1].
+ * Works for derating in either direction, full and zero must differ
+ */
+static float derate(float value, float full, float zero)
+{
+    return clampf((value - zero) / (full - zero), 0.0f, 1.0f);
+}
+
+void sopCompute(const SOP_Params_t *params, const SOP_Inputs_t *in, float horizon_s, SOP_Limits_t *out)
+{
+    const SOP_Params_t *p = params;
+
+    // Resistance the cell presents after a constant current step of horizon_s
+    float rEff = p->r0_ohms + p->r1_ohms * (1.0f - expf(-horizon_s / p->tau_s));
+    float rPack = rEff * (float)p->numSeriesCells;
+    float soc = clampf(in->soc, 0.0f, 1.0f);
+
+    float thermalHeadroom = p->cellTempMax - in->tempMax;
+    float thermalLimit = 0.0f;
+    if (thermalHeadroom > 0.0f)
+    {
+        thermalLimit = sqrtf(thermalHeadroom * p->thermalMass_JperK / (p->thermalResistance_ohms * horizon_s));
+    }
+
+    /* Discharge */
+    float discharge = p->maxDischargeCurrent;
+    discharge = minf(discharge, (in->ocvMin - p->cellVoltageMin) / rEff);
+    discharge = minf(discharge, soc * p->capacity_As / horizon_s);
+    discharge = minf(discharge, thermalLimit);
+    discharge *= derate(in->tempMax, p->dischargeDerateTemp, p->cellTempMax);
+    discharge = discharge < 0.0f ? 0.0f : discharge;
+
+    /* Charge */
+    float charge = p->maxChargeCurrent;
+    charge = minf(charge, (p->cellVoltageMax - in->ocvMax) / rEff);
+    charge = minf(charge, (1.0f - soc) * p->capacity_As / horizon_s);
+    charge = minf(charge, thermalLimit);
+    charge *= derate(in->tempMax, p->dischargeDerateTemp, p->cellTempMax);
+    charge *= derate(in->tempMin, p->chargeDerateTemp, p->chargeTempMin);
+    charge = charge < 0.0f ? 0.0f : charge;
+
+    out->dischargeCurrent = discharge;
+    out->chargeCurrent = charge;
+    out->dischargePower = discharge * (in->packOcv - discharge * rPack);
+    out->chargePower = charge * (in->packOcv + charge * rPack);
+    out->dischargePower = out->dischargePower < 0.0f ? 0.0f : out->dischargePower;
+}
@@ -0,0 +1,218 @@
+/**
+  *****************************************************************************
+  * @file    thermal_estimator.c
+  * @brief   Estimates the temperature of channels with a failed thermistor
+  * @details A reading outside [minValid_C, maxValid_C] marks the channel's
+  * thermistor as failed. Working channels take their reading. A failed
+  * channel is predicted with a lumped model:
+  *
+  *   C dT/dt = I^2 R - G(fan) (T - T_inlet) + Gn sum(T_neighbour - T)
+  *
+  * where T_inlet is the coolest working channel. The prediction is then
+  * corrected towards the mean of the nearest working channel on each side as
+  * a scalar Kalman update, with a measurement variance that grows with the
+  * square of the distance to the further one. That mean is biased by the channel's
+  * position in the air flow, so the variance is kept at or above the
+  * measurement variance rather than collapsing as corrections accumulate. A
+  * failed channel with no working channel in its segment runs on the model
+  * alone and its variance grows with time.
+  *****************************************************************************
+  */
+
+#include "thermal_estimator.h"
+#include <math.h>
+
+void thermalEstimatorInit(ThermalEstimator_t *est, const ThermalEstimator_Params_t *params)
+{
+    est->params = *params;
+    if (est->params.numChannels > THERMAL_ESTIMATOR_MAX_CHANNELS) {
+        est->params.numChannels = THERMAL_ESTIMATOR_MAX_CHANNELS;
+    }
+    if (est->params.channelsPerSegment == 0) {
+        est->params.channelsPerSegment = est->params.numChannels;
+    }
+
+    for (uint32_t ch = 0; ch < THERMAL_ESTIMATOR_MAX_CHANNELS; ch++) {
+        est->temperature_C[ch] = 0.0f;
+        est->variance_K2[ch] = 0.0f;
+        est->failed[ch] = false;
+    }
+    est->initialized = false;
+    est->inlet_C = 0.0f;
+    est->numFailed = 0;
+}
+
+static bool isValidReading(const ThermalEstimator_Params_t *params, float reading)
+{
+    // Written so NaN is invalid
+    return reading >= params->minValid_C && reading <= params->maxValid_C;
+}
+
+/*
+ * Sums the temperatures of ch's neighbours in its segment
+ * @return number of neighbours summed
+ */
+static uint32_t sumNeighbours(const ThermalEstimator_t *est, uint32_t ch, float *sum)
+{
+    const uint32_t perSegment = est->params.channelsPerSegment;
+    const uint32_t segmentStart = (ch / perSegment) * perSegment;
+    uint32_t count = 0;
+
+    *sum = 0.0f;
+    if (ch > segmentStart) {
+        *sum += est->temperature_C[ch - 1];
+        count++;
+    }
+    if (ch + 1 < segmentStart + perSegment && ch + 1 < est->params.numChannels) {
+        *sum += est->temperature_C[ch + 1];
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Averages the nearest working channel on each side of ch in its segment.
+ * Their offsets from ch come from the same air flow so don't average out,
+ * the spread is taken from the further of the two
+ * @return squared distance to the further channel, 0 if none was found
+ */
+static float nearestWorkingMean(const ThermalEstimator_t *est, uint32_t ch, float *mean)
+{
+    const uint32_t perSegment = est->params.channelsPerSegment;
+    const uint32_t segmentStart = (ch / perSegment) * perSegment;
+    uint32_t segmentEnd = segmentStart + perSegment;
+    if (segmentEnd > est->params.numChannels) {
+        segmentEnd = est->params.numChannels;
+    }
+
+    float sum = 0.0f;
+    float distanceSq = 0.0f;
+    uint32_t count = 0;
+
+    for (uint32_t other = ch; other > segmentStart; other--) {
+        if (!est->failed[other - 1]) {
+            const float distance = ch - (other - 1);
+            sum += est->temperature_C[other - 1];
+            distanceSq = fmaxf(distanceSq, distance * distance);
+            count++;
+            break;
+        }
+    }
+    for (uint32_t other = ch + 1; other < segmentEnd; other++) {
+        if (!est->failed[other]) {
+            const float distance = other - ch;
+            sum += est->temperature_C[other];
+            distanceSq = fmaxf(distanceSq, distance * distance);
+            count++;
+            break;
+        }
+    }
+
+    if (count == 0) {
+        return 0.0f;
+    }
+    *mean = sum / count;
+    return distanceSq;
+}
+
+/**
+ * @brief Update the estimates with the latest readings
+ *
+ * @param measured_C Thermistor readings, one per channel
+ * @param current_A Pack current, either sign
+ * @param fanDuty Fan duty, 0-1
+ * @param dt_s Time since the last step
+ */
+void thermalEstimatorStep(ThermalEstimator_t *est, const float measured_C[], float current_A,
+                          float fanDuty, float dt_s)
+{
+    const ThermalEstimator_Params_t *params = &est->params;
+    const uint32_t numChannels = params->numChannels;
+
+    // Working channels follow their thermistor
+    float inlet = INFINITY;
+    float workingSum = 0.0f;
+    uint32_t numFailed = 0;
+    for (uint32_t ch = 0; ch < numChannels; ch++) {
+        if (isValidReading(params, measured_C[ch])) {
+            est->failed[ch] = false;
+            est->temperature_C[ch] = measured_C[ch];
+            est->variance_K2[ch] = params->sensorNoise_K2;
+            inlet = fminf(inlet, measured_C[ch]);
+            workingSum += measured_C[ch];
+        } else {
+            est->failed[ch] = true;
+            numFailed++;
+        }
+    }
+    est->numFailed = numFailed;
+
+    if (numFailed < numChannels) {
+        est->inlet_C = inlet;
+    }
+
+    if (!est->initialized) {
+        // Start failed channels at the mean of the working ones, with a
+        // neighbour sized uncertainty
+        const float mean = (numFailed < numChannels) ? workingSum / (numChannels - numFailed) : 25.0f;
+        for (uint32_t ch = 0; ch < numChannels; ch++) {
+            if (est->failed[ch]) {
+                est->temperature_C[ch] = mean;
+                est->variance_K2[ch] = 4.0f * params->neighbourNoise_K2;
+            }
+        }
+        est->initialized = true;
+        return;
+    }
+
+    if (numFailed == 0) {
+        return;
+    }
+
+    fanDuty = fminf(fmaxf(fanDuty, 0.0f), 1.0f);
+    const float heating_W = current_A * current_A * params->heatingResistance_ohms;
+    const float cooling_WperK = params->coolingFanOff_WperK + fanDuty * params->coolingFanFull_WperK;
+
+    for (uint32_t ch = 0; ch < numChannels; ch++) {
+        if (!est->failed[ch]) {
+            continue;
+        }
+
+        float T = est->temperature_C[ch];
+        float P = est->variance_K2[ch];
+
+        // Predict
+        float neighbourSum;
+        uint32_t neighbours = sumNeighbours(est, ch, &neighbourSum);
+        float flow_W = heating_W - cooling_WperK * (T - est->inlet_C)
+                       + params->neighbourCoupling_WperK * (neighbourSum - neighbours * T);
+        T += dt_s * flow_W / params->heatCapacity_JperK;
+        P += params->processNoise_K2ps * dt_s;
+
+        // Correct towards the nearest working channels, trusted less the
+        // further away they are
+        float z;
+        const float spread = nearestWorkingMean(est, ch, &z);
+        if (spread > 0.0f) {
+            const float R = params->neighbourNoise_K2 * spread;
+            const float K = P / (P + R);
+            T += K * (z - T);
+            P = fmaxf((1.0f - K) * P, R);
+        }
+
+        est->temperature_C[ch] = T;
+        est->variance_K2[ch] = P;
+    }
+}
+
+/// @return estimate plus sigmas standard deviations, for over temperature checks
+float thermalEstimatorUpperBound(const ThermalEstimator_t *est, uint32_t channel, float sigmas)
+{
+    return est->temperature_C[channel] + sigmas * sqrtf(est->variance_K2[channel]);
+}
+
+/// @return estimate less sigmas standard deviations, for under temperature checks
+float thermalEstimatorLowerBound(const ThermalEstimator_t *est, uint32_t channel, float sigmas)
+{
+    return est->temperature_C[channel] - sigmas * sqrtf(est->variance_K2[channel]);
+}
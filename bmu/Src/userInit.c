@@ -59,7 +59,7 @@ void userInit()
         Error_Handler();
     }
 
-    if (initBusVoltagesAndCurrentQueues() != HAL_OK) {
+    if (initBusVoltagesAndCurrentSnapshot() != HAL_OK) {
         Error_Handler();
     }
  
@@ -0,0 +1,10 @@
+#ifndef CYCLE_CLOCK_H
+
+#define CYCLE_CLOCK_H
+
+#include "bsp.h"
+
+void cycleClockInit();
+uint32_t cycleClockMicros();
+
+#endif /* end of include guard: CYCLE_CLOCK_H */
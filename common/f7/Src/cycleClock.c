@@ -0,0 +1,51 @@
+/**
+  *****************************************************************************
+  * @file    cycleClock.c
+  * @brief   Microsecond time stamps from the Cortex-M7 DWT cycle counter
+  * @details Finer than the 1 ms tick, for timing interrupts and the tasks
+  * they wake. The counter is extended to a 32 bit microsecond count each
+  * time it's read.
+  ******************************************************************************
+  */
+
+#include "cycleClock.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+/**
+ * @brief Starts the cycle counter, if it isn't already running
+ */
+void cycleClockInit()
+{
+   if (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+      return;
+   }
+   CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+   DWT->LAR = 0xC5ACCE55; // Unlock access to the DWT
+   DWT->CYCCNT = 0;
+   DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Microseconds since @ref cycleClockInit, wrapping at 32 bits. The
+ * cycle counter wraps every ~20 s, so this must be called at least that often
+ * to extend it. Safe to call from interrupts
+ */
+uint32_t cycleClockMicros()
+{
+   static uint32_t lastCycles = 0;
+   static uint32_t remainderCycles = 0;
+   static uint32_t micros = 0;
+   const uint32_t cyclesPerMicro = SystemCoreClock / 1000000U;
+
+   UBaseType_t savedInterruptStatus = portSET_INTERRUPT_MASK_FROM_ISR();
+   uint32_t cycles = DWT->CYCCNT;
+   remainderCycles += cycles - lastCycles;
+   lastCycles = cycles;
+   micros += remainderCycles / cyclesPerMicro;
+   remainderCycles %= cyclesPerMicro;
+   uint32_t now = micros;
+   portCLEAR_INTERRUPT_MASK_FROM_ISR(savedInterruptStatus);
+
+   return now;
+}
@@ -0,0 +1,391 @@
+"""
+Emulates the Cascadia Motion PM100DX inverter on the CAN protocol the VCU
+speaks to it (see vcu/Src/motorController.c and canReceive.c).
+
+The model works on decoded DBC signals and times in seconds, so it can be
+stepped from a real time CAN loop (inverter_emulator.py) or a virtual clock.
+It covers the parts of the Cascadia protocol the VCU relies on:
+ - The vehicle state machine (VSM) and inverter state, with the enable
+   lockout that is only released by a disable command
+ - The command message timeout, which disables the inverter and locks it out
+ - Torque commands (sent by the VCU as Nm * 10) and the torque limit command
+ - Parameter (EEPROM) reads and writes, including the fault clear address
+ - Run and post fault codes, injected by the test
+The motor's torque follows the command through a current loop lag, limited
+by the motor's peak torque, the inverter's DC current limit and the voltage
+available for field weakening.
+"""
+from dataclasses import dataclass, field
+from enum import IntEnum
+import math
+
+
+class VsmState(IntEnum):
+    START = 0
+    PRECHARGE_INIT = 1
+    PRECHARGE_ACTIVE = 2
+    PRECHARGE_COMPLETE = 3
+    WAIT = 4
+    READY = 5
+    MOTOR_RUNNING = 6
+    FAULT = 7
+    SHUTDOWN = 14
+    RECYCLE_POWER = 15
+
+
+class InverterState(IntEnum):
+    POWER_UP = 0
+    STOP = 1
+    OPEN_LOOP = 2
+    CLOSED_LOOP = 3
+    WAIT = 4
+    IDLE_RUN = 8
+    IDLE_STOP = 9
+
+
+# From vcu/Inc/motorController.h
+FAULT_CLEAR_ADDRESS = 20
+PARAM_WRITE = 1
+PARAM_READ = 0
+
+# Default broadcast periods (s). The fast messages go out every 10 ms, the
+# slow ones every 100 ms, as set in the inverter's CAN active messages word
+BROADCAST_PERIODS = {
+    'MC_Motor_Position_Info': 0.010,
+    'MC_Current_Info': 0.010,
+    'MC_Voltage_Info': 0.010,
+    'MC_Flux_ID_IQ_Info': 0.010,
+    'MC_Internal_States': 0.010,
+    'MC_Fault_Codes': 0.010,
+    'MC_Torque_And_Timer_Info': 0.010,
+    'MC_Modulation_And_Flux_Info': 0.010,
+    'MC_Temperature_Set_1': 0.100,
+    'MC_Temperature_Set_2': 0.100,
+    'MC_Temperature_Set_3': 0.100,
+    'MC_Internal_Voltages': 0.100,
+    'MC_Firmware_Info': 0.100,
+}
+
+
+@dataclass
+class InverterParams:
+    peak_torque_Nm: float = 231.0           # MAX_MOTOR_TORQUE_NM
+    current_loop_tau_s: float = 0.003       # Torque response to a step command
+    command_timeout_s: float = 0.333        # EEPROM CAN command message timeout
+    dc_current_limit_A: float = 250.0       # DISCHARGE_CURRENT_LIMIT_DEFAULT
+    regen_current_limit_A: float = 0.0      # CHARGE_CURRENT_LIMIT_DEFAULT
+    min_bus_voltage_V: float = 50.0         # Below this the VSM stays in START
+    efficiency: float = 0.93                # Inverter and motor, shaft power / DC power
+    # Speed at which the back EMF reaches the bus voltage, per volt of bus
+    base_speed_rpm_per_V: float = 11.0
+    torque_constant_Nm_per_A: float = 0.61  # For phase current reports
+    pole_pairs: int = 10
+    coolant_temp_C: float = 35.0
+    thermal_tau_s: float = 30.0
+    thermal_resistance_C_per_W: float = 0.02
+
+
+@dataclass
+class InverterStatistics:
+    commands: int = 0
+    enables_while_locked_out: int = 0
+    command_timeouts: int = 0
+    param_reads: int = 0
+    param_writes: int = 0
+    fault_clears: int = 0
+
+
+@dataclass
+class CascadiaInverter:
+    params: InverterParams = field(default_factory=InverterParams)
+    # EEPROM parameters by address. Reads of addresses not listed here fail
+    eeprom: dict = field(default_factory=lambda: {FAULT_CLEAR_ADDRESS: 0})
+
+    def __post_init__(self):
+        self.vsm_state = VsmState.START
+        self.inverter_state = InverterState.POWER_UP
+        self.lockout = True
+        self.enabled = False
+        self.direction = 0
+        self.run_faults = 0
+        self.post_faults = 0
+        self.torque_command_Nm = 0.0
+        self.torque_limit_Nm = 0.0
+        self.torque_Nm = 0.0
+        self.last_command_s = None
+        self.rolling_counter = 0
+        self.power_on_s = 0.0
+        self.module_temp_C = self.params.coolant_temp_C
+        self.dc_bus_V = 0.0
+        self.dc_bus_A = 0.0
+        self.motor_rpm = 0.0
+        self.pending_responses = []
+        self.stats = InverterStatistics()
+        self._last_step_s = None
+
+    # ------------------------------------------------------------------
+    # Messages from the VCU
+    # ------------------------------------------------------------------
+    def on_command(self, signals, now_s):
+        """MC_Command_Message"""
+        self.stats.commands += 1
+        self.last_command_s = now_s
+        enable = bool(signals['VCU_INV_Inverter_Enable'])
+        if not enable:
+            # A disable command releases the lockout, unless faulted
+            self.enabled = False
+            if self.vsm_state != VsmState.FAULT:
+                self.lockout = False
+        elif self.lockout or self.vsm_state in (VsmState.FAULT, VsmState.START):
+            if not self.enabled:
+                self.stats.enables_while_locked_out += 1
+        else:
+            self.enabled = True
+        self.direction = int(signals['VCU_INV_Direction_Command'])
+        # The VCU sends torque in Nm * 10 on a signal scaled 1
+        self.torque_command_Nm = signals['VCU_INV_Torque_Command'] / 10.0
+        self.torque_limit_Nm = signals['VCU_INV_Torque_Limit_Command']
+
+    def on_param_command(self, signals, now_s):
+        """MC_Read_Write_Param_Command, answered on the next step"""
+        address = int(signals['VCU_INV_Parameter_Address'])
+        data = int(signals['VCU_INV_Parameter_Data'])
+        write_ok = 0
+        if int(signals['VCU_INV_Parameter_RW_Command']) == PARAM_WRITE:
+            self.stats.param_writes += 1
+            if address == FAULT_CLEAR_ADDRESS:
+                if data == 0:
+                    self.clear_faults()
+                write_ok = 1
+            elif address in self.eeprom:
+                self.eeprom[address] = data
+                write_ok = 1
+        else:
+            self.stats.param_reads += 1
+            data = self.eeprom.get(address, 0)
+        self.pending_responses.append({
+            'INV_Parameter_Response_Addr': address,
+            'INV_Parameter_Response_Write_OK': write_ok,
+            'INV_Parameter_Response_Data': data,
+        })
+
+    # ------------------------------------------------------------------
+    # Faults
+    # ------------------------------------------------------------------
+    def inject_fault(self, run_faults=0, post_faults=0):
+        self.run_faults |= run_faults
+        self.post_faults |= post_faults
+        if self.run_faults or self.post_faults:
+            self.vsm_state = VsmState.FAULT
+            self.enabled = False
+            self.lockout = True
+
+    def clear_faults(self):
+        self.stats.fault_clears += 1
+        self.run_faults = 0
+        self.post_faults = 0
+        if self.vsm_state == VsmState.FAULT:
+            # Re-enabling needs a disable command first
+            self.vsm_state = VsmState.WAIT
+            self.lockout = True
+
+    # ------------------------------------------------------------------
+    # Motor
+    # ------------------------------------------------------------------
+    def available_torque_Nm(self, rpm, bus_V):
+        """Torque the inverter will produce at a speed, before the command"""
+        p = self.params
+        limit = p.peak_torque_Nm
+        if 0 < self.torque_limit_Nm < limit:
+            limit = self.torque_limit_Nm
+        omega = abs(rpm) * 2 * math.pi / 60
+        if omega > 1.0:
+            # DC current limit, P = V I = T w / efficiency
+            limit = min(limit, bus_V * p.dc_current_limit_A * p.efficiency / omega)
+            # Field weakening above base speed, falling to zero at twice base
+            base_rpm = p.base_speed_rpm_per_V * bus_V
+            if abs(rpm) > base_rpm:
+                limit *= max(0.0, 2.0 - abs(rpm) / base_rpm) if base_rpm > 0 else 0.0
+        return max(0.0, limit)
+
+    def step(self, now_s, motor_rpm, bus_V):
+        """
+        Advance to now_s with the motor at motor_rpm and the DC bus at bus_V.
+        Returns the shaft torque (Nm) and DC bus current (A) drawn
+        """
+        p = self.params
+        dt = 0.0 if self._last_step_s is None else max(0.0, now_s - self._last_step_s)
+        self._last_step_s = now_s
+        self.power_on_s += dt
+        self.motor_rpm = motor_rpm
+        self.dc_bus_V = bus_V
+
+        if self.vsm_state == VsmState.START and bus_V >= p.min_bus_voltage_V:
+            self.vsm_state = VsmState.WAIT
+            self.inverter_state = InverterState.STOP
+        elif self.vsm_state != VsmState.FAULT and bus_V < p.min_bus_voltage_V:
+            self.vsm_state = VsmState.START
+            self.inverter_state = InverterState.POWER_UP
+            self.enabled = False
+
+        if (self.enabled and self.last_command_s is not None
+                and now_s - self.last_command_s > p.command_timeout_s):
+            self.stats.command_timeouts += 1
+            self.enabled = False
+            self.lockout = True
+
+        if self.vsm_state != VsmState.FAULT and self.vsm_state != VsmState.START:
+            if self.enabled:
+                self.vsm_state = VsmState.MOTOR_RUNNING
+                self.inverter_state = InverterState.CLOSED_LOOP
+            else:
+                self.vsm_state = VsmState.WAIT
+                self.inverter_state = InverterState.STOP
+
+        target = 0.0
+        if self.enabled:
+            limit = self.available_torque_Nm(motor_rpm, bus_V)
+            target = min(max(self.torque_command_Nm, 0.0), limit)
+            if self.direction:
+                target = -target
+        if p.current_loop_tau_s > 0:
+            self.torque_Nm += (target - self.torque_Nm) * (1.0 - math.exp(-dt / p.current_loop_tau_s))
+        else:
+            self.torque_Nm = target
+        if not self.enabled and abs(self.torque_Nm) < 0.05:
+            self.torque_Nm = 0.0
+
+        omega = motor_rpm * 2 * math.pi / 60
+        shaft_W = self.torque_Nm * omega
+        if shaft_W >= 0:
+            dc_W = shaft_W / p.efficiency
+        else:
+            dc_W = shaft_W * p.efficiency
+        self.dc_bus_A = dc_W / bus_V if bus_V > 1.0 else 0.0
+        if self.dc_bus_A < -p.regen_current_limit_A:
+            self.dc_bus_A = -p.regen_current_limit_A
+
+        loss_W = abs(dc_W - shaft_W) + 20.0
+        target_temp = p.coolant_temp_C + loss_W * p.thermal_resistance_C_per_W
+        if p.thermal_tau_s > 0:
+            self.module_temp_C += (target_temp - self.module_temp_C) * (1.0 - math.exp(-dt / p.thermal_tau_s))
+
+        return self.torque_Nm, self.dc_bus_A
+
+    # ------------------------------------------------------------------
+    # Broadcast messages, as decoded signals
+    # ------------------------------------------------------------------
+    def broadcast(self, name):
+        p = self.params
+        iq = self.torque_Nm / p.torque_constant_Nm_per_A
+        if name == 'MC_Motor_Position_Info':
+            return {
+                'INV_Motor_Angle_Electrical': 0,
+                'INV_Motor_Speed': int(round(self.motor_rpm)),
+                'INV_Electrical_Output_Frequency': self.motor_rpm / 60 * p.pole_pairs,
+                'INV_Delta_Resolver_Filtered': 0,
+            }
+        if name == 'MC_Current_Info':
+            phase = abs(iq) / math.sqrt(2)
+            return {
+                'INV_Phase_A_Current': phase,
+                'INV_Phase_B_Current': phase,
+                'INV_Phase_C_Current': phase,
+                'INV_DC_Bus_Current': self.dc_bus_A,
+            }
+        if name == 'MC_Voltage_Info':
+            return {
+                'INV_DC_Bus_Voltage': self.dc_bus_V,
+                'INV_Output_Voltage': 0,
+                'INV_VAB_Vd_Voltage': 0,
+                'INV_VBC_Vq_Voltage': 0,
+            }
+        if name == 'MC_Flux_ID_IQ_Info':
+            return {'INV_Vd_ff': 0, 'INV_Vq_ff': 0, 'INV_Id': 0, 'INV_Iq': iq}
+        if name == 'MC_Internal_States':
+            self.rolling_counter = (self.rolling_counter + 1) & 0xF
+            signals = {s: 0 for s in _INTERNAL_STATES_SIGNALS}
+            signals.update({
+                'INV_VSM_State': int(self.vsm_state),
+                'INV_Inverter_State': int(self.inverter_state),
+                'INV_Inverter_Run_Mode': 0,
+                'INV_Inverter_Command_Mode': 0,
+                'INV_Rolling_Counter': self.rolling_counter,
+                'INV_Inverter_Enable_State': int(self.enabled),
+                'INV_Inverter_Enable_Lockout': int(self.lockout),
+                'INV_Direction_Command': self.direction,
+                'INV_PWM_Frequency': 12,
+            })
+            return signals
+        if name == 'MC_Fault_Codes':
+            return {
+                'INV_Post_Fault_Lo': self.post_faults & 0xFFFF,
+                'INV_Post_Fault_Hi': (self.post_faults >> 16) & 0xFFFF,
+                'INV_Run_Fault_Lo': self.run_faults & 0xFFFF,
+                'INV_Run_Fault_Hi': (self.run_faults >> 16) & 0xFFFF,
+            }
+        if name == 'MC_Torque_And_Timer_Info':
+            return {
+                'INV_Commanded_Torque': self.torque_command_Nm if self.enabled else 0.0,
+                'INV_Torque_Feedback': self.torque_Nm,
+                'INV_Power_On_Timer': int(self.power_on_s / 0.003) * 0.003,
+            }
+        if name == 'MC_Modulation_And_Flux_Info':
+            return {
+                'INV_Modulation_Index': 0,
+                'INV_Flux_Weakening_Output': 0,
+                'INV_Id_Command': 0,
+                'INV_Iq_Command': iq,
+            }
+        if name == 'MC_Temperature_Set_1':
+            return {
+                'INV_Module_A_Temp': self.module_temp_C,
+                'INV_Module_B_Temp': self.module_temp_C,
+                'INV_Module_C_Temp': self.module_temp_C,
+                'INV_Gate_Driver_Board_Temp': p.coolant_temp_C,
+            }
+        if name == 'MC_Temperature_Set_2':
+            return {
+                'INV_Control_Board_Temp': p.coolant_temp_C,
+                'INV_RTD1_Temperature': 0,
+                'INV_RTD2_Temperature': 0,
+                'INV_Stall_Burst_Model_Temp': 0,
+            }
+        if name == 'MC_Temperature_Set_3':
+            return {
+                'INV_Coolant_Temp': p.coolant_temp_C,
+                'INV_Hot_Spot_Temp': self.module_temp_C,
+                'INV_Motor_Temp': p.coolant_temp_C,
+                'INV_Torque_Shudder': 0,
+            }
+        if name == 'MC_Internal_Voltages':
+            return {
+                'INV_Ref_Voltage_1_5': 1.5,
+                'INV_Ref_Voltage_2_5': 2.5,
+                'INV_Ref_Voltage_5_0': 5.0,
+                'INV_Ref_Voltage_12_0': 12.0,
+            }
+        if name == 'MC_Firmware_Info':
+            return {
+                'INV_Project_Code_EEP_Ver': 0,
+                'INV_SW_Version': 0,
+                'INV_DateCode_MMDD': 0,
+                'INV_DateCode_YYYY': 0,
+            }
+        raise KeyError(name)
+
+    def take_responses(self):
+        """MC_Read_Write_Param_Response signals waiting to be sent"""
+        responses, self.pending_responses = self.pending_responses, []
+        return responses
+
+
+_INTERNAL_STATES_SIGNALS = (
+    'INV_Relay_1_Status', 'INV_Relay_2_Status', 'INV_Relay_3_Status',
+    'INV_Relay_4_Status', 'INV_Relay_5_Status', 'INV_Relay_6_Status',
+    'INV_Inverter_Discharge_State', 'INV_Self_Sensing_Assist_Enable',
+    'INV_Burst_Model_Mode', 'INV_Key_Switch_Start_Status', 'INV_BMS_Active',
+    'INV_BMS_Torque_Limiting', 'INV_Limit_Max_Speed', 'INV_Limit_Hot_Spot',
+    'INV_Low_Speed_Limiting', 'INV_Limit_Coolant_Derating',
+    'INV_Limit_Stall_Burst_Model',
+)
@@ -0,0 +1,165 @@
+"""
+Latency and effectiveness measurements of the VCU's control loops, taken by
+the inverter emulator from the commands the VCU sends back.
+
+ - Command timing: intervals between MC_Command_Message frames
+ - Throttle latency: from a pedal step to the first torque command that
+   follows it
+ - Traction control latency: from the rear slip first exceeding the target
+   to the first command that cuts the torque below its value at that time
+ - Slip: peak, RMS over the target and time spent over the target while
+   driving. Slip is only counted once the car or the rear wheels are past
+   about 10 rad/s, where the VCU's traction control starts acting
+"""
+import math
+
+
+def percentile(values, fraction):
+    if not values:
+        return None
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, int(math.ceil(fraction * len(ordered))) - 1))
+    return ordered[index]
+
+
+def distribution(values_s):
+    """Summary of a list of times, in ms"""
+    if not values_s:
+        return {'count': 0}
+    ms = [v * 1000 for v in values_s]
+    mean = sum(ms) / len(ms)
+    return {
+        'count': len(ms),
+        'mean_ms': mean,
+        'std_ms': math.sqrt(sum((v - mean) ** 2 for v in ms) / len(ms)),
+        'p50_ms': percentile(ms, 0.50),
+        'p95_ms': percentile(ms, 0.95),
+        'p99_ms': percentile(ms, 0.99),
+        'max_ms': max(ms),
+    }
+
+
+def histogram(values_s, bin_ms, bins=20):
+    """Counts of values in bins of bin_ms, the last bin holding the overflow"""
+    counts = [0] * bins
+    for v in values_s:
+        counts[min(bins - 1, int(v * 1000 // bin_ms))] += 1
+    return counts
+
+
+def format_histogram(title, values_s, bin_ms, bins=20, width=40):
+    counts = histogram(values_s, bin_ms, bins)
+    peak = max(counts) if any(counts) else 1
+    lines = [title]
+    for i, count in enumerate(counts):
+        if count == 0:
+            continue
+        label = f'{i * bin_ms:6.1f}-{(i + 1) * bin_ms:6.1f} ms' if i < bins - 1 else f'{i * bin_ms:6.1f}+ ms        '
+        lines.append(f'  {label} {count:6d} ' + '#' * max(1, count * width // peak))
+    return '\n'.join(lines)
+
+
+class ControlMetrics:
+    def __init__(self, desired_slip=0.1, min_slip_speed_mps=2.5):
+        self.desired_slip = desired_slip
+        self.min_slip_speed_mps = min_slip_speed_mps
+        self.command_times_s = []
+        self.last_torque_Nm = None
+        self.last_limit_Nm = None
+        # Throttle
+        self.last_throttle = 0.0
+        self.throttle_step_s = None
+        self.throttle_step_rising = True
+        self.throttle_latencies_s = []
+        # Traction control
+        self.slip_onset_s = None
+        self.slip_onset_torque_Nm = None
+        self.tc_latencies_s = []
+        self.slip_over_s = 0.0
+        self.slip_sq_sum = 0.0
+        self.slip_samples = 0
+        self.peak_slip = 0.0
+        self.drive_time_s = 0.0
+
+    def on_throttle(self, throttle, now_s, threshold=0.05):
+        """Pedal position the driver sets, 0 - 1"""
+        if abs(throttle - self.last_throttle) >= threshold and self.throttle_step_s is None:
+            self.throttle_step_s = now_s
+            self.throttle_step_rising = throttle > self.last_throttle
+        self.last_throttle = throttle
+
+    def on_command(self, torque_Nm, limit_Nm, enabled, now_s):
+        """Each MC_Command_Message, torque in Nm"""
+        self.command_times_s.append(now_s)
+        if self.throttle_step_s is not None and enabled and self.last_torque_Nm is not None:
+            changed = (torque_Nm > self.last_torque_Nm) if self.throttle_step_rising else (torque_Nm < self.last_torque_Nm)
+            if changed:
+                self.throttle_latencies_s.append(now_s - self.throttle_step_s)
+                self.throttle_step_s = None
+        if self.slip_onset_s is not None:
+            command = min(torque_Nm, limit_Nm) if limit_Nm > 0 else torque_Nm
+            if command < self.slip_onset_torque_Nm - 0.5:
+                self.tc_latencies_s.append(now_s - self.slip_onset_s)
+                self.slip_onset_s = None
+        self.last_torque_Nm = torque_Nm
+        self.last_limit_Nm = limit_Nm
+
+    def on_vehicle(self, slip, speed_mps, wheel_speed_mps, torque_Nm, dt_s, now_s):
+        """
+        Each physics step, with the true rear slip, the car's and the rear
+        wheels' speeds and the shaft torque
+        """
+        if max(speed_mps, wheel_speed_mps) < self.min_slip_speed_mps:
+            self.slip_onset_s = None
+            return
+        if torque_Nm <= 0:
+            return
+        self.drive_time_s += dt_s
+        self.peak_slip = max(self.peak_slip, slip)
+        over = max(0.0, slip - self.desired_slip)
+        self.slip_sq_sum += over ** 2
+        self.slip_samples += 1
+        if over > 0:
+            self.slip_over_s += dt_s
+            if self.slip_onset_s is None and self.last_torque_Nm is not None:
+                self.slip_onset_s = now_s
+                command = self.last_torque_Nm
+                if self.last_limit_Nm:
+                    command = min(command, self.last_limit_Nm)
+                self.slip_onset_torque_Nm = command
+        elif self.slip_onset_s is not None and slip < self.desired_slip * 0.5:
+            # Recovered without a torque cut
+            self.slip_onset_s = None
+
+    def command_intervals_s(self):
+        t = self.command_times_s
+        return [b - a for a, b in zip(t, t[1:])]
+
+    def summary(self):
+        return {
+            'command_interval': distribution(self.command_intervals_s()),
+            'throttle_latency': distribution(self.throttle_latencies_s),
+            'tc_latency': distribution(self.tc_latencies_s),
+            'peak_slip': self.peak_slip,
+            'slip_rms_over_target': math.sqrt(self.slip_sq_sum / self.slip_samples) if self.slip_samples else 0.0,
+            'time_over_slip_target_pct': 100 * self.slip_over_s / self.drive_time_s if self.drive_time_s else 0.0,
+        }
+
+    def report(self):
+        lines = []
+        summary = self.summary()
+        for key in ('command_interval', 'throttle_latency', 'tc_latency'):
+            d = summary[key]
+            if d['count'] == 0:
+                lines.append(f'{key}: no samples')
+                continue
+            lines.append(f"{key}: n={d['count']} mean={d['mean_ms']:.2f} std={d['std_ms']:.2f} "
+                         f"p50={d['p50_ms']:.2f} p95={d['p95_ms']:.2f} p99={d['p99_ms']:.2f} "
+                         f"max={d['max_ms']:.2f} ms")
+        lines.append(f"slip: peak={summary['peak_slip']:.3f} rms over target={summary['slip_rms_over_target']:.4f} "
+                     f"time over target={summary['time_over_slip_target_pct']:.1f}%")
+        if self.throttle_latencies_s:
+            lines.append(format_histogram('throttle latency', self.throttle_latencies_s, 5.0))
+        if self.tc_latencies_s:
+            lines.append(format_histogram('traction control latency', self.tc_latencies_s, 10.0))
+        return '\n'.join(lines)
@@ -0,0 +1,202 @@
+"""
+Virtual time engine for the multi-board co-simulation.
+
+Time is an integer count of nanoseconds and events at the same time run in
+the order they were scheduled, so a run depends only on its inputs and
+seed and repeats exactly. Nothing waits on the wall clock; the simulation
+runs as fast as the host can work through the events.
+
+Each board has a CPU modelled as FreeRTOS schedules it: tasks are released
+periodically or by an event, and the CPU runs the highest priority job that
+is ready, pre-empting lower ones. CAN receive interrupts pre-empt every
+task. A task's effect (the CAN frames it sends, the state it updates) takes
+place when its job completes. Each job takes the task's cost, a
+per-task estimate of its execution time on target, varied by a seeded
+random jitter. From this come the per-board CPU utilisation, task response
+times and deadline misses.
+"""
+from dataclasses import dataclass, field
+import heapq
+import random
+
+ISR_PRIORITY = 1000
+
+
+class Simulator:
+    def __init__(self):
+        self.now_ns = 0
+        self._queue = []
+        self._seq = 0
+
+    @property
+    def now_s(self):
+        return self.now_ns / 1e9
+
+    def at(self, t_ns, callback):
+        self._seq += 1
+        heapq.heappush(self._queue, (int(t_ns), self._seq, callback))
+
+    def after(self, dt_ns, callback):
+        self.at(self.now_ns + dt_ns, callback)
+
+    def every(self, period_ns, callback, offset_ns=0):
+        def fire():
+            callback()
+            self.after(period_ns, fire)
+        self.at(self.now_ns + offset_ns, fire)
+
+    def run(self, until_ns, stop=None):
+        queue = self._queue
+        while queue and queue[0][0] <= until_ns:
+            t, _, callback = heapq.heappop(queue)
+            self.now_ns = t
+            callback()
+            if stop is not None and stop():
+                return
+        self.now_ns = max(self.now_ns, until_ns)
+
+
+class LatencyStats:
+    """Count, mean and maximum, with a histogram for percentiles"""
+
+    def __init__(self, bin_us=10):
+        self.bin_ns = bin_us * 1000
+        self.count = 0
+        self.total_ns = 0
+        self.max_ns = 0
+        self.bins = {}
+
+    def add(self, ns):
+        self.count += 1
+        self.total_ns += ns
+        if ns > self.max_ns:
+            self.max_ns = ns
+        b = ns // self.bin_ns
+        self.bins[b] = self.bins.get(b, 0) + 1
+
+    def mean_us(self):
+        return self.total_ns / self.count / 1000 if self.count else 0.0
+
+    def percentile_us(self, fraction):
+        if not self.count:
+            return 0.0
+        target = fraction * self.count
+        seen = 0
+        for b in sorted(self.bins):
+            seen += self.bins[b]
+            if seen >= target:
+                # Top of the bin, or the maximum if that is lower
+                return min((b + 1) * self.bin_ns, self.max_ns) / 1000
+        return self.max_ns / 1000
+
+
+@dataclass
+class Task:
+    name: str
+    priority: int
+    cost_us: float
+    run: object = None          # run(now_s) when each job completes
+    period_ms: float = None     # None for a task released by events
+    offset_ms: float = 0.0
+    jitter: float = 0.2         # Cost varies by up to this fraction either way
+    releases: int = 0
+    misses: int = 0             # Jobs still running at the next release
+    busy_ns: int = 0
+    response: LatencyStats = field(default_factory=LatencyStats)
+    pending: int = 0
+
+
+class Job:
+    __slots__ = ('task', 'release_ns', 'remaining_ns', 'seq', 'done')
+
+    def __init__(self, task, release_ns, cost_ns, seq, done):
+        self.task = task
+        self.release_ns = release_ns
+        self.remaining_ns = cost_ns
+        self.seq = seq
+        self.done = done
+
+    def key(self):
+        # Highest priority first, then first released
+        return (-self.task.priority, self.seq)
+
+
+class BoardCpu:
+    def __init__(self, sim, name, seed, isr_cost_us=4.0):
+        self.sim = sim
+        self.name = name
+        self.rng = random.Random(f'{seed}:{name}')
+        self.isr_task = Task('CAN RX ISR', ISR_PRIORITY, isr_cost_us, jitter=0.1)
+        self.tasks = []
+        self.ready = []
+        self.current = None
+        self.current_start_ns = 0
+        self.busy_ns = 0
+        self._token = 0
+        self._seq = 0
+
+    def add_task(self, task):
+        self.tasks.append(task)
+        if task.period_ms is not None:
+            period_ns = int(task.period_ms * 1e6)
+            self.sim.every(period_ns, lambda: self.release(task), int(task.offset_ms * 1e6))
+        return task
+
+    def release(self, task, done=None):
+        """Make a job of the task ready; done(now_s) runs when it completes"""
+        task.releases += 1
+        if task.pending and task.period_ms is not None:
+            task.misses += 1
+        task.pending += 1
+        variation = 1.0 + task.jitter * (2 * self.rng.random() - 1)
+        cost_ns = max(1, int(task.cost_us * 1000 * variation))
+        self._seq += 1
+        job = Job(task, self.sim.now_ns, cost_ns, self._seq, done)
+        if self.current is not None and job.key() < self.current.key():
+            self._preempt()
+        heapq.heappush(self.ready, (job.key(), job))
+        if self.current is None:
+            self._dispatch()
+
+    def interrupt(self, handler):
+        """Run handler(now_s) from the CAN receive interrupt"""
+        self.release(self.isr_task, handler)
+
+    def _preempt(self):
+        ran = self.sim.now_ns - self.current_start_ns
+        self.current.remaining_ns -= ran
+        self.current.task.busy_ns += ran
+        self.busy_ns += ran
+        heapq.heappush(self.ready, (self.current.key(), self.current))
+        self.current = None
+        self._token += 1
+
+    def _dispatch(self):
+        if not self.ready:
+            return
+        _, job = heapq.heappop(self.ready)
+        self.current = job
+        self.current_start_ns = self.sim.now_ns
+        self._token += 1
+        token = self._token
+        self.sim.after(job.remaining_ns, lambda: self._complete(token))
+
+    def _complete(self, token):
+        if token != self._token:
+            return      # Pre-empted
+        job = self.current
+        ran = self.sim.now_ns - self.current_start_ns
+        job.task.busy_ns += ran
+        self.busy_ns += ran
+        self.current = None
+        job.task.pending -= 1
+        job.task.response.add(self.sim.now_ns - job.release_ns)
+        if job.done is not None:
+            job.done(self.sim.now_s)
+        elif job.task.run is not None:
+            job.task.run(self.sim.now_s)
+        if self.current is None:
+            self._dispatch()
+
+    def utilisation(self, elapsed_ns):
+        return self.busy_ns / elapsed_ns if elapsed_ns else 0.0
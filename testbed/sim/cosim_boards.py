@@ -0,0 +1,363 @@
+"""
+Board models for the co-simulation: the BMU, VCU, PDU, DCU and the four
+WSBs as their CAN traffic and task timing see them, and the inverter and
+car as a plant node.
+
+Each board runs its FreeRTOS tasks at their firmware periods on its own
+modelled CPU (cosim.BoardCpu), receives the DBC messages it subscribes to
+through its CAN receive interrupt, and sends from three hardware mailboxes.
+Task costs are estimates of execution time on target, in us, and should be
+updated from the FreeRTOS run time stats (debug.c) as the firmware changes.
+The behaviour is what the other boards depend on: the HV and EM enable
+handshakes, the pedal to torque path and traction control, and the
+periodic status messages with values from the plant.
+"""
+import math
+
+from cascadia_inverter import BROADCAST_PERIODS
+from cosim import BoardCpu, LatencyStats, Task
+from inverter_emulator import InverterEmulator
+from reference_vcu import ReferenceVcu
+
+MS = 1000000    # ns
+
+
+class Board:
+    name = None
+    node = None         # Node name in the DBC
+    extra_subscriptions = ()
+
+    def __init__(self, sim, bus, db, plant, seed):
+        self.sim = sim
+        self.db = db
+        self.plant = plant
+        self.cpu = BoardCpu(sim, self.name, seed)
+        self.can = bus.node(self.name)
+        self.subscriptions = {m.frame_id: m for m in db.by_name.values()
+                              if self.node in m.receivers and m.sender != self.node}
+        for name in self.extra_subscriptions:
+            self.subscriptions[db[name].frame_id] = db[name]
+        self.can.on_receive(self._on_frame)
+        self.signals = {}
+        self.send_failures = 0
+
+    def _on_frame(self, frame):
+        message = self.subscriptions.get(frame.frame_id)
+        if message is None:
+            return
+        data = frame.data
+        self.cpu.interrupt(lambda now_s: self.on_message(message.name, message.decode(data), now_s))
+
+    def on_message(self, name, signals, now_s):
+        """From the CAN receive interrupt"""
+        self.signals.update(signals)
+
+    def task(self, name, priority, cost_us, period_ms=None, run=None, offset_ms=0.0):
+        return self.cpu.add_task(Task(name, priority, cost_us, run=run, period_ms=period_ms,
+                                      offset_ms=offset_ms))
+
+    def send(self, name, signals):
+        message = self.db[name]
+        if not self.can.send(message.frame_id, message.encode(signals), name):
+            self.send_failures += 1
+            return False
+        return True
+
+    def send_later(self, delay_ms, name, signals):
+        """Send after a vTaskDelay in the middle of a task"""
+        self.sim.after(int(delay_ms * MS), lambda: self.send(name, signals))
+
+
+class Plant:
+    """
+    The inverter and car (inverter_emulator.InverterEmulator) on a virtual
+    clock. The inverter is a CAN node with its own queue; it is powered by
+    the PDU and sees the pack voltage once the BMU closes the contactors
+    """
+    name = 'INV'
+
+    def __init__(self, sim, bus, db, scenario, physics_dt_ms=1.0, vehicle=None):
+        self.sim = sim
+        self.db = db
+        self.emulator = InverterEmulator(scenario, vehicle=vehicle, front_wheel_speeds=False,
+                                         physics_dt_s=physics_dt_ms / 1000, periods=BROADCAST_PERIODS)
+        self.emulator.hv_on = False
+        self.mc_powered = False
+        self.can = bus.node(self.name, mailboxes=None)
+        self.listened = {db[n].frame_id: db[n] for n in ('MC_Command_Message', 'MC_Read_Write_Param_Command')}
+        self.can.on_receive(self._on_frame)
+        sim.every(int(physics_dt_ms * MS), self._step)
+
+    @property
+    def vehicle(self):
+        return self.emulator.vehicle
+
+    @property
+    def driver(self):
+        return self.emulator.driver
+
+    def _on_frame(self, frame):
+        message = self.listened.get(frame.frame_id)
+        if message is not None and self.mc_powered:
+            self.emulator.receive(message.name, message.decode(frame.data), self.sim.now_s)
+
+    def _step(self):
+        for name, signals in self.emulator.advance(self.sim.now_s):
+            if self.mc_powered:
+                message = self.db[name]
+                self.can.send(message.frame_id, message.encode(signals), name)
+
+
+class Dcu(Board):
+    name = 'DCU'
+    node = 'DCU'
+
+    def __init__(self, sim, bus, db, plant, seed, presses):
+        super().__init__(sim, bus, db, plant, seed)
+        self.task('mainTask', 2, 40, period_ms=1000, run=self.heartbeat)
+        self.buttons = self.task('buttonTask', 3, 25)
+        for t_s, button in presses:
+            sim.at(int(t_s * 1e9), lambda b=button: self.cpu.release(self.buttons, lambda now_s: self.press(b)))
+
+    def heartbeat(self, now_s):
+        self.send('DCU_Heartbeat', {})
+
+    def press(self, button):
+        self.send('DCU_buttonEvents', {button: 1})
+
+
+class Bmu(Board):
+    """Precharge on the HV button, pack status from the plant"""
+    name = 'BMU'
+    node = 'BMU'
+    PRECHARGE_TIME_S = 2.5
+    CAPACITY_AS = 15.0 * 3600
+    CELLS = 140
+
+    def __init__(self, sim, bus, db, plant, seed):
+        super().__init__(sim, bus, db, plant, seed)
+        self.hv_on = False
+        self.precharging = False
+        self.soc = 0.9
+        self.cell_index = 0
+        self.last_measure_s = 0.0
+        self.task('hvMeasureTask', 6, 120, period_ms=10, run=self.measure)
+        self.task('stateBusHVSend', 4, 60, period_ms=100, run=self.send_bus, offset_ms=1)
+        self.task('batteryTask', 4, 1800, period_ms=100, run=self.battery, offset_ms=3)
+        self.task('socTask', 3, 400, period_ms=200, run=self.state_of_power, offset_ms=5)
+        self.task('cellSendTask', 2, 80, period_ms=50, run=self.send_cells, offset_ms=7)
+        self.task('heartbeat', 2, 30, period_ms=1000, run=lambda now_s: self.send('BMU_Heartbeat', {}))
+        self.precharge = self.task('prechargeTask', 5, 200)
+
+    def on_message(self, name, signals, now_s):
+        super().on_message(name, signals, now_s)
+        if name == 'DCU_buttonEvents' and signals.get('ButtonHVEnabled') and not self.hv_on and not self.precharging:
+            self.precharging = True
+            self.sim.after(int(self.PRECHARGE_TIME_S * 1e9),
+                           lambda: self.cpu.release(self.precharge, self.close_contactors))
+
+    def close_contactors(self, now_s):
+        self.precharging = False
+        self.hv_on = True
+        self.plant.emulator.hv_on = True
+        self.send('BMU_HV_Power_State', {'HV_Power_State': 1})
+
+    def measure(self, now_s):
+        dt = now_s - self.last_measure_s
+        self.last_measure_s = now_s
+        self.soc -= self.plant.vehicle.bus_current_A * dt / self.CAPACITY_AS
+
+    def send_bus(self, now_s):
+        vehicle = self.plant.vehicle
+        cell = vehicle.bus_voltage_V / self.CELLS
+        self.send('BMU_stateBusHV', {'VoltageBusHV': vehicle.bus_voltage_V if self.hv_on else 0.0,
+                                     'CurrentBusHV': vehicle.bus_current_A,
+                                     'VoltageCellMax': cell + 0.01, 'VoltageCellMin': cell - 0.01})
+
+    def battery(self, now_s):
+        vehicle = self.plant.vehicle
+        self.send('BMU_batteryStatusHV', {'StateBatteryChargeHV': 100 * self.soc, 'StateBatteryHealthHV': 100,
+                                          'StateBMS': 1, 'TempCellMax': 35.0, 'TempCellMin': 30.0})
+        self.send('BMU_stateBatteryHV', {'VoltageBatteryHV': vehicle.bus_voltage_V * 1000,
+                                         'CurrentDCBatteryHV': vehicle.bus_current_A,
+                                         'PowerBatteryHV': vehicle.bus_voltage_V * vehicle.bus_current_A})
+
+    def state_of_power(self, now_s):
+        self.send('BMU_stateOfPowerCurrent', {'DischargeCurrentLimit2s': 250, 'DischargeCurrentLimit10s': 200,
+                                              'ChargeCurrentLimit2s': 0, 'ChargeCurrentLimit10s': 0})
+        self.send('BMU_stateOfPowerPower', {'DischargePowerLimit2s': 80, 'DischargePowerLimit10s': 70,
+                                            'ChargePowerLimit2s': 0, 'ChargePowerLimit10s': 0})
+
+    def send_cells(self, now_s):
+        cell = self.plant.vehicle.bus_voltage_V / self.CELLS
+        mux = self.cell_index
+        self.cell_index = (self.cell_index + 1) % math.ceil(self.CELLS / 3)
+        self.send('BMU_CellVoltage', {'VoltageCellMuxSelect': mux, f'VoltageCell{3 * mux + 1:02d}': cell,
+                                      f'VoltageCell{3 * mux + 2:02d}': cell, f'VoltageCell{3 * mux + 3:02d}': cell})
+
+
+class Pdu(Board):
+    """Powers the inverter on the VCU's EM power request"""
+    name = 'PDU'
+    node = 'PDU'
+    extra_subscriptions = ('VCU_EM_Power_State_Request',)
+
+    def __init__(self, sim, bus, db, plant, seed):
+        super().__init__(sim, bus, db, plant, seed)
+        self.task('sensorRead', 2, 300, period_ms=500)
+        self.task('publish', 2, 90, period_ms=1000, run=self.publish, offset_ms=2)
+        self.task('heartbeat', 2, 30, period_ms=1000, run=lambda now_s: self.send('PDU_Heartbeat', {}))
+        self.control = self.task('controlStateMachine', 4, 60)
+
+    def on_message(self, name, signals, now_s):
+        super().on_message(name, signals, now_s)
+        if name == 'VCU_EM_Power_State_Request':
+            self.cpu.release(self.control, lambda t: self.set_mc_power(bool(signals['EM_Power_State_Request'])))
+
+    def set_mc_power(self, on):
+        self.plant.mc_powered = on
+        self.publish(self.sim.now_s)
+
+    def publish(self, now_s):
+        on = int(self.plant.mc_powered)
+        self.send('PDU_ChannelStatus', {'StatusPowerMCLeft': on, 'StatusPowerMCRight': on,
+                                        'StatusPowerVCU': 1, 'StatusPowerBMU': 1, 'StatusPowerDCU': 1})
+
+
+class Vcu(Board):
+    """
+    Drive by wire: EM enable once HV is on, inverter power and lockout
+    release, then the torque loop and traction control tasks.
+
+    TIM6 triggers the pedal ADC sequence in hardware. In the torque loop
+    (the default, brakeAndThrottle.c) the ADC oversamples, and each half of
+    the DMA buffer, a loop period of sequences, wakes the highest priority
+    task, which decimates it and commands torque for that sample. With
+    torque_loop=False it is the previous throttle task instead: a periodic
+    task that reads whichever sample the DMA last wrote, with the ADC on its
+    own 10.1 ms period. Either way the time from the ADC sample to the
+    command being queued is recorded, with the jitter of the command
+    interval.
+    """
+    name = 'VCU'
+    node = 'VCU_F7'
+    ADC_SEQUENCE_US = 20    # 5 channels of 84 + 12 ADC clocks at 25 MHz
+    ADC_OVERSAMPLE_PERIOD_US = 500
+    LEGACY_ADC_PERIOD_MS = 10.1
+
+    def __init__(self, sim, bus, db, plant, seed, traction_control=False, torque_loop=True,
+                 torque_loop_period_ms=10, throttle_period_ms=50, tc_period_ms=35):
+        super().__init__(sim, bus, db, plant, seed)
+        self.model = ReferenceVcu(traction_control=traction_control)
+        self.hv_on = False
+        self.em_requested = False
+        self.em_enabled = False
+        self.torque_loop = torque_loop
+        self.adc_sample = None      # (time ns, throttle, brake)
+        self.adc_block = []
+        self.adc_oversample = max(1, int(torque_loop_period_ms * 1000 / self.ADC_OVERSAMPLE_PERIOD_US))
+        self.command_period_ns = int((torque_loop_period_ms if torque_loop else throttle_period_ms) * MS)
+        self.last_command_ns = None
+        self.command_latency = LatencyStats(bin_us=25)
+        self.command_jitter = LatencyStats(bin_us=25)
+        self.publish_count = 0
+        if torque_loop:
+            # Decimation of the block is about 10 us of the loop
+            self.throttle_task = self.task('torqueLoop', 6, 70, run=self.throttle)
+            sim.every(self.ADC_OVERSAMPLE_PERIOD_US * 1000, self._adc_trigger)
+        else:
+            self.throttle_task = self.task('throttlePolling', 4, 150, period_ms=throttle_period_ms,
+                                           run=self.throttle)
+            sim.every(int(self.LEGACY_ADC_PERIOD_MS * MS), self._adc_trigger)
+        self.task('tractionControl', 3, 220, period_ms=tc_period_ms, run=self.traction_control, offset_ms=1)
+        self.task('canPublish', 2, 90, period_ms=50, run=self.publish, offset_ms=3)
+        self.task('heartbeat', 2, 30, period_ms=1000, run=lambda now_s: self.send('VCU_F7_Heartbeat', {}))
+        self.fsm = self.task('driveByWire', 5, 80)
+
+    def on_message(self, name, signals, now_s):
+        super().on_message(name, signals, now_s)
+        self.model.on_message(name, signals)
+        if name == 'BMU_HV_Power_State':
+            self.hv_on = bool(signals['HV_Power_State'])
+        elif name == 'DCU_buttonEvents' and signals.get('ButtonEMEnabled') and self.hv_on and not self.em_requested:
+            self.cpu.release(self.fsm, self.request_em)
+        elif name == 'DCU_buttonEvents' and signals.get('ButtonTCEnabled'):
+            self.model.traction_control = not self.model.traction_control
+
+    def request_em(self, now_s):
+        self.em_requested = True
+        self.send('VCU_EM_Power_State_Request', {'EM_Power_State_Request': 1})
+
+    def _adc_trigger(self):
+        self.sim.after(self.ADC_SEQUENCE_US * 1000, self._adc_complete)
+
+    def _adc_complete(self):
+        driver = self.plant.driver
+        if not self.torque_loop:
+            self.adc_sample = (self.sim.now_ns, driver.throttle, driver.brake)
+            return
+        # There's no injected noise, so the trimmed mean is the mean
+        self.adc_block.append((driver.throttle, driver.brake))
+        if len(self.adc_block) < self.adc_oversample:
+            return
+        throttles, brakes = zip(*self.adc_block)
+        self.adc_block = []
+        self.adc_sample = (self.sim.now_ns, sum(throttles) / len(throttles), sum(brakes) / len(brakes))
+        self.cpu.interrupt(lambda now_s: self.cpu.release(self.throttle_task))
+
+    def throttle(self, now_s):
+        if not self.em_requested or not self.signals.get('StatusPowerMCLeft') or self.adc_sample is None:
+            self.last_command_ns = None
+            return
+        sample_ns, throttle, brake = self.adc_sample
+        command = self.model.torque_command(throttle, brake)
+        self.send('MC_Command_Message', command)
+        now_ns = self.sim.now_ns
+        self.command_latency.add(now_ns - sample_ns)
+        if self.last_command_ns is not None:
+            self.command_jitter.add(abs(now_ns - self.last_command_ns - self.command_period_ns))
+        self.last_command_ns = now_ns
+        if not self.em_enabled and self.model.lockout_released():
+            self.em_enabled = True
+            self.send('VCU_EM_State', {'EM_State': 1})
+
+    def publish(self, now_s):
+        self.send('VCU_INV_Power', {'INV_Tractive_Power_kW': self.signals.get('INV_DC_Bus_Voltage', 0.0)
+                                    * self.signals.get('INV_DC_Bus_Current', 0.0) / 1000})
+        self.publish_count += 1
+        if self.torque_loop and self.publish_count % 20 == 0:
+            latency, jitter = self.command_latency, self.command_jitter
+            self.send('VCU_TorqueLoopTiming', {
+                'TorqueLoopLatencyP50': latency.percentile_us(0.5),
+                'TorqueLoopLatencyP99': latency.percentile_us(0.99),
+                'TorqueLoopLatencyMax': latency.max_ns / 1000,
+                'TorqueLoopJitterP99': jitter.percentile_us(0.99),
+                'TorqueLoopJitterMax': jitter.max_ns / 1000,
+            })
+
+    def traction_control(self, now_s):
+        self.model.torque_limit_Nm = self.model.traction_control_limit()
+        rear = self.signals.get('INV_Motor_Speed', 0) * 2 * math.pi / 60 * (12 / 45)
+        self.send('RearWheelSpeedRADS', {'VCU_wheelSpeed_RL': rear, 'VCU_wheelSpeed_RR': rear})
+        self.send_later(2, 'WheelSpeedKPH', {'RLSpeedKPH': rear * 0.945, 'RRSpeedKPH': rear * 0.945})
+        self.send_later(4, 'TractionControlData', {'TCTorqueMax': self.model.torque_limit_Nm})
+
+
+class Wsb(Board):
+    """Wheel speed board, one per corner"""
+
+    def __init__(self, sim, bus, db, plant, seed, corner):
+        self.name = f'WSB{corner}'
+        self.node = f'WSB{corner}'
+        self.corner = corner
+        super().__init__(sim, bus, db, plant, seed)
+        self.task('pollSensors', 3, 60, period_ms=10, run=self.poll)
+
+    def poll(self, now_s):
+        vehicle = self.plant.vehicle
+        distance = int(vehicle.distance_m * 1000) & 0xFFFFFFFF
+        if self.corner in ('FL', 'FR'):
+            self.send(f'WSB{self.corner}_Sensors', {f'{self.corner}_WheelDistance': distance,
+                                                    f'{self.corner}_Speed_RAD_S': vehicle.front_omega})
+        else:
+            self.send(f'WSB{self.corner}_Sensors', {f'{self.corner}_WheelDistance': distance})
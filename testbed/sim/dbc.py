@@ -0,0 +1,106 @@
+"""
+Minimal reader for the car's DBC (common/Data/2024CAR.dbc): message ids,
+lengths, signals and their receivers, with encoding and decoding of the
+little endian integer signals it uses. The co-simulation uses this so it
+needs nothing beyond the standard library; tools talking to real buses use
+cantools.
+"""
+from dataclasses import dataclass, field
+from pathlib import Path
+import re
+
+DBC_PATH = Path(__file__).resolve().parents[2] / 'common/Data/2024CAR.dbc'
+
+_MESSAGE = re.compile(r'^BO_ (\d+) (\w+)\s*: (\d+) (\w+)')
+_SIGNAL = re.compile(r'^\s+SG_ (\w+)\s*(M|m\d+)?\s*: (\d+)\|(\d+)@([01])([+-]) '
+                     r'\(([^,]+),([^)]+)\) \[[^\]]*\] "[^"]*"\s*(.*)$')
+
+
+@dataclass
+class Signal:
+    name: str
+    start: int
+    length: int
+    signed: bool
+    scale: float
+    offset: float
+    receivers: tuple
+    multiplexer: bool = False
+    multiplexed_by: int = None      # Mux value this signal is sent with
+
+
+@dataclass
+class Message:
+    frame_id: int                   # Without the extended frame flag
+    name: str
+    length: int
+    sender: str
+    signals: dict = field(default_factory=dict)
+
+    @property
+    def receivers(self):
+        nodes = set()
+        for signal in self.signals.values():
+            nodes.update(signal.receivers)
+        return nodes
+
+    def encode(self, values):
+        """Bytes for the signal values given; missing signals are 0"""
+        raw = 0
+        for name, value in values.items():
+            signal = self.signals.get(name)
+            if signal is None:
+                continue
+            x = int(round((value - signal.offset) / signal.scale))
+            if signal.signed:
+                lo, hi = -(1 << (signal.length - 1)), (1 << (signal.length - 1)) - 1
+            else:
+                lo, hi = 0, (1 << signal.length) - 1
+            x = min(max(x, lo), hi) & ((1 << signal.length) - 1)
+            raw |= x << signal.start
+        return raw.to_bytes(self.length, 'little')
+
+    def decode(self, data):
+        raw = int.from_bytes(bytes(data).ljust(self.length, b'\0'), 'little')
+        mux = None
+        for signal in self.signals.values():
+            if signal.multiplexer:
+                mux = (raw >> signal.start) & ((1 << signal.length) - 1)
+        values = {}
+        for signal in self.signals.values():
+            if signal.multiplexed_by is not None and signal.multiplexed_by != mux:
+                continue
+            x = (raw >> signal.start) & ((1 << signal.length) - 1)
+            if signal.signed and x & (1 << (signal.length - 1)):
+                x -= 1 << signal.length
+            values[signal.name] = x * signal.scale + signal.offset
+        return values
+
+
+class Database:
+    def __init__(self, path=DBC_PATH):
+        self.by_name = {}
+        self.by_id = {}
+        message = None
+        with open(path, encoding='latin-1') as f:
+            for line in f:
+                m = _MESSAGE.match(line)
+                if m:
+                    message = Message(int(m.group(1)) & 0x1FFFFFFF, m.group(2), int(m.group(3)), m.group(4))
+                    self.by_name[message.name] = message
+                    self.by_id[message.frame_id] = message
+                    continue
+                m = _SIGNAL.match(line)
+                if m and message is not None:
+                    mux = m.group(2)
+                    message.signals[m.group(1)] = Signal(
+                        name=m.group(1), start=int(m.group(3)), length=int(m.group(4)),
+                        signed=m.group(6) == '-', scale=float(m.group(7)), offset=float(m.group(8)),
+                        receivers=tuple(r.strip() for r in m.group(9).split(',') if r.strip()),
+                        multiplexer=mux == 'M',
+                        multiplexed_by=int(mux[1:]) if mux and mux != 'M' else None)
+                elif not line.strip():
+                    message = None
+
+    def __getitem__(self, name):
+        return self.by_name[name]
@@ -0,0 +1,222 @@
+"""
+Driver inputs for the inverter emulator: launches, laps of a simple track
+and throttle steps, and the conversion of pedal positions to the voltages
+the VCU HIL board drives into the VCU's pedal inputs.
+"""
+from dataclasses import dataclass
+import math
+
+# VCU pedal calibration, ADC counts (vcu/Inc/brakeAndThrottle.h)
+THROTT_A_LOW = 2272
+THROTT_A_HIGH = 2500
+THROTT_B_LOW = 2160
+THROTT_B_HIGH = 2405
+BRAKE_POS_LOW = 1080
+BRAKE_POS_HIGH = 1180
+STEERING_POT_CENTER = 2048
+ADC_FULL_SCALE = 4095
+ADC_VREF_MV = 3300
+
+# VCU HIL board inputs (testbed/HIL_Firmware/VCU_HIL/VCU_HIL/include/processCAN.h),
+# each a little endian uint16 of millivolts
+THROTTLE_A_CAN_ID = 0x401020F
+THROTTLE_B_CAN_ID = 0x402020F
+BRAKE_PRES_RAW_CAN_ID = 0x403020F
+BRAKE_POS_CAN_ID = 0x404020F
+STEER_RAW_CAN_ID = 0x405020F
+
+
+def _counts_to_mV(counts):
+    return int(round(counts * ADC_VREF_MV / ADC_FULL_SCALE))
+
+
+def pedal_voltages_mV(throttle, brake):
+    """HIL CAN id to millivolts, for throttle and brake pedal positions (0 - 1)"""
+    throttle = min(max(throttle, 0.0), 1.0)
+    brake = min(max(brake, 0.0), 1.0)
+    return {
+        THROTTLE_A_CAN_ID: _counts_to_mV(THROTT_A_LOW + throttle * (THROTT_A_HIGH - THROTT_A_LOW)),
+        THROTTLE_B_CAN_ID: _counts_to_mV(THROTT_B_LOW + throttle * (THROTT_B_HIGH - THROTT_B_LOW)),
+        BRAKE_POS_CAN_ID: _counts_to_mV(BRAKE_POS_LOW + brake * (BRAKE_POS_HIGH - BRAKE_POS_LOW)),
+        BRAKE_PRES_RAW_CAN_ID: _counts_to_mV(brake * ADC_FULL_SCALE),
+        STEER_RAW_CAN_ID: _counts_to_mV(STEERING_POT_CENTER),
+    }
+
+
+@dataclass
+class DriverInput:
+    throttle: float = 0.0   # 0 - 1
+    brake: float = 0.0      # 0 - 1
+    done: bool = False
+
+
+class Scenario:
+    """Driver for a run. inputs() is called every physics step"""
+    name = 'idle'
+    # Time at the start with the pedals released, for the VCU to enable the inverter
+    settle_s = 2.0
+
+    def inputs(self, t_s, vehicle):
+        return DriverInput()
+
+    def summary(self, vehicle):
+        return {}
+
+
+class LaunchScenario(Scenario):
+    """Full throttle from a stop, over the acceleration event distance"""
+    name = 'launch'
+
+    def __init__(self, distance_m=75.0, throttle=1.0, settle_s=2.0):
+        self.distance_m = distance_m
+        self.throttle = throttle
+        self.settle_s = settle_s
+        self.start_s = None
+        self.finish_s = None
+
+    def inputs(self, t_s, vehicle):
+        if t_s < self.settle_s:
+            return DriverInput()
+        if self.start_s is None:
+            self.start_s = t_s
+            self.start_m = vehicle.distance_m
+        if vehicle.distance_m - self.start_m >= self.distance_m:
+            if self.finish_s is None:
+                self.finish_s = t_s
+            return DriverInput(done=True)
+        return DriverInput(throttle=self.throttle)
+
+    def summary(self, vehicle):
+        if self.finish_s is None:
+            return {'launch_time_s': None}
+        return {
+            'launch_time_s': self.finish_s - self.start_s,
+            'launch_speed_kph': vehicle.speed_mps * 3.6,
+        }
+
+
+@dataclass
+class TrackSegment:
+    length_m: float
+    radius_m: float = math.inf  # Straight when infinite
+
+
+# A short autocross style lap, about 400 m
+DEFAULT_TRACK = [
+    TrackSegment(75), TrackSegment(30, 9), TrackSegment(50), TrackSegment(25, 15),
+    TrackSegment(60), TrackSegment(40, 7), TrackSegment(35), TrackSegment(30, 20),
+    TrackSegment(55),
+]
+
+
+class LapScenario(Scenario):
+    """
+    Laps of a track of straights and constant radius corners. The driver
+    holds the grip limited speed in corners, brakes at a constant rate into
+    them and is on full throttle otherwise
+    """
+    name = 'lap'
+
+    def __init__(self, laps=2, track=None, lateral_mu=1.4, braking_mps2=12.0,
+                 settle_s=2.0):
+        self.track = track or DEFAULT_TRACK
+        self.laps = laps
+        self.lateral_mu = lateral_mu
+        self.braking_mps2 = braking_mps2
+        self.settle_s = settle_s
+        self.lap_length_m = sum(s.length_m for s in self.track)
+        self.start_s = None
+        self.lap_times_s = []
+        self._lap_start_s = None
+
+    def corner_speed_mps(self, segment):
+        if math.isinf(segment.radius_m):
+            return math.inf
+        return math.sqrt(self.lateral_mu * 9.81 * segment.radius_m)
+
+    def speed_limit_mps(self, lap_distance_m):
+        """Highest speed that can still make every corner ahead"""
+        limit = math.inf
+        position = 0.0
+        # Look over this lap and the next
+        for segment in self.track + self.track:
+            end = position + segment.length_m
+            v_corner = self.corner_speed_mps(segment)
+            if end > lap_distance_m and not math.isinf(v_corner):
+                if position <= lap_distance_m:
+                    limit = min(limit, v_corner)
+                else:
+                    distance = position - lap_distance_m
+                    limit = min(limit, math.sqrt(v_corner ** 2 + 2 * self.braking_mps2 * distance))
+            position = end
+            if position > lap_distance_m + 2 * self.lap_length_m:
+                break
+        return limit
+
+    def inputs(self, t_s, vehicle):
+        if t_s < self.settle_s:
+            return DriverInput()
+        if self.start_s is None:
+            self.start_s = t_s
+            self._lap_start_s = t_s
+            self.start_m = vehicle.distance_m
+        travelled = vehicle.distance_m - self.start_m
+        laps_done = int(travelled // self.lap_length_m)
+        if laps_done > len(self.lap_times_s):
+            self.lap_times_s.append(t_s - self._lap_start_s)
+            self._lap_start_s = t_s
+        if laps_done >= self.laps:
+            return DriverInput(done=True)
+
+        limit = self.speed_limit_mps(travelled % self.lap_length_m)
+        error = limit - vehicle.speed_mps
+        if error > 0.5:
+            return DriverInput(throttle=min(1.0, error / 2.0))
+        if error < -0.3:
+            return DriverInput(brake=min(1.0, -error / 3.0))
+        return DriverInput(throttle=0.15)
+
+    def summary(self, vehicle):
+        return {
+            'lap_times_s': [round(t, 3) for t in self.lap_times_s],
+            'energy_Wh': vehicle.energy_J / 3600,
+        }
+
+
+class ThrottleStepScenario(Scenario):
+    """
+    Throttle steps between two positions, for the latency from a pedal
+    change to the VCU's torque command. Between steps the driver brakes if
+    the car is going faster than max_speed_mps
+    """
+    name = 'steps'
+
+    def __init__(self, steps=40, low=0.0, high=0.5, period_s=0.6, settle_s=2.0,
+                 max_speed_mps=8.0):
+        self.steps = steps
+        self.low = low
+        self.high = high
+        self.period_s = period_s
+        self.settle_s = settle_s
+        self.max_speed_mps = max_speed_mps
+        self.step_times_s = []
+
+    def inputs(self, t_s, vehicle):
+        if t_s < self.settle_s:
+            return DriverInput()
+        index = int((t_s - self.settle_s) // self.period_s)
+        if index >= 2 * self.steps:
+            return DriverInput(done=True)
+        if len(self.step_times_s) <= index:
+            self.step_times_s.append(t_s)
+        if index % 2 == 0:
+            return DriverInput(throttle=self.high)
+        brake = 0.3 if vehicle.speed_mps > self.max_speed_mps else 0.0
+        return DriverInput(throttle=self.low, brake=brake)
+
+
+SCENARIOS = {
+    'launch': LaunchScenario,
+    'lap': LapScenario,
+    'steps': ThrottleStepScenario,
+}
@@ -0,0 +1,246 @@
+"""
+Emulates the inverter and the car around it, so the VCU can be driven
+through launches and laps from a Linux host.
+
+The emulator answers the VCU's inverter commands as the Cascadia PM100DX
+does (cascadia_inverter.py), spins the motor through a longitudinal model of
+the car with tire slip (vehicle_model.py), and broadcasts what the VCU reads
+back: the inverter's status messages and the front wheel speeds from the
+WSBs. A driver (drive_scenarios.py) works the pedals through the VCU HIL
+board, and the VCU's commands are timed against the driver and the car to
+measure its control loop latencies and how well traction control holds the
+slip (control_metrics.py).
+
+With --reference-vcu, a model of the VCU's control tasks (reference_vcu.py)
+stands in for the board and the run is done in virtual time, with no CAN
+bus needed.
+
+    # Against a VCU on vcan0 / can0, pedals through the HIL bus
+    python3 inverter_emulator.py -c can0 --hil-channel slcan0 -s launch
+    # Offline baseline
+    python3 inverter_emulator.py --reference-vcu -s lap --laps 3
+"""
+import argparse
+import csv
+from pathlib import Path
+import time
+
+from cascadia_inverter import BROADCAST_PERIODS, CascadiaInverter, InverterParams
+from control_metrics import ControlMetrics
+from drive_scenarios import (DriverInput, LapScenario, LaunchScenario,
+                             ThrottleStepScenario, pedal_voltages_mV)
+from reference_vcu import ReferenceVcu
+from vehicle_model import VehicleModel, VehicleParams
+
+DBC_PATH = Path(__file__).resolve().parents[2] / 'common/Data/2024CAR.dbc'
+
+WSB_PERIOD_S = 0.010    # POLL_SENSORS_PERIOD_MS on the WSB
+HIL_PEDAL_PERIOD_S = 0.010
+
+
+class InverterEmulator:
+    """
+    The inverter, car and driver, stepped to a time given by the caller so
+    it can run on the wall clock or a virtual one
+    """
+
+    def __init__(self, scenario, inverter=None, vehicle=None, metrics=None,
+                 physics_dt_s=0.001, front_wheel_speeds=True, periods=None):
+        self.scenario = scenario
+        self.inverter = inverter or CascadiaInverter()
+        self.vehicle = vehicle or VehicleModel()
+        self.metrics = metrics or ControlMetrics()
+        self.physics_dt_s = physics_dt_s
+        self.periods = dict(periods or BROADCAST_PERIODS)
+        if front_wheel_speeds:
+            self.periods['WSBFL_Sensors'] = WSB_PERIOD_S
+            self.periods['WSBFR_Sensors'] = WSB_PERIOD_S
+        self.next_send_s = {name: 0.0 for name in self.periods}
+        self.t_s = 0.0
+        self.driver = DriverInput()
+        self.shaft_torque_Nm = 0.0
+        self.hv_on = True           # The inverter sees no bus voltage with the contactors open
+        self.done = False
+        self.log = []
+
+    def receive(self, name, signals, now_s):
+        """A message from the VCU"""
+        if name == 'MC_Command_Message':
+            self.inverter.on_command(signals, now_s)
+            self.metrics.on_command(signals['VCU_INV_Torque_Command'] / 10.0,
+                                    signals['VCU_INV_Torque_Limit_Command'],
+                                    bool(signals['VCU_INV_Inverter_Enable']), now_s)
+        elif name == 'MC_Read_Write_Param_Command':
+            self.inverter.on_param_command(signals, now_s)
+
+    def _signals(self, name):
+        if name == 'WSBFL_Sensors':
+            return {'FL_WheelDistance': int(self.vehicle.distance_m * 1000) & 0xFFFFFFFF,
+                    'FL_Speed_RAD_S': self.vehicle.front_omega}
+        if name == 'WSBFR_Sensors':
+            return {'FR_WheelDistance': int(self.vehicle.distance_m * 1000) & 0xFFFFFFFF,
+                    'FR_Speed_RAD_S': self.vehicle.front_omega}
+        return self.inverter.broadcast(name)
+
+    def advance(self, now_s):
+        """
+        Run the car up to now_s. Returns the messages due, as (name, signals)
+        """
+        dt = self.physics_dt_s
+        vehicle = self.vehicle
+        while self.t_s + dt <= now_s + 1e-9 and not self.done:
+            self.t_s += dt
+            self.driver = self.scenario.inputs(self.t_s, vehicle)
+            self.metrics.on_throttle(self.driver.throttle, self.t_s)
+            bus_V = vehicle.bus_voltage_V if self.hv_on else 0.0
+            torque, current = self.inverter.step(self.t_s, vehicle.motor_rpm, bus_V)
+            self.shaft_torque_Nm = torque
+            vehicle.step(dt, torque, self.driver.brake, current)
+            self.metrics.on_vehicle(vehicle.rear_slip, vehicle.speed_mps,
+                                    vehicle.rear_omega * vehicle.params.wheel_radius_m, torque, dt, self.t_s)
+            self.log.append((round(self.t_s, 6), self.driver.throttle, self.driver.brake,
+                             self.inverter.torque_command_Nm, self.inverter.torque_limit_Nm,
+                             torque, vehicle.motor_rpm, vehicle.speed_mps, vehicle.rear_slip,
+                             vehicle.bus_voltage_V, current))
+            self.done = self.driver.done
+
+        messages = []
+        for name, period in self.periods.items():
+            if now_s >= self.next_send_s[name]:
+                messages.append((name, self._signals(name)))
+                self.next_send_s[name] += period
+                if self.next_send_s[name] <= now_s:
+                    # Fell behind, don't send a burst to catch up
+                    self.next_send_s[name] = now_s + period
+        for response in self.inverter.take_responses():
+            messages.append(('MC_Read_Write_Param_Response', response))
+        return messages
+
+    def write_log(self, path):
+        with open(path, 'w', newline='') as f:
+            writer = csv.writer(f)
+            writer.writerow(['time_s', 'throttle', 'brake', 'torque_command_Nm', 'torque_limit_Nm',
+                             'torque_Nm', 'motor_rpm', 'speed_mps', 'rear_slip', 'bus_V', 'bus_A'])
+            writer.writerows(self.log)
+
+
+def run_reference(emulator, vcu, timeout_s, tick_s=0.001):
+    """Close the loop through the reference VCU, in virtual time"""
+    now_s = 0.0
+    while not emulator.done and now_s < timeout_s:
+        now_s += tick_s
+        for name, signals in emulator.advance(now_s):
+            vcu.on_message(name, signals)
+        command = vcu.step(now_s, emulator.driver.throttle, emulator.driver.brake)
+        if command is not None:
+            emulator.receive('MC_Command_Message', command, now_s)
+
+
+def run_on_bus(emulator, channel, hil_channel, timeout_s, tick_s=0.001):
+    """Run against a VCU on a CAN bus, on the wall clock"""
+    import can
+    import cantools
+
+    db = cantools.db.load_file(DBC_PATH)
+    bus = can.interface.Bus(channel=channel, bustype='socketcan')
+    hil_bus = can.interface.Bus(channel=hil_channel, bustype='socketcan') if hil_channel else None
+    listened = {db.get_message_by_name(name).frame_id: name
+                for name in ('MC_Command_Message', 'MC_Read_Write_Param_Command')}
+    frames = {}
+    next_pedal_s = 0.0
+
+    start = time.monotonic()
+    next_tick = start
+    try:
+        while not emulator.done and time.monotonic() - start < timeout_s:
+            next_tick += tick_s
+            # Take the VCU's frames until the next tick, time stamped as they arrive
+            while True:
+                remaining = next_tick - time.monotonic()
+                msg = bus.recv(timeout=max(remaining, 0.0))
+                if msg is None:
+                    break
+                name = listened.get(msg.arbitration_id)
+                if name is not None:
+                    signals = db.decode_message(msg.arbitration_id, msg.data, decode_choices=False)
+                    emulator.receive(name, signals, time.monotonic() - start)
+                if remaining <= 0:
+                    break
+
+            now_s = time.monotonic() - start
+            for name, signals in emulator.advance(now_s):
+                if name not in frames:
+                    frames[name] = db.get_message_by_name(name)
+                message = frames[name]
+                data = message.encode(signals, strict=False)
+                bus.send(can.Message(arbitration_id=message.frame_id, data=data,
+                                     is_extended_id=message.is_extended_frame))
+            if hil_bus is not None and now_s >= next_pedal_s:
+                next_pedal_s = now_s + HIL_PEDAL_PERIOD_S
+                for can_id, mV in pedal_voltages_mV(emulator.driver.throttle, emulator.driver.brake).items():
+                    hil_bus.send(can.Message(arbitration_id=can_id, data=mV.to_bytes(2, 'little'),
+                                             is_extended_id=True))
+    finally:
+        bus.shutdown()
+        if hil_bus is not None:
+            hil_bus.shutdown()
+
+
+def make_scenario(args):
+    if args.scenario == 'launch':
+        return LaunchScenario(distance_m=args.distance, settle_s=args.settle)
+    if args.scenario == 'lap':
+        return LapScenario(laps=args.laps, settle_s=args.settle)
+    return ThrottleStepScenario(steps=args.steps, settle_s=args.settle)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Emulate the inverter and car for the VCU')
+    parser.add_argument('-c', '--channel', type=str, default='vcan0', help='Vehicle CAN interface')
+    parser.add_argument('--hil-channel', type=str, default=None,
+                        help='HIL CAN interface, to drive the pedals through the VCU HIL board')
+    parser.add_argument('-s', '--scenario', choices=('launch', 'lap', 'steps'), default='launch')
+    parser.add_argument('--distance', type=float, default=75.0, help='Launch distance (m)')
+    parser.add_argument('--laps', type=int, default=2)
+    parser.add_argument('--steps', type=int, default=40, help='Throttle steps')
+    parser.add_argument('--settle', type=float, default=2.0,
+                        help='Time with the pedals released before the run, for the VCU to enable the inverter (s)')
+    parser.add_argument('--timeout', type=float, default=300.0, help='Give up after (s)')
+    parser.add_argument('--mu', type=float, default=VehicleParams.tire_mu, help='Rear tire peak friction')
+    parser.add_argument('--command-timeout', type=float, default=InverterParams.command_timeout_s,
+                        help='Inverter command message timeout (s)')
+    parser.add_argument('--reference-vcu', action='store_true',
+                        help='Close the loop with a model of the VCU, in virtual time')
+    parser.add_argument('--no-tc', action='store_true', help='Reference VCU without traction control')
+    parser.add_argument('--log', type=Path, default=None, help='Write a CSV of the run')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    scenario = make_scenario(args)
+    emulator = InverterEmulator(
+        scenario,
+        inverter=CascadiaInverter(InverterParams(command_timeout_s=args.command_timeout)),
+        vehicle=VehicleModel(VehicleParams(tire_mu=args.mu)),
+    )
+
+    if args.reference_vcu:
+        run_reference(emulator, ReferenceVcu(traction_control=not args.no_tc), args.timeout)
+    else:
+        run_on_bus(emulator, args.channel, args.hil_channel, args.timeout)
+
+    print(f'scenario: {scenario.name}, finished: {emulator.done}, t={emulator.t_s:.3f} s')
+    for key, value in scenario.summary(emulator.vehicle).items():
+        print(f'{key}: {value}')
+    stats = emulator.inverter.stats
+    print(f'inverter: commands={stats.commands} timeouts={stats.command_timeouts} '
+          f'locked out enables={stats.enables_while_locked_out} param reads={stats.param_reads} '
+          f'writes={stats.param_writes}')
+    print(emulator.metrics.report())
+    if args.log:
+        emulator.write_log(args.log)
+
+
+if __name__ == '__main__':
+    main()
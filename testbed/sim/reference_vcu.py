@@ -0,0 +1,126 @@
+"""
+A stand in for the VCU, for running the inverter emulator without a board.
+
+It follows the VCU firmware's task timing and control laws closely enough to
+give baseline numbers to compare the real VCU against:
+ - mcInit: disable commands until the inverter reports the lockout released
+ - The torque loop (brakeAndThrottle.c, once per pedal ADC sample, every
+   TORQUE_LOOP_PERIOD_MS) maps the pedal to a torque command as
+   requestTorqueFromMC does, with the power limit
+ - The traction control task (traction_control.c, every 35 ms) sets the
+   torque limit from the slip of the rear wheels over the front
+
+It only sees what the VCU would: the decoded inverter and WSB messages, and
+the pedal positions. Traction control compares the rear and front wheel
+speeds both in rad/s here.
+"""
+import math
+
+TORQUE_LOOP_PERIOD_S = 0.010
+TRACTION_CONTROL_PERIOD_S = 0.035
+MIN_THROTTLE_PERCENT_FOR_TORQUE = 5.0
+MAX_TORQUE_DEMAND_DEFAULT_NM = 200.0
+INV_POWER_LIMIT_W = 70000.0
+GEAR_RATIO = 12.0 / 45.0
+TC_KP_DEFAULT = 10.0
+SLIP_PERCENT_DEFAULT = 0.1
+ZERO_SPEED_LOWER_BOUND = 10.0
+MAX_SLIP = 80.0
+APPS_BRAKE_PLAUSIBILITY_THRESHOLD = 40
+TPS_MAX_WHILE_BRAKE_PRESSED_PERCENT = 25
+TPS_WHILE_BRAKE_PRESSED_RESET_PERCENT = 5
+
+
+def map_range(x, in_min, in_max, out_min, out_max):
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min
+
+
+class ReferenceVcu:
+    def __init__(self, traction_control=True, kP=TC_KP_DEFAULT, desired_slip=SLIP_PERCENT_DEFAULT,
+                 throttle_period_s=TORQUE_LOOP_PERIOD_S, tc_period_s=TRACTION_CONTROL_PERIOD_S):
+        self.traction_control = traction_control
+        self.kP = kP
+        self.desired_slip = desired_slip
+        self.throttle_period_s = throttle_period_s
+        self.tc_period_s = tc_period_s
+        self.signals = {}
+        self.next_throttle_s = 0.0
+        self.next_tc_s = 0.0
+        self.torque_limit_Nm = MAX_TORQUE_DEMAND_DEFAULT_NM
+        self.throttle_disabled = False
+
+    def on_message(self, name, signals):
+        self.signals.update(signals)
+
+    def _throttle_percent(self, throttle, brake):
+        """APPS / brake plausibility, as in brakeAndThrottle.c"""
+        throttle *= 100
+        brake *= 100
+        if self.throttle_disabled:
+            if throttle < TPS_WHILE_BRAKE_PRESSED_RESET_PERCENT:
+                self.throttle_disabled = False
+            return 0.0
+        if brake > APPS_BRAKE_PLAUSIBILITY_THRESHOLD and throttle > TPS_MAX_WHILE_BRAKE_PRESSED_PERCENT:
+            self.throttle_disabled = True
+            return 0.0
+        return throttle
+
+    def traction_control_limit(self):
+        """The traction control task's torque limit, from the latest wheel speeds"""
+        rpm = self.signals.get('INV_Motor_Speed', 0)
+        rear = rpm * 2 * math.pi / 60 * GEAR_RATIO
+        slips = []
+        for front in (self.signals.get('FL_Speed_RAD_S', 0.0), self.signals.get('FR_Speed_RAD_S', 0.0)):
+            if abs(front) < 0.1:
+                front = 0.1
+            slips.append(min(max((rear - front) / front, -MAX_SLIP), MAX_SLIP))
+        error = max(slips) - self.desired_slip
+        adjustment = self.kP * error if error > 0 else 0.0
+        limit = min(max(MAX_TORQUE_DEMAND_DEFAULT_NM - adjustment, 0.0), MAX_TORQUE_DEMAND_DEFAULT_NM)
+        if self.traction_control and rear > ZERO_SPEED_LOWER_BOUND:
+            return limit
+        return MAX_TORQUE_DEMAND_DEFAULT_NM
+
+    def lockout_released(self):
+        return not self.signals.get('INV_Inverter_Enable_Lockout', 1)
+
+    def torque_command(self, throttle, brake):
+        """
+        MC_Command_Message signals for the pedal positions, a disable command
+        while the inverter is locked out (sendLockoutReleaseToMC)
+        """
+        command = {
+            'VCU_INV_Torque_Command': 0,
+            'VCU_INV_Speed_Command': 0,
+            'VCU_INV_Direction_Command': 0,
+            'VCU_INV_Inverter_Enable': 0,
+            'VCU_INV_Inverter_Discharge': 0,
+            'VCU_INV_Speed_Mode_Enable': 0,
+            'VCU_INV_Torque_Limit_Command': 0,
+        }
+        if not self.lockout_released():
+            return command
+
+        throttle_percent = self._throttle_percent(throttle, brake)
+        if throttle_percent < MIN_THROTTLE_PERCENT_FOR_TORQUE:
+            throttle_percent = 0.0
+        max_torque = min(MAX_TORQUE_DEMAND_DEFAULT_NM, self.torque_limit_Nm)
+        omega = self.signals.get('INV_Motor_Speed', 0) * 2 * math.pi / 60
+        if omega > 0:
+            max_torque = min(max_torque, INV_POWER_LIMIT_W / omega)
+        torque = max(0.0, map_range(throttle_percent, MIN_THROTTLE_PERCENT_FOR_TORQUE, 100, 0, max_torque))
+        command['VCU_INV_Torque_Command'] = int(torque) * 10
+        command['VCU_INV_Inverter_Enable'] = 1
+        command['VCU_INV_Torque_Limit_Command'] = max_torque
+        return command
+
+    def step(self, now_s, throttle, brake):
+        """Returns the MC_Command_Message signals to send at now_s, if any"""
+        if now_s >= self.next_tc_s:
+            self.next_tc_s += self.tc_period_s
+            self.torque_limit_Nm = self.traction_control_limit()
+
+        if now_s < self.next_throttle_s:
+            return None
+        self.next_throttle_s += self.throttle_period_s
+        return self.torque_command(throttle, brake)
@@ -0,0 +1,151 @@
+"""
+Runs the BMU, VCU, PDU, DCU and WSBs with the inverter and car on a shared
+virtual clock and CAN bus (cosim.py, cosim_boards.py, virtual_can.py),
+through a scripted drive cycle: HV on, EM enable, then laps of the track.
+
+The run goes as fast as the host allows and repeats exactly: the report
+ends with a SHA-256 of every frame on the bus (time, id and data), and
+--repeat runs the cycle again to check it. It reports each board's CPU
+utilisation and task response times, the bus load, the latency of every
+message from the send call to the end of its frame, and the VCU's control
+loop latencies (control_metrics.py), including the time from each pedal ADC
+sample to its torque command being queued.
+
+    python3 run_cosim.py --laps 22 --repeat 2
+    python3 run_cosim.py --laps 1 --legacy-throttle  # The VCU's previous 50 ms throttle task
+    python3 run_cosim.py --laps 1 --mirror vcan0   # Watch the frames with candump
+"""
+import argparse
+import time
+
+from control_metrics import format_histogram
+from cosim import LatencyStats, Simulator
+from cosim_boards import Bmu, Dcu, Pdu, Plant, Vcu, Wsb
+from dbc import Database
+from drive_scenarios import LapScenario
+from vehicle_model import VehicleModel, VehicleParams
+from virtual_can import BIT_RATE, VirtualCanBus
+
+# Drive cycle script (s)
+HV_BUTTON_S = 0.5
+EM_BUTTON_S = 4.0
+TC_BUTTON_S = 4.5
+DRIVE_START_S = 6.0
+
+
+class CoSimulation:
+    def __init__(self, db, laps, seed=1, traction_control=False, tire_mu=VehicleParams.tire_mu,
+                 bit_rate=BIT_RATE, torque_loop=True, torque_loop_period_ms=10, throttle_period_ms=50):
+        self.sim = Simulator()
+        self.bus = VirtualCanBus(self.sim, bit_rate)
+        self.scenario = LapScenario(laps=laps, settle_s=DRIVE_START_S)
+        self.plant = Plant(self.sim, self.bus, db, self.scenario,
+                           vehicle=VehicleModel(VehicleParams(tire_mu=tire_mu)))
+        presses = [(HV_BUTTON_S, 'ButtonHVEnabled'), (EM_BUTTON_S, 'ButtonEMEnabled')]
+        if traction_control:
+            presses.append((TC_BUTTON_S, 'ButtonTCEnabled'))
+        self.boards = [
+            Bmu(self.sim, self.bus, db, self.plant, seed),
+            Vcu(self.sim, self.bus, db, self.plant, seed, torque_loop=torque_loop,
+                torque_loop_period_ms=torque_loop_period_ms, throttle_period_ms=throttle_period_ms),
+            Pdu(self.sim, self.bus, db, self.plant, seed),
+            Dcu(self.sim, self.bus, db, self.plant, seed, presses),
+        ] + [Wsb(self.sim, self.bus, db, self.plant, seed, corner) for corner in ('FL', 'FR', 'RL', 'RR')]
+        self.message_latency = {}
+        self.bus.observe(self._on_frame)
+
+    def _on_frame(self, frame):
+        stats = self.message_latency.get(frame.name)
+        if stats is None:
+            stats = self.message_latency[frame.name] = LatencyStats(bin_us=50)
+        stats.add(frame.end_ns - frame.queued_ns)
+
+    def run(self, timeout_s):
+        self.sim.run(int(timeout_s * 1e9), stop=lambda: self.plant.emulator.done)
+
+    def report(self):
+        elapsed = self.sim.now_ns
+        lines = [f'simulated {elapsed / 1e9:.3f} s, finished: {self.plant.emulator.done}']
+        for key, value in self.scenario.summary(self.plant.vehicle).items():
+            lines.append(f'{key}: {value}')
+
+        lines.append('')
+        lines.append(f'{"board / task":32s} {"cpu %":>7s} {"jobs":>8s} {"mean us":>9s} {"p99 us":>9s} '
+                     f'{"max us":>9s} {"missed":>6s}')
+        for board in self.boards:
+            cpu = board.cpu
+            lines.append(f'{board.name:32s} {100 * cpu.utilisation(elapsed):7.2f}   tx dropped: {board.send_failures}')
+            for task in [cpu.isr_task] + cpu.tasks:
+                r = task.response
+                lines.append(f'  {task.name:30s} {100 * task.busy_ns / elapsed:7.2f} {r.count:8d} '
+                             f'{r.mean_us():9.1f} {r.percentile_us(0.99):9.1f} {r.max_ns / 1000:9.1f} '
+                             f'{task.misses:6d}')
+
+        lines.append('')
+        lines.append(f'bus: {self.bus.frames} frames, load {100 * self.bus.load(elapsed):.1f}%')
+        lines.append(f'{"message":32s} {"frames":>8s} {"mean us":>9s} {"p99 us":>9s} {"max us":>9s}')
+        for name in sorted(self.message_latency):
+            s = self.message_latency[name]
+            lines.append(f'{name:32s} {s.count:8d} {s.mean_us():9.1f} {s.percentile_us(0.99):9.1f} '
+                         f'{s.max_ns / 1000:9.1f}')
+
+        vcu = next(board for board in self.boards if isinstance(board, Vcu))
+        lines.append('')
+        lines.append(f'VCU {"torque loop" if vcu.torque_loop else "throttle task"}, ADC sample to command queued:')
+        for label, s in (('latency', vcu.command_latency), ('jitter', vcu.command_jitter)):
+            lines.append(f'  {label:8s} {s.count:6d} commands, mean {s.mean_us():8.1f} us, '
+                         f'p50 {s.percentile_us(0.5):8.1f} us, p99 {s.percentile_us(0.99):8.1f} us, '
+                         f'max {s.max_ns / 1000:8.1f} us')
+
+        lines.append('')
+        lines.append(self.plant.emulator.metrics.report())
+        lines.append(f'digest: {self.bus.digest.hexdigest()}')
+        return '\n'.join(lines)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='Virtual time co-simulation of the car\'s boards')
+    parser.add_argument('--laps', type=int, default=2)
+    parser.add_argument('--seed', type=int, default=1, help='Seed for task execution time jitter')
+    parser.add_argument('--tc', action='store_true', help='Turn traction control on from the DCU')
+    parser.add_argument('--mu', type=float, default=VehicleParams.tire_mu, help='Rear tire peak friction')
+    parser.add_argument('--torque-period', type=float, default=10, help='VCU torque loop (pedal ADC) period (ms)')
+    parser.add_argument('--legacy-throttle', action='store_true',
+                        help='Run the VCU\'s previous 50 ms throttle task instead of the torque loop')
+    parser.add_argument('--throttle-period', type=float, default=50, help='Previous throttle task period (ms)')
+    parser.add_argument('--timeout', type=float, default=4000.0, help='Simulated time limit (s)')
+    parser.add_argument('--repeat', type=int, default=1, help='Run this many times and compare the digests')
+    parser.add_argument('--mirror', type=str, default=None,
+                        help='Also send every frame to this socketcan interface, e.g. vcan0')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    db = Database()
+    digests = []
+    for run in range(args.repeat):
+        cosim = CoSimulation(db, args.laps, seed=args.seed, traction_control=args.tc, tire_mu=args.mu,
+                             torque_loop=not args.legacy_throttle, torque_loop_period_ms=args.torque_period,
+                             throttle_period_ms=args.throttle_period)
+        if args.mirror:
+            import can
+            mirror = can.interface.Bus(channel=args.mirror, bustype='socketcan')
+            cosim.bus.observe(lambda f: mirror.send(can.Message(arbitration_id=f.frame_id, data=f.data,
+                                                                is_extended_id=True)))
+        start = time.monotonic()
+        cosim.run(args.timeout)
+        wall = time.monotonic() - start
+        digests.append(cosim.bus.digest.hexdigest())
+        if run == 0:
+            print(cosim.report())
+        print(f'run {run + 1}: {wall:.1f} s wall clock, {cosim.sim.now_s / wall:.1f}x real time')
+    if args.repeat > 1:
+        same = all(d == digests[0] for d in digests)
+        print(f'reproducible: {"yes" if same else "NO"} over {args.repeat} runs')
+        if not same:
+            raise SystemExit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,140 @@
+"""
+Longitudinal model of the car for the inverter emulator.
+
+A single motor drives the rear axle through the chain (45:12), so both rear
+wheels turn at the motor speed over the gear ratio, as the VCU assumes in
+traction_control.c. The rear tires make force from their slip ratio through
+a simplified Pacejka curve, on the rear axle load including the load
+transferred under acceleration and the aero downforce. The front wheels roll
+freely. Drag, downforce and rolling resistance act on the car, and the
+brakes act on all four wheels.
+
+The pack is an open circuit voltage behind a series resistance, which sets
+the DC bus voltage seen by the inverter.
+"""
+from dataclasses import dataclass
+import math
+
+G = 9.81
+AIR_DENSITY = 1.2
+
+
+@dataclass
+class VehicleParams:
+    mass_kg: float = 290.0              # With driver
+    wheelbase_m: float = 1.55
+    cg_height_m: float = 0.30
+    rear_weight_fraction: float = 0.54
+    wheel_radius_m: float = 0.2625      # WHEEL_DIAMETER_M / 2
+    gear_ratio: float = 45.0 / 12.0     # Motor turns per wheel turn
+    drivetrain_efficiency: float = 0.97
+    # Inertia of the motor, reflected to the wheels, and of both rear wheels
+    rear_inertia_kgm2: float = 0.9
+    front_inertia_kgm2: float = 0.4
+    drag_area_m2: float = 1.1           # Cd * A
+    lift_area_m2: float = 2.2           # Cl * A, downforce
+    aero_rear_fraction: float = 0.55
+    rolling_resistance: float = 0.015
+    max_brake_torque_Nm: float = 3000.0  # All wheels, at full pedal
+    brake_rear_fraction: float = 0.35
+    # Pacejka magic formula coefficients, longitudinal
+    tire_B: float = 12.0
+    tire_C: float = 1.65
+    tire_mu: float = 1.6
+    tire_E: float = 0.3
+    # Pack
+    pack_ocv_V: float = 470.0
+    pack_resistance_ohm: float = 0.35
+
+
+def tire_force_coefficient(slip, p):
+    """Longitudinal force over normal load at a slip ratio"""
+    bx = p.tire_B * slip
+    return p.tire_mu * math.sin(p.tire_C * math.atan(bx - p.tire_E * (bx - math.atan(bx))))
+
+
+def slip_ratio(wheel_speed_mps, vehicle_speed_mps):
+    """(wheel - ground) / ground, with the ground speed floored near a stop"""
+    return (wheel_speed_mps - vehicle_speed_mps) / max(abs(vehicle_speed_mps), 0.5)
+
+
+class VehicleModel:
+    def __init__(self, params=None):
+        self.params = params or VehicleParams()
+        self.reset()
+
+    def reset(self):
+        self.speed_mps = 0.0
+        self.distance_m = 0.0
+        self.accel_mps2 = 0.0
+        self.rear_omega = 0.0      # Rear wheel speed, rad/s
+        self.front_omega = 0.0
+        self.rear_slip = 0.0
+        self.drive_force_N = 0.0
+        self.bus_current_A = 0.0
+        self.energy_J = 0.0
+        self.time_s = 0.0
+
+    @property
+    def motor_rpm(self):
+        return self.rear_omega * self.params.gear_ratio * 60 / (2 * math.pi)
+
+    @property
+    def bus_voltage_V(self):
+        p = self.params
+        return p.pack_ocv_V - p.pack_resistance_ohm * self.bus_current_A
+
+    def rear_axle_load_N(self):
+        p = self.params
+        static = p.mass_kg * G * p.rear_weight_fraction
+        transfer = p.mass_kg * self.accel_mps2 * p.cg_height_m / p.wheelbase_m
+        aero = 0.5 * AIR_DENSITY * p.lift_area_m2 * self.speed_mps ** 2 * p.aero_rear_fraction
+        return max(static + transfer + aero, 0.0)
+
+    def step(self, dt, motor_torque_Nm, brake_fraction, bus_current_A):
+        """
+        Advance dt seconds with the motor torque and brake pedal (0 - 1).
+        The bus current is the inverter's, for the pack voltage
+        """
+        p = self.params
+        r = p.wheel_radius_m
+        self.bus_current_A = bus_current_A
+        self.energy_J += self.bus_voltage_V * bus_current_A * dt
+
+        # Integrate the wheel in sub steps, the slip dynamics are stiff at low speed
+        substeps = 10
+        h = dt / substeps
+        for _ in range(substeps):
+            self.rear_slip = slip_ratio(self.rear_omega * r, self.speed_mps)
+            rear_load = self.rear_axle_load_N()
+            fx = tire_force_coefficient(self.rear_slip, p) * rear_load
+
+            wheel_torque = motor_torque_Nm * p.gear_ratio
+            if wheel_torque > 0:
+                wheel_torque *= p.drivetrain_efficiency
+            brake = p.max_brake_torque_Nm * min(max(brake_fraction, 0.0), 1.0)
+            rear_brake = brake * p.brake_rear_fraction
+            front_brake = brake - rear_brake
+
+            net = wheel_torque - fx * r
+            if self.rear_omega > 0.01 or net > rear_brake:
+                self.rear_omega = max(self.rear_omega + (net - rear_brake) / p.rear_inertia_kgm2 * h, 0.0)
+            else:
+                # Held by the brakes
+                self.rear_omega = 0.0
+
+            # Front brakes act through the front tires, which are assumed not to lock
+            front_brake_force = front_brake / r if self.speed_mps > 0.01 else 0.0
+            drag = 0.5 * AIR_DENSITY * p.drag_area_m2 * self.speed_mps ** 2
+            rolling = p.rolling_resistance * p.mass_kg * G if self.speed_mps > 0.01 else 0.0
+            force = fx - drag - rolling - front_brake_force
+            if self.speed_mps <= 0.01 and force < 0:
+                force = 0.0
+            equivalent_mass = p.mass_kg + p.front_inertia_kgm2 / r ** 2
+            self.accel_mps2 = force / equivalent_mass
+            self.speed_mps = max(self.speed_mps + self.accel_mps2 * h, 0.0)
+            self.distance_m += self.speed_mps * h
+            self.drive_force_N = fx
+
+        self.front_omega = self.speed_mps / r
+        self.time_s += dt
@@ -0,0 +1,177 @@
+"""
+In-process CAN bus for the co-simulation, timed bit for bit.
+
+Every node has the three transmit mailboxes of the STM32 bxCAN, which send
+the lowest identifier first (TransmitFifoPriority disabled) and refuse a
+frame when all three are full, as F7_sendCanMessageBase does. Plant nodes
+(the inverter) can be given an unbounded queue instead. When the bus goes
+idle the lowest identifier waiting in any node wins arbitration. A frame
+takes its length in bits, with the stuff bits worked out from its contents
+and CRC, plus the interframe space, at the bus bit rate. Receivers get the
+frame when it ends.
+"""
+import hashlib
+import heapq
+
+BIT_RATE = 500000   # CAN3 on the VCU: 50 MHz APB1 / 5 / (1 + 13 + 6) tq
+HW_MAILBOXES = 3
+INTERFRAME_BITS = 3
+
+
+def _crc15(bits):
+    crc = 0
+    for bit in bits:
+        crc_next = bit ^ ((crc >> 14) & 1)
+        crc = (crc << 1) & 0x7FFF
+        if crc_next:
+            crc ^= 0x4599
+    return crc
+
+
+def _bits(value, count):
+    return [(value >> (count - 1 - i)) & 1 for i in range(count)]
+
+
+_frame_bits_cache = {}
+
+
+def frame_bits(frame_id, data):
+    """Bits on the bus for an extended data frame, stuff bits included"""
+    key = (frame_id, data)
+    bits = _frame_bits_cache.get(key)
+    if bits is None:
+        if len(_frame_bits_cache) > 100000:
+            _frame_bits_cache.clear()
+        bits = _frame_bits_cache[key] = _count_frame_bits(frame_id, data)
+    return bits
+
+
+def _count_frame_bits(frame_id, data):
+    stuffed = ([0] + _bits(frame_id >> 18, 11) + [1, 1] + _bits(frame_id & 0x3FFFF, 18)
+               + [0, 0, 0] + _bits(len(data), 4))
+    for byte in data:
+        stuffed += _bits(byte, 8)
+    stuffed += _bits(_crc15(stuffed), 15)
+
+    stuff = 0
+    run_bit, run = None, 0
+    for bit in stuffed:
+        if bit == run_bit:
+            run += 1
+        else:
+            run_bit, run = bit, 1
+        if run == 5:
+            # The stuff bit is the complement and starts the next run
+            stuff += 1
+            run_bit, run = 1 - bit, 1
+    # CRC delimiter, ACK slot and delimiter, end of frame
+    return len(stuffed) + stuff + 1 + 2 + 7
+
+
+class Frame:
+    __slots__ = ('frame_id', 'data', 'name', 'sender', 'queued_ns', 'start_ns', 'end_ns')
+
+    def __init__(self, frame_id, data, name, sender, queued_ns):
+        self.frame_id = frame_id
+        self.data = data
+        self.name = name
+        self.sender = sender
+        self.queued_ns = queued_ns
+        self.start_ns = None
+        self.end_ns = None
+
+
+class CanNode:
+    def __init__(self, bus, name, mailboxes=HW_MAILBOXES):
+        self.bus = bus
+        self.name = name
+        self.mailboxes = mailboxes     # None for an unbounded queue
+        self.pending = []
+        self.in_flight = 0              # A mailbox is only freed once its frame is sent
+        self.receivers = []
+        self.sent = 0
+        self.dropped = 0
+
+    def send(self, frame_id, data, name=None):
+        """Returns False if every mailbox is full, like HAL_CAN_AddTxMessage"""
+        if self.mailboxes is not None and len(self.pending) + self.in_flight >= self.mailboxes:
+            self.dropped += 1
+            return False
+        frame = Frame(frame_id, bytes(data), name, self.name, self.bus.sim.now_ns)
+        heapq.heappush(self.pending, (frame_id, self.bus.next_seq(), frame))
+        self.bus.request()
+        return True
+
+    def on_receive(self, callback):
+        """callback(frame) at the end of every frame sent by another node"""
+        self.receivers.append(callback)
+
+
+class VirtualCanBus:
+    def __init__(self, sim, bit_rate=BIT_RATE):
+        self.sim = sim
+        self.bit_ns = 1e9 / bit_rate
+        self.nodes = []
+        self.busy_until_ns = 0
+        self.busy_ns = 0
+        self.frames = 0
+        self.digest = hashlib.sha256()
+        self.observers = []
+        self._seq = 0
+        self._arbitration_pending = False
+
+    def next_seq(self):
+        self._seq += 1
+        return self._seq
+
+    def node(self, name, mailboxes=HW_MAILBOXES):
+        node = CanNode(self, name, mailboxes)
+        self.nodes.append(node)
+        return node
+
+    def observe(self, callback):
+        """callback(frame) for every frame, as a bus monitor"""
+        self.observers.append(callback)
+
+    def request(self):
+        if self._arbitration_pending:
+            return
+        self._arbitration_pending = True
+        self.sim.at(max(self.sim.now_ns, self.busy_until_ns), self._arbitrate)
+
+    def _arbitrate(self):
+        self._arbitration_pending = False
+        winner = None
+        for node in self.nodes:
+            if node.pending and (winner is None or node.pending[0][:2] < winner.pending[0][:2]):
+                winner = node
+        if winner is None:
+            return
+        _, _, frame = heapq.heappop(winner.pending)
+        winner.in_flight += 1
+        frame.start_ns = self.sim.now_ns
+        bits = frame_bits(frame.frame_id, frame.data)
+        duration = int(round(bits * self.bit_ns))
+        frame.end_ns = frame.start_ns + duration
+        # The bus is free again after the interframe space
+        self.busy_until_ns = frame.end_ns + int(round(INTERFRAME_BITS * self.bit_ns))
+        self.busy_ns += self.busy_until_ns - frame.start_ns
+        self.sim.at(frame.end_ns, lambda: self._deliver(winner, frame))
+        self._arbitration_pending = True
+        self.sim.at(self.busy_until_ns, self._arbitrate)
+
+    def _deliver(self, sender, frame):
+        sender.sent += 1
+        sender.in_flight -= 1
+        self.frames += 1
+        self.digest.update(frame.end_ns.to_bytes(8, 'little') + frame.frame_id.to_bytes(4, 'little')
+                           + bytes([len(frame.data)]) + frame.data)
+        for observer in self.observers:
+            observer(frame)
+        for node in self.nodes:
+            if node is not sender:
+                for callback in node.receivers:
+                    callback(frame)
+
+    def load(self, elapsed_ns):
+        return self.busy_ns / elapsed_ns if elapsed_ns else 0.0
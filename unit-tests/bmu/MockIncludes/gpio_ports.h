@@ -30,5 +30,8 @@
 #define BTN_ENDURANCE_LAP_READ_GPIO_Port (GPIOB)
 #define BTN_ENDURANCE_LAP_READ_Pin (GPIO_PIN_11)
 
+#define ISO_SPI_NSS_GPIO_Port (GPIOE)
+#define ISO_SPI_NSS_Pin (GPIO_PIN_11)
+
 
 #endif
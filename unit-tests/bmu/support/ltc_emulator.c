@@ -0,0 +1,829 @@
+/**
+  *****************************************************************************
+  * @file    ltc_emulator.c
+  * @brief   Emulated LTC6804-1 daisy chain for host tests
+  * @details Follows the LTC6804-1 datasheet: command codes, the CRC15 PEC
+  * (polynomial 0x4599, seed 16), register group layouts, conversion order
+  * and timing, and the isoSPI idle and core sleep state machines. Where the
+  * datasheet gives a range, the timing that is hardest on the BMU is used
+  * (earliest idle and sleep, slowest wake up).
+  *
+  * Each device decodes every broadcast command. Write data is shifted down
+  * the chain, so the first set clocked out ends up in the last device, and
+  * read data is shifted back, so the first set clocked in is from device 0.
+  * A device only sees a transfer if its port and every port before it in the
+  * chain was ready when chip select went low.
+  *
+  * Time is in microseconds and is expected to increase between calls. The
+  * discharge timer is tracked in 32 bits of microseconds, so the longest
+  * DCTO settings can't expire.
+  *****************************************************************************
+  */
+
+#include "ltc_emulator.h"
+#include <math.h>
+#include <string.h>
+
+// Command codes, with the MD, DCP, PUP and channel bits cleared
+#define CMD_WRCFG   0x001
+#define CMD_RDCFG   0x002
+#define CMD_RDCVA   0x004
+#define CMD_RDCVB   0x006
+#define CMD_RDCVC   0x008
+#define CMD_RDCVD   0x00A
+#define CMD_RDAUXA  0x00C
+#define CMD_RDAUXB  0x00E
+#define CMD_RDSTATA 0x010
+#define CMD_RDSTATB 0x012
+#define CMD_ADCV    0x260
+#define CMD_ADOW    0x228
+#define CMD_ADAX    0x460
+#define CMD_ADSTAT  0x468
+#define CMD_ADCVAX  0x46F
+#define CMD_CLRCELL 0x711
+#define CMD_CLRAUX  0x712
+#define CMD_CLRSTAT 0x713
+#define CMD_PLADC   0x714
+
+#define CMD_MD_MASK   0x180
+#define CMD_MD_SHIFT  7
+#define CMD_PUP_BIT   0x040
+#define CMD_DCP_BIT   0x010
+#define CMD_CH_MASK   0x007
+
+#define COMMAND_SIZE 4
+#define GROUP_SIZE (LTC_EMULATOR_REGISTER_SIZE + 2)
+
+// Configuration register group
+#define CFGR0_ADCOPT  (1 << 0)
+#define CFGR0_REFON   (1 << 2)
+#define CFGR0_GPIO1_POS 3
+#define CFGR0_DEFAULT 0xF8      ///< GPIO pull downs off
+#define CFGR5_DCTO_POS 4
+
+#define MUX_CHANNEL_MASK 0xF
+
+#define COUNTS_PER_VOLT 10000.0f
+#define GPIO_HIGH_V 5.0f
+#define REFERENCE_V 3.0f
+#define VA_V 5.0f
+#define VD_V 3.0f
+#define DIE_TEMPERATURE_C 25.0f
+#define SOC_COUNTS_DIVIDER 20   ///< Sum of cells LSB is 20 cell LSBs
+#define ITMP_COUNTS_PER_C 75    ///< 7.5 mV/K in 100 uV counts
+#define ITMP_OFFSET_K 273.0f
+#define VUV_VOV_COUNTS 16
+
+#define AUX_MUX 4       ///< GPIO5
+#define AUX_REF 5
+#define STATUS_CHANNELS 4
+#define CELL_PAIRS 6
+
+/// Full conversions of all twelve cells, by ADCOPT then MD
+static const uint32_t allCellsTime_us[2][4] = {
+    {12807, 1113, 2335, 201317},   // 422 Hz, 27 kHz, 7 kHz, 26 Hz
+    {5919, 1288, 3195, 4407},      // 1 kHz, 14 kHz, 3 kHz, 2 kHz
+};
+/// One cell pair, or one GPIO or status channel
+static const uint32_t singleTime_us[2][4] = {
+    {2178, 201, 405, 34067},
+    {991, 230, 549, 748},
+};
+/// Noise relative to 7 kHz mode
+static const float noiseScale[2][4] = {
+    {0.5f, 4.0f, 1.0f, 0.25f},
+    {0.5f, 2.0f, 1.0f, 0.5f},
+};
+/// Discharge timeout for each DCTO setting, in seconds
+static const uint32_t dischargeTimeout_s[16] = {
+    0, 30, 60, 120, 180, 240, 300, 600, 900, 1200, 1800, 2400, 3600, 4500, 5400, 7200,
+};
+
+static uint16_t pecTable[256];
+static bool pecTableReady = false;
+
+static void pecInit(void)
+{
+    for (int i = 0; i < 256; i++) {
+        uint16_t remainder = i << 7;
+        for (int bit = 8; bit > 0; bit--) {
+            if (remainder & 0x4000) {
+                remainder = (remainder << 1) ^ 0x4599;
+            } else {
+                remainder = remainder << 1;
+            }
+        }
+        pecTable[i] = remainder & 0xFFFF;
+    }
+    pecTableReady = true;
+}
+
+/**
+ * @brief The datasheet's table driven PEC, independent of ltc_common.c so
+ * the two can be checked against each other
+ */
+void ltcEmulatorPec(const uint8_t *data, size_t len, uint8_t pec[2])
+{
+    if (!pecTableReady) {
+        pecInit();
+    }
+    uint16_t remainder = 16;
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t address = ((remainder >> 7) ^ data[i]) & 0xFF;
+        remainder = (remainder << 8) ^ pecTable[address];
+    }
+    remainder = remainder << 1;
+    pec[0] = remainder >> 8;
+    pec[1] = remainder & 0xFF;
+}
+
+static bool pecMatches(const uint8_t *data, size_t len)
+{
+    uint8_t pec[2];
+    ltcEmulatorPec(data, len, pec);
+    return pec[0] == data[len] && pec[1] == data[len + 1];
+}
+
+static uint32_t nextRandom(LtcEmulator_t *emu)
+{
+    // xorshift32
+    uint32_t x = emu->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    emu->random = x;
+    return x;
+}
+
+static float uniformRandom(LtcEmulator_t *emu)
+{
+    return (float)(nextRandom(emu) >> 8) / (float)(1 << 24);
+}
+
+static void injectBitErrors(LtcEmulator_t *emu, uint8_t *data, size_t len)
+{
+    if (emu->faults.bitErrorRate <= 0.0f) {
+        return;
+    }
+    for (size_t i = 0; i < len; i++) {
+        for (int bit = 0; bit < 8; bit++) {
+            if (uniformRandom(emu) < emu->faults.bitErrorRate) {
+                data[i] ^= 1 << bit;
+                emu->bitErrors++;
+            }
+        }
+    }
+}
+
+static uint32_t byteTime_us(const LtcEmulator_t *emu, size_t bytes)
+{
+    return (uint32_t)(((uint64_t)bytes * 8 * 1000000 + emu->params.spiClock_Hz - 1) / emu->params.spiClock_Hz);
+}
+
+static bool timeReached(uint32_t now_us, uint32_t time_us)
+{
+    return (int32_t)(now_us - time_us) >= 0;
+}
+
+static bool adcOption(const LtcEmulatorDevice_t *device)
+{
+    return device->config[0] & CFGR0_ADCOPT;
+}
+
+static uint16_t toCounts(float voltage)
+{
+    const float counts = roundf(voltage * COUNTS_PER_VOLT);
+    if (counts < 0.0f) {
+        return 0;
+    }
+    if (counts > (float)UINT16_MAX) {
+        return UINT16_MAX;
+    }
+    return (uint16_t)counts;
+}
+
+static float conversionNoise(LtcEmulator_t *emu, const LtcEmulatorDevice_t *device)
+{
+    const float peak = emu->params.noise_V * noiseScale[adcOption(device)][device->conversionMode];
+    return peak * (2.0f * uniformRandom(emu) - 1.0f);
+}
+
+static float modelCellVoltage(const LtcEmulator_t *emu, int device, int cell, uint32_t now_us)
+{
+    if (emu->model.cellVoltage == NULL) {
+        return 0.0f;
+    }
+    return emu->model.cellVoltage(emu->model.context, device, cell, now_us);
+}
+
+bool ltcEmulatorDischarging(const LtcEmulator_t *emu, int device, int cell)
+{
+    const uint8_t *config = emu->devices[device].config;
+    if (cell < 8) {
+        return config[4] & (1 << cell);
+    }
+    return config[5] & (1 << (cell - 8));
+}
+
+static void resetConfig(LtcEmulatorDevice_t *device)
+{
+    static const uint8_t defaultConfig[LTC_EMULATOR_REGISTER_SIZE] = {CFGR0_DEFAULT, 0, 0, 0, 0, 0};
+
+    memcpy(device->config, defaultConfig, sizeof(device->config));
+    device->muxChannel = (CFGR0_DEFAULT >> CFGR0_GPIO1_POS) & MUX_CHANNEL_MASK;
+    device->lastMuxChannel = device->muxChannel;
+}
+
+static void resetDevice(LtcEmulatorDevice_t *device, uint32_t now_us)
+{
+    memset(device, 0, sizeof(*device));
+    resetConfig(device);
+    memset(device->cells, 0xFF, sizeof(device->cells));
+    memset(device->aux, 0xFF, sizeof(device->aux));
+    memset(device->status, 0xFF, sizeof(device->status));
+    memset(device->flags, 0xFF, sizeof(device->flags));
+    device->asleep = true;
+    device->lastDischarge_us = now_us;
+}
+
+void ltcEmulatorInit(LtcEmulator_t *emu, const LtcEmulator_Params_t *params, const LtcEmulatorModel_t *model,
+                     uint32_t now_us)
+{
+    memset(emu, 0, sizeof(*emu));
+    emu->params = *params;
+    if (emu->params.numDevices > LTC_EMULATOR_MAX_DEVICES) {
+        emu->params.numDevices = LTC_EMULATOR_MAX_DEVICES;
+    }
+    if (emu->params.spiClock_Hz == 0) {
+        emu->params.spiClock_Hz = 1000000;
+    }
+    emu->model = *model;
+    emu->random = params->seed ? params->seed : 1;
+    emu->faults.brokenFrom = emu->params.numDevices;
+
+    for (uint32_t i = 0; i < emu->params.numDevices; i++) {
+        resetDevice(&emu->devices[i], now_us);
+    }
+}
+
+/**
+ * @brief Node voltages above C0 while the ADOW current sources pull the
+ * open inputs. An open input gets halfway to where the current source drives
+ * it on the first conversion, as the input filter capacitor discharges, and
+ * all the way from the second, which is why the datasheet asks for at least
+ * two ADOW commands
+ */
+static void openWireNodes(const LtcEmulator_t *emu, int index, uint32_t now_us, float nodes[LTC_EMULATOR_CELL_INPUTS])
+{
+    const LtcEmulatorDevice_t *device = &emu->devices[index];
+    float cells[LTC_EMULATOR_CELLS];
+
+    nodes[0] = 0.0f;
+    for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+        cells[cell] = modelCellVoltage(emu, index, cell, now_us);
+        nodes[cell + 1] = nodes[cell] + cells[cell];
+    }
+    if (device->conversion != LTC_EMU_CONV_OPEN_WIRE) {
+        return;
+    }
+
+    const float fraction = device->openWireCount >= 2 ? 1.0f : 0.5f;
+    float pulled[LTC_EMULATOR_CELL_INPUTS];
+    memcpy(pulled, nodes, sizeof(pulled));
+    for (int input = 0; input < LTC_EMULATOR_CELL_INPUTS; input++) {
+        if (!emu->faults.openWire[index][input]) {
+            continue;
+        }
+        // Pulled up towards the input above it, or down towards the one below
+        if (device->pullup && input < LTC_EMULATOR_CELLS) {
+            pulled[input] = nodes[input] + fraction * (nodes[input + 1] - nodes[input]);
+        } else if (!device->pullup && input > 0) {
+            pulled[input] = nodes[input] + fraction * (nodes[input - 1] - nodes[input]);
+        }
+    }
+    memcpy(nodes, pulled, sizeof(pulled));
+}
+
+static void convertCell(LtcEmulator_t *emu, int index, int cell, const float nodes[LTC_EMULATOR_CELL_INPUTS])
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+    // A shorted input reads zero scale, which the open wire check relies on
+    float voltage = nodes[cell + 1] - nodes[cell];
+    if (device->dischargePermitted && emu->params.dischargeResistance_ohms > 0.0f
+        && ltcEmulatorDischarging(emu, index, cell)) {
+        voltage -= voltage / emu->params.dischargeResistance_ohms * emu->params.senseResistance_ohms;
+    }
+    const uint16_t counts = voltage > 0.0f ? toCounts(voltage + conversionNoise(emu, device)) : 0;
+    device->cells[cell] = counts;
+
+    // Under and over voltage flags, against thresholds in 1.6 mV steps
+    const uint32_t vuv = device->config[1] | ((device->config[2] & 0x0F) << 8);
+    const uint32_t vov = (device->config[2] >> 4) | (device->config[3] << 4);
+    const int byte = cell / 4;
+    const int bit = (cell % 4) * 2;
+    device->flags[byte] &= ~(3 << bit);
+    if (counts < (vuv + 1) * VUV_VOV_COUNTS) {
+        device->flags[byte] |= 1 << bit;
+    }
+    if (counts > vov * VUV_VOV_COUNTS) {
+        device->flags[byte] |= 2 << bit;
+    }
+}
+
+static void convertCellPair(LtcEmulator_t *emu, int index, int pair, uint32_t now_us)
+{
+    float nodes[LTC_EMULATOR_CELL_INPUTS];
+    openWireNodes(emu, index, now_us, nodes);
+    convertCell(emu, index, pair, nodes);
+    convertCell(emu, index, pair + CELL_PAIRS, nodes);
+}
+
+static void convertAux(LtcEmulator_t *emu, int index, int channel, uint32_t now_us)
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+    float voltage;
+
+    if (channel == AUX_REF) {
+        voltage = REFERENCE_V;
+    } else if (!(device->config[0] & (1 << (CFGR0_GPIO1_POS + channel)))) {
+        // Pull down on
+        voltage = 0.0f;
+    } else if (channel == AUX_MUX) {
+        // Mux output, from the previous channel until the mux settles
+        int muxChannel = device->muxChannel;
+        if (!timeReached(now_us, device->muxChange_us + emu->params.muxSettle_us)) {
+            muxChannel = device->lastMuxChannel;
+        }
+        voltage = 0.0f;
+        if (emu->model.muxVoltage != NULL) {
+            voltage = emu->model.muxVoltage(emu->model.context, index, muxChannel, now_us);
+        }
+    } else {
+        // Mux select, pulled up
+        voltage = GPIO_HIGH_V;
+    }
+    device->aux[channel] = toCounts(voltage + conversionNoise(emu, device));
+}
+
+static void convertStatus(LtcEmulator_t *emu, int index, int channel, uint32_t now_us)
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+
+    switch (channel) {
+        case 0:
+        {
+            float sum = 0.0f;
+            for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+                sum += modelCellVoltage(emu, index, cell, now_us);
+            }
+            device->status[0] = toCounts(sum / SOC_COUNTS_DIVIDER);
+            break;
+        }
+        case 1:
+            device->status[1] = (uint16_t)((DIE_TEMPERATURE_C + ITMP_OFFSET_K) * ITMP_COUNTS_PER_C);
+            break;
+        case 2:
+            device->status[2] = toCounts(VA_V);
+            break;
+        default:
+            device->status[3] = toCounts(VD_V);
+            break;
+    }
+}
+
+static void conversionStep(LtcEmulator_t *emu, int index, uint32_t step, uint32_t now_us)
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+    const uint32_t channel = device->conversionChannel;
+
+    switch (device->conversion) {
+        case LTC_EMU_CONV_CELLS:
+        case LTC_EMU_CONV_OPEN_WIRE:
+            convertCellPair(emu, index, channel ? channel - 1 : step, now_us);
+            break;
+        case LTC_EMU_CONV_AUX:
+            convertAux(emu, index, channel ? channel - 1 : step, now_us);
+            break;
+        case LTC_EMU_CONV_CELLS_AUX:
+            // Cells, then GPIO1 and GPIO2
+            if (step < CELL_PAIRS) {
+                convertCellPair(emu, index, step, now_us);
+            } else {
+                convertAux(emu, index, step - CELL_PAIRS, now_us);
+            }
+            break;
+        case LTC_EMU_CONV_STATUS:
+            convertStatus(emu, index, channel ? channel - 1 : step, now_us);
+            break;
+        default:
+            break;
+    }
+}
+
+static void advanceConversion(LtcEmulator_t *emu, int index, uint32_t now_us)
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+
+    while (device->conversion != LTC_EMU_CONV_NONE && device->stepsDone < device->conversionSteps) {
+        const uint32_t stepEnd_us = device->conversionStart_us +
+            (uint32_t)((uint64_t)device->conversionTime_us * (device->stepsDone + 1) / device->conversionSteps);
+        if (!timeReached(now_us, stepEnd_us)) {
+            return;
+        }
+        conversionStep(emu, index, device->stepsDone, stepEnd_us);
+        device->stepsDone++;
+    }
+}
+
+static bool converting(const LtcEmulatorDevice_t *device, uint32_t now_us)
+{
+    return device->conversion != LTC_EMU_CONV_NONE &&
+        !timeReached(now_us, device->conversionStart_us + device->conversionTime_us);
+}
+
+static void advanceDischarge(LtcEmulator_t *emu, int index, uint32_t now_us)
+{
+    LtcEmulatorDevice_t *device = &emu->devices[index];
+    const float dt_s = (float)(now_us - device->lastDischarge_us) * 1e-6f;
+    device->lastDischarge_us = now_us;
+
+    if (emu->params.dischargeResistance_ohms > 0.0f) {
+        for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+            if (ltcEmulatorDischarging(emu, index, cell)) {
+                device->discharged_C[cell] +=
+                    modelCellVoltage(emu, index, cell, now_us) / emu->params.dischargeResistance_ohms * dt_s;
+            }
+        }
+    }
+
+    const uint32_t timeout_s = dischargeTimeout_s[device->config[5] >> CFGR5_DCTO_POS];
+    if (timeout_s != 0 && (now_us - device->dischargeTimerStart_us) / 1000000 >= timeout_s) {
+        device->config[4] = 0;
+        device->config[5] &= 0xF0;
+    }
+}
+
+/**
+ * @brief Watchdog timeout: the configuration is reset, except that the
+ * discharge keeps running if its timer is set
+ */
+static void enterSleep(LtcEmulatorDevice_t *device)
+{
+    const uint8_t dischargeLow = device->config[4];
+    const uint8_t dischargeHigh = device->config[5];
+
+    resetConfig(device);
+    if (dischargeHigh >> CFGR5_DCTO_POS) {
+        device->config[4] = dischargeLow;
+        device->config[5] = dischargeHigh;
+    }
+    device->conversion = LTC_EMU_CONV_NONE;
+    device->asleep = true;
+    device->portReady = false;
+}
+
+/**
+ * @brief Run conversions, timers and power state changes up to now
+ */
+void ltcEmulatorAdvance(LtcEmulator_t *emu, uint32_t now_us)
+{
+    for (uint32_t i = 0; i < emu->params.numDevices; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+
+        advanceConversion(emu, i, now_us);
+        advanceDischarge(emu, i, now_us);
+        if (device->portReady && timeReached(now_us, device->lastActivity_us + LTC_EMULATOR_T_IDLE_US)) {
+            device->portReady = false;
+        }
+        if (!device->asleep && timeReached(now_us, device->lastCommand_us + LTC_EMULATOR_T_SLEEP_US)) {
+            enterSleep(device);
+        }
+    }
+}
+
+/**
+ * @brief Chip select falling edge. Idle ports wake up one after another
+ * down the chain, each once the one before it is ready
+ *
+ * @return Number of devices, from device 0, that were ready to communicate
+ */
+static uint32_t chipSelectEdge(LtcEmulator_t *emu, uint32_t now_us)
+{
+    uint32_t reachable = 0;
+    bool allReady = true;
+    uint32_t signal_us = now_us;
+
+    for (uint32_t i = 0; i < emu->faults.brokenFrom && i < emu->params.numDevices; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+
+        if (device->portReady && timeReached(signal_us, device->lastActivity_us + LTC_EMULATOR_T_IDLE_US)) {
+            device->portReady = false;
+        }
+        if (!device->portReady) {
+            const uint32_t latency = device->asleep ? LTC_EMULATOR_T_WAKE_US : LTC_EMULATOR_T_READY_US;
+            device->readyTime_us = signal_us + latency;
+            device->lastActivity_us = device->readyTime_us;
+            device->portReady = true;
+            if (device->asleep) {
+                device->asleep = false;
+                device->lastCommand_us = device->readyTime_us;
+            }
+        } else if (!timeReached(device->lastActivity_us, signal_us)) {
+            // Passing the edge on keeps an awake port from idling
+            device->lastActivity_us = signal_us;
+        }
+        // The next port sees the edge once this one is ready
+        if (!timeReached(signal_us, device->readyTime_us)) {
+            signal_us = device->readyTime_us;
+        }
+        if (allReady && timeReached(now_us, device->readyTime_us)) {
+            reachable++;
+        } else {
+            allReady = false;
+        }
+    }
+
+    return reachable;
+}
+
+/**
+ * @brief Chip select pulsed low with nothing clocked, to wake the chain
+ */
+void ltcEmulatorWakePulse(LtcEmulator_t *emu, uint32_t now_us)
+{
+    ltcEmulatorAdvance(emu, now_us);
+    chipSelectEdge(emu, now_us);
+}
+
+static void writeConfig(LtcEmulator_t *emu, const uint8_t *data, size_t len, uint32_t reachable, uint32_t now_us)
+{
+    for (uint32_t i = 0; i < reachable; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+        // Shifted down the chain, so the first set ends up in the last device
+        const size_t offset = COMMAND_SIZE + (emu->params.numDevices - 1 - i) * GROUP_SIZE;
+        if (offset + GROUP_SIZE > len) {
+            continue;
+        }
+        if (!pecMatches(&data[offset], LTC_EMULATOR_REGISTER_SIZE)) {
+            device->writesRejected++;
+            continue;
+        }
+
+        memcpy(device->config, &data[offset], LTC_EMULATOR_REGISTER_SIZE);
+        device->dischargeTimerStart_us = now_us;
+        const int channel = (device->config[0] >> CFGR0_GPIO1_POS) & MUX_CHANNEL_MASK;
+        if (channel != device->muxChannel) {
+            device->lastMuxChannel = device->muxChannel;
+            device->muxChannel = channel;
+            device->muxChange_us = now_us;
+        }
+    }
+}
+
+static bool readGroup(const LtcEmulatorDevice_t *device, uint16_t command, uint8_t data[LTC_EMULATOR_REGISTER_SIZE])
+{
+    const uint16_t *words = NULL;
+
+    switch (command) {
+        case CMD_RDCFG:
+            memcpy(data, device->config, LTC_EMULATOR_REGISTER_SIZE);
+            return true;
+        case CMD_RDCVA:
+        case CMD_RDCVB:
+        case CMD_RDCVC:
+        case CMD_RDCVD:
+            words = &device->cells[(command - CMD_RDCVA) / 2 * 3];
+            break;
+        case CMD_RDAUXA:
+        case CMD_RDAUXB:
+            words = &device->aux[(command - CMD_RDAUXA) / 2 * 3];
+            break;
+        case CMD_RDSTATA:
+            words = device->status;
+            break;
+        case CMD_RDSTATB:
+            data[0] = device->status[3] & 0xFF;
+            data[1] = device->status[3] >> 8;
+            memcpy(&data[2], device->flags, sizeof(device->flags));
+            data[5] = 0;
+            return true;
+        default:
+            return false;
+    }
+
+    // Little endian
+    for (int i = 0; i < 3; i++) {
+        data[2 * i] = words[i] & 0xFF;
+        data[2 * i + 1] = words[i] >> 8;
+    }
+    return true;
+}
+
+static bool readData(LtcEmulator_t *emu, uint16_t command, uint8_t *rx, size_t len, uint32_t reachable)
+{
+    uint8_t data[GROUP_SIZE];
+
+    if (!readGroup(&emu->devices[0], command, data)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < reachable; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+        const size_t offset = COMMAND_SIZE + i * GROUP_SIZE;
+        if (offset >= len) {
+            break;
+        }
+
+        readGroup(device, command, data);
+        ltcEmulatorPec(data, LTC_EMULATOR_REGISTER_SIZE, &data[LTC_EMULATOR_REGISTER_SIZE]);
+        if (i == emu->faults.corruptDevice && emu->faults.corruptReads > 0) {
+            data[0] ^= 0x01;
+            emu->faults.corruptReads--;
+            device->readsCorrupted++;
+        }
+        memcpy(&rx[offset], data, len - offset < GROUP_SIZE ? len - offset : GROUP_SIZE);
+    }
+    return true;
+}
+
+static void startConversion(LtcEmulator_t *emu, uint16_t code, uint32_t reachable, uint32_t now_us)
+{
+    const uint16_t command = code & ~CMD_MD_MASK;
+    const uint8_t mode = (code & CMD_MD_MASK) >> CMD_MD_SHIFT;
+    LtcEmulatorConversion_t conversion;
+    uint8_t channel;
+
+    if ((command & ~CMD_DCP_BIT) == CMD_ADCVAX) {
+        conversion = LTC_EMU_CONV_CELLS_AUX;
+        channel = 0;
+    } else if ((command & ~(CMD_DCP_BIT | CMD_CH_MASK)) == CMD_ADCV) {
+        conversion = LTC_EMU_CONV_CELLS;
+        channel = command & CMD_CH_MASK;
+    } else if ((command & ~(CMD_PUP_BIT | CMD_DCP_BIT | CMD_CH_MASK)) == CMD_ADOW) {
+        conversion = LTC_EMU_CONV_OPEN_WIRE;
+        channel = command & CMD_CH_MASK;
+    } else if ((command & ~CMD_CH_MASK) == CMD_ADAX) {
+        conversion = LTC_EMU_CONV_AUX;
+        channel = command & CMD_CH_MASK;
+    } else if ((command & ~CMD_CH_MASK) == CMD_ADSTAT) {
+        conversion = LTC_EMU_CONV_STATUS;
+        channel = command & CMD_CH_MASK;
+    } else {
+        return;
+    }
+    const bool pullup = command & CMD_PUP_BIT;
+    const bool dischargePermitted = command & CMD_DCP_BIT;
+
+    for (uint32_t i = 0; i < reachable; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+        const bool option = adcOption(device);
+
+        if (conversion == LTC_EMU_CONV_OPEN_WIRE) {
+            if (device->conversion == LTC_EMU_CONV_OPEN_WIRE && device->openWirePullup == pullup) {
+                device->openWireCount++;
+            } else {
+                device->openWireCount = 1;
+            }
+            device->openWirePullup = pullup;
+        } else {
+            device->openWireCount = 0;
+        }
+
+        device->conversion = conversion;
+        device->conversionMode = mode;
+        device->conversionChannel = channel;
+        device->pullup = pullup;
+        device->dischargePermitted = dischargePermitted;
+        device->conversionStart_us = now_us;
+        device->stepsDone = 0;
+
+        uint32_t steps;
+        switch (conversion) {
+            case LTC_EMU_CONV_CELLS_AUX:
+                steps = CELL_PAIRS + 2;
+                break;
+            case LTC_EMU_CONV_STATUS:
+                steps = STATUS_CHANNELS;
+                break;
+            default:
+                steps = CELL_PAIRS;
+                break;
+        }
+        if (channel != 0) {
+            device->conversionSteps = 1;
+            device->conversionTime_us = singleTime_us[option][mode];
+        } else {
+            device->conversionSteps = steps;
+            device->conversionTime_us = allCellsTime_us[option][mode] * steps / CELL_PAIRS;
+        }
+
+        // The reference powers up first unless it was left on
+        if (!(device->config[0] & CFGR0_REFON)) {
+            device->conversionStart_us += LTC_EMULATOR_T_REFUP_US;
+        }
+    }
+}
+
+static void clearRegisters(LtcEmulator_t *emu, uint16_t command, uint32_t reachable)
+{
+    for (uint32_t i = 0; i < reachable; i++) {
+        LtcEmulatorDevice_t *device = &emu->devices[i];
+        if (command == CMD_CLRCELL) {
+            memset(device->cells, 0xFF, sizeof(device->cells));
+        } else if (command == CMD_CLRAUX) {
+            memset(device->aux, 0xFF, sizeof(device->aux));
+        } else {
+            memset(device->status, 0xFF, sizeof(device->status));
+            memset(device->flags, 0xFF, sizeof(device->flags));
+        }
+    }
+}
+
+/**
+ * @brief Poll ADC: SDO is held low until the conversions finish
+ */
+static void pollConversion(LtcEmulator_t *emu, uint8_t *rx, size_t len, uint32_t reachable, uint32_t now_us)
+{
+    for (size_t byte = COMMAND_SIZE; byte < len; byte++) {
+        const uint32_t byte_us = now_us + byteTime_us(emu, byte);
+        bool busy = false;
+        for (uint32_t i = 0; i < reachable; i++) {
+            busy |= converting(&emu->devices[i], byte_us);
+        }
+        rx[byte] = busy ? 0x00 : 0xFF;
+    }
+}
+
+/**
+ * @brief One chip select low period. tx is clocked out to the chain while
+ * rx is clocked in; unused bytes read back as 0xFF, as SDO idles high
+ *
+ * @return How long the transfer takes on the bus
+ */
+uint32_t ltcEmulatorTransfer(LtcEmulator_t *emu, const uint8_t *tx, uint8_t *rx, size_t len, uint32_t now_us)
+{
+    uint8_t seen[COMMAND_SIZE + LTC_EMULATOR_MAX_DEVICES * GROUP_SIZE];
+    const uint32_t duration_us = byteTime_us(emu, len);
+
+    ltcEmulatorAdvance(emu, now_us);
+    memset(rx, 0xFF, len);
+    emu->transfers++;
+    emu->bytes += len;
+    emu->busTime_us += duration_us;
+
+    const uint32_t reachable = chipSelectEdge(emu, now_us);
+    for (uint32_t i = 0; i < reachable; i++) {
+        emu->devices[i].lastActivity_us = now_us + duration_us;
+    }
+    // A dummy byte sent to wake the ports is meant to be lost
+    const uint32_t connected = emu->faults.brokenFrom < emu->params.numDevices ? emu->faults.brokenFrom
+                                                                               : emu->params.numDevices;
+    if (reachable < connected && len >= COMMAND_SIZE) {
+        emu->ignoredTransfers++;
+    }
+    if (reachable == 0) {
+        return duration_us;
+    }
+    if (len < COMMAND_SIZE) {
+        return duration_us;
+    }
+
+    const size_t seenLen = len < sizeof(seen) ? len : sizeof(seen);
+    memcpy(seen, tx, seenLen);
+    injectBitErrors(emu, seen, seenLen);
+    if (!pecMatches(seen, 2)) {
+        emu->commandPecErrors++;
+        return duration_us;
+    }
+    emu->commands++;
+    for (uint32_t i = 0; i < reachable; i++) {
+        emu->devices[i].lastCommand_us = now_us;
+    }
+
+    const uint16_t command = ((seen[0] << 8) | seen[1]) & 0x7FF;
+    const uint32_t commandEnd_us = now_us + byteTime_us(emu, COMMAND_SIZE);
+    switch (command) {
+        case CMD_WRCFG:
+            emu->configWrites++;
+            // Written when chip select rises, once the data has shifted through
+            writeConfig(emu, seen, seenLen, reachable, now_us + duration_us);
+            break;
+        case CMD_CLRCELL:
+        case CMD_CLRAUX:
+        case CMD_CLRSTAT:
+            clearRegisters(emu, command, reachable);
+            break;
+        case CMD_PLADC:
+            pollConversion(emu, rx, len, reachable, now_us);
+            break;
+        default:
+            if (!readData(emu, command, rx, len, reachable)) {
+                startConversion(emu, command, reachable, commandEnd_us);
+            }
+            break;
+    }
+
+    if (len > COMMAND_SIZE) {
+        injectBitErrors(emu, &rx[COMMAND_SIZE], len - COMMAND_SIZE);
+    }
+    return duration_us;
+}
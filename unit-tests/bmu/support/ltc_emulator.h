@@ -0,0 +1,143 @@
+#ifndef LTC_EMULATOR_H
+#define LTC_EMULATOR_H
+
+/*
+ * Emulated daisy chain of LTC6804-1 battery monitors on isoSPI, for host
+ * tests of the AMS code. Each transfer is one chip select low period, with
+ * the bytes the BMU clocks out and those it would clock in. Commands are
+ * decoded and checked as the LTC does: the command and each board's write
+ * data are dropped on a PEC mismatch, and read data is returned with its
+ * PEC, board 0 (next to the BMU) first. Conversions take the datasheet time
+ * for their mode and update the registers a channel pair at a time, so
+ * reading back early gives the previous results. The isoSPI port goes idle
+ * and the core goes to sleep (resetting the configuration) as on the LTC, so
+ * the BMU's wake ups are exercised too.
+ *
+ * Cell voltages and the thermistor mux output come from a model supplied by
+ * the test. The mux is selected by GPIO1 - 4 and read on GPIO5, as on the
+ * AMS boards, and takes a settling time after it is switched. The discharge
+ * (DCC) bits and discharge timer are emulated, and the charge taken from
+ * each cell by its discharge resistor is accumulated. A discharging cell
+ * reads low by its discharge current through the sense resistance, unless
+ * the conversion was started with DCP clear, which pauses discharge while
+ * the cells convert. Faults can be injected:
+ * random bit errors on the isoSPI bus, corrupted reads from one board, open
+ * cell sense wires, and a broken chain from one board on.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LTC_EMULATOR_MAX_DEVICES 16
+#define LTC_EMULATOR_CELLS 12
+#define LTC_EMULATOR_REGISTER_SIZE 6
+/// Cell inputs C0 (most negative) to C12
+#define LTC_EMULATOR_CELL_INPUTS (LTC_EMULATOR_CELLS + 1)
+
+// Datasheet timing, minimums where the BMU must allow for the worst case
+#define LTC_EMULATOR_T_IDLE_US 4300         ///< isoSPI port idle after no activity
+#define LTC_EMULATOR_T_SLEEP_US 1800000     ///< Core sleeps after no valid command
+#define LTC_EMULATOR_T_WAKE_US 300          ///< Per device, from sleep
+#define LTC_EMULATOR_T_READY_US 10          ///< Per device, port idle with the core awake
+#define LTC_EMULATOR_T_REFUP_US 4400        ///< Reference power up before a conversion
+
+typedef struct LtcEmulatorModel_t {
+    void *context;
+    /// Voltage of cell (0 - 11, LTC cell 1 - 12) on a device at a time
+    float (*cellVoltage)(void *context, int device, int cell, uint32_t now_us);
+    /// Thermistor mux output on GPIO5, with the mux on a channel (0 - 15)
+    float (*muxVoltage)(void *context, int device, int channel, uint32_t now_us);
+} LtcEmulatorModel_t;
+
+typedef struct LtcEmulator_Params_t {
+    uint32_t numDevices;
+    uint32_t spiClock_Hz;               ///< Sets the time each transfer takes
+    float dischargeResistance_ohms;     ///< Per cell discharge resistor
+    float senseResistance_ohms;         ///< Cell sense path the discharge current also flows through
+    uint32_t muxSettle_us;              ///< GPIO5 reads the last channel until the mux settles
+    float noise_V;                      ///< Peak conversion noise in 7 kHz mode, scaled for other modes
+    uint32_t seed;                      ///< For noise and bit errors, so runs repeat
+} LtcEmulator_Params_t;
+
+typedef struct LtcEmulator_Faults_t {
+    uint32_t brokenFrom;                ///< Devices from here on are cut off, numDevices for none
+    float bitErrorRate;                 ///< Probability of each bit on the bus flipping
+    uint32_t corruptDevice;             ///< Device whose reads are corrupted
+    uint32_t corruptReads;              ///< Number of its next reads to corrupt
+    bool openWire[LTC_EMULATOR_MAX_DEVICES][LTC_EMULATOR_CELL_INPUTS];
+} LtcEmulator_Faults_t;
+
+typedef enum LtcEmulatorConversion_t {
+    LTC_EMU_CONV_NONE,
+    LTC_EMU_CONV_CELLS,         ///< ADCV
+    LTC_EMU_CONV_OPEN_WIRE,     ///< ADOW
+    LTC_EMU_CONV_AUX,           ///< ADAX
+    LTC_EMU_CONV_CELLS_AUX,     ///< ADCVAX
+    LTC_EMU_CONV_STATUS,        ///< ADSTAT
+} LtcEmulatorConversion_t;
+
+typedef struct LtcEmulatorDevice_t {
+    uint8_t config[LTC_EMULATOR_REGISTER_SIZE];
+    uint16_t cells[LTC_EMULATOR_CELLS];     ///< 100 uV per count
+    uint16_t aux[6];                        ///< GPIO1 - 5 and the reference
+    uint16_t status[4];                     ///< Sum of cells, die temperature, VA, VD
+    uint8_t flags[3];                       ///< Cell under and over voltage
+    // Power states
+    bool asleep;
+    bool portReady;
+    uint32_t readyTime_us;                  ///< Port ready after a wake up
+    uint32_t lastActivity_us;               ///< Port goes idle tIDLE after this
+    uint32_t lastCommand_us;                ///< Core sleeps tSLEEP after this
+    // Conversion in progress
+    LtcEmulatorConversion_t conversion;
+    uint8_t conversionMode;                 ///< MD bits
+    uint8_t conversionChannel;              ///< CH or CHG bits
+    bool pullup;
+    bool dischargePermitted;                ///< DCP bit
+    uint32_t conversionStart_us;
+    uint32_t conversionTime_us;
+    uint32_t conversionSteps;
+    uint32_t stepsDone;
+    // Open wire, consecutive ADOW conversions with the same pull direction
+    uint32_t openWireCount;
+    bool openWirePullup;
+    // Thermistor mux
+    int muxChannel;
+    int lastMuxChannel;
+    uint32_t muxChange_us;
+    // Discharge
+    uint32_t dischargeTimerStart_us;
+    float discharged_C[LTC_EMULATOR_CELLS];
+    uint32_t lastDischarge_us;
+    // Statistics
+    uint32_t writesRejected;                ///< Write data dropped on a PEC mismatch
+    uint32_t readsCorrupted;
+} LtcEmulatorDevice_t;
+
+typedef struct LtcEmulator_t {
+    LtcEmulator_Params_t params;
+    LtcEmulatorModel_t model;
+    LtcEmulator_Faults_t faults;
+    LtcEmulatorDevice_t devices[LTC_EMULATOR_MAX_DEVICES];
+    uint32_t random;
+    // Statistics
+    uint32_t transfers;
+    uint32_t bytes;
+    uint64_t busTime_us;
+    uint32_t commands;
+    uint32_t configWrites;                  ///< WRCFG commands
+    uint32_t commandPecErrors;
+    uint32_t ignoredTransfers;              ///< Commands lost by some devices while their ports were waking up
+    uint32_t bitErrors;
+} LtcEmulator_t;
+
+void ltcEmulatorInit(LtcEmulator_t *emu, const LtcEmulator_Params_t *params, const LtcEmulatorModel_t *model,
+                     uint32_t now_us);
+void ltcEmulatorPec(const uint8_t *data, size_t len, uint8_t pec[2]);
+uint32_t ltcEmulatorTransfer(LtcEmulator_t *emu, const uint8_t *tx, uint8_t *rx, size_t len, uint32_t now_us);
+void ltcEmulatorWakePulse(LtcEmulator_t *emu, uint32_t now_us);
+void ltcEmulatorAdvance(LtcEmulator_t *emu, uint32_t now_us);
+bool ltcEmulatorDischarging(const LtcEmulator_t *emu, int device, int cell);
+
+#endif /* end of include guard: LTC_EMULATOR_H */
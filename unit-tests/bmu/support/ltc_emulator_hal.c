@@ -0,0 +1,141 @@
+/**
+  *****************************************************************************
+  * @file    ltc_emulator_hal.c
+  * @brief   HAL and FreeRTOS stand-ins connecting the LTC driver to the
+  * emulator
+  * @details The driver clocks the isoSPI bus as one transfer per chip select
+  * low period, so a transfer is handed to the emulator at the time chip
+  * select fell. Chip select raised again with nothing clocked is a wake up
+  * pulse.
+  *****************************************************************************
+  */
+
+#include "ltc_emulator_hal.h"
+#include "gpio.h"
+#include "spi.h"
+#include "tim.h"
+#include "task.h"
+#include <string.h>
+
+#define MAX_TRANSFER_SIZE 256
+#define US_PER_TICK 1000
+
+SPI_HandleTypeDef hspi4;
+static TIM_TypeDef delayTimer;
+TIM_HandleTypeDef htim9 = {.Instance = &delayTimer};
+
+static LtcEmulator_t *emulator;
+static uint32_t now_us;
+static bool chipSelected;
+static bool clocked;
+static uint32_t chipSelect_us;
+static bool delayTimerRunning;
+static LtcEmulatorHalStats_t stats;
+
+void ltcEmulatorHalInit(LtcEmulator_t *emu, uint32_t start_us)
+{
+    emulator = emu;
+    now_us = start_us;
+    chipSelected = false;
+    clocked = false;
+    delayTimerRunning = false;
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint32_t ltcEmulatorHalNow(void)
+{
+    return now_us;
+}
+
+void ltcEmulatorHalWait(uint32_t us)
+{
+    now_us += us;
+    ltcEmulatorAdvance(emulator, now_us);
+}
+
+const LtcEmulatorHalStats_t *ltcEmulatorHalStats(void)
+{
+    return &stats;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+    if (GPIOx != ISO_SPI_NSS_GPIO_Port || GPIO_Pin != ISO_SPI_NSS_Pin) {
+        return;
+    }
+
+    if (PinState == GPIO_PIN_RESET && !chipSelected) {
+        chipSelected = true;
+        clocked = false;
+        chipSelect_us = now_us;
+        stats.chipSelects++;
+    } else if (PinState == GPIO_PIN_SET && chipSelected) {
+        chipSelected = false;
+        if (!clocked) {
+            ltcEmulatorWakePulse(emulator, chipSelect_us);
+            stats.wakePulses++;
+        }
+    }
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout)
+{
+    (void)hspi;
+    (void)Timeout;
+    if (!chipSelected || clocked) {
+        // The emulator only sees one transfer per chip select low period
+        return HAL_ERROR;
+    }
+    clocked = true;
+    now_us += ltcEmulatorTransfer(emulator, pTxData, pRxData, Size, chipSelect_us);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+    uint8_t rx[MAX_TRANSFER_SIZE];
+
+    if (Size > sizeof(rx)) {
+        return HAL_ERROR;
+    }
+    return HAL_SPI_TransmitReceive(hspi, pData, rx, Size, Timeout);
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+    delayTimerRunning = true;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim)
+{
+    (void)htim;
+    delayTimerRunning = false;
+    return HAL_OK;
+}
+
+// The delay timer counts microseconds, one per read of its counter
+TIM_TypeDef *fake_timer_instance(TIM_HandleTypeDef *htim)
+{
+    if (delayTimerRunning) {
+        htim->Instance->CNT++;
+        now_us++;
+    }
+    return htim->Instance;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return now_us / US_PER_TICK;
+}
+
+// Blocks until the xTicksToDelay'th tick interrupt, so up to a tick short
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+    if (xTicksToDelay == 0) {
+        return;
+    }
+    ltcEmulatorHalWait((now_us / US_PER_TICK + xTicksToDelay) * US_PER_TICK - now_us);
+}
@@ -0,0 +1,28 @@
+#ifndef LTC_EMULATOR_HAL_H
+#define LTC_EMULATOR_HAL_H
+
+/*
+ * Host stand-ins for what the BMU's LTC driver (ltc_common.c, ltc_chip.c,
+ * ltc6804.c) uses from the HAL and FreeRTOS, connected to an emulated
+ * daisy chain so the driver itself can be run against it. The isoSPI chip
+ * select and SPI transfers go to the emulator, a chip select pulse with
+ * nothing clocked is a wake up. Time only moves when the driver waits: each
+ * read of the delay timer's counter is a microsecond, vTaskDelay a
+ * millisecond per tick, and SPI transfers take their time on the bus. The
+ * tick count is the time in milliseconds, rounded down as the SysTick does.
+ */
+
+#include <stdint.h>
+#include "ltc_emulator.h"
+
+typedef struct LtcEmulatorHalStats_t {
+    uint32_t chipSelects;       ///< Chip select low periods, with or without a transfer
+    uint32_t wakePulses;        ///< Chip select low periods with nothing clocked
+} LtcEmulatorHalStats_t;
+
+void ltcEmulatorHalInit(LtcEmulator_t *emu, uint32_t now_us);
+uint32_t ltcEmulatorHalNow(void);
+void ltcEmulatorHalWait(uint32_t us);
+const LtcEmulatorHalStats_t *ltcEmulatorHalStats(void);
+
+#endif /* end of include guard: LTC_EMULATOR_HAL_H */
@@ -0,0 +1,231 @@
+#include "unity.h"
+
+#include "balance_planner.h"
+#include "ocv_lut.h"
+
+#include <math.h>
+
+/*
+ * Simulates balancing a pack with a spread of cell SOCs, comparing the balance
+ * planner against the previous approach of pausing balancing every cycle for a
+ * reading and re-checking a single 1% threshold every 3 seconds.
+ */
+
+#define NUM_BOARDS (2)
+#define CELLS_PER_BOARD (14)
+#define NUM_CELLS (NUM_BOARDS * CELLS_PER_BOARD)
+
+#define CYCLE_S (0.5f)
+#define RELAXATION_S (0.25f)
+#define RECHECK_S (3.0f)
+#define CAPACITY_AS (128050.0f)
+#define BLEED_R (33.0f)
+#define MAX_SIM_S (48.0f * 3600.0f)
+
+static BalancePlanner_Params_t params;
+static float soc[NUM_CELLS];
+
+static void initPack(void)
+{
+    // 0 - 5% spread, deterministic
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        soc[cell] = 0.80f + 0.05f * (float)((cell * 7) % NUM_CELLS) / (NUM_CELLS - 1);
+    }
+}
+
+static float socSpread(void)
+{
+    float min = 1.0f, max = 0.0f;
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        min = soc[cell] < min ? soc[cell] : min;
+        max = soc[cell] > max ? soc[cell] : max;
+    }
+    return max - min;
+}
+
+static void bleed(const bool bleeding[], float dt_s)
+{
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        if (bleeding[cell]) {
+            soc[cell] -= ocvLutSocToOcv(soc[cell], NULL) / BLEED_R * dt_s / CAPACITY_AS;
+        }
+    }
+}
+
+static void readVoltages(float voltage[])
+{
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        voltage[cell] = ocvLutSocToOcv(soc[cell], NULL);
+    }
+}
+
+void setUp(void)
+{
+    params = (BalancePlanner_Params_t){
+        .numCells = NUM_CELLS,
+        .cellsPerBoard = CELLS_PER_BOARD,
+        .capacity_As = CAPACITY_AS,
+        .bleedResistance_ohms = BLEED_R,
+        .maxBoardPower_W = 5.0f,
+        .maxTemp_C = 55.0f,
+        .startSocDelta = 0.01f,
+        .stopSocDelta = 0.002f,
+    };
+    initPack();
+}
+
+void tearDown(void)
+{
+}
+
+/// @return time for the spread to fall to targetSpread, or -1 if it doesn't
+static float simulateLegacy(float targetSpread)
+{
+    bool bleeding[NUM_CELLS] = {false};
+    float voltage[NUM_CELLS];
+    float sinceCheck = RECHECK_S + 1.0f;
+
+    for (float t = 0.0f; t < MAX_SIM_S; t += CYCLE_S) {
+        if (socSpread() <= targetSpread) {
+            return t;
+        }
+        // Paused for the relaxation time every cycle
+        bleed(bleeding, CYCLE_S - RELAXATION_S);
+        sinceCheck += CYCLE_S;
+        if (sinceCheck > RECHECK_S) {
+            float minSoc = 1.0f;
+            readVoltages(voltage);
+            for (int cell = 0; cell < NUM_CELLS; cell++) {
+                float cellSoc = ocvLutOcvToSoc(voltage[cell]);
+                minSoc = cellSoc < minSoc ? cellSoc : minSoc;
+            }
+            for (int cell = 0; cell < NUM_CELLS; cell++) {
+                bleeding[cell] = ocvLutOcvToSoc(voltage[cell]) - minSoc > 0.01f;
+            }
+            sinceCheck = 0.0f;
+        }
+    }
+    return -1.0f;
+}
+
+static BalancePlanner_t planner;
+
+/// Mirrors balanceCharge: relaxed reading and re-plan every RECHECK_S
+static float simulatePlanner(float targetSpread, float *firstPrediction)
+{
+    float voltage[NUM_CELLS];
+    float sinceCheck = RECHECK_S + 1.0f;
+
+    balancePlannerInit(&planner, &params);
+    *firstPrediction = -1.0f;
+
+    for (float t = 0.0f; t < MAX_SIM_S; t += CYCLE_S) {
+        if (socSpread() <= targetSpread) {
+            return t;
+        }
+        sinceCheck += CYCLE_S;
+        bool relaxed = sinceCheck > RECHECK_S;
+        float bled_s = relaxed ? CYCLE_S - RELAXATION_S : CYCLE_S;
+        bleed(planner.bleeding, bled_s);
+        if (relaxed) {
+            readVoltages(voltage);
+            balancePlannerUpdate(&planner, voltage);
+            sinceCheck = 0.0f;
+        }
+        balancePlannerStep(&planner, bled_s, 25.0f);
+        if (*firstPrediction < 0.0f) {
+            *firstPrediction = planner.predictedTimeToBalance_s;
+        }
+    }
+    return -1.0f;
+}
+
+void test_plannerBalancesFasterThanLegacy(void)
+{
+    const float target = 0.015f;
+    float prediction;
+
+    float legacy_s = simulateLegacy(target);
+    initPack();
+    float planned_s = simulatePlanner(target, &prediction);
+
+    TEST_ASSERT_TRUE(legacy_s > 0.0f);
+    TEST_ASSERT_TRUE(planned_s > 0.0f);
+    TEST_ASSERT_TRUE(planned_s < 0.75f * legacy_s);
+}
+
+void test_plannerReachesStopDelta(void)
+{
+    float prediction;
+    float balanced_s = simulatePlanner(0.004f, &prediction);
+
+    TEST_ASSERT_TRUE(balanced_s > 0.0f);
+    // Prediction ignores the relaxation pauses and is made from the first reading
+    TEST_ASSERT_FLOAT_WITHIN(0.25f * balanced_s, balanced_s, prediction);
+}
+
+void test_respectsBoardPowerLimit(void)
+{
+    float voltage[NUM_CELLS];
+
+    balancePlannerInit(&planner, &params);
+    readVoltages(voltage);
+    balancePlannerUpdate(&planner, voltage);
+    balancePlannerStep(&planner, 0.0f, 25.0f);
+
+    for (int board = 0; board < NUM_BOARDS; board++) {
+        float power = 0.0f;
+        for (int cell = board * CELLS_PER_BOARD; cell < (board + 1) * CELLS_PER_BOARD; cell++) {
+            power += planner.bleeding[cell] ? planner.bleedPower_W[cell] : 0.0f;
+        }
+        TEST_ASSERT_TRUE(power > 0.0f);
+        TEST_ASSERT_TRUE(power <= params.maxBoardPower_W);
+    }
+}
+
+void test_hysteresis(void)
+{
+    float voltage[NUM_CELLS];
+
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        soc[cell] = 0.8f;
+    }
+    soc[1] = 0.805f; // Below start delta
+    soc[2] = 0.815f; // Above start delta
+
+    balancePlannerInit(&planner, &params);
+    readVoltages(voltage);
+    balancePlannerUpdate(&planner, voltage);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, planner.remaining_s[1]);
+    TEST_ASSERT_TRUE(planner.remaining_s[2] > 0.0f);
+
+    // Cell 2 is part of the plan, so it continues below the start delta
+    soc[2] = 0.805f;
+    readVoltages(voltage);
+    balancePlannerUpdate(&planner, voltage);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, planner.remaining_s[1]);
+    TEST_ASSERT_TRUE(planner.remaining_s[2] > 0.0f);
+
+    // Until within the stop delta
+    soc[2] = 0.801f;
+    readVoltages(voltage);
+    balancePlannerUpdate(&planner, voltage);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, planner.remaining_s[2]);
+    TEST_ASSERT_TRUE(balancePlannerIsBalanced(&planner));
+}
+
+void test_blockedWhenHot(void)
+{
+    float voltage[NUM_CELLS];
+
+    balancePlannerInit(&planner, &params);
+    readVoltages(voltage);
+    balancePlannerUpdate(&planner, voltage);
+    balancePlannerStep(&planner, 0.0f, params.maxTemp_C);
+
+    for (int cell = 0; cell < NUM_CELLS; cell++) {
+        TEST_ASSERT_FALSE(planner.bleeding[cell]);
+    }
+    TEST_ASSERT_TRUE(planner.predictedTimeToBalance_s < 0.0f);
+    TEST_ASSERT_FALSE(balancePlannerIsBalanced(&planner));
+}
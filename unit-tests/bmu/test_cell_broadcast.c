@@ -0,0 +1,161 @@
+#include "unity.h"
+
+#include "cell_broadcast.h"
+
+#include <math.h>
+
+/*
+ * 140 cells sent 3 per message, as with BMU_CellVoltage. One cell is a low
+ * outlier and one is sagging under load, the rest sit at the pack voltage
+ * with a little measurement noise.
+ */
+
+#define NUM_CELLS (140)
+#define GROUP_LEN (3)
+#define NUM_GROUPS ((NUM_CELLS + GROUP_LEN - 1) / GROUP_LEN)
+#define SLOTS (2000)
+
+static CellBroadcast_t broadcast;
+static CellBroadcast_Params_t params;
+static float cells[NUM_CELLS];
+static uint32_t sends[NUM_GROUPS];
+static uint32_t maxGap[NUM_GROUPS];
+
+static float noise(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return ((float)((*seed >> 16) & 0x7fff) / 0x7fff - 0.5f) * 2.0f;
+}
+
+void setUp(void)
+{
+    params = (CellBroadcast_Params_t){
+        .numValues = NUM_CELLS,
+        .groupLen = GROUP_LEN,
+        .sweepEvery = 2,
+        .changeScale = 0.005f,
+        .outlierScale = 0.05f,
+        .lowLimit = 2.8f,
+        .highLimit = 4.2f,
+        .limitBand = 0.2f,
+        .limitWeight = 4.0f,
+    };
+    for (int g = 0; g < NUM_GROUPS; g++) {
+        sends[g] = 0;
+        maxGap[g] = 0;
+    }
+}
+
+void tearDown(void)
+{
+}
+
+static void run(void)
+{
+    unsigned seed = 3;
+    uint32_t lastSent[NUM_GROUPS] = {0};
+
+    cellBroadcastInit(&broadcast, &params);
+    for (uint32_t slot = 1; slot <= SLOTS; slot++) {
+        for (int c = 0; c < NUM_CELLS; c++) {
+            cells[c] = 3.8f + 0.0005f * noise(&seed);
+        }
+        cells[70] = 3.6f;                                   // Weak cell
+        cells[100] = 3.8f - 0.1f * (1.0f + sinf(slot * 0.05f)); // Sagging with load
+
+        uint32_t first = cellBroadcastNext(&broadcast, cells);
+        TEST_ASSERT_EQUAL_UINT32(0, first % GROUP_LEN);
+        uint32_t g = first / GROUP_LEN;
+        sends[g]++;
+        if (slot - lastSent[g] > maxGap[g]) {
+            maxGap[g] = slot - lastSent[g];
+        }
+        lastSent[g] = slot;
+    }
+}
+
+void test_roundRobinWhenSweepingEverySlot(void)
+{
+    params.sweepEvery = 1;
+    run();
+    for (int g = 0; g < NUM_GROUPS; g++) {
+        TEST_ASSERT_UINT32_WITHIN(1, SLOTS / NUM_GROUPS, sends[g]);
+        TEST_ASSERT_TRUE(maxGap[g] <= NUM_GROUPS);
+    }
+}
+
+void test_importantCellsSentMoreOften(void)
+{
+    run();
+
+    uint32_t quietSends = 0;
+    uint32_t quietGroups = 0;
+    for (int g = 0; g < NUM_GROUPS; g++) {
+        // Sweep guarantees every group within two passes
+        TEST_ASSERT_TRUE(maxGap[g] <= 2 * NUM_GROUPS);
+        if (g != 70 / GROUP_LEN && g != 100 / GROUP_LEN) {
+            quietSends += sends[g];
+            quietGroups++;
+        }
+    }
+    const float quietRate = (float)quietSends / quietGroups;
+
+    TEST_ASSERT_TRUE(sends[70 / GROUP_LEN] > 2 * (SLOTS / NUM_GROUPS));
+    TEST_ASSERT_TRUE(sends[100 / GROUP_LEN] > 3 * (SLOTS / NUM_GROUPS));
+    // Quiet groups still get at least the sweep rate
+    TEST_ASSERT_TRUE(quietRate >= SLOTS / (2.0f * NUM_GROUPS));
+}
+
+void test_nearLimitIsImportant(void)
+{
+    params.outlierScale = 1e6f; // Only look at the limits
+    cellBroadcastInit(&broadcast, &params);
+    for (int c = 0; c < NUM_CELLS; c++) {
+        cells[c] = 3.5f;
+        broadcast.lastSent[c] = 3.5f;
+    }
+    TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.0f, cellBroadcastImportance(&broadcast, cells, 5, 3.5f));
+    broadcast.lastSent[15] = 2.85f;
+    cells[15] = 2.85f;
+    // 50 mV into the 200 mV band
+    TEST_ASSERT_FLOAT_WITHIN(1e-3f, 3.0f, cellBroadcastImportance(&broadcast, cells, 5, 3.5f));
+}
+
+// What the generated signal sending function does with a packed signal
+static uint32_t generatedEncode(float signal, float offset, float scale)
+{
+    float sendValue = signal;
+    sendValue -= offset;
+    sendValue /= scale;
+    return (uint32_t)sendValue & CELL_BROADCAST_PACKED_INVALID;
+}
+
+void test_packedVoltagesRoundToTheirCode(void)
+{
+    const float voltages[] = {2.5f, 2.5004f, 3.2f, 3.7f, 3.7006f, 4.2f, 4.546f};
+    const uint32_t codes[] = {0, 0, 700, 1200, 1201, 1700, 2046};
+
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_EQUAL_UINT32(codes[i], cellBroadcastPackedCode(voltages[i], 2.5f, 0.001f));
+        TEST_ASSERT_EQUAL_UINT32(codes[i], generatedEncode(cellBroadcastPack(voltages[i], 2.5f, 0.001f),
+                                                           2.5f, 0.001f));
+    }
+}
+
+void test_outOfRangeReadingsAreInvalid(void)
+{
+    // Undervoltage, an open wire reading 0 or doubling its neighbour, and
+    // an unreadable cell
+    const float voltages[] = {2.499f, 2.3f, 0.0f, -0.1f, 4.547f, 7.4f, NAN};
+
+    for (int i = 0; i < 7; i++) {
+        TEST_ASSERT_EQUAL_UINT32(CELL_BROADCAST_PACKED_INVALID, cellBroadcastPackedCode(voltages[i], 2.5f, 0.001f));
+        TEST_ASSERT_EQUAL_UINT32(CELL_BROADCAST_PACKED_INVALID,
+                                 generatedEncode(cellBroadcastPack(voltages[i], 2.5f, 0.001f), 2.5f, 0.001f));
+    }
+    // Temperatures have a negative offset, a shorted thermistor reads far below it
+    TEST_ASSERT_EQUAL_UINT32(600, generatedEncode(cellBroadcastPack(20.0f, -40.0f, 0.1f), -40.0f, 0.1f));
+    TEST_ASSERT_EQUAL_UINT32(0, generatedEncode(cellBroadcastPack(-40.0f, -40.0f, 0.1f), -40.0f, 0.1f));
+    TEST_ASSERT_EQUAL_UINT32(CELL_BROADCAST_PACKED_INVALID,
+                             generatedEncode(cellBroadcastPack(-273.0f, -40.0f, 0.1f), -40.0f, 0.1f));
+}
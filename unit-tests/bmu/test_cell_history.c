@@ -0,0 +1,136 @@
+#include "unity.h"
+
+#include "cell_history.h"
+
+#include <math.h>
+
+/*
+ * Records a drive with load steps into the history and checks the frames
+ * read back against what was recorded.
+ */
+
+#define NUM_CELLS (140)
+#define NUM_TEMPS (189)
+
+static CellHistory_t history;
+static float voltages[NUM_CELLS];
+static float temps[NUM_TEMPS];
+
+void setUp(void)
+{
+    cellHistoryInit(&history, NUM_CELLS, NUM_TEMPS);
+}
+
+void tearDown(void)
+{
+}
+
+static float current(int step)
+{
+    return (step % 20) < 15 ? 200.0f : -50.0f;
+}
+
+// Fills in the readings for a step, a sag of up to ~1 V on a current step
+static void readings(int step)
+{
+    float I = current(step);
+    for (int i = 0; i < NUM_CELLS; i++) {
+        voltages[i] = 4.0f - 0.001f * step - I * 0.005f + 0.0001f * (i % 7);
+    }
+    for (int i = 0; i < NUM_TEMPS; i++) {
+        temps[i] = 25.0f + 0.01f * step + 0.1f * (i % 5);
+    }
+}
+
+void test_fitsRamBudget(void)
+{
+    TEST_ASSERT_TRUE(sizeof(CellHistory_t) <= CELL_HISTORY_RAM_BYTES);
+    // At least 4 s of the 100 ms battery task
+    TEST_ASSERT_TRUE(CELL_HISTORY_FRAMES >= 40);
+}
+
+void test_framesMatchRecordingAfterWrap(void)
+{
+    const int steps = 3 * CELL_HISTORY_FRAMES + 5;
+    for (int step = 0; step < steps; step++) {
+        readings(step);
+        cellHistoryRecord(&history, voltages, temps, current(step), 2, step * 100);
+    }
+    TEST_ASSERT_EQUAL_UINT32(CELL_HISTORY_FRAMES, cellHistoryNumFrames(&history));
+
+    float outV[NUM_CELLS];
+    float outT[NUM_TEMPS];
+    float IBus;
+    uint8_t state;
+    uint32_t tick;
+    float maxError = 0.0f;
+
+    for (uint32_t i = 0; i < CELL_HISTORY_FRAMES; i++) {
+        const int step = steps - CELL_HISTORY_FRAMES + i;
+        TEST_ASSERT_TRUE(cellHistoryGetFrame(&history, i, outV, outT, &IBus, &state, &tick));
+        TEST_ASSERT_EQUAL_UINT32(step * 100, tick);
+        TEST_ASSERT_EQUAL_INT(2, state);
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, current(step), IBus);
+
+        readings(step);
+        for (int c = 0; c < NUM_CELLS; c++) {
+            maxError = fmaxf(maxError, fabsf(outV[c] - voltages[c]));
+        }
+        for (int t = 0; t < NUM_TEMPS; t++) {
+            TEST_ASSERT_FLOAT_WITHIN(0.06f, temps[t], outT[t]);
+        }
+    }
+    // 1.25 V load steps need a 16 mV scale for one frame
+    TEST_ASSERT_TRUE(maxError <= 0.0085f);
+    TEST_ASSERT_FALSE(cellHistoryGetFrame(&history, CELL_HISTORY_FRAMES, outV, outT, &IBus, &state, &tick));
+}
+
+void test_freezeKeepsFramesBeforeFault(void)
+{
+    for (int step = 0; step < 10; step++) {
+        readings(step);
+        cellHistoryRecord(&history, voltages, temps, 0.0f, 1, step);
+    }
+    cellHistoryFreeze(&history, 3);
+    cellHistoryFreeze(&history, 4);
+
+    for (int step = 10; step < 20; step++) {
+        readings(step);
+        cellHistoryRecord(&history, voltages, temps, 0.0f, 1, step);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(10, cellHistoryNumFrames(&history));
+    TEST_ASSERT_EQUAL_INT(3, history.freezeReason);
+    TEST_ASSERT_EQUAL_UINT32(9, history.freezeTick);
+
+    cellHistoryClear(&history);
+    TEST_ASSERT_FALSE(history.frozen);
+    TEST_ASSERT_EQUAL_UINT32(0, cellHistoryNumFrames(&history));
+}
+
+void test_largeStepCatchesUp(void)
+{
+    for (int i = 0; i < NUM_CELLS; i++) {
+        voltages[i] = 0.0f;
+    }
+    for (int i = 0; i < NUM_TEMPS; i++) {
+        temps[i] = 25.0f;
+    }
+    cellHistoryRecord(&history, voltages, temps, 0.0f, 0, 0);
+
+    // Cells come in after a failed first read, beyond what one frame can hold
+    voltages[0] = 3.9f;
+    for (int step = 1; step < 4; step++) {
+        cellHistoryRecord(&history, voltages, temps, 0.0f, 0, step);
+    }
+
+    float outV[NUM_CELLS];
+    float outT[NUM_TEMPS];
+    float IBus;
+    uint8_t state;
+    uint32_t tick;
+    cellHistoryGetFrame(&history, 1, outV, outT, &IBus, &state, &tick);
+    TEST_ASSERT_TRUE(outV[0] > 1.5f && outV[0] < 3.9f);
+    cellHistoryGetFrame(&history, 3, outV, outT, &IBus, &state, &tick);
+    TEST_ASSERT_FLOAT_WITHIN(0.0085f, 3.9f, outV[0]);
+}
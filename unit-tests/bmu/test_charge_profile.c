@@ -0,0 +1,322 @@
+#include "unity.h"
+
+#include "charge_profile.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+/*
+ * Simulated pack: 140 series groups, each an OCV(SOC) behind R0 and R1||C1,
+ * with spread in capacity, starting SOC and resistance. The charger delivers
+ * what it's asked for up to its rating, and holds its own pack voltage limit.
+ * Cells more than 1 % SOC above the lowest bleed through the balance
+ * resistors. The profile is compared with the fixed current the BMU used to
+ * ask for, which stops on the first cell reaching the over voltage limit.
+ */
+
+#define CELLS (140)
+#define CAPACITY_AS (128050.0f)
+#define R0 (0.00486f)
+#define R1 (0.003f)
+#define TAU_S (30.0f)
+#define OV_LIMIT (4.2f)
+#define CHARGER_RATING_A (15.0f)
+#define DEFAULT_CURRENT_A (5.0f)
+#define BLEED_A (4.2f / 33.0f)
+#define PERIOD_S (0.5f)
+#define SIM_DT_S (0.1f)
+#define TARGET_SOC (0.9f)
+#define MAX_TIME_S (12.0f * 3600.0f)
+
+static ChargeProfile_Params_t params;
+static ChargeProfile_t profile;
+
+typedef struct {
+    float capacity[CELLS];
+    float r0[CELLS];
+    float soc[CELLS];
+    float v1[CELLS];
+    bool bleeding[CELLS];
+} Pack_t;
+
+static Pack_t pack;
+
+static float noise(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return ((float)((*seed >> 16) & 0x7fff) / 0x7fff - 0.5f) * 2.0f;
+}
+
+static float ocv(float soc)
+{
+    return 3.0f + 0.7f * soc + 0.5f * soc * soc;
+}
+
+static void packInit(float socSpread, float capacitySpread)
+{
+    unsigned seed = 3;
+    for (int i = 0; i < CELLS; i++) {
+        pack.capacity[i] = CAPACITY_AS * (1.0f + capacitySpread * 0.5f * noise(&seed));
+        pack.r0[i] = R0 * (1.0f + 0.1f * noise(&seed));
+        pack.soc[i] = 0.2f + socSpread * 0.5f * noise(&seed);
+        pack.v1[i] = 0.0f;
+        pack.bleeding[i] = false;
+    }
+}
+
+static float cellVoltage(int i, float I)
+{
+    return ocv(pack.soc[i]) + I * pack.r0[i] + pack.v1[i];
+}
+
+static float meanSoc(void)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < CELLS; i++) {
+        sum += pack.soc[i];
+    }
+    return sum / CELLS;
+}
+
+static bool updateBalancing(void)
+{
+    float minSoc = 1.0f;
+    for (int i = 0; i < CELLS; i++) {
+        minSoc = fminf(minSoc, pack.soc[i]);
+    }
+    bool any = false;
+    for (int i = 0; i < CELLS; i++) {
+        if (pack.soc[i] - minSoc > 0.01f) {
+            pack.bleeding[i] = true;
+        } else if (pack.soc[i] - minSoc < 0.002f) {
+            pack.bleeding[i] = false;
+        }
+        any |= pack.bleeding[i];
+    }
+    return any;
+}
+
+/*
+ * Charger output for a request: its rating, and no more than holds the pack
+ * at its voltage limit
+ */
+static float chargerCurrent(float request, float packLimit_V)
+{
+    float ocvSum = 0.0f;
+    float rSum = 0.0f;
+    for (int i = 0; i < CELLS; i++) {
+        ocvSum += ocv(pack.soc[i]) + pack.v1[i];
+        rSum += pack.r0[i];
+    }
+    float I = fminf(request, CHARGER_RATING_A);
+    I = fminf(I, (packLimit_V - ocvSum) / rSum);
+    return fmaxf(I, 0.0f);
+}
+
+static void simulate(float I, float duration_s)
+{
+    for (float t = 0.0f; t < duration_s - 1e-6f; t += SIM_DT_S) {
+        for (int i = 0; i < CELLS; i++) {
+            const float cellI = I - (pack.bleeding[i] ? BLEED_A : 0.0f);
+            pack.soc[i] += cellI * SIM_DT_S / pack.capacity[i];
+            pack.v1[i] += (cellI * R1 - pack.v1[i]) * SIM_DT_S / TAU_S;
+        }
+    }
+}
+
+typedef struct {
+    float timeToTarget_s;
+    float maxCellVoltage;
+    bool overVoltage;
+    ChargeProfile_Phase_t finalPhase;
+    float chargeTime_s;
+} Result_t;
+
+static float highestCell(float I)
+{
+    float max = 0.0f;
+    for (int i = 0; i < CELLS; i++) {
+        max = fmaxf(max, cellVoltage(i, I));
+    }
+    return max;
+}
+
+static Result_t runProfile(float tempC)
+{
+    unsigned seed = 11;
+    Result_t r = {.timeToTarget_s = INFINITY};
+    float I = 0.0f;
+    float t = 0.0f;
+
+    chargeProfileInit(&profile, &params);
+    for (; t < MAX_TIME_S; t += PERIOD_S) {
+        updateBalancing();
+        const ChargeProfile_Inputs_t in = {
+            .cellVoltageMax = highestCell(I) + 0.001f * noise(&seed),
+            .tempMax = tempC,
+            .tempMin = tempC,
+            .current_A = I + 0.05f * noise(&seed),
+        };
+        const float request = chargeProfileStep(&profile, &in, PERIOD_S);
+        if (profile.phase == CHARGE_PROFILE_DONE || profile.phase == CHARGE_PROFILE_TEMP_BLOCKED) {
+            break;
+        }
+        I = chargerCurrent(request, CELLS * OV_LIMIT);
+        simulate(I, PERIOD_S);
+
+        r.maxCellVoltage = fmaxf(r.maxCellVoltage, highestCell(I));
+        if (!isfinite(r.timeToTarget_s) && meanSoc() >= TARGET_SOC) {
+            r.timeToTarget_s = t + PERIOD_S;
+        }
+    }
+    r.chargeTime_s = t;
+    r.overVoltage = r.maxCellVoltage >= OV_LIMIT;
+    r.finalPhase = profile.phase;
+    return r;
+}
+
+/*
+ * What the BMU did before: a fixed request (the default 5 A + 0.2) until the
+ * first cell reaches the over voltage limit and trips the BMU
+ */
+static Result_t runFixed(float request)
+{
+    Result_t r = {.timeToTarget_s = INFINITY};
+    float I = 0.0f;
+
+    for (float t = 0.0f; t < MAX_TIME_S; t += PERIOD_S) {
+        updateBalancing();
+        I = chargerCurrent(request, CELLS * OV_LIMIT);
+        simulate(I, PERIOD_S);
+
+        r.maxCellVoltage = fmaxf(r.maxCellVoltage, highestCell(I));
+        if (!isfinite(r.timeToTarget_s) && meanSoc() >= TARGET_SOC) {
+            r.timeToTarget_s = t + PERIOD_S;
+        }
+        r.chargeTime_s = t;
+        if (r.maxCellVoltage >= OV_LIMIT) {
+            r.overVoltage = true;
+            break;
+        }
+    }
+    return r;
+}
+
+void setUp(void)
+{
+    params = (ChargeProfile_Params_t){
+        .maxCurrent_A = DEFAULT_CURRENT_A,
+        .cvCellVoltage = 4.18f,
+        .r0_ohms = R0,
+        .r1_ohms = R1,
+        .tau_s = TAU_S,
+        .tempMin_C = 0.0f,
+        .derateLow_C = 5.0f,
+        .derateHigh_C = 45.0f,
+        .tempMax_C = 55.0f,
+        .termCurrent_A = 0.5f,
+    };
+}
+
+void tearDown(void)
+{
+}
+
+void test_sameCurrentWithoutOverVoltage(void)
+{
+    // The old request, 5 A + 0.2, for both
+    params.maxCurrent_A = DEFAULT_CURRENT_A + 0.2f;
+    packInit(0.02f, 0.06f);
+    Result_t fixed = runFixed(DEFAULT_CURRENT_A + 0.2f);
+    const float fixedSoc = meanSoc();
+    packInit(0.02f, 0.06f);
+    Result_t cccv = runProfile(25.0f);
+
+    // At the same current the profile is no faster to the target. It tapers
+    // instead of tripping the BMU on the highest cell's over voltage, and
+    // ends about 1 % fuller
+    TEST_ASSERT_TRUE(fixed.overVoltage);
+    TEST_ASSERT_FALSE(cccv.overVoltage);
+    TEST_ASSERT_TRUE(cccv.maxCellVoltage < params.cvCellVoltage + 0.005f);
+    TEST_ASSERT_TRUE(meanSoc() > fixedSoc + 0.005f);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f * fixed.timeToTarget_s, fixed.timeToTarget_s, cccv.timeToTarget_s);
+}
+
+void test_imbalancedPackFinishes(void)
+{
+    // The spread grows to ~6 % SOC by the end, which takes the balance
+    // resistors longer than MAX_TIME_S to bleed off. Charging mustn't wait
+    packInit(0.02f, 0.06f);
+    Result_t cccv = runProfile(25.0f);
+
+    TEST_ASSERT_EQUAL_INT(CHARGE_PROFILE_DONE, cccv.finalPhase);
+    TEST_ASSERT_TRUE(cccv.chargeTime_s < 7.0f * 3600.0f);
+    TEST_ASSERT_TRUE(updateBalancing());
+}
+
+void test_higherRatingOnlyShortensCc(void)
+{
+    packInit(0.02f, 0.06f);
+    Result_t slow = runProfile(25.0f);
+    params.maxCurrent_A = CHARGER_RATING_A;
+    packInit(0.02f, 0.06f);
+    Result_t fast = runProfile(25.0f);
+
+    TEST_ASSERT_TRUE(fast.timeToTarget_s < 0.5f * slow.timeToTarget_s);
+    TEST_ASSERT_FALSE(fast.overVoltage);
+}
+
+void test_tapersToDone(void)
+{
+    packInit(0.0f, 0.0f);
+    Result_t cccv = runProfile(25.0f);
+
+    TEST_ASSERT_EQUAL_INT(CHARGE_PROFILE_DONE, cccv.finalPhase);
+    TEST_ASSERT_TRUE(meanSoc() > 0.97f);
+    TEST_ASSERT_TRUE(cccv.maxCellVoltage < params.cvCellVoltage + 0.005f);
+}
+
+void test_doneOnTaper(void)
+{
+    ChargeProfile_Inputs_t in = {
+        .cellVoltageMax = 4.18f,
+        .tempMax = 25.0f,
+        .tempMin = 25.0f,
+        .current_A = 0.0f,
+    };
+    chargeProfileInit(&profile, &params);
+    chargeProfileStep(&profile, &in, PERIOD_S);
+    TEST_ASSERT_EQUAL_INT(CHARGE_PROFILE_DONE, profile.phase);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, profile.current_A);
+
+    // Stays done
+    in.cellVoltageMax = 4.0f;
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, chargeProfileStep(&profile, &in, PERIOD_S));
+}
+
+void test_temperatureDerating(void)
+{
+    ChargeProfile_Inputs_t in = {
+        .cellVoltageMax = 3.8f,
+        .tempMax = 25.0f,
+        .tempMin = 25.0f,
+    };
+    chargeProfileInit(&profile, &params);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, DEFAULT_CURRENT_A, chargeProfileStep(&profile, &in, PERIOD_S));
+
+    in.tempMax = 50.0f;
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, DEFAULT_CURRENT_A / 2, chargeProfileStep(&profile, &in, PERIOD_S));
+    TEST_ASSERT_EQUAL_INT(CHARGE_PROFILE_CC, profile.phase);
+
+    in.tempMax = 25.0f;
+    in.tempMin = 2.5f;
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, DEFAULT_CURRENT_A / 2, chargeProfileStep(&profile, &in, PERIOD_S));
+
+    in.tempMin = -1.0f;
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, chargeProfileStep(&profile, &in, PERIOD_S));
+    TEST_ASSERT_EQUAL_INT(CHARGE_PROFILE_TEMP_BLOCKED, profile.phase);
+
+    // Not latched, resumes once warm
+    in.tempMin = 25.0f;
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, DEFAULT_CURRENT_A, chargeProfileStep(&profile, &in, PERIOD_S));
+}
@@ -0,0 +1,230 @@
+#include "unity.h"
+
+#include "current_filter.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Characterises the HV bus current filter pipeline: frequency response of the
+ * fast and slow outputs, step latency, charge preservation for coulomb
+ * counting and state size, compared to the 100 sample moving average it
+ * replaces. A recorded current trace can be replayed by setting IBUS_TRACE to
+ * a CSV file with columns time_s,current_A sampled at 1 kHz.
+ */
+
+#define FS_HZ (1000.0f)
+#define DT_S (1.0f / FS_HZ)
+#define MOVING_AVERAGE_SIZE (100)
+
+static CurrentFilter_Params_t params;
+static CurrentFilter_t filter;
+
+typedef struct MovingAverage_t {
+    float history[MOVING_AVERAGE_SIZE];
+    float sum;
+    int index;
+} MovingAverage_t;
+
+static MovingAverage_t movingAverage;
+
+/// Previous filterIBus implementation
+static float movingAverageStep(MovingAverage_t *ma, float x)
+{
+    ma->sum -= ma->history[ma->index];
+    ma->history[ma->index] = x;
+    ma->sum += x;
+    ma->index = (ma->index + 1) % MOVING_AVERAGE_SIZE;
+    return ma->sum / MOVING_AVERAGE_SIZE;
+}
+
+void setUp(void)
+{
+    currentFilterDefaultParams(&params);
+    currentFilterInit(&filter, &params);
+    movingAverage = (MovingAverage_t){0};
+}
+
+void tearDown(void)
+{
+}
+
+typedef struct Response_t {
+    float fast;
+    float slow;
+    float movingAverage;
+} Response_t;
+
+/// Steady state amplitude of each output for a 100 A sine at freq_Hz
+static Response_t measureGain(float freq_Hz)
+{
+    const float amplitude = 100.0f;
+    const int settle = (int)(2.0f * FS_HZ);
+    const int measure = (int)(4.0f * FS_HZ);
+    Response_t peak = {0};
+
+    setUp();
+    for (int n = 0; n < settle + measure; n++) {
+        float x = amplitude * sinf(2.0f * 3.14159265f * freq_Hz * n * DT_S);
+        bool slowUpdated = currentFilterStep(&filter, x);
+        float ma = movingAverageStep(&movingAverage, x);
+        if (n >= settle) {
+            peak.fast = fmaxf(peak.fast, fabsf(filter.fast));
+            peak.movingAverage = fmaxf(peak.movingAverage, fabsf(ma));
+            if (slowUpdated) {
+                peak.slow = fmaxf(peak.slow, fabsf(filter.slow));
+            }
+        }
+    }
+    peak.fast /= amplitude;
+    peak.slow /= amplitude;
+    peak.movingAverage /= amplitude;
+    return peak;
+}
+
+void test_frequencyResponse(void)
+{
+    const float freqs[] = {0.5f, 1, 2, 5, 10, 20, 50, 100, 195, 250, 400};
+    Response_t r[sizeof(freqs) / sizeof(freqs[0])];
+
+    for (unsigned i = 0; i < sizeof(freqs) / sizeof(freqs[0]); i++) {
+        r[i] = measureGain(freqs[i]);
+    }
+
+    // Fast passband flat to well past the moving average's first null
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1.0f, r[4].fast);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.707f, r[6].fast);
+    TEST_ASSERT_TRUE(r[10].fast < 0.05f);
+
+    // Slow passband and stopband, including 195 Hz which aliases to 5 Hz
+    // after decimation
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 1.0f, r[1].slow);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.707f, r[3].slow);
+    TEST_ASSERT_TRUE(r[5].slow < 0.01f);
+    TEST_ASSERT_TRUE(r[8].slow < 0.01f);
+    TEST_ASSERT_TRUE(r[8].slow < r[8].movingAverage);
+}
+
+/// Samples for the output to first reach 90% of a step
+static int stepLatency(const float *output)
+{
+    for (int n = 0; n < 1000; n++) {
+        if (output[n] >= 0.9f) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+void test_stepLatency(void)
+{
+    static float fast[1000], slow[1000], ma[1000];
+    float lastSlow = 0.0f;
+
+    for (int n = 0; n < 1000; n++) {
+        if (currentFilterStep(&filter, 1.0f)) {
+            lastSlow = filter.slow;
+        }
+        fast[n] = filter.fast;
+        slow[n] = lastSlow;
+        ma[n] = movingAverageStep(&movingAverage, 1.0f);
+    }
+
+    TEST_ASSERT_TRUE(stepLatency(fast) >= 0 && stepLatency(fast) < 15);
+    TEST_ASSERT_TRUE(stepLatency(slow) >= 0);
+    TEST_ASSERT_TRUE(stepLatency(fast) < stepLatency(ma));
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 1.0f, filter.slow);
+}
+
+static uint32_t rngState = 1;
+static float noise(float amplitude)
+{
+    rngState = rngState * 1664525U + 1013904223U;
+    return amplitude * ((float)(rngState >> 8) / (float)(1U << 24) * 2.0f - 1.0f);
+}
+
+/// Drive cycle like current: bursts of acceleration and regen plus noise
+static float syntheticCurrent(int n)
+{
+    float t = n * DT_S;
+    float base = 80.0f + 60.0f * sinf(0.5f * t) + (fmodf(t, 7.0f) < 1.0f ? 150.0f : 0.0f)
+                 - (fmodf(t, 11.0f) < 0.5f ? 40.0f : 0.0f);
+    return base + noise(20.0f);
+}
+
+typedef struct Replay_t {
+    double charge_As;
+    double slowCharge_As;
+    double maCharge_As;
+    double fastSqErr;
+    double maSqErr;
+    int samples;
+} Replay_t;
+
+static void replaySample(Replay_t *r, float current)
+{
+    if (currentFilterStep(&filter, current)) {
+        r->slowCharge_As += filter.slow * DT_S * params.cicDecimation;
+    }
+    float ma = movingAverageStep(&movingAverage, current);
+    r->charge_As += current * DT_S;
+    r->maCharge_As += ma * DT_S;
+    r->samples++;
+}
+
+static int replayRecordedTrace(Replay_t *r, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    float t, current;
+
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "%f,%f", &t, &current) != 2) {
+            continue; // header or malformed line
+        }
+        replaySample(r, current);
+    }
+    fclose(f);
+    return r->samples > 0;
+}
+
+void test_chargePreservedOnReplay(void)
+{
+    Replay_t r = {0};
+    const char *path = getenv("IBUS_TRACE");
+
+    if (path == NULL || !replayRecordedTrace(&r, path)) {
+        for (int n = 0; n < (int)(600.0f * FS_HZ); n++) {
+            replaySample(&r, syntheticCurrent(n));
+        }
+        // Let the filters settle on zero current so all the charge comes out
+        for (int n = 0; n < (int)(2.0f * FS_HZ); n++) {
+            replaySample(&r, 0.0f);
+        }
+    }
+
+    TEST_ASSERT_FLOAT_WITHIN(0.001f * fabs(r.charge_As) + 1.0f, r.charge_As, r.slowCharge_As);
+}
+
+void test_stateSmallerThanMovingAverage(void)
+{
+    TEST_ASSERT_TRUE(sizeof(CurrentFilter_t) < sizeof(MovingAverage_t));
+}
+
+void test_inputClamped(void)
+{
+    params.cicLsb_A = 1e-6f;
+    params.cicOrder = 4;
+    currentFilterInit(&filter, &params);
+
+    for (int n = 0; n < 2000; n++) {
+        currentFilterStep(&filter, 1000.0f);
+    }
+    // Clamped, but no wrap around to a negative value
+    TEST_ASSERT_TRUE(filter.slow > 0.0f);
+}
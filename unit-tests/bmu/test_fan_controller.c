@@ -0,0 +1,142 @@
+#include "unity.h"
+
+#include "fan_controller.h"
+
+#include <math.h>
+
+/*
+ * Simulated hottest channel: a lumped heat capacity heated by I^2 R and
+ * cooled to the inlet air through a conductance that rises with fan duty,
+ * with the same values as the BMU's thermal estimator. The thermistor lags
+ * the cells and reads in 0.25 C steps. The drive is an endurance stint of
+ * repeated laps followed by a cool down in the pits. The controller is
+ * compared with the map the BMU used before: off below 25 C, then 20 % to
+ * 100 % duty from 25 C to 35 C on the thermistor reading.
+ */
+
+#define HEAT_CAPACITY (1330.0f)
+#define HEATING_R (0.0018f)
+#define G_FAN_OFF (0.3f)
+#define G_FAN_FULL (1.5f)
+#define SENSOR_TAU_S (60.0f)
+#define AMBIENT_C (22.0f)
+#define START_C (26.0f)
+#define FULL_POWER_W (4 * 3.6f)
+#define PERIOD_S (1.0f)
+#define SIM_DT_S (0.1f)
+#define STINT_S (1500)
+#define COOL_DOWN_S (1200)
+
+static FanController_Params_t params;
+static FanController_t fan;
+
+typedef struct {
+    float peak_C;
+    float energy_J;
+    float coolDownEnergy_J;
+    float dutyAfterMinute;      // A minute into the stint
+} Result_t;
+
+/*
+ * Pack current over a 75 s lap: accelerations, a brief regen, and cruising
+ */
+static float lapCurrent(int t)
+{
+    const int lapTime = t % 75;
+    if (lapTime < 10) {
+        return 150.0f;
+    } else if (lapTime < 14) {
+        return -40.0f;
+    } else if (lapTime < 30) {
+        return 40.0f;
+    } else if (lapTime < 38) {
+        return 120.0f;
+    }
+    return 30.0f;
+}
+
+static float temperatureMap(float measured)
+{
+    if (measured < 25.0f) {
+        return 0.0f;
+    }
+    float duty = 0.2f + (measured - 25.0f) / 10.0f * 0.8f;
+    return duty > 1.0f ? 1.0f : duty;
+}
+
+static Result_t run(bool useController)
+{
+    Result_t r = {0};
+    float core = START_C;
+    float sensor = START_C;
+    float duty = 0.0f;
+
+    fanControllerInit(&fan, &params);
+    for (int t = 0; t < STINT_S + COOL_DOWN_S; t++) {
+        const float I = t < STINT_S ? lapCurrent(t) : 0.0f;
+
+        const float measured = roundf(sensor * 4.0f) / 4.0f;
+        if (useController) {
+            const FanController_Inputs_t in = {
+                .tempMax = measured,
+                .tempInlet = AMBIENT_C + 1.0f,
+                .current_A = I,
+            };
+            duty = fanControllerStep(&fan, &in, PERIOD_S);
+        } else {
+            duty = temperatureMap(measured);
+        }
+        if (t == 60) {
+            r.dutyAfterMinute = duty;
+        }
+
+        for (float s = 0.0f; s < PERIOD_S - 1e-6f; s += SIM_DT_S) {
+            const float G = G_FAN_OFF + G_FAN_FULL * duty;
+            core += SIM_DT_S * (I * I * HEATING_R - G * (core - AMBIENT_C)) / HEAT_CAPACITY;
+            sensor += SIM_DT_S * (core - sensor) / SENSOR_TAU_S;
+        }
+
+        const float power = FULL_POWER_W * duty * duty * duty;
+        r.energy_J += power * PERIOD_S;
+        if (t >= STINT_S) {
+            r.coolDownEnergy_J += power * PERIOD_S;
+        }
+        r.peak_C = fmaxf(r.peak_C, core);
+    }
+    return r;
+}
+
+void setUp(void)
+{
+    params = (FanController_Params_t){
+        .offTemp_C = 26.0f,
+        .peakTemp_C = 38.0f,
+        .minDuty = 0.2f,
+        .maxDuty = 1.0f,
+        .horizon_s = 240.0f,
+        .trendTau_s = 60.0f,
+        .heatingResistance_ohms = HEATING_R,
+        .coolingFanOff_WperK = G_FAN_OFF,
+        .coolingFanFull_WperK = G_FAN_FULL,
+        .minDeltaT_K = 2.0f,
+        .fullPower_W = FULL_POWER_W,
+    };
+}
+
+void tearDown(void)
+{
+}
+
+void test_coolerStintForLessEnergy(void)
+{
+    Result_t before = run(false);
+    Result_t after = run(true);
+
+    // The fans' defaults (fanControl.c): peak 29.69 C on 5.1 kJ, 0.2 kJ of it
+    // cooling down, against 29.74 C on 5.9 kJ, 1.9 kJ cooling down
+    TEST_ASSERT_TRUE(after.peak_C < before.peak_C);
+    TEST_ASSERT_TRUE(after.energy_J < 0.9f * before.energy_J);
+    TEST_ASSERT_TRUE(after.coolDownEnergy_J < 0.2f * before.coolDownEnergy_J);
+    TEST_ASSERT_TRUE(after.dutyAfterMinute > before.dutyAfterMinute);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f * after.energy_J, after.energy_J, fan.energy_J);
+}
@@ -0,0 +1,353 @@
+#include "unity.h"
+
+#include "hv_adc_stream.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Emulated ADE7912: registers as on the SPI bus, with the waveform
+ * registers updated at each conversion and DREADY pulsed low. The ADC runs
+ * off its own crystal, slightly off nominal, so its output rate drifts
+ * against the FreeRTOS tick. IWV counts conversions and V1WV is its
+ * negative, so a reading shows which conversion it came from. V2WV is a
+ * 50 Hz sine.
+ *
+ * The stream is compared with the BMU's previous acquisition: a task woken
+ * every 1 ms tick, late by up to its scheduling jitter, reading the three
+ * registers one after another and stamping them with the tick.
+ */
+
+#define ADC_PERIOD_US (1000.0 * (1.0 + 300e-6))
+#define SPI_BYTE_US (9.5)
+#define EXTI_LATENCY_US (3.0)
+#define TASK_JITTER_US (300.0)
+#define TICK_US (1000.0)
+#define BLOCK_SIZE 5
+#define SIM_CONVERSIONS 10000
+
+#define ADDR_IWV 0x0
+#define ADDR_V1WV 0x1
+#define ADDR_V2WV 0x2
+#define ADDR_ADC_CRC 0x4
+#define ADDR_CFG 0x8
+#define ADDR_STATUS0 0x9
+#define ADDR_CNT_SNAPSHOT 0xA
+
+typedef struct {
+    int32_t iwv;
+    int32_t v1wv;
+    int32_t v2wv;
+    uint8_t cfg;
+    uint8_t status0;
+    uint32_t conversions;
+    uint32_t transfers;
+} AdeEmulator_t;
+
+static AdeEmulator_t ade;
+static HvAdcStream_t stream;
+static unsigned seed;
+
+static double noise01(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (double)((seed >> 16) & 0x7fff) / 0x7fff;
+}
+
+static double conversionTime(uint32_t k)
+{
+    return 20.0 + k * ADC_PERIOD_US;
+}
+
+static void adeConvert(uint32_t k)
+{
+    ade.iwv = (int32_t)k * 700 - 4000000;
+    ade.v1wv = -(int32_t)k;
+    ade.v2wv = (int32_t)lround(3.0e6 * sin(2.0 * M_PI * 50.0 * conversionTime(k) * 1e-6));
+    ade.conversions = k + 1;
+}
+
+static void put24(uint8_t *out, int32_t value)
+{
+    out[0] = (uint8_t)(value >> 16);
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)value;
+}
+
+/*
+ * One chip select low period. The first MISO byte is high impedance while
+ * the command is clocked in. Reads of IWV burst through the following
+ * registers, other reads return the one register
+ */
+static void adeTransfer(const uint8_t *tx, uint8_t *rx, unsigned len)
+{
+    const uint8_t addr = tx[0] >> 3;
+    uint8_t out[16];
+    unsigned outLen = 0;
+
+    ade.transfers++;
+    memset(rx, 0xff, len);
+    if (!(tx[0] & 0x4)) {
+        if (addr == ADDR_CFG && len > 1) {
+            ade.cfg = tx[1];
+        }
+        return;
+    }
+
+    switch (addr) {
+        case ADDR_IWV:
+            put24(&out[0], ade.iwv);
+            put24(&out[3], ade.v1wv);
+            put24(&out[6], ade.v2wv);
+            out[9] = 0x5a;      // ADC_CRC, not emulated
+            out[10] = 0xa5;
+            out[11] = ade.status0;
+            out[12] = (uint8_t)(ade.conversions >> 8);
+            out[13] = (uint8_t)ade.conversions;
+            outLen = 14;
+            break;
+        case ADDR_V1WV:
+            put24(out, ade.v1wv);
+            outLen = 3;
+            break;
+        case ADDR_V2WV:
+            put24(out, ade.v2wv);
+            outLen = 3;
+            break;
+        case ADDR_CFG:
+            out[0] = ade.cfg;
+            outLen = 1;
+            break;
+        case ADDR_STATUS0:
+            out[0] = ade.status0;
+            outLen = 1;
+            break;
+    }
+    for (unsigned i = 1; i < len && i - 1 < outLen; i++) {
+        rx[i] = out[i - 1];
+    }
+}
+
+/*
+ * The previous acquisition's single register read
+ */
+static int32_t adeReadRegister(uint8_t addr)
+{
+    uint8_t tx[4] = {(uint8_t)((addr << 3) | 0x4)};
+    uint8_t rx[4];
+    adeTransfer(tx, rx, 4);
+    return (int32_t)(((uint32_t)rx[1] << 24) | ((uint32_t)rx[2] << 16) | ((uint32_t)rx[3] << 8)) >> 8;
+}
+
+/*
+ * Latest conversion completed at time t
+ */
+static void adeAdvance(double t_us)
+{
+    if (t_us < conversionTime(0)) {
+        return;
+    }
+    uint32_t k = (uint32_t)((t_us - conversionTime(0)) / ADC_PERIOD_US);
+    if (k + 1 != ade.conversions) {
+        adeConvert(k);
+    }
+}
+
+typedef struct {
+    uint32_t received;
+    uint32_t duplicates;
+    uint32_t skipped;
+    uint32_t mixed;         // Channels from different conversions
+    uint32_t wakeups;
+    double maxTimeError_us;
+} Result_t;
+
+static void checkReading(Result_t *r, int32_t current, int32_t v1, double timestamp_us, int32_t *lastK)
+{
+    const int32_t k = (current + 4000000) / 700;
+    if (k != -v1) {
+        r->mixed++;
+    }
+    if (*lastK >= 0) {
+        if (k == *lastK) {
+            r->duplicates++;
+        } else if (k > *lastK + 1) {
+            r->skipped += k - *lastK - 1;
+        }
+    }
+    *lastK = k;
+    r->received++;
+    const double error = fabs(timestamp_us - conversionTime(k));
+    if (error > r->maxTimeError_us) {
+        r->maxTimeError_us = error;
+    }
+}
+
+static void drain(Result_t *r, int32_t *lastK)
+{
+    HvAdcSample_t sample;
+    while (hvAdcStreamPop(&stream, &sample)) {
+        checkReading(r, sample.current, sample.v1, sample.timestamp_us, lastK);
+    }
+}
+
+/*
+ * DREADY interrupt, then the DMA burst read, then the task when a block is
+ * waiting. Samples with a conversion index in [stallFrom, stallTo) arrive
+ * while the task is held off
+ */
+static Result_t runStream(uint32_t stallFrom, uint32_t stallTo)
+{
+    Result_t r = {0};
+    int32_t lastK = -1;
+    uint8_t tx[HV_ADC_BURST_LEN];
+    uint8_t rx[HV_ADC_BURST_LEN];
+
+    hvAdcStreamInit(&stream, BLOCK_SIZE, 1000);
+    for (uint32_t k = 0; k < SIM_CONVERSIONS; k++) {
+        adeConvert(k);
+        const double drdy = conversionTime(k) + EXTI_LATENCY_US * noise01();
+        if (!hvAdcStreamDataReady(&stream, (uint32_t)drdy)) {
+            continue;
+        }
+        hvAdcBurstCommand(tx);
+        adeTransfer(tx, rx, HV_ADC_BURST_LEN);
+        const bool notify = hvAdcStreamReadComplete(&stream, rx);
+        if (notify && (k < stallFrom || k >= stallTo)) {
+            r.wakeups++;
+            drain(&r, &lastK);
+        }
+    }
+    drain(&r, &lastK);
+    return r;
+}
+
+static Result_t runPolled(void)
+{
+    Result_t r = {0};
+    int32_t lastK = -1;
+    const uint32_t ticks = (uint32_t)(SIM_CONVERSIONS * ADC_PERIOD_US / TICK_US) - 1;
+
+    for (uint32_t tick = 1; tick < ticks; tick++) {
+        double t = tick * TICK_US + TASK_JITTER_US * noise01();
+        adeAdvance(t);
+        const int32_t current = adeReadRegister(ADDR_IWV);
+        t += 4 * SPI_BYTE_US;
+        adeAdvance(t);
+        const int32_t v1 = adeReadRegister(ADDR_V1WV);
+        t += 4 * SPI_BYTE_US;
+        adeAdvance(t);
+        adeReadRegister(ADDR_V2WV);
+        r.wakeups++;
+        checkReading(&r, current, v1, tick * TICK_US, &lastK);
+    }
+    return r;
+}
+
+void setUp(void)
+{
+    memset(&ade, 0, sizeof(ade));
+    seed = 1;
+}
+
+void tearDown(void)
+{
+}
+
+void test_burstDecode(void)
+{
+    const int32_t values[][3] = {
+        {0, 1, -1},
+        {8388607, -8388608, 123456},
+        {-4000000, 4000000, -2},
+    };
+    uint8_t tx[HV_ADC_BURST_LEN];
+    uint8_t rx[HV_ADC_BURST_LEN];
+
+    hvAdcBurstCommand(tx);
+    TEST_ASSERT_EQUAL_HEX8(0x04, tx[0]);
+    for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        ade.iwv = values[i][0];
+        ade.v1wv = values[i][1];
+        ade.v2wv = values[i][2];
+        adeTransfer(tx, rx, HV_ADC_BURST_LEN);
+
+        HvAdcSample_t sample;
+        hvAdcDecodeBurst(rx, &sample);
+        TEST_ASSERT_EQUAL_INT32(values[i][0], sample.current);
+        TEST_ASSERT_EQUAL_INT32(values[i][1], sample.v1);
+        TEST_ASSERT_EQUAL_INT32(values[i][2], sample.v2);
+        // Same as reading the registers one at a time
+        TEST_ASSERT_EQUAL_INT32(adeReadRegister(ADDR_IWV), sample.current);
+        TEST_ASSERT_EQUAL_INT32(adeReadRegister(ADDR_V2WV), sample.v2);
+    }
+}
+
+void test_everyConversionOnceWithBlockWakeups(void)
+{
+    Result_t polled = runPolled();
+    setUp();
+    Result_t streamed = runStream(0, 0);
+
+    TEST_ASSERT_TRUE(polled.duplicates + polled.skipped > 0);
+    TEST_ASSERT_TRUE(polled.mixed > 0);
+
+    TEST_ASSERT_EQUAL_UINT32(SIM_CONVERSIONS, streamed.received);
+    TEST_ASSERT_EQUAL_UINT32(0, streamed.duplicates);
+    TEST_ASSERT_EQUAL_UINT32(0, streamed.skipped);
+    TEST_ASSERT_EQUAL_UINT32(0, streamed.mixed);
+    TEST_ASSERT_TRUE(streamed.maxTimeError_us <= EXTI_LATENCY_US + 1.0);
+    TEST_ASSERT_EQUAL_UINT32(SIM_CONVERSIONS / BLOCK_SIZE, streamed.wakeups);
+    TEST_ASSERT_EQUAL_UINT32(0, stream.gaps);
+    TEST_ASSERT_EQUAL_UINT32(0, stream.overruns);
+    TEST_ASSERT_EQUAL_UINT32(SIM_CONVERSIONS, ade.transfers);
+    TEST_ASSERT_TRUE(stream.minInterval_us >= ADC_PERIOD_US - EXTI_LATENCY_US - 1.0);
+    TEST_ASSERT_TRUE(stream.maxInterval_us <= ADC_PERIOD_US + EXTI_LATENCY_US + 1.0);
+}
+
+void test_overrunWhileTaskHeldOff(void)
+{
+    // Held off for 100 conversions, the buffer keeps the oldest that fit
+    Result_t r = runStream(1000, 1100);
+
+    TEST_ASSERT_EQUAL_UINT32(SIM_CONVERSIONS, stream.samples);
+    TEST_ASSERT_TRUE(stream.overruns > 0);
+    TEST_ASSERT_EQUAL_UINT32(SIM_CONVERSIONS, r.received + stream.overruns);
+    TEST_ASSERT_EQUAL_UINT32(stream.overruns, r.skipped);
+    TEST_ASSERT_EQUAL_UINT32(0, r.duplicates);
+}
+
+void test_missedConversionsCounted(void)
+{
+    uint8_t tx[HV_ADC_BURST_LEN];
+    uint8_t rx[HV_ADC_BURST_LEN];
+
+    hvAdcStreamInit(&stream, BLOCK_SIZE, 1000);
+    hvAdcBurstCommand(tx);
+    for (uint32_t k = 0; k < 20; k++) {
+        adeConvert(k);
+        const uint32_t t = (uint32_t)conversionTime(k);
+        if (!hvAdcStreamDataReady(&stream, t)) {
+            continue;
+        }
+        if (k == 5) {
+            // Bus error, the read is abandoned
+            hvAdcStreamReadFailed(&stream);
+            continue;
+        }
+        if (k == 10) {
+            // Read stalled past the next DREADY
+            adeConvert(k + 1);
+            TEST_ASSERT_FALSE(hvAdcStreamDataReady(&stream, (uint32_t)conversionTime(k + 1)));
+            k++;
+        }
+        adeTransfer(tx, rx, HV_ADC_BURST_LEN);
+        hvAdcStreamReadComplete(&stream, rx);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(1, stream.readErrors);
+    TEST_ASSERT_EQUAL_UINT32(1, stream.busyDrdys);
+    TEST_ASSERT_EQUAL_UINT32(18, stream.samples);
+    TEST_ASSERT_EQUAL_UINT32(2, stream.gaps);
+    TEST_ASSERT_EQUAL_UINT32(18, hvAdcStreamCount(&stream));
+}
@@ -0,0 +1,77 @@
+#include "unity.h"
+
+#include "hv_bus_snapshot.h"
+
+static HVBusSnapshot_t snapshot;
+
+static HVBusMeasurements_t measurement(uint32_t n)
+{
+    return (HVBusMeasurements_t){
+        .IBus = (float)n,
+        .VBus = 2.0f * n,
+        .VBatt = 3.0f * n,
+        .timestamp = n,
+    };
+}
+
+void setUp(void)
+{
+    hvBusSnapshotInit(&snapshot);
+}
+
+void tearDown(void)
+{
+}
+
+void test_nothingPublished(void)
+{
+    HVBusMeasurements_t read;
+    TEST_ASSERT_FALSE(hvBusSnapshotRead(&snapshot, &read));
+}
+
+void test_readsLastWrite(void)
+{
+    HVBusMeasurements_t read;
+
+    for (uint32_t n = 1; n < 10; n++) {
+        HVBusMeasurements_t written = measurement(n);
+        hvBusSnapshotWrite(&snapshot, &written);
+        TEST_ASSERT_TRUE(hvBusSnapshotRead(&snapshot, &read));
+        TEST_ASSERT_EQUAL_UINT32(n, read.timestamp);
+        TEST_ASSERT_EQUAL_FLOAT(3.0f * n, read.VBatt);
+    }
+}
+
+/*
+ * Reader preempting the writer part way through a write, as the writer would
+ * have left the snapshot
+ */
+void test_readDuringWrite(void)
+{
+    HVBusMeasurements_t written = measurement(1);
+    HVBusMeasurements_t read;
+
+    hvBusSnapshotWrite(&snapshot, &written);
+
+    uint32_t sequence = snapshot.sequence;
+    snapshot.sequence = sequence + 1;
+    snapshot.buffer[((sequence >> 1) + 1) & 1U].IBus = 100.0f;
+
+    TEST_ASSERT_TRUE(hvBusSnapshotRead(&snapshot, &read));
+    TEST_ASSERT_EQUAL_UINT32(1, read.timestamp);
+    TEST_ASSERT_EQUAL_FLOAT(1.0f, read.IBus);
+}
+
+void test_readsLatestOverManyWrites(void)
+{
+    const int iterations = 100000;
+    HVBusMeasurements_t written = measurement(1);
+    HVBusMeasurements_t read;
+
+    for (int i = 0; i < iterations; i++) {
+        written.timestamp = i;
+        hvBusSnapshotWrite(&snapshot, &written);
+        TEST_ASSERT_TRUE(hvBusSnapshotRead(&snapshot, &read));
+        TEST_ASSERT_EQUAL_UINT32(i, read.timestamp);
+    }
+}
@@ -0,0 +1,205 @@
+#include "unity.h"
+
+#include "imd_decoder.h"
+
+#include <math.h>
+
+/*
+ * Generated IMD PWM: captures at a 50 kHz timer tick, with a little jitter
+ * on each edge, covering every IR155 band. Glitches are short pulses from
+ * noise on the line, which split a period into two short captures.
+ */
+
+#define TICK_HZ (50000)
+
+static ImdDecoder_Params_t params;
+static ImdDecoder_t dec;
+static unsigned seed;
+static double now_ms;
+
+static float noise(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return ((float)((seed >> 16) & 0x7fff) / 0x7fff - 0.5f) * 2.0f;
+}
+
+/*
+ * One period of the PWM, with the edges jittered by up to 2 ticks
+ */
+static bool capture(float frequency_Hz, float duty_percent)
+{
+    const float period = TICK_HZ / frequency_Hz;
+    const uint32_t periodTicks = (uint32_t)lroundf(period + 2.0f * noise());
+    const uint32_t highTicks = (uint32_t)lroundf(period * duty_percent / 100.0f + 2.0f * noise());
+    now_ms += 1000.0 / frequency_Hz;
+    return imdDecoderCapture(&dec, periodTicks, highTicks, (uint32_t)now_ms);
+}
+
+static void run(float frequency_Hz, float duty_percent, int periods)
+{
+    for (int i = 0; i < periods; i++) {
+        capture(frequency_Hz, duty_percent);
+    }
+}
+
+/*
+ * The BMU's previous decoding: the latest capture alone, banded the same way
+ */
+static int latestCaptureBand(uint32_t periodTicks)
+{
+    const uint32_t freq_mHz = (TICK_HZ * 1000) / periodTicks;
+    for (int band = 1; band <= 5; band++) {
+        if (freq_mHz > band * 9500 && freq_mHz < band * 10500) {
+            return band;
+        }
+    }
+    return 0;
+}
+
+void setUp(void)
+{
+    params = (ImdDecoder_Params_t){
+        .tickFrequency_Hz = TICK_HZ,
+        .bandTolerance = 0.05f,
+        .lockCount = 3,
+        .outlierDuty_percent = 5.0f,
+        .timeout_ms = 200,
+    };
+    seed = 1;
+    now_ms = 1000.0;
+    imdDecoderInit(&dec, &params, (uint32_t)now_ms);
+}
+
+void tearDown(void)
+{
+}
+
+void test_allBands(void)
+{
+    const struct {
+        float frequency_Hz;
+        float duty_percent;
+        ImdDecoder_Band_t band;
+    } cases[] = {
+        {10.0f, 50.0f, IMD_BAND_10HZ},
+        {10.0f, 88.0f, IMD_BAND_10HZ},
+        {20.0f, 30.0f, IMD_BAND_20HZ},
+        {30.0f, 7.5f, IMD_BAND_30HZ},
+        {30.0f, 92.5f, IMD_BAND_30HZ},
+        {40.0f, 50.0f, IMD_BAND_40HZ},
+        {50.0f, 50.0f, IMD_BAND_50HZ},
+        // Edges of the tolerance
+        {10.4f, 20.0f, IMD_BAND_10HZ},
+        {47.8f, 50.0f, IMD_BAND_50HZ},
+    };
+
+    for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        run(cases[i].frequency_Hz, cases[i].duty_percent, 10);
+
+        TEST_ASSERT_TRUE(dec.valid);
+        TEST_ASSERT_EQUAL_INT(cases[i].band, dec.band);
+        TEST_ASSERT_FLOAT_WITHIN(0.01f * cases[i].frequency_Hz, cases[i].frequency_Hz, dec.frequency_Hz);
+        TEST_ASSERT_FLOAT_WITHIN(0.5f, cases[i].duty_percent, dec.duty_percent);
+        if (cases[i].band == IMD_BAND_10HZ || cases[i].band == IMD_BAND_20HZ) {
+            const float dc = cases[i].duty_percent / 100.0f;
+            const float expected = 0.9f * 1200.0f / (dc - 0.05f) - 1200.0f;
+            TEST_ASSERT_FLOAT_WITHIN(0.03f * expected + 5.0f, expected, dec.resistance_kOhms);
+        } else {
+            TEST_ASSERT_FALSE(isfinite(dec.resistance_kOhms));
+        }
+    }
+    // Only the band changes, duty steps within a band are counted while the median catches up
+    TEST_ASSERT_EQUAL_UINT32(6, dec.bandChanges);
+}
+
+void test_glitchesRejected(void)
+{
+    int latestWrong = 0;
+    int decodedWrong = 0;
+    const float period = TICK_HZ / 10.0f;
+
+    run(10.0f, 30.0f, 5);
+    for (int i = 0; i < 200; i++) {
+        if (i % 7 == 3) {
+            // Noise pulse early in the low time splits the period in two
+            const uint32_t first = (uint32_t)(period * 0.4f);
+            const uint32_t second = (uint32_t)period - first;
+            now_ms += 1000.0 * first / TICK_HZ;
+            imdDecoderCapture(&dec, first, (uint32_t)(period * 0.3f), (uint32_t)now_ms);
+            latestWrong += latestCaptureBand(first) != 1;
+            now_ms += 1000.0 * second / TICK_HZ;
+            imdDecoderCapture(&dec, second, (uint32_t)(period * 0.01f), (uint32_t)now_ms);
+            latestWrong += latestCaptureBand(second) != 1;
+        } else if (i % 11 == 5) {
+            // Noise holding the line high, a duty outlier
+            capture(10.0f, 90.0f);
+        } else {
+            capture(10.0f, 30.0f);
+        }
+        decodedWrong += !(dec.valid && dec.band == IMD_BAND_10HZ && fabsf(dec.duty_percent - 30.0f) < 1.0f);
+    }
+
+    TEST_ASSERT_TRUE(latestWrong > 0);
+    TEST_ASSERT_EQUAL_INT(0, decodedWrong);
+    TEST_ASSERT_EQUAL_UINT32(0, dec.bandChanges);
+    TEST_ASSERT_TRUE(dec.outliers > 0);
+}
+
+void test_timeToValidAndBandChange(void)
+{
+    // Output held low while the IMD starts up
+    const uint32_t start_ms = (uint32_t)now_ms;
+    TEST_ASSERT_FALSE(imdDecoderSignalLost(&dec, start_ms + 100));
+    TEST_ASSERT_TRUE(imdDecoderSignalLost(&dec, start_ms + 300));
+    now_ms += 500.0;
+
+    // Speed start measurement, good
+    bool changed = false;
+    int periods = 0;
+    while (!changed) {
+        changed = capture(30.0f, 7.5f);
+        periods++;
+    }
+    TEST_ASSERT_EQUAL_INT(params.lockCount, periods);
+    TEST_ASSERT_UINT32_WITHIN(5, 500 + 100, dec.timeToValid_ms);
+    TEST_ASSERT_EQUAL_INT(IMD_BAND_30HZ, dec.band);
+    run(30.0f, 7.5f, 60);
+
+    // Then normal, picked up within the lock count
+    changed = false;
+    periods = 0;
+    while (!changed) {
+        changed = capture(10.0f, 40.0f);
+        periods++;
+    }
+    TEST_ASSERT_EQUAL_INT(params.lockCount, periods);
+    TEST_ASSERT_EQUAL_INT(IMD_BAND_10HZ, dec.band);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 40.0f, dec.duty_percent);
+    TEST_ASSERT_EQUAL_UINT32(1, dec.bandChanges);
+    TEST_ASSERT_EQUAL_UINT32(0, dec.outliers);
+}
+
+void test_signalLostAndRecovered(void)
+{
+    run(10.0f, 40.0f, 5);
+    TEST_ASSERT_TRUE(dec.valid);
+    TEST_ASSERT_FALSE(imdDecoderSignalLost(&dec, (uint32_t)now_ms + 150));
+    TEST_ASSERT_TRUE(imdDecoderSignalLost(&dec, (uint32_t)now_ms + 250));
+
+    // Comes back in another band, locked afresh
+    now_ms += 1000.0;
+    capture(50.0f, 50.0f);
+    TEST_ASSERT_FALSE(dec.valid);
+    run(50.0f, 50.0f, 2);
+    TEST_ASSERT_TRUE(dec.valid);
+    TEST_ASSERT_EQUAL_INT(IMD_BAND_50HZ, dec.band);
+    TEST_ASSERT_FALSE(imdDecoderSignalLost(&dec, (uint32_t)now_ms));
+}
+
+void test_resistanceLimits(void)
+{
+    run(10.0f, 4.0f, 5);
+    TEST_ASSERT_FALSE(isfinite(dec.resistance_kOhms));
+    run(10.0f, 97.0f, 5);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, dec.resistance_kOhms);
+}
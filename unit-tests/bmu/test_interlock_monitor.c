@@ -0,0 +1,171 @@
+#include "unity.h"
+
+#include "interlock_monitor.h"
+
+/*
+ * Injects GPIO edges into the interlock monitor and runs a model of the fault
+ * monitor task: woken by an edge notification, or by timeout after the pending
+ * debounce time (rounded up to 1 ms ticks) or the 100 ms sample period.
+ */
+
+#define DEBOUNCE_US (1000)
+#define TICK_US (1000)
+#define PERIOD_US (100000)
+
+typedef struct Edge_t {
+    uint32_t time_us;
+    InterlockLoop_t loop;
+    bool closed;
+    bool interruptSeen;     ///< false to model a missed edge
+} Edge_t;
+
+static InterlockMonitor_t monitor;
+static bool level[NUM_INTERLOCK_LOOPS];
+static uint32_t confirmedAt[NUM_INTERLOCK_LOOPS];
+
+void setUp(void)
+{
+    interlockMonitorInit(&monitor, DEBOUNCE_US);
+    for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++) {
+        level[loop] = true;
+        confirmedAt[loop] = 0;
+    }
+}
+
+void tearDown(void)
+{
+}
+
+/// Runs the task model until end_us, applying edges as they occur
+static void simulate(const Edge_t *edges, int numEdges, uint32_t end_us)
+{
+    uint32_t now = 0;
+    int next = 0;
+
+    while (now < end_us) {
+        uint32_t wait_us;
+        uint32_t timeout = PERIOD_US;
+        if (interlockMonitorPending(&monitor, now, &wait_us)) {
+            timeout = (wait_us / 1000 + 1) * TICK_US;
+        }
+
+        // Sleep until the timeout, or the next edge interrupt wakes us
+        uint32_t wake = now + timeout;
+        while (next < numEdges && edges[next].time_us <= wake) {
+            level[edges[next].loop] = edges[next].closed;
+            if (edges[next].interruptSeen) {
+                interlockMonitorEdge(&monitor, edges[next].loop, edges[next].closed, edges[next].time_us);
+                wake = edges[next].time_us;
+                next++;
+                break;
+            }
+            next++;
+        }
+        now = wake;
+
+        uint32_t opened = interlockMonitorUpdate(&monitor, level, now);
+        for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++) {
+            if (opened & (1U << loop)) {
+                confirmedAt[loop] = now;
+            }
+        }
+    }
+}
+
+void test_cleanOpenConfirmedWithinBound(void)
+{
+    const Edge_t edges[] = {
+        {123456, INTERLOCK_BSPD, false, true},
+    };
+
+    simulate(edges, 1, 500000);
+
+    uint32_t latency = confirmedAt[INTERLOCK_BSPD] - 123456;
+    TEST_ASSERT_TRUE(monitor.loops[INTERLOCK_BSPD].open);
+    TEST_ASSERT_EQUAL_UINT32(123456, monitor.loops[INTERLOCK_BSPD].openedAt_us);
+    TEST_ASSERT_TRUE(latency >= DEBOUNCE_US);
+    TEST_ASSERT_TRUE(latency <= DEBOUNCE_US + TICK_US);
+    TEST_ASSERT_FALSE(monitor.loops[INTERLOCK_HVD].open);
+}
+
+void test_bounceIsNotReported(void)
+{
+    const Edge_t edges[] = {
+        {10000, INTERLOCK_HVD, false, true},
+        {10200, INTERLOCK_HVD, true, true},
+        {10300, INTERLOCK_HVD, false, true},
+        {10350, INTERLOCK_HVD, true, true},
+    };
+
+    simulate(edges, 4, 300000);
+
+    TEST_ASSERT_FALSE(monitor.loops[INTERLOCK_HVD].open);
+    TEST_ASSERT_EQUAL_UINT32(0, confirmedAt[INTERLOCK_HVD]);
+    TEST_ASSERT_EQUAL_UINT32(2, monitor.loops[INTERLOCK_HVD].glitches);
+}
+
+void test_bounceThenOpenTimestampedAtLastEdge(void)
+{
+    const Edge_t edges[] = {
+        {50000, INTERLOCK_IL, false, true},
+        {50100, INTERLOCK_IL, true, true},
+        {50250, INTERLOCK_IL, false, true},
+    };
+
+    simulate(edges, 3, 300000);
+
+    TEST_ASSERT_TRUE(monitor.loops[INTERLOCK_IL].open);
+    TEST_ASSERT_EQUAL_UINT32(50250, monitor.loops[INTERLOCK_IL].openedAt_us);
+    TEST_ASSERT_TRUE(confirmedAt[INTERLOCK_IL] - 50250 <= DEBOUNCE_US + TICK_US);
+}
+
+void test_missedEdgeCaughtBySampling(void)
+{
+    const Edge_t edges[] = {
+        {20000, INTERLOCK_HVIL, false, false},
+    };
+
+    simulate(edges, 1, 400000);
+
+    TEST_ASSERT_TRUE(monitor.loops[INTERLOCK_HVIL].open);
+    TEST_ASSERT_TRUE(confirmedAt[INTERLOCK_HVIL] - 20000 <= PERIOD_US + DEBOUNCE_US + TICK_US);
+}
+
+void test_edgeAfterSampleNotDiscarded(void)
+{
+    bool closed[NUM_INTERLOCK_LOOPS];
+    uint32_t wait_us;
+
+    for (int loop = 0; loop < NUM_INTERLOCK_LOOPS; loop++) {
+        closed[loop] = true;
+    }
+
+    // Task takes the time and samples the levels, then the edge interrupt
+    // fires before the update runs
+    interlockMonitorEdge(&monitor, INTERLOCK_CBRB, false, 1005);
+    TEST_ASSERT_EQUAL_UINT32(0, interlockMonitorUpdate(&monitor, closed, 1000));
+    TEST_ASSERT_TRUE(interlockMonitorPending(&monitor, 1000, &wait_us));
+    TEST_ASSERT_EQUAL_UINT32(DEBOUNCE_US, wait_us);
+    TEST_ASSERT_EQUAL_UINT32(0, monitor.loops[INTERLOCK_CBRB].glitches);
+
+    closed[INTERLOCK_CBRB] = false;
+    TEST_ASSERT_EQUAL_UINT32(0, interlockMonitorUpdate(&monitor, closed, 1500));
+    TEST_ASSERT_EQUAL_UINT32(1U << INTERLOCK_CBRB, interlockMonitorUpdate(&monitor, closed, 2005));
+}
+
+void test_reportsWhichLoop(void)
+{
+    const Edge_t edges[] = {
+        {70000, INTERLOCK_HVD, false, true},
+        {70500, INTERLOCK_BSPD, false, true},
+    };
+
+    simulate(edges, 2, 200000);
+
+    TEST_ASSERT_TRUE(monitor.loops[INTERLOCK_HVD].open);
+    TEST_ASSERT_TRUE(monitor.loops[INTERLOCK_BSPD].open);
+    TEST_ASSERT_FALSE(monitor.loops[INTERLOCK_IL].open);
+    TEST_ASSERT_EQUAL_UINT32(70000, monitor.loops[INTERLOCK_HVD].openedAt_us);
+    TEST_ASSERT_EQUAL_UINT32(70500, monitor.loops[INTERLOCK_BSPD].openedAt_us);
+    TEST_ASSERT_EQUAL_STRING("HVD", interlockLoopName(INTERLOCK_HVD));
+}
@@ -0,0 +1,348 @@
+#include "unity.h"
+
+#include "ltc_chip.h"
+#include "ltc_chip_interface.h"
+#include "ltc6804.h"
+#include "ltc_common.h"
+#include "errorHandler.h"
+#include "fake_debug.h"
+#include "queue.h"
+#include "ltc_emulator.h"
+#include "ltc_emulator_hal.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Runs the BMU's LTC driver (ltc_common.c, ltc_chip.c and ltc6804.c) on the
+ * emulated daisy chain, through the HAL stand-ins in ltc_emulator_hal.c.
+ * batteries.c is not linked, the tests call the driver as its battery task
+ * does.
+ */
+
+#define SPI_CLOCK_HZ 781250     // SPI4, 108 MHz / 128
+#define DISCHARGE_OHMS 33.0f
+#define SENSE_OHMS 0.5f         // Cell tap wiring the bleed current also flows through
+#define NOISE_V 0.0003f
+#define LTC_CELL_UNUSED_1 5     // C6, see batt_readBackCellVoltageBlocks
+#define LTC_CELL_UNUSED_2 11    // C12
+#define TEMP_CHANNELS_READ 14   // batt_next_temp_channel skips 7 and 8
+
+static LtcEmulator_t emu;
+static float cellVoltages[NUM_BOARDS][LTC_EMULATOR_CELLS];
+static float cells[NUM_VOLTAGE_CELLS];
+static float temps[NUM_TEMP_CELLS];
+
+static float cellVoltage(void *context, int device, int cell, uint32_t time_us)
+{
+    (void)context;
+    (void)time_us;
+    return cellVoltages[device][cell];
+}
+
+static float muxVoltage(void *context, int device, int channel, uint32_t time_us)
+{
+    (void)context;
+    (void)time_us;
+    return 1.0f + 0.05f * channel + 0.001f * device;
+}
+
+// batteries.c isn't linked, so the open wire test skips its current check
+HAL_StatusTypeDef getIBus(float *IBus)
+{
+    (void)IBus;
+    return HAL_ERROR;
+}
+
+void _handleError(char *file, int line)
+{
+    (void)file;
+    (void)line;
+    TEST_FAIL_MESSAGE("handleError called");
+}
+
+void setUp(void)
+{
+    const LtcEmulator_Params_t params = {
+        .numDevices = NUM_BOARDS,
+        .spiClock_Hz = SPI_CLOCK_HZ,
+        .dischargeResistance_ohms = DISCHARGE_OHMS,
+        .senseResistance_ohms = SENSE_OHMS,
+        .muxSettle_us = 1000,
+        .noise_V = NOISE_V,
+        .seed = 1234,
+    };
+    const LtcEmulatorModel_t model = {
+        .context = NULL,
+        .cellVoltage = cellVoltage,
+        .muxVoltage = muxVoltage,
+    };
+
+    for (int board = 0; board < NUM_BOARDS; board++) {
+        for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+            cellVoltages[board][cell] = 3.6f + 0.01f * cell + 0.002f * board;
+        }
+    }
+    // Past the driver's last wakeup, whichever test ran before
+    const uint32_t start_us = 10000000;
+    ltcEmulatorInit(&emu, &params, &model, start_us);
+    ltcEmulatorHalInit(&emu, start_us);
+    fake_mock_init_queues();
+    fake_mock_init_debug();
+    TEST_ASSERT_EQUAL(HAL_OK, batt_init());
+}
+
+void tearDown(void)
+{
+}
+
+/// LTC cell (0 - 11) a BMU cell is measured on
+static int ltcCell(int cell)
+{
+    const int boardCell = cell % CELLS_PER_BOARD;
+    return boardCell < LTC_CELL_UNUSED_1 ? boardCell : boardCell + 1;
+}
+
+/// batt_read_thermistors' mapping of a board's mux channel, -1 if unused
+static int tempIndex(int board, int channel)
+{
+    if (channel == 7 || channel == 8 || (channel == 6 && board % 2 == 1)) {
+        return -1;
+    }
+    int index = board * 13 + (board + 1) / 2 + channel;
+    if (channel >= 9) {
+        index -= (board % 2 == 0) ? 2 : 3;
+    }
+    return index;
+}
+
+void test_initConfiguresEveryBoard(void)
+{
+    for (int board = 0; board < NUM_BOARDS; board++) {
+        TEST_ASSERT_FALSE(emu.devices[board].asleep);
+        TEST_ASSERT_EQUAL_HEX8(REFON(1) | SWTRD(1), emu.devices[board].config[0] & 0x7);
+        TEST_ASSERT_EQUAL_UINT32(0, emu.devices[board].writesRejected);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    TEST_ASSERT_EQUAL_UINT32(0, emu.commandPecErrors);
+}
+
+void test_cycleReadsEveryCellAndThermistor(void)
+{
+    for (int i = 0; i < NUM_TEMP_CELLS; i++) {
+        temps[i] = NAN;
+    }
+
+    for (int cycle = 0; cycle < TEMP_CHANNELS_READ; cycle++) {
+        TEST_ASSERT_EQUAL(HAL_OK, batt_read_cell_voltages_and_temps(cells, temps));
+        for (int cell = 0; cell < NUM_VOLTAGE_CELLS; cell++) {
+            const float expected = cellVoltages[cell / CELLS_PER_BOARD][ltcCell(cell)];
+            TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, expected, cells[cell]);
+        }
+        ltcEmulatorHalWait(100000);
+    }
+
+    // Every thermistor was read once, from the right board and channel
+    for (int board = 0; board < NUM_BOARDS; board++) {
+        for (int channel = 0; channel < TEMP_CHANNELS_PER_BOARD; channel++) {
+            const int index = tempIndex(board, channel);
+            if (index < 0) {
+                continue;
+            }
+            const float expected = batt_convert_voltage_to_temp(muxVoltage(NULL, board, channel, 0));
+            TEST_ASSERT_FLOAT_WITHIN(0.5f, expected, temps[index]);
+        }
+    }
+    for (int i = 0; i < NUM_TEMP_CELLS; i++) {
+        TEST_ASSERT_FALSE(isnan(temps[i]));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    TEST_ASSERT_EQUAL_UINT32(0, emu.commandPecErrors);
+    for (int board = 0; board < NUM_BOARDS; board++) {
+        for (int group = 0; group < NUM_LTC_REG_GROUPS; group++) {
+            TEST_ASSERT_EQUAL_UINT32(0, batt_get_pec_errors(board, group));
+        }
+    }
+}
+
+void test_wakeupSkipNeverOutlastsIdle(void)
+{
+    // From every point in a tick, until well past tIDLE
+    for (uint32_t gap_us = 0; gap_us < 2 * LTC_EMULATOR_T_IDLE_US; gap_us += 37) {
+        ltcEmulatorHalWait(2 * LTC_EMULATOR_T_IDLE_US);
+        TEST_ASSERT_EQUAL_INT(0, batt_spi_wakeup(false));
+        ltcEmulatorHalWait(gap_us);
+
+        // Skipped or not, the command gets to every board
+        const uint32_t commands = emu.commands;
+        TEST_ASSERT_EQUAL_INT(0, batt_spi_wakeup(false));
+        TEST_ASSERT_EQUAL(HAL_OK, batt_broadcast_command(ADSTAT));
+        TEST_ASSERT_EQUAL_UINT32(commands + 1, emu.commands);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+}
+
+void test_balancingConfigIsWrittenOncePerChange(void)
+{
+    static bool balance[NUM_VOLTAGE_CELLS];
+    const int cycles = 2 * TEMP_CHANNELS_READ;
+    uint32_t writes;
+    uint32_t skipped;
+    uint32_t startWrites;
+    uint32_t startSkipped;
+
+    batt_get_config_write_counts(&startWrites, &startSkipped);
+    const uint32_t startConfigWrites = emu.configWrites;
+
+    // Battery task cycles, the planner changes its plan once
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        balance[7] = true;
+        balance[42] = cycle >= cycles / 2;
+        TEST_ASSERT_EQUAL(HAL_OK, batt_read_cell_voltages_and_temps(cells, temps));
+        TEST_ASSERT_EQUAL(HAL_OK, batt_write_balancing_config(balance, DT_30_SEC));
+        ltcEmulatorHalWait(10000);
+    }
+
+    // The thermistor mux write each cycle sends the balance state along, so
+    // the balancing write only goes out on the two cycles its bits changed
+    batt_get_config_write_counts(&writes, &skipped);
+    TEST_ASSERT_EQUAL_UINT32(cycles + 2, writes - startWrites);
+    TEST_ASSERT_EQUAL_UINT32(cycles - 2, skipped - startSkipped);
+    TEST_ASSERT_EQUAL_UINT32(cycles + 2, emu.configWrites - startConfigWrites);
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 0, ltcCell(7)));
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 42 / CELLS_PER_BOARD, ltcCell(42)));
+}
+
+// balanceCharge's timing: a 500 ms task, and every 3 s recheck a reading
+// taken after the resistors have been off for the 250 ms relaxation time
+#define CHARGE_TASK_PERIOD_US 500000
+#define CELL_RELAXATION_US 250000
+#define BALANCE_RECHECK_CYCLES 7
+
+/// The AMS calls of one balanceCharge cycle
+static void balanceChargeCycle(bool relaxedReading, const bool *plan)
+{
+    const uint32_t start_us = ltcEmulatorHalNow();
+
+    if (relaxedReading) {
+        // pauseBalance
+        TEST_ASSERT_EQUAL(HAL_OK, batt_unset_balancing_all_cells());
+        TEST_ASSERT_EQUAL_INT(0, batt_spi_wakeup(false));
+        TEST_ASSERT_EQUAL(HAL_OK, batt_write_config());
+        ltcEmulatorHalWait(CELL_RELAXATION_US);
+    }
+    TEST_ASSERT_EQUAL(HAL_OK, batt_read_cell_voltages_and_temps(cells, temps));
+    TEST_ASSERT_EQUAL(HAL_OK, batt_write_balancing_config(plan, DT_30_SEC));
+    ltcEmulatorHalWait(CHARGE_TASK_PERIOD_US - (ltcEmulatorHalNow() - start_us));
+}
+
+void test_balanceChargeWritesConfigOncePerCycle(void)
+{
+    static bool plan[NUM_VOLTAGE_CELLS];
+    const int cycles = 3 * BALANCE_RECHECK_CYCLES;
+    const int planChange = BALANCE_RECHECK_CYCLES + 3;
+    const float bleeding = cellVoltages[0][ltcCell(7)];
+
+    plan[7] = true;
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        const bool relaxedReading = cycle % BALANCE_RECHECK_CYCLES == 0;
+        // The planner drops a cell between rechecks once it has bled enough
+        plan[42] = cycle < planChange;
+        const uint32_t startWrites = emu.configWrites;
+
+        balanceChargeCycle(relaxedReading, plan);
+
+        // Pause, mux and new plan on a relaxed reading. Otherwise the mux
+        // write carries the plan, and the plan is only written on a change
+        const uint32_t expected = relaxedReading ? 3 : (cycle == planChange ? 2 : 1);
+        TEST_ASSERT_EQUAL_UINT32(expected, emu.configWrites - startWrites);
+        TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 0, ltcCell(7)));
+        TEST_ASSERT_EQUAL(cycle < planChange, ltcEmulatorDischarging(&emu, 42 / CELLS_PER_BOARD, ltcCell(42)));
+        // Read while bleeding, with discharge paused for the conversion
+        TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, bleeding, cells[7]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    TEST_ASSERT_EQUAL_UINT32(0, emu.commandPecErrors);
+}
+
+typedef struct {
+    uint32_t cycle_us;
+    uint32_t bytes;
+    uint32_t chipSelects;
+} CycleCost_t;
+
+/// Averaged over a cycle through every thermistor channel
+static CycleCost_t measureCycle(HAL_StatusTypeDef (*cycle)(float *, float *))
+{
+    const uint32_t startBytes = emu.bytes;
+    const uint32_t startChipSelects = ltcEmulatorHalStats()->chipSelects;
+    uint32_t cycle_us = 0;
+
+    for (int i = 0; i < TEMP_CHANNELS_READ; i++) {
+        const uint32_t start_us = ltcEmulatorHalNow();
+        TEST_ASSERT_EQUAL(HAL_OK, cycle(cells, temps));
+        cycle_us += ltcEmulatorHalNow() - start_us;
+        ltcEmulatorHalWait(10000);
+    }
+    return (CycleCost_t){
+        .cycle_us = cycle_us / TEMP_CHANNELS_READ,
+        .bytes = (emu.bytes - startBytes) / TEMP_CHANNELS_READ,
+        .chipSelects = (ltcEmulatorHalStats()->chipSelects - startChipSelects) / TEMP_CHANNELS_READ,
+    };
+}
+
+/// The AMS cycle before voltages and a thermistor were read in one sequence
+static HAL_StatusTypeDef separateCycle(float *cell_voltage_array, float *cell_temp_array)
+{
+    if (batt_read_cell_voltages(cell_voltage_array) != HAL_OK) {
+        return HAL_ERROR;
+    }
+    return batt_read_cell_temps(cell_temp_array);
+}
+
+void test_combinedCycleIsShorterOnTheSameBusTraffic(void)
+{
+    const CycleCost_t separate = measureCycle(separateCycle);
+    const CycleCost_t combined = measureCycle(batt_read_cell_voltages_and_temps);
+
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    // The mux is on GPIO5, out of ADCVAX's reach, so the same registers are
+    // written and read either way
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(separate.bytes, combined.bytes);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(separate.chipSelects, combined.chipSelects);
+    // The thermistor converts during the cell read back instead
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(separate.cycle_us - CONVERSION_TIME_SINGLE_7kHz_US, combined.cycle_us);
+}
+
+void test_fastAdcModeShortensCycle(void)
+{
+    const int cycles = 100;
+
+    uint32_t cycle_us = 0;
+    for (int i = 0; i < cycles; i++) {
+        const uint32_t start_us = ltcEmulatorHalNow();
+        TEST_ASSERT_EQUAL(HAL_OK, batt_read_cell_voltages_and_temps(cells, temps));
+        cycle_us += ltcEmulatorHalNow() - start_us;
+        ltcEmulatorHalWait(10000);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, emu.ignoredTransfers);
+    TEST_ASSERT_EQUAL_UINT32(0, emu.commandPecErrors);
+
+    // 27 kHz mode saves the difference in conversion time
+    TEST_ASSERT_EQUAL(HAL_OK, batt_set_adc_mode(LTC_ADC_MODE_FAST));
+    uint32_t fastCycle_us = 0;
+    for (int i = 0; i < cycles; i++) {
+        const uint32_t start_us = ltcEmulatorHalNow();
+        TEST_ASSERT_EQUAL(HAL_OK, batt_read_cell_voltages_and_temps(cells, temps));
+        fastCycle_us += ltcEmulatorHalNow() - start_us;
+        for (int cell = 0; cell < NUM_VOLTAGE_CELLS; cell++) {
+            const float expected = cellVoltages[cell / CELLS_PER_BOARD][ltcCell(cell)];
+            TEST_ASSERT_FLOAT_WITHIN(4 * NOISE_V + 1e-4f, expected, cells[cell]);
+        }
+        ltcEmulatorHalWait(10000);
+    }
+    TEST_ASSERT_EQUAL(HAL_OK, batt_set_adc_mode(LTC_ADC_MODE_NORMAL));
+    TEST_ASSERT_UINT32_WITHIN(1000, CONVERSION_TIME_7kHz_US - CONVERSION_TIME_27kHz_US,
+                              (cycle_us - fastCycle_us) / cycles);
+}
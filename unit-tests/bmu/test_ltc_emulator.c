@@ -0,0 +1,510 @@
+#include "unity.h"
+
+#include "ltc_emulator.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Checks the LTC6804 emulator against the datasheet, with frames built as
+ * ltc_common.c builds them. test_ltc_driver.c runs the driver itself on it.
+ */
+
+#define NUM_DEVICES 14
+#define SPI_CLOCK_HZ 781250     // SPI4, 108 MHz / 128
+#define GROUP 8
+#define CYCLE_TX_SIZE (4 + NUM_DEVICES * GROUP)
+
+// Firmware commands, 7 kHz mode (MD = 2) unless noted
+#define WRCFG 0x0001
+#define RDCFG 0x0002
+#define RDCVA 0x0004
+#define RDCVB 0x0006
+#define RDCVC 0x0008
+#define RDCVD 0x000A
+#define RDAUXB 0x000E
+#define ADCV 0x0360
+#define DCP 0x0010
+#define ADAX_GPIO5 0x0565
+#define ADOW_PULLDOWN 0x0328
+#define ADOW_PULLUP 0x0368
+#define CLRCELL 0x0711
+#define PLADC 0x0714
+
+// Firmware timing (ltc_chip.h, ltc_common.h)
+#define CONVERSION_TIME_7kHz_US 2480
+#define CONVERSION_TIME_SINGLE_7kHz_US 405
+#define LTC_T_WAKE_MAX_US 300
+#define LTC_T_READY_US 10
+
+#define REFON (1 << 2)
+#define GPIO_PULLDOWNS_OFF 0xF8
+#define GPIO1_POS 3
+#define GPIO5_POS 7
+/// batt_set_temp_config: mux select on GPIO1 - 4, mux output on GPIO5
+#define MUX_CONFIG(channel) ((1 << GPIO5_POS) | ((channel) << GPIO1_POS) | REFON)
+
+#define DISCHARGE_OHMS 33.0f
+#define SENSE_OHMS 0.5f
+#define NOISE_V 0.0003f
+
+static LtcEmulator_t emu;
+static uint32_t now_us;
+static float cellVoltages[NUM_DEVICES][LTC_EMULATOR_CELLS];
+
+static float cellVoltage(void *context, int device, int cell, uint32_t time_us)
+{
+    (void)context;
+    (void)time_us;
+    return cellVoltages[device][cell];
+}
+
+static float muxVoltage(void *context, int device, int channel, uint32_t time_us)
+{
+    (void)context;
+    (void)time_us;
+    return 1.0f + 0.05f * channel + 0.001f * device;
+}
+
+void setUp(void)
+{
+    const LtcEmulator_Params_t params = {
+        .numDevices = NUM_DEVICES,
+        .spiClock_Hz = SPI_CLOCK_HZ,
+        .dischargeResistance_ohms = DISCHARGE_OHMS,
+        .senseResistance_ohms = SENSE_OHMS,
+        .muxSettle_us = 1000,
+        .noise_V = NOISE_V,
+        .seed = 1234,
+    };
+    const LtcEmulatorModel_t model = {
+        .context = NULL,
+        .cellVoltage = cellVoltage,
+        .muxVoltage = muxVoltage,
+    };
+
+    for (int device = 0; device < NUM_DEVICES; device++) {
+        for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+            cellVoltages[device][cell] = 3.6f + 0.01f * cell + 0.002f * device;
+        }
+    }
+    now_us = 1000;
+    ltcEmulatorInit(&emu, &params, &model, now_us);
+}
+
+void tearDown(void)
+{
+}
+
+static void wait(uint32_t us)
+{
+    now_us += us;
+    ltcEmulatorAdvance(&emu, now_us);
+}
+
+static void transfer(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    // Chip select is raised for a few microseconds between transfers
+    now_us += ltcEmulatorTransfer(&emu, tx, rx, len, now_us) + 2;
+}
+
+static void formatCommand(uint16_t code, uint8_t *tx)
+{
+    tx[0] = code >> 8;
+    tx[1] = code & 0xFF;
+    ltcEmulatorPec(tx, 2, &tx[2]);
+}
+
+static void sendCommand(uint16_t code)
+{
+    uint8_t tx[4];
+    uint8_t rx[4];
+    formatCommand(code, tx);
+    transfer(tx, rx, sizeof(tx));
+}
+
+/// batt_spi_wakeup
+static void wakeup(bool sleeping)
+{
+    const uint8_t dummy = 0xFF;
+    uint8_t rx;
+
+    if (sleeping) {
+        ltcEmulatorWakePulse(&emu, now_us);
+        wait(LTC_T_WAKE_MAX_US * NUM_DEVICES);
+    } else {
+        transfer(&dummy, &rx, 1);
+        wait(LTC_T_READY_US * NUM_DEVICES);
+    }
+}
+
+/// batt_format_write_config_command: the last board's data goes first
+static void writeConfig(uint8_t config[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE])
+{
+    uint8_t tx[CYCLE_TX_SIZE];
+    uint8_t rx[CYCLE_TX_SIZE];
+
+    formatCommand(WRCFG, tx);
+    for (int board = NUM_DEVICES - 1, i = 4; board >= 0; board--, i += GROUP) {
+        memcpy(&tx[i], config[board], LTC_EMULATOR_REGISTER_SIZE);
+        ltcEmulatorPec(&tx[i], LTC_EMULATOR_REGISTER_SIZE, &tx[i + LTC_EMULATOR_REGISTER_SIZE]);
+    }
+    transfer(tx, rx, sizeof(tx));
+}
+
+static void writeSameConfig(uint8_t cfgr0, uint8_t dischargeLow, uint8_t dischargeHigh)
+{
+    uint8_t config[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE] = {{0}};
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        config[board][0] = cfgr0;
+        config[board][4] = dischargeLow;
+        config[board][5] = dischargeHigh;
+    }
+    writeConfig(config);
+}
+
+/// batt_read_data: board 0 responds first. Returns the boards that passed PEC
+static int readGroup(uint16_t code, uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE], bool pecOk[NUM_DEVICES])
+{
+    uint8_t tx[CYCLE_TX_SIZE];
+    uint8_t rx[CYCLE_TX_SIZE];
+    int passed = 0;
+
+    memset(tx, 0xFF, sizeof(tx));
+    formatCommand(code, tx);
+    transfer(tx, rx, sizeof(tx));
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        const uint8_t *group = &rx[4 + board * GROUP];
+        uint8_t pec[2];
+        ltcEmulatorPec(group, LTC_EMULATOR_REGISTER_SIZE, pec);
+        pecOk[board] = pec[0] == group[6] && pec[1] == group[7];
+        memcpy(data[board], group, LTC_EMULATOR_REGISTER_SIZE);
+        passed += pecOk[board];
+    }
+    return passed;
+}
+
+/// Cell voltages in volts, as batt_read_cell_voltages unpacks them
+static int readCells(float cells[NUM_DEVICES][LTC_EMULATOR_CELLS])
+{
+    static const uint16_t commands[] = {RDCVA, RDCVB, RDCVC, RDCVD};
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+    int passed = 0;
+
+    for (int block = 0; block < 4; block++) {
+        passed += readGroup(commands[block], data, pecOk);
+        for (int board = 0; board < NUM_DEVICES; board++) {
+            for (int i = 0; i < 3; i++) {
+                const uint16_t raw = data[board][2 * i] | (data[board][2 * i + 1] << 8);
+                cells[board][block * 3 + i] = raw / 10000.0f;
+            }
+        }
+    }
+    return passed;
+}
+
+void test_pecMatchesDatasheet(void)
+{
+    const uint8_t wrcfg[2] = {0x00, 0x01};
+    uint8_t pec[2];
+
+    ltcEmulatorPec(wrcfg, sizeof(wrcfg), pec);
+    TEST_ASSERT_EQUAL_HEX8(0x3D, pec[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x6E, pec[1]);
+
+    // Every single bit error in a register group is caught
+    uint8_t group[GROUP] = {0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC};
+    ltcEmulatorPec(group, LTC_EMULATOR_REGISTER_SIZE, &group[6]);
+    for (int bit = 0; bit < GROUP * 8; bit++) {
+        uint8_t corrupted[GROUP];
+        memcpy(corrupted, group, sizeof(corrupted));
+        corrupted[bit / 8] ^= 1 << (bit % 8);
+        ltcEmulatorPec(corrupted, LTC_EMULATOR_REGISTER_SIZE, pec);
+        TEST_ASSERT_FALSE(pec[0] == corrupted[6] && pec[1] == corrupted[7]);
+    }
+}
+
+void test_configIsShiftedDownTheChain(void)
+{
+    uint8_t config[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE] = {{0}};
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        config[board][0] = GPIO_PULLDOWNS_OFF | REFON;
+        config[board][1] = board;
+        config[board][4] = 1 << (board % 8);
+    }
+    wakeup(true);
+    writeConfig(config);
+    TEST_ASSERT_EQUAL_INT(NUM_DEVICES, readGroup(RDCFG, data, pecOk));
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        TEST_ASSERT_EQUAL_MEMORY(config[board], data[board], LTC_EMULATOR_REGISTER_SIZE);
+    }
+
+    // A board drops write data that fails its PEC and keeps its config
+    uint8_t tx[CYCLE_TX_SIZE];
+    uint8_t rx[CYCLE_TX_SIZE];
+    formatCommand(WRCFG, tx);
+    for (int board = NUM_DEVICES - 1, i = 4; board >= 0; board--, i += GROUP) {
+        config[board][1] = 0xA0 + board;
+        memcpy(&tx[i], config[board], LTC_EMULATOR_REGISTER_SIZE);
+        ltcEmulatorPec(&tx[i], LTC_EMULATOR_REGISTER_SIZE, &tx[i + LTC_EMULATOR_REGISTER_SIZE]);
+        if (board == 3) {
+            tx[i + 1] ^= 0x10;
+        }
+    }
+    transfer(tx, rx, sizeof(tx));
+    readGroup(RDCFG, data, pecOk);
+    TEST_ASSERT_EQUAL_HEX8(3, data[3][1]);
+    TEST_ASSERT_EQUAL_HEX8(0xA4, data[4][1]);
+    TEST_ASSERT_EQUAL_UINT32(1, emu.devices[3].writesRejected);
+
+    // A command with a bad PEC is ignored by every board
+    formatCommand(CLRCELL, tx);
+    tx[3] ^= 0x01;
+    transfer(tx, rx, 4);
+    TEST_ASSERT_EQUAL_UINT32(1, emu.commandPecErrors);
+}
+
+void test_cellsConvertInPairsAtTheDatasheetRate(void)
+{
+    float cells[NUM_DEVICES][LTC_EMULATOR_CELLS];
+    uint8_t tx[12];
+    uint8_t rx[12];
+
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0, 0);
+    sendCommand(CLRCELL);
+    sendCommand(ADCV);
+
+    // 2335 us for six pairs: C1/C7 and C2/C8 are done after 1 ms, C3/C9 isn't
+    const uint32_t start_us = now_us;
+    wait(1000);
+    ltcEmulatorAdvance(&emu, start_us + 1000);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, emu.devices[0].cells[2]);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, emu.devices[0].cells[8]);
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[0][1], emu.devices[0].cells[1] / 10000.0f);
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[0][7], emu.devices[0].cells[7] / 10000.0f);
+
+    // Poll ADC holds SDO low until the conversion finishes
+    formatCommand(PLADC, tx);
+    transfer(tx, rx, sizeof(tx));
+    TEST_ASSERT_EQUAL_HEX8(0x00, rx[4]);
+
+    // The firmware's conversion time covers the datasheet's
+    now_us = start_us + CONVERSION_TIME_7kHz_US;
+    transfer(tx, rx, sizeof(tx));
+    TEST_ASSERT_EQUAL_HEX8(0xFF, rx[4]);
+    TEST_ASSERT_EQUAL_INT(4 * NUM_DEVICES, readCells(cells));
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+            TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[board][cell], cells[board][cell]);
+        }
+    }
+
+    // Without REFON the reference has to power up first
+    writeSameConfig(GPIO_PULLDOWNS_OFF, 0, 0);
+    sendCommand(CLRCELL);
+    sendCommand(ADCV);
+    wait(CONVERSION_TIME_7kHz_US);
+    TEST_ASSERT_EQUAL_HEX16(0xFFFF, emu.devices[0].cells[0]);
+    wait(LTC_EMULATOR_T_REFUP_US);
+    TEST_ASSERT_NOT_EQUAL(0xFFFF, emu.devices[0].cells[11]);
+}
+
+void test_thermistorMuxOnGpio5(void)
+{
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+
+    wakeup(true);
+    writeSameConfig(MUX_CONFIG(3), 0, 0);
+    wait(1000);
+
+    // Converting straight after switching reads the previous channel
+    writeSameConfig(MUX_CONFIG(9), 0, 0);
+    sendCommand(ADAX_GPIO5);
+    wait(CONVERSION_TIME_SINGLE_7kHz_US);
+    readGroup(RDAUXB, data, pecOk);
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, muxVoltage(NULL, 5, 3, 0), (data[5][2] | (data[5][3] << 8)) / 10000.0f);
+
+    // As the firmware does it, the cell conversion gives the mux time to settle
+    writeSameConfig(MUX_CONFIG(12), 0, 0);
+    sendCommand(ADCV);
+    wait(CONVERSION_TIME_7kHz_US);
+    sendCommand(ADAX_GPIO5);
+    wait(CONVERSION_TIME_SINGLE_7kHz_US);
+    TEST_ASSERT_EQUAL_INT(NUM_DEVICES, readGroup(RDAUXB, data, pecOk));
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        const float volts = (data[board][2] | (data[board][3] << 8)) / 10000.0f;
+        TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, muxVoltage(NULL, board, 12, 0), volts);
+    }
+
+    // With its pull down on, GPIO5 reads zero
+    writeSameConfig((GPIO_PULLDOWNS_OFF & ~(1 << GPIO5_POS)) | REFON, 0, 0);
+    sendCommand(ADAX_GPIO5);
+    wait(CONVERSION_TIME_SINGLE_7kHz_US);
+    readGroup(RDAUXB, data, pecOk);
+    TEST_ASSERT_EQUAL_INT(0, data[0][2] | (data[0][3] << 8));
+}
+
+static void openWireReadings(uint16_t command, float cells[NUM_DEVICES][LTC_EMULATOR_CELLS])
+{
+    // Two ADOW commands, as the datasheet asks (NUM_OPEN_WIRE_TEST_VOLTAGE_READINGS)
+    for (int i = 0; i < 2; i++) {
+        wakeup(false);
+        sendCommand(command);
+        wait(CONVERSION_TIME_7kHz_US);
+    }
+    wakeup(false);
+    readCells(cells);
+}
+
+void test_openWireShowsUpAsTheFirmwareExpects(void)
+{
+    float pullup[NUM_DEVICES][LTC_EMULATOR_CELLS];
+    float pulldown[NUM_DEVICES][LTC_EMULATOR_CELLS];
+
+    emu.faults.openWire[2][3] = true;
+    emu.faults.openWire[5][0] = true;
+    emu.faults.openWire[7][LTC_EMULATOR_CELLS] = true;
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0, 0);
+    openWireReadings(ADOW_PULLUP, pullup);
+    openWireReadings(ADOW_PULLDOWN, pulldown);
+
+    // checkOpenCircuitCell: pull up minus pull down below -400 mV above an
+    // open input, pull up near zero for C0 and pull down near zero for the top
+    for (int board = 0; board < NUM_DEVICES; board++) {
+        for (int cell = 0; cell < LTC_EMULATOR_CELLS; cell++) {
+            const bool open = (board == 2 && cell == 3) || (board == 5 && cell == 0) ||
+                (board == 7 && cell == LTC_EMULATOR_CELLS - 1);
+            const float difference = pullup[board][cell] - pulldown[board][cell];
+            bool detected = difference < -0.4f;
+            if (cell == 0) {
+                detected |= pullup[board][cell] < 0.0002f;
+            }
+            if (cell == LTC_EMULATOR_CELLS - 1) {
+                detected |= pulldown[board][cell] < 0.0002f;
+            }
+            TEST_ASSERT_EQUAL(open, detected);
+        }
+    }
+}
+
+void test_brokenChainAndCorruptReads(void)
+{
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+
+    wakeup(true);
+    emu.faults.brokenFrom = 9;
+    emu.faults.corruptDevice = 4;
+    emu.faults.corruptReads = 1;
+    TEST_ASSERT_EQUAL_INT(8, readGroup(RDCFG, data, pecOk));
+    TEST_ASSERT_FALSE(pecOk[4]);
+    TEST_ASSERT_FALSE(pecOk[9]);
+    TEST_ASSERT_EQUAL_HEX8(0xFF, data[13][0]);
+
+    // A retry gets the corrupted board back, but not the ones cut off
+    TEST_ASSERT_EQUAL_INT(9, readGroup(RDCFG, data, pecOk));
+    TEST_ASSERT_TRUE(pecOk[4]);
+}
+
+void test_bitErrorsNeverPassPec(void)
+{
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+    uint32_t failed = 0;
+
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0, 0);
+    sendCommand(ADCV);
+    wait(CONVERSION_TIME_7kHz_US);
+    emu.faults.bitErrorRate = 2e-4f;
+    for (int i = 0; i < 2000; i++) {
+        failed += NUM_DEVICES - readGroup(RDCVA, data, pecOk);
+        for (int board = 0; board < NUM_DEVICES; board++) {
+            if (pecOk[board]) {
+                TEST_ASSERT_EQUAL_HEX8(emu.devices[board].cells[0] & 0xFF, data[board][0]);
+                TEST_ASSERT_EQUAL_HEX8(emu.devices[board].cells[2] >> 8, data[board][5]);
+            }
+        }
+        wait(100);
+    }
+    TEST_ASSERT_TRUE(emu.bitErrors > 0);
+    TEST_ASSERT_TRUE(failed > 0);
+    TEST_ASSERT_TRUE(emu.commandPecErrors > 0);
+}
+
+void test_portIdlesAndCoreSleeps(void)
+{
+    uint8_t data[NUM_DEVICES][LTC_EMULATOR_REGISTER_SIZE];
+    bool pecOk[NUM_DEVICES];
+
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0x01, 0);
+
+    // A command sent once the ports have idled is lost, it only wakes them
+    wait(LTC_EMULATOR_T_IDLE_US + 100);
+    TEST_ASSERT_EQUAL_INT(0, readGroup(RDCFG, data, pecOk));
+    TEST_ASSERT_EQUAL_UINT32(1, emu.ignoredTransfers);
+    wait(LTC_T_READY_US * NUM_DEVICES);
+    TEST_ASSERT_EQUAL_INT(NUM_DEVICES, readGroup(RDCFG, data, pecOk));
+
+    // The watchdog resets the config, including the discharge with no timer
+    wait(LTC_EMULATOR_T_SLEEP_US);
+    TEST_ASSERT_TRUE(emu.devices[0].asleep);
+    wakeup(true);
+    readGroup(RDCFG, data, pecOk);
+    TEST_ASSERT_EQUAL_HEX8(GPIO_PULLDOWNS_OFF, data[0][0]);
+    TEST_ASSERT_EQUAL_HEX8(0, data[0][4]);
+}
+
+void test_dischargeRunsUntilTheTimerExpires(void)
+{
+    // DCTO = 1, 30 s
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0x01, 0x10 | 0x02);
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 6, 0));
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 6, 9));
+    TEST_ASSERT_FALSE(ltcEmulatorDischarging(&emu, 6, 8));
+
+    // Carries on through the watchdog timeout, then stops at 30 s
+    for (int s = 0; s < 29; s++) {
+        wait(1000000);
+    }
+    TEST_ASSERT_TRUE(emu.devices[6].asleep);
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 6, 9));
+    wait(2000000);
+    TEST_ASSERT_FALSE(ltcEmulatorDischarging(&emu, 6, 9));
+
+    const float expected_C = cellVoltages[6][9] / DISCHARGE_OHMS * 30.0f;
+    TEST_ASSERT_FLOAT_WITHIN(expected_C * 0.04f, expected_C, emu.devices[6].discharged_C[9]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6f, 0.0f, emu.devices[6].discharged_C[8]);
+}
+
+void test_bleedingCellReadsLowOnlyWithDischargePermitted(void)
+{
+    float cells[NUM_DEVICES][LTC_EMULATOR_CELLS];
+    const float drop_V = cellVoltages[6][9] / DISCHARGE_OHMS * SENSE_OHMS;
+
+    // Cell 10 (DCC10) bleeding, DCTO = 1
+    wakeup(true);
+    writeSameConfig(GPIO_PULLDOWNS_OFF | REFON, 0x00, 0x10 | 0x02);
+
+    // DCP clear, as the firmware sends it: discharge pauses for the conversion
+    sendCommand(ADCV);
+    wait(CONVERSION_TIME_7kHz_US);
+    TEST_ASSERT_EQUAL_INT(4 * NUM_DEVICES, readCells(cells));
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[6][9], cells[6][9]);
+
+    sendCommand(ADCV | DCP);
+    wait(CONVERSION_TIME_7kHz_US);
+    TEST_ASSERT_EQUAL_INT(4 * NUM_DEVICES, readCells(cells));
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[6][9] - drop_V, cells[6][9]);
+    TEST_ASSERT_FLOAT_WITHIN(NOISE_V + 1e-4f, cellVoltages[6][8], cells[6][8]);
+    TEST_ASSERT_TRUE(ltcEmulatorDischarging(&emu, 6, 9));
+}
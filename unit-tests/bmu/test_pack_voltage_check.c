@@ -0,0 +1,101 @@
+#include "unity.h"
+
+#include "pack_voltage_check.h"
+
+/*
+ * Pack model: 140 cells at an OCV behind a series resistance, with VBatt
+ * sensed after the interconnect resistance. Checked every 100 ms like the
+ * battery task.
+ */
+
+#define NUM_CELLS (140)
+#define CELL_R (0.00486f)
+#define INTERCONNECT_R (0.01f)
+#define DT_S (0.1f)
+
+static PackVoltageCheck_t check;
+
+void setUp(void)
+{
+    PackVoltageCheck_Params_t params = {
+        .interconnectResistance_ohms = INTERCONNECT_R,
+        .packResistance_ohms = NUM_CELLS * CELL_R + INTERCONNECT_R,
+        .tolerance_V = 2.0f,
+        .toleranceRelative = 0.01f,
+        .acquisitionTime_s = 0.02f,
+        .faultTime_s = 2.0f,
+    };
+    packVoltageCheckInit(&check, &params);
+}
+
+void tearDown(void)
+{
+}
+
+static float sumOfCells(float ocv, float current)
+{
+    return NUM_CELLS * (ocv - current * CELL_R);
+}
+
+static float vBatt(float ocv, float current)
+{
+    return sumOfCells(ocv, current) - current * INTERCONNECT_R;
+}
+
+void test_consistentUnderLoad(void)
+{
+    for (int step = 0; step < 100; step++) {
+        float current = 200.0f;
+        TEST_ASSERT_FALSE(packVoltageCheckStep(&check, sumOfCells(3.8f, current),
+                                               vBatt(3.8f, current), current, 0.001f, DT_S));
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, check.residual_V);
+    TEST_ASSERT_FALSE(check.faulted);
+}
+
+void test_currentStepWithSkewDoesNotFault(void)
+{
+    // Cells read at the old current, VBatt sampled after a 250A step
+    for (int step = 0; step < 100; step++) {
+        float current = (step / 10) % 2 ? 250.0f : 0.0f;
+        float lastCurrent = ((step - 1) / 10) % 2 ? 250.0f : 0.0f;
+        if (step == 0) {
+            lastCurrent = current;
+        }
+        TEST_ASSERT_FALSE(packVoltageCheckStep(&check, sumOfCells(3.8f, lastCurrent),
+                                               vBatt(3.8f, current), current, 0.05f, DT_S));
+    }
+}
+
+void test_offsetFaultsOnceAfterFaultTime(void)
+{
+    int faults = 0;
+    int firstFault = -1;
+
+    for (int step = 0; step < 50; step++) {
+        // VBatt sense reading 15 V low
+        if (packVoltageCheckStep(&check, sumOfCells(3.8f, 50.0f), vBatt(3.8f, 50.0f) - 15.0f,
+                                 50.0f, 0.001f, DT_S)) {
+            faults++;
+            firstFault = (firstFault < 0) ? step : firstFault;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_INT(1, faults);
+    // 2 s of 100 ms steps, give or take float accumulation
+    TEST_ASSERT_TRUE(firstFault >= 19 && firstFault <= 20);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 15.0f, check.residual_V);
+
+    // Clears once back in tolerance
+    packVoltageCheckStep(&check, sumOfCells(3.8f, 50.0f), vBatt(3.8f, 50.0f), 50.0f, 0.001f, DT_S);
+    TEST_ASSERT_FALSE(check.faulted);
+}
+
+void test_shortGlitchDoesNotFault(void)
+{
+    for (int step = 0; step < 100; step++) {
+        float offset = (step % 15 < 5) ? 15.0f : 0.0f;
+        TEST_ASSERT_FALSE(packVoltageCheckStep(&check, sumOfCells(3.8f, 0.0f) + offset,
+                                               vBatt(3.8f, 0.0f), 0.0f, 0.001f, DT_S));
+    }
+}
@@ -0,0 +1,171 @@
+#include "unity.h"
+
+#include "precharge_fit.h"
+
+#include <math.h>
+
+/*
+ * Simulated precharge: the bus capacitance, with an optional leakage
+ * resistance, charged from the pack through the precharge resistor once the
+ * precharge relay closes. VBus and VBatt are read with ADC noise at a
+ * jittery ~1 ms. As in step 4, precharge completes on the measured VBus
+ * reaching 90 % of the pack, and the fit has to judge the bus before then.
+ */
+
+#define R_PRECHARGE (10000.0f)
+#define V_PACK (300.0f)
+#define R_PACK (0.3f)
+#define NOISE_V (1.0f)
+#define RELAY_CLOSE_S (0.015f)
+#define TIMEOUT_S (60.0f)
+
+static PrechargeFit_Params_t params;
+static PrechargeFit_t fit;
+
+static float noise(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return ((float)((*seed >> 16) & 0x7fff) / 0x7fff - 0.5f) * 2.0f;
+}
+
+void setUp(void)
+{
+    params = (PrechargeFit_Params_t){
+        .resistance_ohms = R_PRECHARGE,
+        .capacitanceMin_F = 100e-6f,
+        .capacitanceMax_F = 1000e-6f,
+        .completeFraction = 0.9f,
+        .leakageMinFraction = 0.95f,
+        .relayCloseTime_s = 0.03f,
+        .startRiseFraction = 0.02f,
+        .fitMinTime_s = 0.3f,
+        .settleTaus = 1.0f,
+    };
+}
+
+void tearDown(void)
+{
+}
+
+typedef struct {
+    PrechargeFit_Result_t result;
+    float resultTime_s;     // From the precharge relay being commanded
+    float completeTime_s;   // Measured VBus at the complete voltage, INFINITY if it never was
+} Run_t;
+
+static Run_t run(float C, float Rleak, float startVBus, unsigned seed)
+{
+    prechargeFitInit(&fit, &params);
+
+    Run_t out = {.result = PRECHARGE_FIT_CHARGING, .resultTime_s = INFINITY, .completeTime_s = INFINITY};
+    float VBus = startVBus;
+    const float dt = 1e-4f;
+    float nextSample = 0.0f;
+
+    for (uint32_t step = 1; step * dt < TIMEOUT_S; step++) {
+        const float t = step * dt;
+        // Bus, with the precharge relay closed after its delay
+        const float I = (t >= RELAY_CLOSE_S) ? (V_PACK - VBus) / (R_PRECHARGE + R_PACK) : 0.0f;
+        const float VBatt = V_PACK - I * R_PACK;
+        VBus += dt * (I - VBus / Rleak) / C;
+
+        if (t < nextSample) {
+            continue;
+        }
+        nextSample = t + 0.001f + 0.001f * fabsf(noise(&seed));
+
+        const float measuredVBus = VBus + NOISE_V * noise(&seed);
+        const float measuredVBatt = VBatt + NOISE_V * noise(&seed);
+        if (out.result == PRECHARGE_FIT_CHARGING) {
+            out.result = prechargeFitStep(&fit, measuredVBus, measuredVBatt, t);
+            if (out.result != PRECHARGE_FIT_CHARGING) {
+                out.resultTime_s = t;
+            }
+        }
+        if (!isfinite(out.completeTime_s) && measuredVBus >= params.completeFraction * V_PACK) {
+            out.completeTime_s = t;
+        }
+        if (out.result != PRECHARGE_FIT_CHARGING && isfinite(out.completeTime_s)) {
+            break;
+        }
+    }
+    return out;
+}
+
+void test_normalBusJudgedBeforeComplete(void)
+{
+    const float capacitances[] = {150e-6f, 300e-6f, 600e-6f, 900e-6f};
+
+    for (int c = 0; c < 4; c++) {
+        for (unsigned seed = 1; seed <= 10; seed++) {
+            Run_t r = run(capacitances[c], INFINITY, 0.0f, seed);
+
+            TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_NORMAL, r.result);
+            TEST_ASSERT_FLOAT_WITHIN(0.05f * capacitances[c], capacitances[c], fit.capacitance_F);
+            TEST_ASSERT_TRUE(isfinite(fit.finalFraction));
+            TEST_ASSERT_TRUE(r.resultTime_s <= r.completeTime_s);
+        }
+    }
+}
+
+void test_partlyChargedBus(void)
+{
+    // Step 3 allows up to 15 % on the bus before precharging
+    Run_t r = run(300e-6f, INFINITY, 0.15f * V_PACK, 3);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_NORMAL, r.result);
+    TEST_ASSERT_FLOAT_WITHIN(15e-6f, 300e-6f, fit.capacitance_F);
+}
+
+void test_capacitanceLow(void)
+{
+    Run_t r = run(40e-6f, INFINITY, 0.0f, 1);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_CAPACITANCE_LOW, r.result);
+    TEST_ASSERT_TRUE(fit.capacitance_F < params.capacitanceMin_F);
+    TEST_ASSERT_TRUE(r.resultTime_s <= r.completeTime_s);
+}
+
+void test_capacitanceHigh(void)
+{
+    Run_t r = run(3000e-6f, INFINITY, 0.0f, 1);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_CAPACITANCE_HIGH, r.result);
+    TEST_ASSERT_TRUE(r.resultTime_s < 1.0f);
+}
+
+void test_prechargeResistorOpen(void)
+{
+    // Bus never rises
+    prechargeFitInit(&fit, &params);
+    unsigned seed = 5;
+    PrechargeFit_Result_t result = PRECHARGE_FIT_CHARGING;
+    float t;
+    for (t = 0.0f; t < TIMEOUT_S && result == PRECHARGE_FIT_CHARGING; t += 0.001f) {
+        result = prechargeFitStep(&fit, NOISE_V * noise(&seed), V_PACK + NOISE_V * noise(&seed), t);
+    }
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_CAPACITANCE_HIGH, result);
+    TEST_ASSERT_TRUE(t < 2.0f);
+}
+
+void test_leakage(void)
+{
+    // 50k leakage settles at 83 %, the threshold never gets there and would time out
+    Run_t r = run(300e-6f, 50000.0f, 0.0f, 1);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_LEAKAGE, r.result);
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 50000.0f / (50000.0f + R_PRECHARGE), fit.finalFraction);
+    TEST_ASSERT_TRUE(r.resultTime_s < 5.0f);
+    TEST_ASSERT_FALSE(isfinite(r.completeTime_s));
+
+    // 150k settles at 94 %, reaches 90 % but is flagged before it does
+    r = run(300e-6f, 150000.0f, 0.0f, 2);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_LEAKAGE, r.result);
+    TEST_ASSERT_TRUE(r.resultTime_s <= r.completeTime_s);
+}
+
+void test_chargerBus(void)
+{
+    // Charger input is a small capacitance, charged in a few tens of ms
+    params.capacitanceMin_F = 0.0f;
+    params.capacitanceMax_F = 50e-6f;
+    Run_t r = run(5e-6f, INFINITY, 0.0f, 1);
+    TEST_ASSERT_EQUAL_INT(PRECHARGE_FIT_NORMAL, r.result);
+    TEST_ASSERT_TRUE(r.resultTime_s < 0.2f);
+}
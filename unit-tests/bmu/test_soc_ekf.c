@@ -0,0 +1,367 @@
+#include "unity.h"
+
+#include "soc_ekf.h"
+#include "ocv_lut.h"
+#include "state_of_charge_data.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Replay harness for the SOC EKF. Runs a trace through the EKF and through
+ * the estimator it replaces in socTask: the segment voltage LUT blended with
+ * coulomb counting, both started from the LUT at startup. Scores RMS/max SOC
+ * error and CPU time per step.
+ *
+ * By default the trace comes from a pack model that is not the EKF's: every
+ * cell has its own capacity, starting SOC and OCV offset, two RC branches, a
+ * resistance that rises as the pack heats, and OCV hysteresis, and the OCV
+ * curve is a smooth fit through the characterization points rather than the
+ * EKF's straight lines between them. The current sensor has an offset and a
+ * gain error. A recorded trace can be replayed instead by pointing
+ * SOC_EKF_TRACE at a csv with columns: time_s,current_A,cell_voltage_V,soc_ref
+ */
+
+#define TRACE_DT_S (0.2f)
+#define TRACE_LEN_S (1500.0f)
+#define TRACE_CAPACITY_AS (128050.0f)
+#define TRACE_CURRENT_BIAS_A (0.5f)
+#define TRACE_CURRENT_GAIN (1.01f)
+
+// Matches the pack, see ltc_chip.h
+#define NUM_CELLS 140
+#define NUM_SEGMENTS 7
+// Matches ADJUSTED_CELL_IR_DEFAULT
+#define ADJUSTED_CELL_IR (0.00486f)
+
+// CPU budget for one EKF step on the host; it runs every 200ms on the F7
+#define MAX_EKF_STEP_NS (20000.0)
+
+typedef struct {
+    double sumSq;
+    float maxErr;
+    unsigned count;
+    double cpu_s;
+} ReplayScore_t;
+
+typedef struct {
+    SocEkf_State_t ekf;
+    float coulombSocStart;
+    float integrated_As;
+    float lastTime;
+    ReplayScore_t ekfScore;
+    ReplayScore_t blendScore;
+} Replay_t;
+
+typedef struct {
+    float soc;
+    float capacity_As;
+    float ocvOffset;
+    float hysteresis;
+    float vFast;
+    float vSlow;
+} Cell_t;
+
+static uint32_t rngState;
+static Cell_t cells[NUM_CELLS];
+
+static float noise(float amplitude)
+{
+    rngState = rngState * 1664525u + 1013904223u;
+    return amplitude * (((float)(rngState >> 8) / (float)(1u << 24)) * 2.0f - 1.0f);
+}
+
+static void score(ReplayScore_t *s, float estimate, float reference)
+{
+    float err = fabsf(estimate - reference);
+    s->sumSq += err * err;
+    s->maxErr = err > s->maxErr ? err : s->maxErr;
+    s->count++;
+}
+
+static float rms(const ReplayScore_t *s)
+{
+    return s->count ? sqrtf(s->sumSq / s->count) : 0.0f;
+}
+
+static double nsPerStep(const ReplayScore_t *s)
+{
+    return s->count ? s->cpu_s * 1e9 / s->count : 0.0;
+}
+
+/*
+ * The estimator socTask publishes without the EKF: SOC from the IR adjusted
+ * segment voltage, blended with coulomb counting from the startup SOC
+ */
+static float blendSoc(const Replay_t *r, float current, float cellVoltage)
+{
+    float segmentVoltage = (cellVoltage + current * ADJUSTED_CELL_IR) * NUM_CELLS / NUM_SEGMENTS;
+    float vSoc = socLutSegmentVoltageToSoc(segmentVoltage);
+    float iSoc = r->coulombSocStart - r->integrated_As / TRACE_CAPACITY_AS;
+    iSoc = iSoc > 1.0f ? 1.0f : iSoc;
+    iSoc = iSoc < 0.0f ? 0.0f : iSoc;
+    float weight = socLutVoltageWeight(vSoc);
+    return vSoc * weight + iSoc * (1.0f - weight);
+}
+
+static void replayInit(Replay_t *r, float time_s, float cellVoltage)
+{
+    float startupSoc = socLutSegmentVoltageToSoc(cellVoltage * NUM_CELLS / NUM_SEGMENTS);
+    SocEkf_Params_t params;
+    socEkfDefaultParams(&params);
+    params.capacity_As = TRACE_CAPACITY_AS;
+    socEkfInit(&r->ekf, &params, startupSoc);
+    r->coulombSocStart = startupSoc;
+    r->integrated_As = 0.0f;
+    r->lastTime = time_s;
+    r->ekfScore = (ReplayScore_t){0};
+    r->blendScore = (ReplayScore_t){0};
+}
+
+static void replaySample(Replay_t *r, float time_s, float current, float voltage, float socRef)
+{
+    float dt = time_s - r->lastTime;
+    r->lastTime = time_s;
+
+    clock_t start = clock();
+    socEkfStep(&r->ekf, current, voltage, dt);
+    r->ekfScore.cpu_s += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    r->integrated_As += current * dt;
+    float blend = blendSoc(r, current, voltage);
+    r->blendScore.cpu_s += (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    score(&r->ekfScore, r->ekf.soc, socRef);
+    score(&r->blendScore, blend, socRef);
+}
+
+/*
+ * Monotone cubic (Fritsch-Carlson) through the characterization points, so
+ * the truth curve bends between them where the EKF's is straight
+ */
+static float truthOcv(float soc)
+{
+    const float *x = ocvLutSoc;
+    const float *y = ocvLutVoltage;
+    unsigned i = 1;
+
+    soc = soc > 1.0f ? 1.0f : soc;
+    soc = soc < 0.0f ? 0.0f : soc;
+    while (i < OCV_LUT_LEN - 1 && soc > x[i])
+    {
+        i++;
+    }
+
+    float h = x[i] - x[i-1];
+    float delta = (y[i] - y[i-1]) / h;
+    float m[2];
+    for (int k = 0; k < 2; k++)
+    {
+        unsigned j = i - 1 + k;
+        if (j == 0 || j == OCV_LUT_LEN - 1)
+        {
+            m[k] = delta;
+            continue;
+        }
+        float d0 = (y[j] - y[j-1]) / (x[j] - x[j-1]);
+        float d1 = (y[j+1] - y[j]) / (x[j+1] - x[j]);
+        m[k] = d0 * d1 <= 0.0f ? 0.0f : 2.0f / (1.0f / d0 + 1.0f / d1);
+    }
+
+    float t = (soc - x[i-1]) / h;
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return (2*t3 - 3*t2 + 1) * y[i-1] + (t3 - 2*t2 + t) * h * m[0]
+         + (-2*t3 + 3*t2) * y[i] + (t3 - t2) * h * m[1];
+}
+
+static void packInit(float soc, float restingPolarization)
+{
+    for (int c = 0; c < NUM_CELLS; c++)
+    {
+        cells[c].soc = soc + noise(0.01f);
+        cells[c].capacity_As = TRACE_CAPACITY_AS * (1.0f + noise(0.03f));
+        cells[c].ocvOffset = noise(0.004f);
+        cells[c].hysteresis = 0.0f;
+        cells[c].vFast = 0.0f;
+        cells[c].vSlow = restingPolarization;
+    }
+}
+
+/*
+ * Advance the pack by dt with the true current, return the average cell
+ * voltage the LTCs measure and the pack's true SOC
+ */
+static float packStep(float current, float temperatureRise, float dt, float *trueSoc)
+{
+    const float r0 = 0.0048f * (1.0f + 0.02f * temperatureRise);
+    const float r1 = 0.0018f;
+    const float tau1 = 6.0f;
+    const float r2 = 0.0022f;
+    const float tau2 = 90.0f;
+    const float hysteresisV = 0.008f;
+    const float hysteresisAs = 300.0f;
+
+    float a1 = expf(-dt / tau1);
+    float a2 = expf(-dt / tau2);
+    float voltageSum = 0.0f;
+    float socSum = 0.0f;
+    for (int c = 0; c < NUM_CELLS; c++)
+    {
+        Cell_t *cell = &cells[c];
+        cell->soc -= current * dt / cell->capacity_As;
+        cell->vFast = a1 * cell->vFast + r1 * (1.0f - a1) * current;
+        cell->vSlow = a2 * cell->vSlow + r2 * (1.0f - a2) * current;
+        // Relaxes towards -hysteresisV discharging and +hysteresisV charging
+        float target = current > 0.0f ? -hysteresisV : (current < 0.0f ? hysteresisV : cell->hysteresis);
+        cell->hysteresis += (target - cell->hysteresis) * fminf(1.0f, fabsf(current) * dt / hysteresisAs);
+
+        float v = truthOcv(cell->soc) + cell->ocvOffset + cell->hysteresis
+                - cell->vFast - cell->vSlow - r0 * current;
+        voltageSum += v + noise(0.003f);
+        socSum += cell->soc;
+    }
+    *trueSoc = socSum / NUM_CELLS;
+    return voltageSum / NUM_CELLS;
+}
+
+/*
+ * Endurance run from socStart. With a nonzero restingPolarization the pack
+ * hasn't relaxed from the previous drive when the BMU starts, so the startup
+ * voltage SOC is off and coulomb counting carries that error
+ */
+static void runSyntheticTrace(Replay_t *r, float socStart, float restingPolarization)
+{
+    float soc;
+
+    rngState = 1;
+    packInit(socStart, restingPolarization);
+    replayInit(r, 0.0f, packStep(0.0f, 0.0f, TRACE_DT_S, &soc));
+
+    for (float t = TRACE_DT_S; t <= TRACE_LEN_S; t += TRACE_DT_S)
+    {
+        // Lap-like load: sustained draw with acceleration peaks and regen
+        float current = 60.0f + 80.0f * sinf(2.0f * (float)M_PI * t / 20.0f);
+        if (fmodf(t, 20.0f) > 16.0f)
+        {
+            current = -20.0f;
+        }
+
+        float voltage = packStep(current, 15.0f * t / TRACE_LEN_S, TRACE_DT_S, &soc);
+        float measured = current * TRACE_CURRENT_GAIN + TRACE_CURRENT_BIAS_A;
+        replaySample(r, t, measured, voltage, soc);
+    }
+}
+
+static int runRecordedTrace(Replay_t *r, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[128];
+    float t, current, voltage, socRef;
+    int started = 0;
+
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "%f,%f,%f,%f", &t, &current, &voltage, &socRef) != 4)
+        {
+            continue; // header or malformed line
+        }
+        if (!started)
+        {
+            replayInit(r, t, voltage);
+            started = 1;
+            continue;
+        }
+        replaySample(r, t, current, voltage, socRef);
+    }
+    fclose(f);
+    return started;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_ocv_lut_monotonic()
+{
+    for (unsigned i = 1; i < OCV_LUT_LEN; i++)
+    {
+        TEST_ASSERT_TRUE(ocvLutSoc[i] > ocvLutSoc[i-1]);
+        TEST_ASSERT_TRUE(ocvLutVoltage[i] > ocvLutVoltage[i-1]);
+    }
+}
+
+void test_ocv_lut_matches_segment_lut()
+{
+    // Everywhere the segment LUTs increase: the low LUT, the mid LUT from the
+    // low cutoff, and the top of the high LUT
+    const float ranges[][2] = {{2.71f, 3.11f}, {3.28f, 3.81f}, {4.055f, 4.065f}};
+
+    for (unsigned r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        for (float v = ranges[r][0]; v <= ranges[r][1]; v += 0.001f)
+        {
+            float lutSoc = socLutSegmentVoltageToSoc(v * SOC_LUT_CELLS_PER_SEGMENT);
+            TEST_ASSERT_FLOAT_WITHIN(2e-4f, lutSoc, ocvLutOcvToSoc(v));
+        }
+    }
+    // Between them the LUTs are flat, so the EKF is within that flat step
+    TEST_ASSERT_FLOAT_WITHIN(0.025f, socLutSegmentVoltageToSoc(3.2f * SOC_LUT_CELLS_PER_SEGMENT),
+                             ocvLutOcvToSoc(3.2f));
+    TEST_ASSERT_FLOAT_WITHIN(0.003f, socLutSegmentVoltageToSoc(3.9f * SOC_LUT_CELLS_PER_SEGMENT),
+                             ocvLutOcvToSoc(3.9f));
+}
+
+void test_ekf_rest_converges_to_ocv()
+{
+    SocEkf_State_t ekf;
+    SocEkf_Params_t params;
+    socEkfDefaultParams(&params);
+    socEkfInit(&ekf, &params, 0.8f);
+
+    float v = ocvLutSocToOcv(0.5f, NULL);
+    for (int i = 0; i < 300; i++)
+    {
+        socEkfStep(&ekf, 0.0f, v, TRACE_DT_S);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.02f, 0.5f, ekf.soc);
+}
+
+void test_ekf_bounded_from_relaxed_start()
+{
+    Replay_t r;
+    runSyntheticTrace(&r, 0.9f, 0.0f);
+
+    // Starting relaxed, counting from the LUT is better (about 1% rms): the
+    // EKF keeps using the voltage through the middle of the curve, where the
+    // hysteresis and the second time constant it doesn't model bias it by a
+    // few percent. That's why it isn't enabled yet
+    TEST_ASSERT_TRUE(rms(&r.blendScore) < 0.02f);
+    TEST_ASSERT_TRUE(rms(&r.ekfScore) < 0.05f);
+    TEST_ASSERT_TRUE(r.ekfScore.maxErr < 0.08f);
+}
+
+void test_ekf_beats_blend_from_unrelaxed_start()
+{
+    Replay_t r;
+    const char *path = getenv("SOC_EKF_TRACE");
+
+    if (path == NULL || !runRecordedTrace(&r, path))
+    {
+        // Cells still 40mV below their OCV from the last stint
+        runSyntheticTrace(&r, 0.9f, 0.04f);
+    }
+
+    TEST_ASSERT_TRUE(rms(&r.ekfScore) < rms(&r.blendScore));
+    TEST_ASSERT_TRUE(rms(&r.ekfScore) < 0.06f);
+    TEST_ASSERT_TRUE(nsPerStep(&r.ekfScore) < MAX_EKF_STEP_NS);
+}
@@ -0,0 +1,156 @@
+#include "unity.h"
+
+#include "state_of_power.h"
+#include "ocv_lut.h"
+
+#include <math.h>
+
+/*
+ * Checks the state of power limits against a first order equivalent circuit
+ * model of a series cell group: holding the computed current for the horizon
+ * must keep the cell inside its voltage window, and should use most of it.
+ */
+
+#define MODEL_DT_S (0.01f)
+#define NUM_SERIES (140)
+
+static SOP_Params_t params;
+
+static void defaultParams(void)
+{
+    params = (SOP_Params_t){
+        .cellVoltageMin = 2.8f,
+        .cellVoltageMax = 4.2f,
+        .cellTempMax = 55.0f,
+        .dischargeDerateTemp = 45.0f,
+        .chargeTempMin = 0.0f,
+        .chargeDerateTemp = 5.0f,
+        .capacity_As = 128050.0f,
+        .r0_ohms = 0.00486f,
+        .r1_ohms = 0.003f,
+        .tau_s = 30.0f,
+        .thermalMass_JperK = 1034.2f * 0.496f,
+        .thermalResistance_ohms = 0.01f,
+        .maxDischargeCurrent = 1000.0f,
+        .maxChargeCurrent = 1000.0f,
+        .numSeriesCells = NUM_SERIES,
+    };
+}
+
+static SOP_Inputs_t restingPack(float soc, float temp)
+{
+    float ocv = ocvLutSocToOcv(soc, NULL);
+    return (SOP_Inputs_t){
+        .ocvMin = ocv,
+        .ocvMax = ocv,
+        .tempMax = temp,
+        .tempMin = temp,
+        .soc = soc,
+        .packOcv = ocv * NUM_SERIES,
+    };
+}
+
+/* Terminal voltage after holding current (positive discharge) for horizon_s */
+static float modelTerminalVoltage(float soc, float current, float horizon_s)
+{
+    float vrc = 0.0f;
+    for (float t = 0.0f; t < horizon_s; t += MODEL_DT_S)
+    {
+        soc -= current * MODEL_DT_S / params.capacity_As;
+        vrc += (params.r1_ohms * current - vrc) * MODEL_DT_S / params.tau_s;
+    }
+    return ocvLutSocToOcv(soc, NULL) - vrc - params.r0_ohms * current;
+}
+
+void setUp()
+{
+    defaultParams();
+}
+
+void tearDown() {}
+
+void test_discharge_limit_holds_voltage_window()
+{
+    const float horizons[] = {SOP_SHORT_HORIZON_S, SOP_LONG_HORIZON_S};
+    const float socs[] = {0.2f, 0.5f, 0.9f};
+
+    for (unsigned h = 0; h < 2; h++)
+    {
+        for (unsigned i = 0; i < 3; i++)
+        {
+            SOP_Inputs_t in = restingPack(socs[i], 25.0f);
+            SOP_Limits_t limits;
+            sopCompute(&params, &in, horizons[h], &limits);
+
+            float v = modelTerminalVoltage(socs[i], limits.dischargeCurrent, horizons[h]);
+            // OCV drop over the horizon isn't in the limit, so allow a little
+            // undershoot, but the limit shouldn't leave much on the table
+            TEST_ASSERT_FLOAT_WITHIN(0.05f, params.cellVoltageMin, v);
+        }
+    }
+}
+
+void test_charge_limit_holds_voltage_window()
+{
+    SOP_Inputs_t in = restingPack(0.5f, 25.0f);
+    SOP_Limits_t limits;
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &limits);
+
+    float v = modelTerminalVoltage(0.5f, -limits.chargeCurrent, SOP_SHORT_HORIZON_S);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, params.cellVoltageMax, v);
+}
+
+void test_long_horizon_is_more_conservative()
+{
+    SOP_Inputs_t in = restingPack(0.6f, 30.0f);
+    SOP_Limits_t shortLimits, longLimits;
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &shortLimits);
+    sopCompute(&params, &in, SOP_LONG_HORIZON_S, &longLimits);
+
+    TEST_ASSERT_TRUE(longLimits.dischargeCurrent < shortLimits.dischargeCurrent);
+    TEST_ASSERT_TRUE(longLimits.dischargePower < shortLimits.dischargePower);
+    TEST_ASSERT_TRUE(longLimits.chargeCurrent < shortLimits.chargeCurrent);
+}
+
+void test_hot_or_empty_pack_is_protected()
+{
+    SOP_Limits_t cool, hot, empty;
+    SOP_Inputs_t in = restingPack(0.8f, 25.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &cool);
+
+    in = restingPack(0.8f, 52.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &hot);
+    TEST_ASSERT_TRUE(hot.dischargeCurrent < 0.5f * cool.dischargeCurrent);
+
+    in = restingPack(0.8f, 56.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &hot);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, hot.dischargeCurrent);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, hot.chargeCurrent);
+
+    in = restingPack(0.02f, 25.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &empty);
+    TEST_ASSERT_TRUE(empty.dischargeCurrent < 0.5f * cool.dischargeCurrent);
+}
+
+void test_no_charge_when_cold_or_full()
+{
+    SOP_Limits_t limits;
+    SOP_Inputs_t in = restingPack(0.5f, -5.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &limits);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, limits.chargeCurrent);
+    TEST_ASSERT_TRUE(limits.dischargeCurrent > 0.0f);
+
+    in = restingPack(1.0f, 25.0f);
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &limits);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, limits.chargeCurrent);
+}
+
+void test_hardware_limit_caps_current()
+{
+    params.maxDischargeCurrent = 100.0f;
+    SOP_Inputs_t in = restingPack(0.9f, 25.0f);
+    SOP_Limits_t limits;
+    sopCompute(&params, &in, SOP_SHORT_HORIZON_S, &limits);
+    TEST_ASSERT_EQUAL_FLOAT(100.0f, limits.dischargeCurrent);
+    TEST_ASSERT_FLOAT_WITHIN(1.0f, 100.0f * (in.packOcv - 100.0f * NUM_SERIES * (params.r0_ohms + params.r1_ohms * (1.0f - expf(-2.0f / 30.0f)))), limits.dischargePower);
+}
@@ -0,0 +1,220 @@
+#include "unity.h"
+
+#include "thermal_estimator.h"
+
+#include <math.h>
+
+/*
+ * Simulated pack: two segments of thermal nodes in an air stream that warms
+ * along the segment, each node with its own cooling (position in the flow)
+ * and coupled to its neighbours. Driven with an endurance like current
+ * profile and the fans following the hottest cell. Some thermistors are
+ * failed and their estimates are compared with the simulated temperatures.
+ */
+
+#define SEGMENTS (2)
+#define PER_SEGMENT (27)
+#define CHANNELS (SEGMENTS * PER_SEGMENT)
+#define DT_S (0.1f)
+#define SIM_S (1800.0f)
+
+#define HEAT_R (0.0036f)
+#define HEAT_C (2600.0f)
+#define G_FAN_OFF (0.5f)
+#define G_FAN_FULL (3.0f)
+#define G_NEIGHBOUR (0.5f)
+#define INLET_C (25.0f)
+#define AIR_RISE_C (3.0f)
+
+static ThermalEstimator_t est;
+static ThermalEstimator_Params_t params;
+static float trueTemp[CHANNELS];
+static float coolingScale[CHANNELS];
+
+static float noise(unsigned *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return ((float)((*seed >> 16) & 0x7fff) / 0x7fff - 0.5f) * 2.0f;
+}
+
+void setUp(void)
+{
+    params = (ThermalEstimator_Params_t){
+        .numChannels = CHANNELS,
+        .channelsPerSegment = PER_SEGMENT,
+        .heatingResistance_ohms = HEAT_R,
+        .heatCapacity_JperK = HEAT_C,
+        .coolingFanOff_WperK = G_FAN_OFF,
+        .coolingFanFull_WperK = G_FAN_FULL,
+        .neighbourCoupling_WperK = G_NEIGHBOUR,
+        .processNoise_K2ps = 0.01f,
+        .neighbourNoise_K2 = 1.0f,
+        .sensorNoise_K2 = 0.0625f,
+        .minValid_C = -30.0f,
+        .maxValid_C = 120.0f,
+    };
+    thermalEstimatorInit(&est, &params);
+
+    unsigned seed = 1;
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        trueTemp[ch] = INLET_C;
+        coolingScale[ch] = 1.0f + 0.2f * noise(&seed);
+    }
+}
+
+void tearDown(void)
+{
+}
+
+static float current(float t)
+{
+    // 20 s laps of 15 s at 150 A and 5 s of 40 A regen
+    return fmodf(t, 20.0f) < 15.0f ? 150.0f : -40.0f;
+}
+
+static float fanDuty(void)
+{
+    float max = 0.0f;
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        max = fmaxf(max, trueTemp[ch]);
+    }
+    return fminf(fmaxf((max - 25.0f) / 10.0f, 0.0f), 1.0f);
+}
+
+static void simulateStep(float I, float duty)
+{
+    float next[CHANNELS];
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        int pos = ch % PER_SEGMENT;
+        float air = INLET_C + AIR_RISE_C * pos / PER_SEGMENT;
+        float G = (G_FAN_OFF + duty * G_FAN_FULL) * coolingScale[ch];
+        float flow = I * I * HEAT_R - G * (trueTemp[ch] - air);
+        if (pos > 0) {
+            flow += G_NEIGHBOUR * (trueTemp[ch - 1] - trueTemp[ch]);
+        }
+        if (pos < PER_SEGMENT - 1) {
+            flow += G_NEIGHBOUR * (trueTemp[ch + 1] - trueTemp[ch]);
+        }
+        next[ch] = trueTemp[ch] + DT_S * flow / HEAT_C;
+    }
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        trueTemp[ch] = next[ch];
+    }
+}
+
+typedef struct {
+    float rms;
+    float maxError;
+    float outsideBound; // Fraction of samples where truth exceeds the 3 sigma bound
+} Accuracy_t;
+
+static Accuracy_t run(const int failed[], int numFailed)
+{
+    unsigned seed = 7;
+    float measured[CHANNELS];
+    double sumSq = 0.0;
+    float maxError = 0.0f;
+    int samples = 0;
+    int outside = 0;
+
+    for (float t = 0.0f; t < SIM_S; t += DT_S) {
+        float I = current(t);
+        float duty = fanDuty();
+        simulateStep(I, duty);
+
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            measured[ch] = trueTemp[ch] + 0.25f * noise(&seed);
+        }
+        for (int i = 0; i < numFailed; i++) {
+            measured[failed[i]] = -40.0f; // Open thermistor
+        }
+        thermalEstimatorStep(&est, measured, I, duty, DT_S);
+
+        if (t < SIM_S / 2) {
+            continue;
+        }
+        for (int i = 0; i < numFailed; i++) {
+            int ch = failed[i];
+            float error = est.temperature_C[ch] - trueTemp[ch];
+            sumSq += error * error;
+            maxError = fmaxf(maxError, fabsf(error));
+            if (trueTemp[ch] > thermalEstimatorUpperBound(&est, ch, 3.0f)
+                || trueTemp[ch] < thermalEstimatorLowerBound(&est, ch, 3.0f)) {
+                outside++;
+            }
+            samples++;
+        }
+    }
+
+    return (Accuracy_t){
+        .rms = sqrtf(sumSq / samples),
+        .maxError = maxError,
+        .outsideBound = (float)outside / samples,
+    };
+}
+
+void test_singleFailedChannels(void)
+{
+    const int failed[] = {5, 13, 40};
+    Accuracy_t acc = run(failed, 3);
+
+    TEST_ASSERT_EQUAL_UINT32(3, est.numFailed);
+    TEST_ASSERT_TRUE(est.failed[5] && est.failed[13] && est.failed[40]);
+    TEST_ASSERT_TRUE(acc.rms < 1.5f);
+    TEST_ASSERT_TRUE(acc.maxError < 3.0f);
+    TEST_ASSERT_TRUE(acc.outsideBound < 0.01f);
+}
+
+void test_adjacentFailedChannels(void)
+{
+    // 30 - 32 failed, 31 has no working neighbour and is corrected towards 29 and 33
+    const int failed[] = {30, 31, 32};
+    Accuracy_t acc = run(failed, 3);
+
+    TEST_ASSERT_TRUE(acc.rms < 1.5f);
+    TEST_ASSERT_TRUE(acc.maxError < 3.0f);
+    TEST_ASSERT_TRUE(acc.outsideBound < 0.01f);
+    // Bounds are wider than for a channel with working neighbours
+    TEST_ASSERT_TRUE(est.variance_K2[31] > params.neighbourNoise_K2);
+    TEST_ASSERT_TRUE(est.variance_K2[30] > params.neighbourNoise_K2);
+}
+
+// THERMAL_MAX_BOUND_K, the widest bound the BMU derates on instead of faulting
+#define MAX_BOUND_K (10.0f)
+
+static float bound(int ch)
+{
+    return (thermalEstimatorUpperBound(&est, ch, 3.0f) - thermalEstimatorLowerBound(&est, ch, 3.0f)) / 2.0f;
+}
+
+void test_boundOnlyOutgrowsLimitWithoutWorkingChannels(void)
+{
+    // 5 and 13 - 15 in the first segment, the whole second segment
+    int failed[4 + PER_SEGMENT] = {5, 13, 14, 15};
+    for (int i = 0; i < PER_SEGMENT; i++) {
+        failed[4 + i] = PER_SEGMENT + i;
+    }
+    run(failed, 4 + PER_SEGMENT);
+
+    TEST_ASSERT_TRUE(bound(5) <= MAX_BOUND_K);
+    TEST_ASSERT_TRUE(bound(13) <= MAX_BOUND_K);
+    TEST_ASSERT_TRUE(bound(14) <= MAX_BOUND_K);
+    // Model only, the variance has grown over the run
+    TEST_ASSERT_TRUE(bound(PER_SEGMENT + PER_SEGMENT / 2) > MAX_BOUND_K);
+}
+
+void test_workingChannelsFollowReadings(void)
+{
+    float measured[CHANNELS];
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        measured[ch] = 30.0f + ch * 0.1f;
+    }
+    measured[10] = 150.0f; // Shorted
+    thermalEstimatorStep(&est, measured, 0.0f, 0.0f, DT_S);
+    thermalEstimatorStep(&est, measured, 0.0f, 0.0f, DT_S);
+
+    TEST_ASSERT_EQUAL_FLOAT(30.0f, est.temperature_C[0]);
+    TEST_ASSERT_EQUAL_FLOAT(30.0f, est.inlet_C);
+    TEST_ASSERT_TRUE(est.failed[10]);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 31.0f, est.temperature_C[10]);
+}
@@ -2,7 +2,8 @@
 #define FAKE_FREERTOS_H
 #include "fake_hal_defs.h"
 
-#define pdMS_TO_TICKS(ms) (ms * 1000)
+// 1 kHz tick, as configTICK_RATE_HZ on the boards
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
 #define __weak  __attribute__((weak)) 
 
 
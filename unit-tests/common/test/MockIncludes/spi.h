@@ -1,4 +1,20 @@
-#ifndef FAKE_GPIO_H
-#define FAKE_GPIO_H
+#ifndef FAKE_SPI_H
+#define FAKE_SPI_H
+#include <stdint.h>
+#include "fake_hal_defs.h"
+#include "gpio.h"
 
-#endif
\ No newline at end of file
+typedef struct
+{
+	uint32_t Instance;
+} SPI_HandleTypeDef;
+
+extern SPI_HandleTypeDef hspi1;
+extern SPI_HandleTypeDef hspi4;
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+                                          uint32_t Timeout);
+
+#endif
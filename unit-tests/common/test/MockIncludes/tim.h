@@ -21,6 +21,30 @@ typedef void (*TimerCallbackFunction_t)( TimerHandle_t xTimer );
 
 TickType_t xTaskGetTickCount( void );
 
+typedef struct
+{
+	volatile uint32_t CNT;
+	volatile uint32_t ARR;
+} TIM_TypeDef;
+
+typedef struct
+{
+	TIM_TypeDef *Instance;
+} TIM_HandleTypeDef;
+
+#define __HAL_TIM_SetCounter(__HANDLE__, __COUNTER__) ((__HANDLE__)->Instance->CNT = (__COUNTER__))
+#define __HAL_TIM_SetAutoreload(__HANDLE__, __AUTORELOAD__) ((__HANDLE__)->Instance->ARR = (__AUTORELOAD__))
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim);
+
+// Busy waits poll the counter through the instance, so the instance is
+// looked up on every read and a test can run its clock from there
+TIM_TypeDef *fake_timer_instance(TIM_HandleTypeDef *htim);
+
+extern TIM_HandleTypeDef htim9;
+#define TIM9 (fake_timer_instance(&htim9))
+
 void fake_mock_init_timers(void);
 
 TimerHandle_t xTimerCreate(	const char * const pcTimerName,
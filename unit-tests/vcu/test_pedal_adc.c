@@ -0,0 +1,231 @@
+#include "unity.h"
+
+#include "pedal_adc.h"
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * Raw to filtered behaviour of the pedal ADC decimation with injected noise.
+ * Blocks are laid out as the DMA writes them: OVERSAMPLE sequences of
+ * CHANNELS conversions. The "raw" reading to compare against is the last
+ * sequence of each block, which is what the loop used to read when the ADC
+ * did a single sequence per period.
+ *
+ * The throttle calibration is copied from brakeAndThrottle.h, which needs
+ * the HAL: 228 counts of throttle A cover the pedal's travel, so the 15 %
+ * APPS tolerance is only 34 counts and a single spike used to trip it.
+ */
+
+#define CHANNELS 5
+#define OVERSAMPLE 20
+#define TRIM 2
+#define THROTTLE_A 0
+#define THROTTLE_B 1
+
+#define THROTT_A_LOW 2272
+#define THROTT_A_HIGH 2500
+#define THROTT_B_LOW 2160
+#define THROTT_B_HIGH 2405
+#define DEADZONE 200
+#define TPS_TOLERANCE_PERCENT 15
+
+#define NOISE_SIGMA 8.0f
+#define SPIKE_COUNTS 300
+#define SPIKE_CHANCE_PER_MILLE 5
+#define SIM_BLOCKS 2000
+
+static PedalAdc_t adc;
+static uint32_t block[OVERSAMPLE * CHANNELS];
+static uint32_t out[CHANNELS];
+static unsigned seed;
+
+static float uniform(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return ((seed >> 8) & 0xffffff) / (float)0x1000000;
+}
+
+// Approximately normal: the sum of twelve uniforms, less six
+static float gaussian(float sigma)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < 12; i++) {
+        sum += uniform();
+    }
+    return (sum - 6.0f) * sigma;
+}
+
+static uint32_t noisy(float value, float sigma, bool spikes)
+{
+    float sample = value + gaussian(sigma);
+    if (spikes && uniform() * 1000 < SPIKE_CHANCE_PER_MILLE) {
+        sample += uniform() < 0.5f ? SPIKE_COUNTS : -SPIKE_COUNTS;
+    }
+    if (sample < 0.0f) {
+        sample = 0.0f;
+    } else if (sample > 4095.0f) {
+        sample = 4095.0f;
+    }
+    return (uint32_t)(sample + 0.5f);
+}
+
+static void fillBlock(const float *values, float sigma, bool spikes)
+{
+    for (int i = 0; i < OVERSAMPLE; i++) {
+        for (int ch = 0; ch < CHANNELS; ch++) {
+            block[i * CHANNELS + ch] = noisy(values[ch], sigma, spikes);
+        }
+    }
+}
+
+static float throttlePercentA(uint32_t counts)
+{
+    return 100.0f * ((float)counts - THROTT_A_LOW) / (THROTT_A_HIGH - THROTT_A_LOW);
+}
+
+static float throttlePercentB(uint32_t counts)
+{
+    return 100.0f - 100.0f * ((float)counts - THROTT_B_LOW) / (THROTT_B_HIGH - THROTT_B_LOW);
+}
+
+// The checks getNewThrottle faults or disables the throttle on
+static bool appsTrips(uint32_t a, uint32_t b)
+{
+    if (a > THROTT_A_HIGH + DEADZONE || a < THROTT_A_LOW - DEADZONE
+        || b > THROTT_B_HIGH + DEADZONE || b < THROTT_B_LOW - DEADZONE) {
+        return true;
+    }
+    return fabsf(throttlePercentA(a) - throttlePercentB(b)) >= TPS_TOLERANCE_PERCENT;
+}
+
+static void halfThrottle(float *values)
+{
+    values[THROTTLE_A] = (THROTT_A_LOW + THROTT_A_HIGH) / 2.0f;
+    values[THROTTLE_B] = (THROTT_B_LOW + THROTT_B_HIGH) / 2.0f;
+    values[2] = 1130;
+    values[3] = 2048;
+    values[4] = 400;
+}
+
+void setUp(void)
+{
+    seed = 11;
+    pedalAdcInit(&adc, CHANNELS, OVERSAMPLE, TRIM);
+}
+
+void tearDown(void)
+{
+}
+
+void test_initClampsParameters(void)
+{
+    pedalAdcInit(&adc, 20, 100, 60);
+    TEST_ASSERT_EQUAL_UINT32(PEDAL_ADC_MAX_CHANNELS, adc.channels);
+    TEST_ASSERT_EQUAL_UINT32(PEDAL_ADC_MAX_OVERSAMPLE, adc.oversample);
+    TEST_ASSERT_EQUAL_UINT32((PEDAL_ADC_MAX_OVERSAMPLE - 1) / 2, adc.trim);
+}
+
+void test_channelsDeinterleavedWithoutNoise(void)
+{
+    const float values[CHANNELS] = {2300, 2200, 1100, 4095, 0};
+    fillBlock(values, 0.0f, false);
+    pedalAdcDecimate(&adc, block, out);
+
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        TEST_ASSERT_EQUAL_UINT32((uint32_t)values[ch], out[ch]);
+        TEST_ASSERT_EQUAL_UINT32((uint32_t)values[ch], adc.stats[ch].value);
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, adc.stats[ch].noiseRms);
+        TEST_ASSERT_EQUAL_UINT32(0, adc.stats[ch].spikes);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, adc.blocks);
+}
+
+void test_spikesTrimmedButCounted(void)
+{
+    float values[CHANNELS];
+    halfThrottle(values);
+    fillBlock(values, 0.0f, false);
+    // Two spikes either way, as many as are trimmed
+    block[3 * CHANNELS + THROTTLE_A] += 1000;
+    block[9 * CHANNELS + THROTTLE_A] += 700;
+    block[12 * CHANNELS + THROTTLE_A] -= 900;
+    block[19 * CHANNELS + THROTTLE_A] -= 500;
+    pedalAdcDecimate(&adc, block, out);
+
+    TEST_ASSERT_EQUAL_UINT32(2386, out[THROTTLE_A]);
+    TEST_ASSERT_EQUAL_UINT32(4, adc.stats[THROTTLE_A].spikes);
+    TEST_ASSERT_EQUAL_UINT32(2386 - 900, adc.stats[THROTTLE_A].minRaw);
+    TEST_ASSERT_EQUAL_UINT32(2386 + 1000, adc.stats[THROTTLE_A].maxRaw);
+    // The spikes still show in the noise
+    TEST_ASSERT_TRUE(adc.stats[THROTTLE_A].noiseRms > 100.0f);
+    TEST_ASSERT_EQUAL_UINT32(0, adc.stats[THROTTLE_B].spikes);
+}
+
+void test_noiseReducedAndMeasured(void)
+{
+    float values[CHANNELS];
+    halfThrottle(values);
+    double rawSumSquares = 0.0;
+    double filteredSumSquares = 0.0;
+
+    for (int k = 0; k < SIM_BLOCKS; k++) {
+        fillBlock(values, NOISE_SIGMA, false);
+        pedalAdcDecimate(&adc, block, out);
+        const float raw = block[(OVERSAMPLE - 1) * CHANNELS + THROTTLE_A] - values[THROTTLE_A];
+        const float filtered = out[THROTTLE_A] - values[THROTTLE_A];
+        rawSumSquares += raw * raw;
+        filteredSumSquares += filtered * filtered;
+    }
+    const float rawRms = sqrtf(rawSumSquares / SIM_BLOCKS);
+    const float filteredRms = sqrtf(filteredSumSquares / SIM_BLOCKS);
+
+    // 16 samples averaged would be a quarter; trimming and rounding cost a little
+    TEST_ASSERT_TRUE(filteredRms < rawRms / 3.0f);
+    // The measured noise is within 20 % of what was injected
+    TEST_ASSERT_FLOAT_WITHIN(0.2f * NOISE_SIGMA, NOISE_SIGMA, adc.stats[THROTTLE_A].noiseRms);
+    TEST_ASSERT_TRUE(adc.stats[THROTTLE_A].maxNoiseRms >= adc.stats[THROTTLE_A].noiseRms);
+}
+
+void test_injectedSpikesNoLongerTripApps(void)
+{
+    float values[CHANNELS];
+    halfThrottle(values);
+    uint32_t rawTrips = 0;
+    uint32_t filteredTrips = 0;
+
+    for (int k = 0; k < SIM_BLOCKS; k++) {
+        fillBlock(values, NOISE_SIGMA, true);
+        pedalAdcDecimate(&adc, block, out);
+        const uint32_t *last = &block[(OVERSAMPLE - 1) * CHANNELS];
+        rawTrips += appsTrips(last[THROTTLE_A], last[THROTTLE_B]);
+        filteredTrips += appsTrips(out[THROTTLE_A], out[THROTTLE_B]);
+    }
+
+    TEST_ASSERT_TRUE(rawTrips > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, filteredTrips);
+    TEST_ASSERT_TRUE(adc.stats[THROTTLE_A].spikes > 0);
+}
+
+void test_stepFollowedWithinOnePeriod(void)
+{
+    float values[CHANNELS];
+    halfThrottle(values);
+    const uint32_t released = THROTT_A_LOW;
+    const uint32_t pressed = THROTT_A_HIGH;
+
+    // Pedal pressed halfway through the block
+    fillBlock(values, 0.0f, false);
+    for (int i = 0; i < OVERSAMPLE; i++) {
+        block[i * CHANNELS + THROTTLE_A] = i < OVERSAMPLE / 2 ? released : pressed;
+    }
+    pedalAdcDecimate(&adc, block, out);
+    TEST_ASSERT_EQUAL_UINT32((released + pressed + 1) / 2, out[THROTTLE_A]);
+
+    // The next period sees all of it
+    for (int i = 0; i < OVERSAMPLE; i++) {
+        block[i * CHANNELS + THROTTLE_A] = pressed;
+    }
+    pedalAdcDecimate(&adc, block, out);
+    TEST_ASSERT_EQUAL_UINT32(pressed, out[THROTTLE_A]);
+}
@@ -0,0 +1,199 @@
+#include "unity.h"
+
+#include "torque_loop_timing.h"
+
+#include <string.h>
+
+/*
+ * Simulated VCU schedule, in microseconds. The pedal ADC fills half of its
+ * DMA buffer every 10 ms; the half transfer interrupt follows the last
+ * sequence's conversion time. The CPU is otherwise taken by bursts of
+ * higher or equal priority work (CAN interrupts, the CAN send task, the FSM)
+ * that arrive at random and run to completion.
+ *
+ * Two loops are compared:
+ *  - The torque loop: woken by the DMA interrupt, it only waits for work
+ *    already running above it, then queues the command
+ *  - The previous throttle task: a vTaskDelayUntil loop at 50 ms on the
+ *    1 ms tick, reading whichever sample the DMA last wrote, and sharing
+ *    its priority with the FSM and CAN tasks, so it waits its turn behind
+ *    whatever is ready when its tick comes
+ *
+ * The schedule is a model of the VCU's load, not a measurement of it: the
+ * results compare the two loop structures under the same load.
+ */
+
+#define PERIOD_US 10000
+#define CONVERSION_US 15
+#define ISR_US 3
+#define LOOP_COST_US 60
+#define OLD_PERIOD_US 50000
+#define OLD_ADC_PERIOD_US 10100  // TIM6 had 101 counts per update
+#define SIM_LOOPS 3000
+#define BURST_CHANCE_PERCENT 30
+#define BURST_MAX_US 400
+#define FSM_CHANCE_PERCENT 20
+#define FSM_MAX_US 2000
+
+static TorqueLoopTiming_t timing;
+static unsigned seed;
+
+static uint32_t randomBelow(uint32_t n)
+{
+    seed = seed * 1103515245u + 12345u;
+    return ((seed >> 16) & 0x7fff) % n;
+}
+
+// Time already taken by higher priority work when the loop becomes ready
+static uint32_t blockedByHigherPriority(void)
+{
+    return randomBelow(100) < BURST_CHANCE_PERCENT ? randomBelow(BURST_MAX_US) : 0;
+}
+
+// Time taken by FSM events and CAN sends, which shared the old task's priority
+static uint32_t blockedBySamePriority(void)
+{
+    return randomBelow(100) < FSM_CHANCE_PERCENT ? randomBelow(FSM_MAX_US) : 0;
+}
+
+static void runTorqueLoop(uint32_t start_us, uint32_t loops)
+{
+    for (uint32_t k = 0; k < loops; k++) {
+        const uint32_t trigger = start_us + k * PERIOD_US;
+        const uint32_t sample = trigger + CONVERSION_US;
+        torqueLoopSampleReady(&timing, sample);
+
+        uint32_t sample_us = 0;
+        TEST_ASSERT_TRUE(torqueLoopTakeSample(&timing, &sample_us));
+        TEST_ASSERT_EQUAL_UINT32(sample, sample_us);
+        const uint32_t queued = sample + ISR_US + blockedByHigherPriority() + LOOP_COST_US;
+        torqueLoopCommandQueued(&timing, sample_us, queued);
+    }
+}
+
+static void runOldThrottleTask(uint32_t loops)
+{
+    uint32_t samples = 0;
+    for (uint32_t k = 0; k < loops; k++) {
+        const uint32_t tick = 7000 + k * OLD_PERIOD_US;
+        // Samples completed by the time the task reads the buffer
+        const uint32_t read = tick + blockedBySamePriority() + blockedByHigherPriority();
+        while ((samples + 1) * OLD_ADC_PERIOD_US + CONVERSION_US <= read) {
+            samples++;
+        }
+        const uint32_t sample = samples * OLD_ADC_PERIOD_US + CONVERSION_US;
+        torqueLoopCommandQueued(&timing, sample, read + LOOP_COST_US);
+    }
+}
+
+void setUp(void)
+{
+    seed = 7;
+    torqueLoopTimingInit(&timing, PERIOD_US, 25, 25);
+}
+
+void tearDown(void)
+{
+}
+
+void test_histogramPercentiles(void)
+{
+    TorqueLoopHistogram_t *hist = &timing.latency;
+
+    TEST_ASSERT_EQUAL_UINT32(0, torqueLoopHistogramPercentile(hist, 0.5f));
+    for (uint32_t i = 0; i < 98; i++) {
+        torqueLoopHistogramAdd(hist, 60);
+    }
+    torqueLoopHistogramAdd(hist, 310);
+    torqueLoopHistogramAdd(hist, 5000);
+
+    TEST_ASSERT_EQUAL_UINT32(100, hist->count);
+    TEST_ASSERT_EQUAL_UINT32(98, hist->bins[2]);
+    TEST_ASSERT_EQUAL_UINT32(1, hist->bins[12]);
+    TEST_ASSERT_EQUAL_UINT32(1, hist->bins[TORQUE_LOOP_HIST_BINS - 1]);
+    TEST_ASSERT_EQUAL_UINT32(5000, hist->max_us);
+    // Top of the bin the fraction falls in
+    TEST_ASSERT_EQUAL_UINT32(75, torqueLoopHistogramPercentile(hist, 0.5f));
+    TEST_ASSERT_EQUAL_UINT32(325, torqueLoopHistogramPercentile(hist, 0.99f));
+    // Past the last bin the maximum is the bound
+    TEST_ASSERT_EQUAL_UINT32(5000, torqueLoopHistogramPercentile(hist, 1.0f));
+}
+
+void test_percentileNotAboveMax(void)
+{
+    torqueLoopHistogramAdd(&timing.latency, 51);
+    TEST_ASSERT_EQUAL_UINT32(51, torqueLoopHistogramPercentile(&timing.latency, 0.5f));
+}
+
+void test_latencyAndJitterAcrossClockWrap(void)
+{
+    uint32_t sample_us;
+
+    torqueLoopSampleReady(&timing, 0xFFFFFF00u);
+    TEST_ASSERT_TRUE(torqueLoopTakeSample(&timing, &sample_us));
+    torqueLoopCommandQueued(&timing, sample_us, 0xFFFFFF80u);
+
+    torqueLoopSampleReady(&timing, 0xFFFFFF00u + PERIOD_US);
+    TEST_ASSERT_TRUE(torqueLoopTakeSample(&timing, &sample_us));
+    torqueLoopCommandQueued(&timing, sample_us, 0xFFFFFF80u + PERIOD_US + 40);
+
+    TEST_ASSERT_EQUAL_UINT32(2, timing.commands);
+    TEST_ASSERT_EQUAL_UINT32(0x80 + 40, timing.latency.max_us);
+    TEST_ASSERT_EQUAL_UINT32(1, timing.jitter.count);
+    TEST_ASSERT_EQUAL_UINT32(40, timing.jitter.max_us);
+}
+
+void test_overrunsCounted(void)
+{
+    uint32_t sample_us;
+
+    TEST_ASSERT_FALSE(torqueLoopTakeSample(&timing, &sample_us));
+    torqueLoopSampleReady(&timing, 100);
+    TEST_ASSERT_TRUE(torqueLoopTakeSample(&timing, &sample_us));
+    TEST_ASSERT_FALSE(torqueLoopTakeSample(&timing, &sample_us));
+
+    // The loop held off for three samples takes the latest
+    torqueLoopSampleReady(&timing, 100 + PERIOD_US);
+    torqueLoopSampleReady(&timing, 100 + 2 * PERIOD_US);
+    torqueLoopSampleReady(&timing, 100 + 3 * PERIOD_US);
+    TEST_ASSERT_TRUE(torqueLoopTakeSample(&timing, &sample_us));
+    TEST_ASSERT_EQUAL_UINT32(100 + 3 * PERIOD_US, sample_us);
+    TEST_ASSERT_EQUAL_UINT32(2, timing.overruns);
+}
+
+void test_restartSkipsJitterForGap(void)
+{
+    torqueLoopCommandQueued(&timing, 0, 100);
+    torqueLoopRestart(&timing);
+    torqueLoopCommandQueued(&timing, 5 * PERIOD_US, 5 * PERIOD_US + 100);
+    torqueLoopCommandQueued(&timing, 6 * PERIOD_US, 6 * PERIOD_US + 100);
+
+    TEST_ASSERT_EQUAL_UINT32(3, timing.latency.count);
+    TEST_ASSERT_EQUAL_UINT32(1, timing.jitter.count);
+    TEST_ASSERT_EQUAL_UINT32(0, timing.jitter.max_us);
+}
+
+void test_torqueLoopTimingIsBounded(void)
+{
+    runTorqueLoop(1000, SIM_LOOPS);
+
+    const uint32_t worst = ISR_US + BURST_MAX_US + LOOP_COST_US;
+    TEST_ASSERT_EQUAL_UINT32(SIM_LOOPS, timing.commands);
+    TEST_ASSERT_EQUAL_UINT32(0, timing.overruns);
+    TEST_ASSERT_TRUE(timing.latency.max_us <= worst);
+    TEST_ASSERT_TRUE(timing.jitter.max_us <= BURST_MAX_US);
+    TEST_ASSERT_TRUE(torqueLoopHistogramPercentile(&timing.latency, 0.5f) <= 100);
+    TEST_ASSERT_TRUE(torqueLoopHistogramPercentile(&timing.latency, 0.99f) <= ISR_US + BURST_MAX_US + LOOP_COST_US);
+}
+
+void test_oldThrottleTaskTimingComparison(void)
+{
+    // Wider bins to fit the old task's range
+    torqueLoopTimingInit(&timing, OLD_PERIOD_US, 500, 100);
+    runOldThrottleTask(SIM_LOOPS);
+
+    // The sample is up to a whole ADC period old before the task runs at all
+    TEST_ASSERT_TRUE(torqueLoopHistogramPercentile(&timing.latency, 0.5f) > PERIOD_US / 4);
+    TEST_ASSERT_TRUE(timing.latency.max_us > PERIOD_US);
+    TEST_ASSERT_TRUE(timing.jitter.max_us > BURST_MAX_US);
+}
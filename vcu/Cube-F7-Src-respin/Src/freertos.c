@@ -167,7 +167,7 @@ void MX_FREERTOS_Init(void) {
 
   /* Create the thread(s) */
   /* definition and creation of driveByWire */
-  osThreadDef(driveByWire, driveByWireTask, osPriorityRealtime, 0, 1000);
+  osThreadDef(driveByWire, driveByWireTask, osPriorityHigh, 0, 1000);
   driveByWireHandle = osThreadCreate(osThread(driveByWire), NULL);
 
   /* definition and creation of mainTask */
@@ -4,6 +4,8 @@
 
 #include "bsp.h"
 #include "FreeRTOS.h"
+#include "torque_loop_timing.h"
+#include "pedal_adc.h"
 
 #define MIN_BRAKE_PRESSED_VAL_PERCENT 15
 #define APPS_BRAKE_PLAUSIBILITY_THRESHOLD 40  // set experimentally based on driver feedback
@@ -42,7 +44,20 @@
 #define THROTTLE_POLLING_TASK_ID 4
 #define THROTTLE_POLLING_FLAG_BIT (0)
 #define VCU_DATA_PUBLISH_TIME_MS 50
-#define THROTTLE_POLLING_TASK_PERIOD_MS 50
+
+// The torque loop runs once per pedal ADC sample, a block of conversion
+// sequences decimated to one value per channel, every TORQUE_LOOP_PERIOD_MS
+#define TORQUE_LOOP_PERIOD_MS 10
+#define TORQUE_LOOP_SAMPLE_TIMEOUT_MS (3 * TORQUE_LOOP_PERIOD_MS)
+#define TORQUE_LOOP_LATENCY_BIN_US 25
+#define TORQUE_LOOP_JITTER_BIN_US 25
+#define TORQUE_LOOP_TIMING_PUBLISH_MS 1000
+
+// TIM6 triggers a conversion sequence every PEDAL_ADC_SEQUENCE_PERIOD_US,
+// and each half of the DMA buffer holds one torque loop period of them
+#define PEDAL_ADC_SEQUENCE_PERIOD_US 500
+#define PEDAL_ADC_OVERSAMPLE (TORQUE_LOOP_PERIOD_MS * 1000 / PEDAL_ADC_SEQUENCE_PERIOD_US)
+#define PEDAL_ADC_TRIM 2
 
 typedef enum ADC_Indices_t {
     THROTTLE_A_INDEX = 0,
@@ -90,5 +105,8 @@ uint16_t calculate_throttle_adc_from_percent2(uint16_t percent);
 float calculate_throttle_percent1(uint16_t tps_value);
 float calculate_throttle_percent2(uint16_t tps_value);
 ThrottleStatus_t getNewThrottle(float *throttleOut);
+const TorqueLoopTiming_t *getTorqueLoopTiming();
+HAL_StatusTypeDef sendTorqueLoopTiming();
+const PedalAdc_t *getPedalAdc();
 
 #endif /* end of include guard: BRAKEANDTHROTTLE_H */
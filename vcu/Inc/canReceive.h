@@ -8,6 +8,10 @@ bool getHvEnableState();
 bool getMotorControllersStatus();
 bool isLockoutDisabled();
 uint8_t getInverterVSMState();
+bool getBMUDischargePowerLimit(float *limit_W);
+
+// Stop using the BMU power limit if it hasn't been updated in this long
+#define BMU_STATE_OF_POWER_TIMEOUT_MS 500
 
 volatile uint8_t inverterVSMState;
 volatile uint8_t inverterInternalState;
@@ -48,6 +48,7 @@ extern uint64_t maxTorqueDemand;
 
 HAL_StatusTypeDef mcInit();
 HAL_StatusTypeDef requestTorqueFromMC(float throttle_percent);
+HAL_StatusTypeDef sendTractivePower();
 HAL_StatusTypeDef sendLockoutReleaseToMC();
 HAL_StatusTypeDef mcClearFaults();
 HAL_StatusTypeDef sendDisableMC();
@@ -0,0 +1,44 @@
+#ifndef PEDAL_ADC_H
+#define PEDAL_ADC_H
+
+/*
+ * Oversampled pedal and steering ADC acquisition. The ADC converts every
+ * channel many times per torque loop period into a circular DMA buffer with
+ * two halves: while the DMA fills one half the loop decimates the other, so
+ * a block is never read while it is being written. Each channel's block is
+ * reduced to one value by a trimmed mean, which drops the lowest and highest
+ * samples so that a single spike can't move the result, then averages the
+ * rest. The spread of each block gives per channel noise statistics.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PEDAL_ADC_MAX_CHANNELS 8
+#define PEDAL_ADC_MAX_OVERSAMPLE 32
+/// A sample this far from its block's median is counted as a spike
+#define PEDAL_ADC_SPIKE_COUNTS 64
+/// Noise is smoothed over about this many blocks
+#define PEDAL_ADC_NOISE_BLOCKS 16
+
+typedef struct PedalAdcChannelStats_t {
+    uint32_t value;         ///< Last decimated value, ADC counts
+    uint32_t minRaw;        ///< Lowest sample in the last block
+    uint32_t maxRaw;        ///< Highest sample in the last block
+    float noiseRms;         ///< Standard deviation of the samples in a block, smoothed
+    float maxNoiseRms;      ///< Largest single block standard deviation
+    uint32_t spikes;        ///< Samples more than PEDAL_ADC_SPIKE_COUNTS from their block's median
+} PedalAdcChannelStats_t;
+
+typedef struct PedalAdc_t {
+    uint32_t channels;
+    uint32_t oversample;    ///< Conversions of each channel per block
+    uint32_t trim;          ///< Samples dropped from each end of a channel's sorted block
+    uint32_t blocks;
+    PedalAdcChannelStats_t stats[PEDAL_ADC_MAX_CHANNELS];
+} PedalAdc_t;
+
+void pedalAdcInit(PedalAdc_t *adc, uint32_t channels, uint32_t oversample, uint32_t trim);
+void pedalAdcDecimate(PedalAdc_t *adc, const uint32_t *block, uint32_t *out);
+
+#endif /* end of include guard: PEDAL_ADC_H */
@@ -0,0 +1,51 @@
+#ifndef TORQUE_LOOP_TIMING_H
+#define TORQUE_LOOP_TIMING_H
+
+/*
+ * Timing of the torque loop. The ADC DMA completion time stamps each pedal
+ * sample and wakes the loop, which records the time from the sample to its
+ * torque command being queued for the CAN send task (latency), and how far
+ * the interval between commands strays from the loop period (jitter). Both
+ * go into fixed width histograms, printed by the torqueLoop CLI command and
+ * summarised on VCU_TorqueLoopTiming. Samples replaced before the loop took
+ * them are counted as overruns.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TORQUE_LOOP_HIST_BINS 40
+
+typedef struct TorqueLoopHistogram_t {
+    uint32_t bins[TORQUE_LOOP_HIST_BINS];  ///< The last bin also counts everything above it
+    uint32_t binWidth_us;
+    uint32_t count;
+    uint32_t max_us;
+} TorqueLoopHistogram_t;
+
+typedef struct TorqueLoopTiming_t {
+    TorqueLoopHistogram_t latency;  ///< ADC sample to torque command queued
+    TorqueLoopHistogram_t jitter;   ///< Command interval minus the period, either way
+    uint32_t period_us;
+    // Latest sample, handed from the DMA interrupt to the loop
+    volatile uint32_t sample_us;
+    volatile uint32_t samples;      ///< Written only by the interrupt
+    uint32_t samplesTaken;          ///< Written only by the loop
+    // Previous command
+    bool anyCommands;
+    uint32_t lastCommand_us;
+    // Statistics
+    uint32_t commands;
+    uint32_t overruns;              ///< Samples replaced before the loop took them
+} TorqueLoopTiming_t;
+
+void torqueLoopTimingInit(TorqueLoopTiming_t *timing, uint32_t period_us,
+                          uint32_t latencyBin_us, uint32_t jitterBin_us);
+void torqueLoopSampleReady(TorqueLoopTiming_t *timing, uint32_t now_us);
+bool torqueLoopTakeSample(TorqueLoopTiming_t *timing, uint32_t *sample_us);
+void torqueLoopCommandQueued(TorqueLoopTiming_t *timing, uint32_t sample_us, uint32_t now_us);
+void torqueLoopRestart(TorqueLoopTiming_t *timing);
+void torqueLoopHistogramAdd(TorqueLoopHistogram_t *hist, uint32_t value_us);
+uint32_t torqueLoopHistogramPercentile(const TorqueLoopHistogram_t *hist, float fraction);
+
+#endif /* end of include guard: TORQUE_LOOP_TIMING_H */
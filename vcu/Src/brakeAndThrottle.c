@@ -10,6 +10,9 @@
 #include "drive_by_wire.h"
 #include "canReceive.h"
 #include "mathUtils.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "cycleClock.h"
 
 #if IS_BOARD_NUCLEO_F7
 #define MOCK_ADC_READINGS
@@ -18,15 +21,52 @@
 
 bool appsBrakePedalPlausibilityCheckFail(float throttle);
 
+extern osThreadId throttlePollingHandle;
 
+// Decimated pedal and steering readings, written by the torque loop
 uint32_t brakeThrottleSteeringADCVals[NUM_ADC_CHANNELS] = {0};
 static float throttlePercentReading = 0.0f;
+static TorqueLoopTiming_t torqueLoopTiming;
+
+// Circular DMA buffer: the DMA fills one half while the loop decimates the other
+static uint32_t pedalAdcDmaBuffer[2][PEDAL_ADC_OVERSAMPLE][NUM_ADC_CHANNELS];
+static volatile uint32_t pedalAdcReadyHalf = 0;
+static PedalAdc_t pedalAdc;
+
+#ifndef MOCK_ADC_READINGS
+/**
+ * @brief Conversion sequence period TIM6 was set up with by the Cube init, so
+ * a regenerated 2018_VCU.ioc with a different TIM6 rate is caught instead of
+ * changing the torque loop period
+ */
+static uint32_t pedalAdcSequencePeriodUs()
+{
+    // APB1 timers run at twice PCLK1 when APB1 is divided down
+    uint32_t timerClockHz = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) {
+        timerClockHz *= 2;
+    }
+    uint64_t counts = (uint64_t)(BRAKE_ADC_TIM_HANDLE.Init.Prescaler + 1) * (BRAKE_ADC_TIM_HANDLE.Init.Period + 1);
+    return (uint32_t)(counts * 1000000U / timerClockHz);
+}
+#endif
 
 HAL_StatusTypeDef startADCConversions()
 {
+    cycleClockInit();
+    torqueLoopTimingInit(&torqueLoopTiming, TORQUE_LOOP_PERIOD_MS * 1000,
+                         TORQUE_LOOP_LATENCY_BIN_US, TORQUE_LOOP_JITTER_BIN_US);
+    pedalAdcInit(&pedalAdc, NUM_ADC_CHANNELS, PEDAL_ADC_OVERSAMPLE, PEDAL_ADC_TRIM);
 #ifndef MOCK_ADC_READINGS
     /*DEBUG_PRINT("Starting adc readings for %d channels\n", NUM_ADC_CHANNELS);*/
-    if (HAL_ADC_Start_DMA(&ADC_HANDLE, brakeThrottleSteeringADCVals, NUM_ADC_CHANNELS) != HAL_OK)
+    if (pedalAdcSequencePeriodUs() != PEDAL_ADC_SEQUENCE_PERIOD_US) {
+        ERROR_PRINT("Brake and throttle adc timer period %lu us, expected %d us\n",
+                    pedalAdcSequencePeriodUs(), PEDAL_ADC_SEQUENCE_PERIOD_US);
+        Error_Handler();
+        return HAL_ERROR;
+    }
+    if (HAL_ADC_Start_DMA(&ADC_HANDLE, (uint32_t *)pedalAdcDmaBuffer,
+                          sizeof(pedalAdcDmaBuffer) / sizeof(uint32_t)) != HAL_OK)
     {
         ERROR_PRINT("Failed to start ADC DMA conversions\n");
         Error_Handler();
@@ -53,6 +93,34 @@ HAL_StatusTypeDef startADCConversions()
     return HAL_OK;
 }
 
+/*
+ * A half of the DMA buffer is full, from the ADC DMA interrupt. TIM6 triggers
+ * the sequences, so this paces the torque loop
+ */
+static void pedalAdcHalfReady(uint32_t half)
+{
+    pedalAdcReadyHalf = half;
+    torqueLoopSampleReady(&torqueLoopTiming, cycleClockMicros());
+
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(throttlePollingHandle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
+
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    if (hadc == &ADC_HANDLE) {
+        pedalAdcHalfReady(0);
+    }
+}
+
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef *hadc)
+{
+    if (hadc == &ADC_HANDLE) {
+        pedalAdcHalfReady(1);
+    }
+}
+
 int map_range(int in, int low, int high, int low_out, int high_out) {
     if (in < low) {
         in = low;
@@ -122,12 +190,6 @@ bool getThrottlePositionPercent(float *throttleOut)
     float throttle;
     (*throttleOut) = 0;
 
-
-    ThrottleAReading = brakeThrottleSteeringADCVals[THROTTLE_A_INDEX];
-    ThrottleBReading = brakeThrottleSteeringADCVals[THROTTLE_B_INDEX];
-    BrakeReading = brakeThrottleSteeringADCVals[BRAKE_POS_INDEX];
-    sendCAN_VCU_ADCReadings();
-
     // Read both TPS sensors
     if (is_throttle1_in_range(brakeThrottleSteeringADCVals[THROTTLE_A_INDEX])
         && is_throttle2_in_range(brakeThrottleSteeringADCVals[THROTTLE_B_INDEX]))
@@ -167,7 +229,6 @@ ThrottleStatus_t getNewThrottle(float *throttleOut)
     (*throttleOut) = 0;
 
     if (!getThrottlePositionPercent(&throttle)) {
-        DEBUG_PRINT("Throttle error\n");
         return THROTTLE_FAULT;
     }
 
@@ -204,7 +265,7 @@ bool appsBrakePedalPlausibilityCheckFail(float throttle)
             throttleAndBrakePressedError = false;
             sendDTC_WARNING_BrakeWhileThrottleError_Enabled();
         } else {
-            DEBUG_PRINT("Throttle disabled, brake was pressed and throttle still not zero\n");
+            // Brake was pressed and throttle still not zero
             return true;
         }
     } else if (getBrakePositionPercent() > APPS_BRAKE_PLAUSIBILITY_THRESHOLD && throttle > TPS_MAX_WHILE_BRAKE_PRESSED_PERCENT) {
@@ -259,6 +320,8 @@ HAL_StatusTypeDef brakeAndThrottleStart()
 
 void canPublishTask(void *pvParameters)
 {
+    uint32_t publishCount = 0;
+
     // Delay to allow first ADC readings to come in
     vTaskDelay(500);
     while (1) {
@@ -272,10 +335,53 @@ void canPublishTask(void *pvParameters)
         if (sendCAN_VCU_Data() != HAL_OK) {
             ERROR_PRINT("Failed to send vcu can data\n");
         }
+
+        // Sent from here rather than the torque loop, so they don't queue
+        // ahead of its commands
+        ThrottleAReading = brakeThrottleSteeringADCVals[THROTTLE_A_INDEX];
+        ThrottleBReading = brakeThrottleSteeringADCVals[THROTTLE_B_INDEX];
+        BrakeReading = brakeThrottleSteeringADCVals[BRAKE_POS_INDEX];
+        sendCAN_VCU_ADCReadings();
+        sendTractivePower();
+
+        if (++publishCount >= TORQUE_LOOP_TIMING_PUBLISH_MS / VCU_DATA_PUBLISH_TIME_MS) {
+            publishCount = 0;
+            sendTorqueLoopTiming();
+        }
         vTaskDelay(pdMS_TO_TICKS(VCU_DATA_PUBLISH_TIME_MS));
     }
 }
 
+const TorqueLoopTiming_t *getTorqueLoopTiming()
+{
+    return &torqueLoopTiming;
+}
+
+const PedalAdc_t *getPedalAdc()
+{
+    return &pedalAdc;
+}
+
+// Saturate at the top of the signal's range, rather than wrapping
+static uint32_t saturate(uint32_t value, uint32_t max)
+{
+    return value < max ? value : max;
+}
+
+HAL_StatusTypeDef sendTorqueLoopTiming()
+{
+    const TorqueLoopHistogram_t *latency = &torqueLoopTiming.latency;
+    const TorqueLoopHistogram_t *jitter = &torqueLoopTiming.jitter;
+
+    TorqueLoopLatencyP50 = saturate(torqueLoopHistogramPercentile(latency, 0.5f), 40950);
+    TorqueLoopLatencyP99 = saturate(torqueLoopHistogramPercentile(latency, 0.99f), 40950);
+    TorqueLoopLatencyMax = saturate(latency->max_us, 40950);
+    TorqueLoopJitterP99 = saturate(torqueLoopHistogramPercentile(jitter, 0.99f), 10230);
+    TorqueLoopJitterMax = saturate(jitter->max_us, 10230);
+    TorqueLoopOverruns = saturate(torqueLoopTiming.overruns, 255);
+    return sendCAN_VCU_TorqueLoopTiming();
+}
+
 HAL_StatusTypeDef pollThrottle(void) {
     ThrottleStatus_t rc = getNewThrottle(&throttlePercentReading);
 
@@ -295,11 +401,44 @@ HAL_StatusTypeDef pollThrottle(void) {
     return requestTorqueFromMC(throttlePercentReading);
 }
 
-void throttlePollingTask(void) 
+/*
+ * Wait for the next pedal sample, and decimate it into
+ * brakeThrottleSteeringADCVals. Each DMA half transfer wakes the loop; the
+ * DMA then spends a whole period filling the other half, so the block can't
+ * change while it is read. With mock readings there is no ADC, so the loop
+ * paces itself and the CLI sets the readings directly.
+ * @return False if no sample came in TORQUE_LOOP_SAMPLE_TIMEOUT_MS
+ */
+static bool waitForPedalSample(uint32_t *sample_us)
 {
-    TickType_t xLastWakeTime = xTaskGetTickCount();
+#ifdef MOCK_ADC_READINGS
+    static TickType_t xLastWakeTime = 0;
+    if (xLastWakeTime == 0) {
+        xLastWakeTime = xTaskGetTickCount();
+    }
+    vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(TORQUE_LOOP_PERIOD_MS));
+    torqueLoopSampleReady(&torqueLoopTiming, cycleClockMicros());
+#else
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TORQUE_LOOP_SAMPLE_TIMEOUT_MS));
+#endif
+    if (!torqueLoopTakeSample(&torqueLoopTiming, sample_us)) {
+        return false;
+    }
+#ifndef MOCK_ADC_READINGS
+    pedalAdcDecimate(&pedalAdc, &pedalAdcDmaBuffer[pedalAdcReadyHalf][0][0],
+                     brakeThrottleSteeringADCVals);
+#endif
+    return true;
+}
 
-    if (registerTaskToWatch(THROTTLE_POLLING_TASK_ID, 2*pdMS_TO_TICKS(THROTTLE_POLLING_TASK_PERIOD_MS), false, NULL) != HAL_OK)
+/*
+ * The torque loop: one torque command per pedal ADC sample, at the highest
+ * task priority, so the time from sample to command doesn't depend on what
+ * else the VCU is doing
+ */
+void throttlePollingTask(void)
+{
+    if (registerTaskToWatch(THROTTLE_POLLING_TASK_ID, 2*pdMS_TO_TICKS(TORQUE_LOOP_SAMPLE_TIMEOUT_MS), false, NULL) != HAL_OK)
     {
         ERROR_PRINT("ERROR: Failed to init throttle polling task, suspending throttle polling task\n");
         while(1);
@@ -311,22 +450,35 @@ void throttlePollingTask(void)
 
     while (1)
     {
-        // Once EM Enabled, start polling throttle
-        if (fsmGetState(&fsmHandle) == STATE_EM_Enable)
+        uint32_t sample_us;
+        bool sampled = waitForPedalSample(&sample_us);
+
+        // Once EM Enabled, command torque for each sample
+        if (fsmGetState(&fsmHandle) != STATE_EM_Enable)
         {
-            // Poll throttle
-            if (pollThrottle() != HAL_OK) {
-                ERROR_PRINT("ERROR: Failed to request torque from MC\n");
-                fsmSendEventUrgent(&fsmHandle, EV_Throttle_Failure, portMAX_DELAY);
-            }
+            // EM disabled
+            throttlePercentReading = 0;
+            torqueLoopRestart(&torqueLoopTiming);
+        }
+        else if (!sampled)
+        {
+            ERROR_PRINT("ERROR: No pedal ADC sample for %d ms\n", TORQUE_LOOP_SAMPLE_TIMEOUT_MS);
+            torqueLoopRestart(&torqueLoopTiming);
+            fsmSendEventUrgent(&fsmHandle, EV_Throttle_Failure, portMAX_DELAY);
+        }
+        else if (pollThrottle() != HAL_OK)
+        {
+            ERROR_PRINT("ERROR: Failed to request torque from MC\n");
+            torqueLoopRestart(&torqueLoopTiming);
+            fsmSendEventUrgent(&fsmHandle, EV_Throttle_Failure, portMAX_DELAY);
         }
         else
         {
-            // EM disabled
-            throttlePercentReading = 0;
+            torqueLoopCommandQueued(&torqueLoopTiming, sample_us, cycleClockMicros());
         }
 
+        // Keeps the microsecond clock extended when there are no samples
+        cycleClockMicros();
         watchdogTaskCheckIn(THROTTLE_POLLING_TASK_ID);
-        vTaskDelayUntil(&xLastWakeTime, pdMS_TO_TICKS(THROTTLE_POLLING_TASK_PERIOD_MS));
     }
 }
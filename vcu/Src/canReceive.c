@@ -27,6 +27,8 @@ volatile bool motorControllersStatus = false;
 volatile bool inverterLockoutDisabled = false;
 volatile uint8_t inverterVSMState;
 volatile uint8_t inverterInternalState;
+volatile uint32_t bmuStateOfPowerTick = 0;
+volatile bool bmuStateOfPowerReceived = false;
 
 /*
  * Functions to get external board status
@@ -56,6 +58,24 @@ uint8_t getInverterVSMState()
     return inverterVSMState;
 }
 
+/**
+ * @brief Get the BMU's short horizon discharge power limit
+ *
+ * @param[out] limit_W Discharge power limit in Watts
+ *
+ * @return true if the limit has been received recently enough to use
+ */
+bool getBMUDischargePowerLimit(float *limit_W)
+{
+    if (!bmuStateOfPowerReceived ||
+        (xTaskGetTickCount() - bmuStateOfPowerTick) > pdMS_TO_TICKS(BMU_STATE_OF_POWER_TIMEOUT_MS))
+    {
+        return false;
+    }
+    *limit_W = DischargePowerLimit2s * 1000.0f;
+    return true;
+}
+
 extern osThreadId driveByWireHandle;
 
 void CAN_Msg_DCU_buttonEvents_Callback()
@@ -149,6 +169,12 @@ void CAN_Msg_MC_Internal_States_Callback() // 100 hz
     inverterVSMState = INV_VSM_State;
 } 
 
+void CAN_Msg_BMU_stateOfPowerPower_Callback()
+{
+    bmuStateOfPowerTick = xTaskGetTickCountFromISR();
+    bmuStateOfPowerReceived = true;
+}
+
 void CAN_Msg_MC_Read_Write_Param_Response_Callback()
 {
     sendLockoutReleaseToMC();
@@ -440,6 +440,90 @@ static const CLI_Command_Definition_t mcInitCommandDefinition =
     0 /* Number of parameters */
 };
 
+BaseType_t torqueLoopCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    // Summary line, then one line per histogram bin
+    static int bin = -1;
+    const TorqueLoopTiming_t *timing = getTorqueLoopTiming();
+    const TorqueLoopHistogram_t *latency = &timing->latency;
+    const TorqueLoopHistogram_t *jitter = &timing->jitter;
+
+    if (bin == -1) {
+        COMMAND_OUTPUT("commands %lu, overruns %lu\r\n"
+                       "latency us: p50 %lu p99 %lu max %lu\r\n"
+                       "jitter us: p50 %lu p99 %lu max %lu\r\n"
+                       "bin us\tlatency\tjitter\r\n",
+                       timing->commands, timing->overruns,
+                       torqueLoopHistogramPercentile(latency, 0.5f),
+                       torqueLoopHistogramPercentile(latency, 0.99f), latency->max_us,
+                       torqueLoopHistogramPercentile(jitter, 0.5f),
+                       torqueLoopHistogramPercentile(jitter, 0.99f), jitter->max_us);
+        bin = 0;
+        return pdTRUE;
+    }
+
+    COMMAND_OUTPUT("%s%lu\t%lu\t%lu\r\n", bin == TORQUE_LOOP_HIST_BINS - 1 ? ">=" : "",
+                   bin * latency->binWidth_us, latency->bins[bin], jitter->bins[bin]);
+    if (++bin == TORQUE_LOOP_HIST_BINS) {
+        bin = -1;
+        return pdFALSE;
+    }
+    vTaskDelay(1); // Hack to avoid overflowing our serial buffer
+    return pdTRUE;
+}
+static const CLI_Command_Definition_t torqueLoopCommandDefinition =
+{
+    "torqueLoop",
+    "torqueLoop:\r\n  Print the torque loop latency (ADC sample to command queued) and jitter histograms\r\n",
+    torqueLoopCommand,
+    0 /* Number of parameters */
+};
+
+static const char *pedalAdcChannelNames[NUM_ADC_CHANNELS] = {
+    [THROTTLE_A_INDEX] = "throttleA",
+    [THROTTLE_B_INDEX] = "throttleB",
+    [BRAKE_POS_INDEX] = "brakePos",
+    [STEERING_INDEX] = "steering",
+    [BRAKE_PRES_INDEX] = "brakePres",
+};
+
+BaseType_t adcNoiseCommand(char *writeBuffer, size_t writeBufferLength,
+                       const char *commandString)
+{
+    // Header line, then one line per channel
+    static int channel = -1;
+    const PedalAdc_t *adc = getPedalAdc();
+
+    if (channel == -1) {
+        COMMAND_OUTPUT("blocks %lu of %lu samples, trimmed %lu each end\r\n"
+                       "channel\tvalue\tmin\tmax\trms\tmaxRms\tspikes\r\n",
+                       adc->blocks, adc->oversample, adc->trim);
+        channel = 0;
+        return pdTRUE;
+    }
+
+    // Noise in tenths of a count, to avoid printing floats
+    const PedalAdcChannelStats_t *stats = &adc->stats[channel];
+    const uint32_t rms = stats->noiseRms * 10;
+    const uint32_t maxRms = stats->maxNoiseRms * 10;
+    COMMAND_OUTPUT("%s\t%lu\t%lu\t%lu\t%lu.%lu\t%lu.%lu\t%lu\r\n",
+                   pedalAdcChannelNames[channel], stats->value, stats->minRaw, stats->maxRaw,
+                   rms / 10, rms % 10, maxRms / 10, maxRms % 10, stats->spikes);
+    if (++channel == NUM_ADC_CHANNELS) {
+        channel = -1;
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+static const CLI_Command_Definition_t adcNoiseCommandDefinition =
+{
+    "adcNoise",
+    "adcNoise:\r\n  Print the pedal and steering ADC readings and noise statistics, in ADC counts\r\n",
+    adcNoiseCommand,
+    0 /* Number of parameters */
+};
+
 HAL_StatusTypeDef stateMachineMockInit()
 {
     if (FreeRTOS_CLIRegisterCommand(&throttleABCommandDefinition) != pdPASS) {
@@ -499,6 +583,12 @@ HAL_StatusTypeDef stateMachineMockInit()
     if (FreeRTOS_CLIRegisterCommand(&getSteeringCommandDefinition) != pdPASS) {
         return HAL_ERROR;
     }
+    if (FreeRTOS_CLIRegisterCommand(&torqueLoopCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
+    if (FreeRTOS_CLIRegisterCommand(&adcNoiseCommandDefinition) != pdPASS) {
+        return HAL_ERROR;
+    }
 
 
     return HAL_OK;
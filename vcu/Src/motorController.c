@@ -15,7 +15,8 @@
 
 //comment out to remove 80kw power limit
 #define ENABLE_POWER_LIMIT
-#define INV_POWER_LIMIT 70000.0 //80kw
+#define INV_POWER_LIMIT 70000.0 // Used when the BMU's state of power isn't being received
+#define MAX_POWER_LIMIT 80000.0 // 80kW rules limit, the BMU's state of power is clamped to it
 #define RPM_TO_RAD (2.0*3.14159/60.0)
 
 MotorControllerSettings mcSettings = {0};
@@ -143,6 +144,11 @@ HAL_StatusTypeDef sendLockoutReleaseToMC() {
 }
 
 
+HAL_StatusTypeDef sendTractivePower() {
+    INV_Tractive_Power_kW = (INV_DC_Bus_Voltage*INV_DC_Bus_Current)*W_TO_KW; //V and I values are sent as V*10 and A*10
+    return sendCAN_VCU_INV_Power();
+}
+
 HAL_StatusTypeDef requestTorqueFromMC(float throttle_percent) {
 
     if (throttle_percent < MIN_THROTTLE_PERCENT_FOR_TORQUE)
@@ -152,12 +158,18 @@ HAL_StatusTypeDef requestTorqueFromMC(float throttle_percent) {
     // Per Cascadia Motion docs, torque requests are sent in Nm * 10
     float maxTorqueDemand = min(mcSettings.MaxTorqueDemand, mcSettings.DriveTorqueLimit);
     #ifdef ENABLE_POWER_LIMIT
-    maxTorqueDemand = min(maxTorqueDemand, INV_POWER_LIMIT/(INV_Motor_Speed*RPM_TO_RAD)); // P=Tω 
+    // Use the BMU's state of power so the car gets what the pack can give,
+    // less when it's hot or empty and more when it's healthy. Only fall back
+    // to the fixed limit if it times out
+    float powerLimit = INV_POWER_LIMIT;
+    float bmuPowerLimit = 0.0f;
+    if (getBMUDischargePowerLimit(&bmuPowerLimit))
+    {
+        powerLimit = min(bmuPowerLimit, MAX_POWER_LIMIT);
+    }
+    maxTorqueDemand = min(maxTorqueDemand, powerLimit/(INV_Motor_Speed*RPM_TO_RAD)); // P=Tω 
     #endif
 
-    INV_Tractive_Power_kW = (INV_DC_Bus_Voltage*INV_DC_Bus_Current)*W_TO_KW; //V and I values are sent as V*10 and A*10
-    sendCAN_VCU_INV_Power();
-
     float scaledTorque = map_range_float(throttle_percent, MIN_THROTTLE_PERCENT_FOR_TORQUE, 100, 0, maxTorqueDemand);
     uint16_t requestTorque = scaledTorque; 
 
@@ -0,0 +1,107 @@
+/**
+  *****************************************************************************
+  * @file    pedal_adc.c
+  * @brief   Decimation and noise statistics for the oversampled pedal ADC
+  * @details A block holds oversample scan sequences, each one conversion of
+  * every channel in rank order, as the DMA writes them. A channel's samples
+  * are sorted (insertion sort, the block is small), the trim lowest and
+  * highest dropped and the rest averaged with rounding. The mean of all the
+  * samples is kept for the noise statistics, so spikes still show up there.
+  *****************************************************************************
+  */
+
+#include "pedal_adc.h"
+#include <math.h>
+#include <string.h>
+
+void pedalAdcInit(PedalAdc_t *adc, uint32_t channels, uint32_t oversample, uint32_t trim)
+{
+    memset(adc, 0, sizeof(*adc));
+    if (channels > PEDAL_ADC_MAX_CHANNELS) {
+        channels = PEDAL_ADC_MAX_CHANNELS;
+    }
+    if (oversample == 0) {
+        oversample = 1;
+    } else if (oversample > PEDAL_ADC_MAX_OVERSAMPLE) {
+        oversample = PEDAL_ADC_MAX_OVERSAMPLE;
+    }
+    // Keep at least one sample
+    if (2 * trim >= oversample) {
+        trim = (oversample - 1) / 2;
+    }
+    adc->channels = channels;
+    adc->oversample = oversample;
+    adc->trim = trim;
+}
+
+static void sortSamples(uint32_t *samples, uint32_t count)
+{
+    for (uint32_t i = 1; i < count; i++) {
+        const uint32_t x = samples[i];
+        uint32_t j = i;
+        while (j > 0 && samples[j - 1] > x) {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = x;
+    }
+}
+
+static void updateStats(PedalAdc_t *adc, PedalAdcChannelStats_t *stats,
+                        const uint32_t *sorted, uint32_t count)
+{
+    const uint32_t median = sorted[count / 2];
+    uint64_t sum = 0;
+    uint64_t sumSquares = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += sorted[i];
+        sumSquares += (uint64_t)sorted[i] * sorted[i];
+        const uint32_t distance = sorted[i] > median ? sorted[i] - median : median - sorted[i];
+        if (distance > PEDAL_ADC_SPIKE_COUNTS) {
+            stats->spikes++;
+        }
+    }
+    // Exact in integers: count^2 * variance, which floats would lose to
+    // cancellation at the top of the ADC range
+    const uint64_t scaledVariance = count * sumSquares - sum * sum;
+    const float rms = sqrtf((float)scaledVariance) / count;
+
+    stats->minRaw = sorted[0];
+    stats->maxRaw = sorted[count - 1];
+    if (rms > stats->maxNoiseRms) {
+        stats->maxNoiseRms = rms;
+    }
+    if (adc->blocks == 0) {
+        stats->noiseRms = rms;
+    } else {
+        stats->noiseRms += (rms - stats->noiseRms) / PEDAL_ADC_NOISE_BLOCKS;
+    }
+}
+
+/**
+ * @brief Reduce one block to a value per channel, in out, and update the
+ * noise statistics
+ */
+void pedalAdcDecimate(PedalAdc_t *adc, const uint32_t *block, uint32_t *out)
+{
+    uint32_t samples[PEDAL_ADC_MAX_OVERSAMPLE];
+    const uint32_t kept = adc->oversample - 2 * adc->trim;
+
+    for (uint32_t channel = 0; channel < adc->channels; channel++) {
+        for (uint32_t i = 0; i < adc->oversample; i++) {
+            samples[i] = block[i * adc->channels + channel];
+        }
+        sortSamples(samples, adc->oversample);
+
+        uint32_t sum = 0;
+        for (uint32_t i = adc->trim; i < adc->trim + kept; i++) {
+            sum += samples[i];
+        }
+        out[channel] = (sum + kept / 2) / kept;
+
+        PedalAdcChannelStats_t *stats = &adc->stats[channel];
+        stats->value = out[channel];
+        updateStats(adc, stats, samples, adc->oversample);
+    }
+    adc->blocks++;
+}
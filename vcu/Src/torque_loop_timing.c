@@ -0,0 +1,122 @@
+/**
+  *****************************************************************************
+  * @file    torque_loop_timing.c
+  * @brief   Latency and jitter of the torque loop
+  * @details The DMA interrupt is the only writer of sample_us and samples, and
+  * the loop the only writer of everything else. The interrupt writes the time
+  * before the count, and the loop reads the count before the time, so a
+  * counted sample always has its time in place. The next sample is a full
+  * ADC period away, so the loop reads the time long before it is replaced.
+  * Times are from a wrapping microsecond clock and only compared by
+  * difference.
+  *****************************************************************************
+  */
+
+#include "torque_loop_timing.h"
+#include <string.h>
+
+#define COMPILER_BARRIER() __atomic_signal_fence(__ATOMIC_SEQ_CST)
+
+static void histogramInit(TorqueLoopHistogram_t *hist, uint32_t binWidth_us)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->binWidth_us = binWidth_us ? binWidth_us : 1;
+}
+
+void torqueLoopTimingInit(TorqueLoopTiming_t *timing, uint32_t period_us,
+                          uint32_t latencyBin_us, uint32_t jitterBin_us)
+{
+    memset(timing, 0, sizeof(*timing));
+    timing->period_us = period_us;
+    histogramInit(&timing->latency, latencyBin_us);
+    histogramInit(&timing->jitter, jitterBin_us);
+}
+
+/**
+ * @brief A pedal sample is ready, from the ADC DMA completion interrupt
+ */
+void torqueLoopSampleReady(TorqueLoopTiming_t *timing, uint32_t now_us)
+{
+    timing->sample_us = now_us;
+    COMPILER_BARRIER();
+    timing->samples = timing->samples + 1;
+}
+
+/**
+ * @brief Take the latest sample for the loop
+ * @return False if there has been no new sample since the last one taken
+ */
+bool torqueLoopTakeSample(TorqueLoopTiming_t *timing, uint32_t *sample_us)
+{
+    const uint32_t samples = timing->samples;
+    COMPILER_BARRIER();
+    const uint32_t newSamples = samples - timing->samplesTaken;
+    if (newSamples == 0) {
+        return false;
+    }
+    *sample_us = timing->sample_us;
+    timing->overruns += newSamples - 1;
+    timing->samplesTaken = samples;
+    return true;
+}
+
+/**
+ * @brief The torque command for the sample taken at sample_us was queued at
+ * now_us
+ */
+void torqueLoopCommandQueued(TorqueLoopTiming_t *timing, uint32_t sample_us, uint32_t now_us)
+{
+    torqueLoopHistogramAdd(&timing->latency, now_us - sample_us);
+    if (timing->anyCommands) {
+        const uint32_t interval = now_us - timing->lastCommand_us;
+        const uint32_t error = interval > timing->period_us ? interval - timing->period_us
+                                                            : timing->period_us - interval;
+        torqueLoopHistogramAdd(&timing->jitter, error);
+    }
+    timing->anyCommands = true;
+    timing->lastCommand_us = now_us;
+    timing->commands++;
+}
+
+/**
+ * @brief The loop stopped sending commands (EM disabled or no samples), so
+ * the gap before the next command isn't counted as jitter
+ */
+void torqueLoopRestart(TorqueLoopTiming_t *timing)
+{
+    timing->anyCommands = false;
+}
+
+void torqueLoopHistogramAdd(TorqueLoopHistogram_t *hist, uint32_t value_us)
+{
+    uint32_t bin = value_us / hist->binWidth_us;
+    if (bin >= TORQUE_LOOP_HIST_BINS) {
+        bin = TORQUE_LOOP_HIST_BINS - 1;
+    }
+    hist->bins[bin]++;
+    hist->count++;
+    if (value_us > hist->max_us) {
+        hist->max_us = value_us;
+    }
+}
+
+/**
+ * @brief Upper bound of the given fraction of the values: the top of the bin
+ * it falls in, or the maximum if that is lower
+ */
+uint32_t torqueLoopHistogramPercentile(const TorqueLoopHistogram_t *hist, float fraction)
+{
+    if (hist->count == 0) {
+        return 0;
+    }
+    const float target = fraction * hist->count;
+    uint32_t seen = 0;
+    for (uint32_t bin = 0; bin < TORQUE_LOOP_HIST_BINS - 1; bin++) {
+        seen += hist->bins[bin];
+        if (seen >= target) {
+            const uint32_t top = (bin + 1) * hist->binWidth_us;
+            return top < hist->max_us ? top : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
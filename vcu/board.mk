@@ -4,7 +4,7 @@ BOARD_NAME_UPPER = VCU_F7
 BOARD_ARCHITECTURE = F7
 
 COMMON_LIB_SRC = userCan.c debug.c state_machine.c FreeRTOS_CLI.c freertos_openocd_hack.c watchdog.c canHeartbeat.c generalErrorHandler.c canReceiveCommon.c
-COMMON_F7_LIB_SRC = userCanF7.c
+COMMON_F7_LIB_SRC = userCanF7.c cycleClock.c
 
 F7_INC_DIR := 
 F7_SRC_DIR := 